@@ -15,6 +15,8 @@
 #include "aopSettings.h"
 
 #include "probeDatabase.h"
+#include "probeSamplingPipeline.h"
+#include "probeSampleCache.h"
 #include "neighborhoodDatabase.h"
 #include "modelDatabase.h"
 
@@ -181,7 +183,14 @@ namespace aop {
 		QueryResults fastImportanceQueryVolume( const Obb &queryVolume, const ProbeContext::RawProbes &queryProbes, const ProbeContext::RawProbeSamples &queryProbeSamples );
 		QueryResults fastFullQueryVolume( const Obb &queryVolume, const ProbeContext::RawProbes &queryProbes, const ProbeContext::RawProbeSamples &queryProbeSamples );
 
-		void ProbeDatabase_sampleInstances( int modelIndex );
+		// samples the models through a ProbeSamplingPipeline and compiles them
+		// instances whose samples are in the probe sample cache aren't traced again
+		void ProbeDatabase_sampleModels( const std::vector< int > &modelIndices );
+		void ProbeDatabase_sampleInstances(
+			ProbeContext::ProbeSamplingPipeline &pipeline,
+			const ProbeContext::ProbeSampleCache::KeyBuilder &sceneKey,
+			int modelIndex
+		);
 
 		ProbeContext::ProbeContextTolerance getPCTFromSettings();
 
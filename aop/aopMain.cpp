@@ -254,6 +254,10 @@ namespace DebugObjects {
 				"Update render lists",
 				AntTWBarUI::makeReferenceAccessor( application->world->sceneRenderer.debug.updateRenderLists )
 			) );
+			container.add( AntTWBarUI::makeSharedVariable(
+				"Sample probes on the CPU",
+				AntTWBarUI::makeReferenceAccessor( application->world->useCpuRayTracer )
+			) );
 		}
 
 		// TODO: maybe make this just a normal member of IDebugObject?
@@ -296,6 +300,11 @@ namespace DebugObjects {
 
 			// TODO: add an instanceIndex member to each instance in ProbeDatabase [10/16/2012 kirschan2]
 			for( auto sampledInstance = sampledModel.getInstances().begin() ; sampledInstance != sampledModel.getInstances().end() ; ++sampledInstance ) {
+				// instances that haven't been compiled yet or that have been loaded without samples
+				if( !sampledInstance->hasProbeSamples() ) {
+					continue;
+				}
+
 				DebugRender::setTransformation( sampledInstance->getSource() );
 				DebugRender::startLocalTransform();
 				visualizeProbeDataset(
@@ -304,7 +313,7 @@ namespace DebugObjects {
 					application->sceneSettings.probeGenerator_resolution,
 					1.0,
 					sampledModel.getProbes(),
-					sampledInstance->getProbeSamples(),
+					sampledInstance->decodeProbeSamples(),
 					pvm
 				);
 				DebugRender::endLocalTransform();
@@ -1187,18 +1196,7 @@ namespace aop {
 			ui.add( AntTWBarUI::makeSharedButton( "Sample marked objects", [this] {
 				AUTO_TIMER_DEFAULT();
 				application->startLongOperation();
-
-				const auto &modelIndices = application->modelTypesUI->markedModels;
-
-				ProgressTracker::Context progressTracker( modelIndices.size() + 1 );
-				for( auto modelIndex = modelIndices.begin() ; modelIndex != modelIndices.end() ; ++modelIndex ) {
-					application->ProbeDatabase_sampleInstances( *modelIndex );
-					progressTracker.markFinished();
-				}
-
-				application->probeDatabase.compileAll( application->sceneSettings.probeGenerator_maxDistance );
-				progressTracker.markFinished();
-
+				application->ProbeDatabase_sampleModels( application->modelTypesUI->markedModels );
 				application->endLongOperation();
 			} ) );
 			ui.add( AntTWBarUI::makeSharedButton( "Remerge models (recompress)", [this] {
@@ -1398,6 +1396,9 @@ namespace aop {
 			ui.add( AntTWBarUI::makeSharedButton( "Store probe database", [this] {
 				application->probeDatabase.store( application->settings.probeDatabasePath );
 			} ) );
+			ui.add( AntTWBarUI::makeSharedButton( "Clear probe sample cache", [this] {
+				ProbeContext::ProbeSampleCache( application->settings.probeSampleCachePath, 0 ).clear();
+			} ) );
 
 			ui.add( AntTWBarUI::makeSharedSeparator() );
 			ui.add( AntTWBarUI::makeSharedButton( "Load neighborhood database", [this] {
@@ -1653,6 +1654,7 @@ namespace aop {
 			}
 		}
 
+		ProbeGenerator::sortProbes( probes );
 		probes.shrink_to_fit();
 
 		const int count = (int) voxels.getMapping().count;
@@ -1702,7 +1704,42 @@ namespace aop {
 		);
 	}
 
-	void Application::ProbeDatabase_sampleInstances( int modelIndex ) {
+	void Application::ProbeDatabase_sampleModels( const std::vector< int > &modelIndices ) {
+		AUTO_TIMER_FOR_FUNCTION();
+
+		ProgressTracker::Context progressTracker( modelIndices.size() + 1 );
+
+		ProbeContext::ProbeSampleCache probeSampleCache( settings.probeSampleCachePath, (unsigned long long) settings.probeSampleCache_maxSize << 20 );
+
+		// the samples of an instance depend on all instances of the scene and the sampling settings
+		ProbeContext::ProbeSampleCache::KeyBuilder sceneKey;
+		sceneKey.add( world->sceneRenderer.getSceneHash() );
+		const int numInstances = world->sceneRenderer.getNumInstances();
+		for( int instanceIndex = 0 ; instanceIndex < numInstances ; instanceIndex++ ) {
+			sceneKey.add( world->sceneRenderer.getModelIndex( instanceIndex ) );
+			sceneKey.add( world->sceneRenderer.getInstanceTransformation( instanceIndex ) );
+		}
+		sceneKey.add( sceneSettings.probeGenerator_resolution );
+		sceneKey.add( sceneSettings.probeGenerator_maxDistance );
+		sceneKey.add( world->useCpuRayTracer );
+
+		// the samples are spilled next to the probe database (or stored in the cache) until all models have been sampled
+		ProbeContext::ProbeSamplingPipeline pipeline( settings.probeDatabasePath, sceneSettings.probeGenerator_resolution, 4, &probeSampleCache );
+		for( auto modelIndex = modelIndices.begin() ; modelIndex != modelIndices.end() ; ++modelIndex ) {
+			ProbeDatabase_sampleInstances( pipeline, sceneKey, *modelIndex );
+			progressTracker.markFinished();
+		}
+
+		// only the sampled models have changed
+		pipeline.compile( probeDatabase, sceneSettings.probeGenerator_maxDistance );
+		progressTracker.markFinished();
+	}
+
+	void Application::ProbeDatabase_sampleInstances(
+		ProbeContext::ProbeSamplingPipeline &pipeline,
+		const ProbeContext::ProbeSampleCache::KeyBuilder &sceneKey,
+		int modelIndex
+	) {
 		AUTO_TIMER_FOR_FUNCTION();
 		log( boost::format( "sampling model %i" ) % modelIndex );
 
@@ -1718,43 +1755,35 @@ namespace aop {
 
 		auto instanceIndices = world->sceneRenderer.getModelInstances( modelIndex );
 
-		ProgressTracker::Context progressTracker( instanceIndices.size() * 3 );
-
-		int totalCount = 0;
+		const auto modelKey = ProbeContext::ProbeSampleCache::KeyBuilder( sceneKey ).add( modelIndex ).add( probes );
 
+		ProbeContext::ProbeSamplingPipeline::Instances instances( instanceIndices.size() );
 		for( int i = 0 ; i < instanceIndices.size() ; i++ ) {
-			const int instanceIndex = instanceIndices[ i ];
-
-			OptixProgramInterface::TransformedProbes transformedProbes;
-			{
-				const auto &transformation = world->sceneRenderer.getInstanceTransformation( instanceIndex );
-				ProbeGenerator::transformProbes( probes, transformation, sceneSettings.probeGenerator_resolution, transformedProbes );
-			}
-
-			// TODO: rename RawProbeData to Optix...::ProbeSamples! [10/21/2012 kirschan2]
-			ProbeContext::RawProbeSamples rawProbeSamples;
-
-			progressTracker.markFinished();
-
-			AUTO_TIMER_BLOCK( boost::str( boost::format( "sampling probe batch with %i probes for instance %i" ) % probes.size() % instanceIndex ) ) {
-				renderContext.disabledInstanceIndex = instanceIndex;
-				world->optixRenderer.sampleProbes( transformedProbes, rawProbeSamples, renderContext, sceneSettings.probeGenerator_maxDistance, instanceIndex + rand() );
-			}
-			progressTracker.markFinished();
+			instances[ i ].instanceIndex = instanceIndices[ i ];
+			instances[ i ].transformation = world->sceneRenderer.getInstanceTransformation( instanceIndices[ i ] );
+			instances[ i ].cacheKey = ProbeContext::ProbeSampleCache::KeyBuilder( modelKey ).add( instanceIndices[ i ] ).key;
+		}
 
-			probeDatabase.addInstanceProbes(
-				modelIndex,
-				world->sceneRenderer.getInstanceTransformation( instanceIndex ),
-				sceneSettings.probeGenerator_resolution,
-				probes,
-				rawProbeSamples
-			);
-			progressTracker.markFinished();
+		// the tracer marks every traced instance finished, the cached instances are marked together afterwards
+		// (both on this thread: the other pipeline stages run on threads of their own)
+		ProgressTracker::Context progressTracker( instanceIndices.size() );
 
-			totalCount += (int) transformedProbes.size();
+		int numCachedInstances = 0;
+		const int totalCount = pipeline.sampleModel( modelIndex, probes, instances,
+			[&] ( int instanceIndex, const OptixProgramInterface::TransformedProbes &transformedProbes, ProbeContext::RawProbeSamples &rawProbeSamples ) {
+				AUTO_TIMER_BLOCK( boost::str( boost::format( "sampling probe batch with %i probes for instance %i" ) % probes.size() % instanceIndex ) ) {
+					renderContext.disabledInstanceIndex = instanceIndex;
+					world->sampleProbes( transformedProbes, rawProbeSamples, renderContext, sceneSettings.probeGenerator_maxDistance, instanceIndex + rand() );
+				}
+				progressTracker.markFinished();
+			},
+			&numCachedInstances
+		);
+		if( numCachedInstances ) {
+			progressTracker.markFinished( numCachedInstances );
 		}
 
-		log( boost::format( "total sampled probes: %i" ) % totalCount );
+		log( boost::format( "total sampled probes: %i (%i of %i instances from the cache)" ) % totalCount % numCachedInstances % instances.size() );
 	}
 
 	ProbeContext::ProbeContextTolerance Application::getPCTFromSettings() {
@@ -1782,7 +1811,7 @@ namespace aop {
 		AUTO_TIMER_BLOCK( "sampling scene") {
 			OptixRenderer::TransformedProbes transformedQueryProbes;
 			ProbeGenerator::transformProbes( queryProbes, queryVolume.volume.transformation, sceneSettings.probeGenerator_resolution, transformedQueryProbes );
-			world->optixRenderer.sampleProbes( transformedQueryProbes, queryProbeSamples, renderContext, sceneSettings.probeGenerator_maxDistance );
+			world->sampleProbes( transformedQueryProbes, queryProbeSamples, renderContext, sceneSettings.probeGenerator_maxDistance );
 		}
 		progressTracker.markFinished();
 
@@ -1953,6 +1982,8 @@ namespace aop {
 			query.setQueryDataset( queryProbes, queryProbeSamples );
 
 			query.setProbeContextTolerance( getPCTFromSettings() );
+			// the visualization needs the grids of all orientations
+			query.setStoreMatchesByOrientation( DebugObjects::ProbeDatabase::automaticallyVisualizeConfigurationQueryDetails );
 
 			query.execute();
 		}
@@ -1983,6 +2014,8 @@ namespace aop {
 			query.setQueryDataset( queryProbes, queryProbeSamples );
 
 			query.setProbeContextTolerance( getPCTFromSettings() );
+			// the visualization needs the grids of all orientations
+			query.setStoreMatchesByOrientation( DebugObjects::ProbeDatabase::automaticallyVisualizeConfigurationQueryDetails );
 
 			query.execute();
 		}
@@ -2076,6 +2109,8 @@ namespace aop {
 		initSGSInterface();
 
 		probeDatabase.registerSceneModels( world->scene.modelNames );
+		// the model visualizations show the samples of every instance
+		probeDatabase.setKeepInstanceSamples( true );
 
 		namedVolumesEditorView.reset( new NamedVolumesEditorView( sceneSettings.volumes ) );
 
@@ -2316,39 +2351,53 @@ namespace aop {
 
 		const int numInstances = world->sceneRenderer.getNumInstances();
 
+		SGSInterface::SceneGrid::Queries queries;
+		std::vector< Neighborhood::Id > modelIndices;
+		queries.reserve( numInstances );
+		modelIndices.reserve( numInstances );
+
 		for( int instanceIndex = 0 ; instanceIndex < numInstances ; instanceIndex++ ) {
-			auto queryResults = world->sceneGrid.query(
+			queries.push_back( SGSInterface::SceneGrid::Query(
 				-1,
 				instanceIndex,
 				world->sceneRenderer.getInstanceTransformation( instanceIndex ).translation(),
 				maxDistance
-			);
+			) );
+			modelIndices.push_back( world->sceneRenderer.getModelIndex( instanceIndex ) );
+		}
 
-			const int modelIndex = world->sceneRenderer.getModelIndex( instanceIndex );
+		SGSInterface::SceneGrid::BatchQueryResults batchResults;
+		world->sceneGrid.queryBatch( queries, batchResults );
 
-			neighborDatabaseV2.addInstance( modelIndex, std::move( queryResults ) );
-		}
+		neighborDatabaseV2.addInstances( modelIndices, batchResults.offsets, batchResults.results );
+		neighborDatabaseV2.compile();
 	}
 
 	void Application::NeighborhoodDatabase_sampleModels( std::vector<int> modelIndices, float maxDistance ) {
 		AUTO_TIMER_FOR_FUNCTION();
 
+		SGSInterface::SceneGrid::Queries queries;
+		std::vector< Neighborhood::Id > instanceModelIndices;
+
 		for( auto modelIndex = modelIndices.begin() ; modelIndex != modelIndices.end() ; ++modelIndex ) {
 			const auto instanceIndices = world->sceneRenderer.getModelInstances( *modelIndex );
 
 			for( auto instanceIndex = instanceIndices.begin() ; instanceIndex != instanceIndices.end() ; ++instanceIndex ) {
-				auto queryResults = world->sceneGrid.query(
+				queries.push_back( SGSInterface::SceneGrid::Query(
 					-1,
 					*instanceIndex,
 					world->sceneRenderer.getInstanceTransformation( *instanceIndex ).translation(),
 					maxDistance
-				);
-
-				const int modelIndex = world->sceneRenderer.getModelIndex( *instanceIndex );
-
-				neighborDatabaseV2.addInstance( modelIndex, std::move( queryResults ) );
+				) );
+				instanceModelIndices.push_back( world->sceneRenderer.getModelIndex( *instanceIndex ) );
 			}
 		}
+
+		SGSInterface::SceneGrid::BatchQueryResults batchResults;
+		world->sceneGrid.queryBatch( queries, batchResults );
+
+		neighborDatabaseV2.addInstances( instanceModelIndices, batchResults.offsets, batchResults.results );
+		neighborDatabaseV2.compile();
 	}
 
 	Neighborhood::Results Application::NeighborhoodDatabase_queryVolume( const Obb &queryVolume, float maxDistance, MeasureType measureType ) {
@@ -2390,6 +2439,9 @@ namespace aop {
 
 		Validation::NeighborhoodData data( numModels, Validation::NeighborhoodSettings( numSamples, maxDistance, positionVariance ) );
 
+		// collect all samples first and query the scene grid for all of them at once
+		SGSInterface::SceneGrid::Queries queries;
+
 		const std::vector< int > markedModels = modelTypesUI->markedModels;
 		for( auto markedModelIndex = markedModels.begin() ; markedModelIndex != markedModels.end() ; ++markedModelIndex ) {
 			const auto instanceIndices = world->sceneRenderer.getModelInstances( *markedModelIndex );
@@ -2410,19 +2462,27 @@ namespace aop {
 						:
 							Eigen::Vector3f::Zero()
 					;
-					auto neighborContext = world->sceneGrid.query(
+					queries.push_back( SGSInterface::SceneGrid::Query(
 						-1,
 						instanceIndex,
 						position + shift,
 						maxDistance
-					);
+					) );
 
-					data.queryDatasets.push_back( neighborContext );
 					data.queryInfos.push_back( modelIndex );
 				}
 			}
 		}
 
+		SGSInterface::SceneGrid::BatchQueryResults batchResults;
+		world->sceneGrid.queryBatch( queries, batchResults );
+
+		const int numQueries = batchResults.getNumQueries();
+		data.queryDatasets.reserve( numQueries );
+		for( int queryIndex = 0 ; queryIndex < numQueries ; ++queryIndex ) {
+			data.queryDatasets.push_back( batchResults.getQueryResults( queryIndex ) );
+		}
+
 		Validation::NeighborhoodData::store( filename, data );
 	}
 
@@ -2541,7 +2601,7 @@ namespace aop {
 						ProbeGenerator::transformProbes( queryData.queryProbes, queryData.queryVolume.transformation, resolution, transformedQueryProbes );
 
 						renderContext.disabledInstanceIndex = *instanceIndex;
-						world->optixRenderer.sampleProbes( transformedQueryProbes, queryData.querySamples, renderContext, maxDistance );
+						world->sampleProbes( transformedQueryProbes, queryData.querySamples, renderContext, maxDistance );
 					}
 					instanceProgressTracker.markFinished();
 
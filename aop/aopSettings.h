@@ -16,6 +16,11 @@ namespace aop {
 		std::string modelDatabasePath;
 		std::string neighborhoodDatabaseV2Path;
 
+		// prefix of the files of the probe sample cache (see ProbeContext::ProbeSampleCache)
+		std::string probeSampleCachePath;
+		// in MB
+		int probeSampleCache_maxSize;
+
 		std::string neighborhoodValidationDataPath;
 		std::string probeValidationDataPath;
 
@@ -30,6 +30,9 @@ namespace aop {
 		, modelDatabasePath( "modelDatabase" )
 		, neighborhoodDatabaseV2Path( "neighborhoodDatabaseV2" )
 
+		, probeSampleCachePath( "probeSampleCache" )
+		, probeSampleCache_maxSize( 4096 )
+
 		, neighborhoodValidationDataPath( "neighborhood.validationData" )
 		, validation_neighborhood_positionVariance()
 		, validation_neighborhood_numSamples(1)
@@ -31,6 +31,9 @@ SERIALIZER_DEFAULT_EXTERN_IMPL( aop::Settings,
 	(modelDatabasePath)
 	(neighborhoodDatabaseV2Path)
 
+	(probeSampleCachePath)
+	(probeSampleCache_maxSize)
+
 	(neighborhoodValidationDataPath)
 	(validation_neighborhood_positionVariance)
 	(validation_neighborhood_numSamples)
@@ -0,0 +1,100 @@
+// measures how fast ProbeDatabase::compileAll builds a synthetic database (in probe samples per second)
+// and compares the radix sort of packed samples with std::sort
+#include "probeDatabase.h"
+#include "radixSort.h"
+
+#include <boost/timer/timer.hpp>
+#include <boost/format.hpp>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+
+using namespace ProbeContext;
+
+static RawProbeSamples makeRandomProbeSamples( int numSamples ) {
+	RawProbeSamples probeSamples( numSamples );
+	for( int probeIndex = 0 ; probeIndex < numSamples ; probeIndex++ ) {
+		RawProbeSample &probeSample = probeSamples[ probeIndex ];
+		probeSample.occlusion = rand() % (OptixProgramInterface::numProbeSamples + 1);
+		probeSample.distance = float( rand() % 1024 ) / 64.0f;
+		probeSample.colorLab.x = char( rand() % 100 );
+		probeSample.colorLab.y = char( rand() % 200 - 100 );
+		probeSample.colorLab.z = char( rand() % 200 - 100 );
+	}
+	return probeSamples;
+}
+
+static void benchmarkCompile( int numModels, int numInstancesPerModel, float modelSize ) {
+	RawProbes probes;
+	ProbeGenerator::generateQueryProbes( Eigen::Vector3f::Constant( modelSize ), 0.25f, probes );
+
+	std::vector< std::string > modelNames;
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		modelNames.push_back( boost::str( boost::format( "model%i" ) % modelIndex ) );
+	}
+
+	ProbeDatabase probeDatabase;
+	probeDatabase.registerSceneModels( modelNames );
+
+	srand( 0 );
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		for( int instanceIndex = 0 ; instanceIndex < numInstancesPerModel ; instanceIndex++ ) {
+			probeDatabase.addInstanceProbes( modelIndex, Obb::Transformation::Identity(), 0.25f, probes, makeRandomProbeSamples( (int) probes.size() ) );
+		}
+	}
+
+	const double numSamples = double( numModels ) * numInstancesPerModel * probes.size();
+	std::cout << boost::format( "compileAll: %i models, %i instances per model, %i probes per instance (%.0f samples, %i workers)\n" )
+		% numModels % numInstancesPerModel % probes.size() % numSamples % TaskRuntime::ThreadPool::getDefault().getNumWorkers();
+
+	const int numRuns = 3;
+	double bestWallTime = 1e30;
+	for( int run = 0 ; run < numRuns ; run++ ) {
+		boost::timer::cpu_timer timer;
+		probeDatabase.compileAll( 5.0f );
+		bestWallTime = std::min( bestWallTime, timer.elapsed().wall * 1e-9 );
+	}
+	std::cout << boost::format( "\t%10.4fs (%.0f samples/s)\n" ) % bestWallTime % (numSamples / bestWallTime);
+}
+
+static void benchmarkPackedSampleSort( int numSamples ) {
+	std::vector< SampleQuantizer::PackedSample > packedSamples( numSamples );
+	for( int sampleIndex = 0 ; sampleIndex < numSamples ; sampleIndex++ ) {
+		packedSamples[ sampleIndex ] = (unsigned( rand() ) ^ (unsigned( rand() ) << 15)) % SampleQuantizer::numBuckets;
+	}
+
+	std::cout << boost::format( "sorting %i packed samples\n" ) % numSamples;
+
+	double stdSortWallTime;
+	{
+		std::vector< SampleQuantizer::PackedSample > samples = packedSamples;
+		boost::timer::cpu_timer timer;
+		std::sort( samples.begin(), samples.end() );
+		stdSortWallTime = timer.elapsed().wall * 1e-9;
+	}
+	std::cout << boost::format( "\t%-12s %10.4fs (%.0f samples/s)\n" ) % "std::sort" % stdSortWallTime % (numSamples / stdSortWallTime);
+
+	{
+		std::vector< SampleQuantizer::PackedSample > samples = packedSamples;
+		boost::timer::cpu_timer timer;
+		RadixSort::sort( samples, SampleQuantizer::numPackedSampleBits );
+		const double wallTime = timer.elapsed().wall * 1e-9;
+		std::cout << boost::format( "\t%-12s %10.4fs (%.0f samples/s, speedup %.2f)\n" ) % "radix sort" % wallTime % (numSamples / wallTime) % (stdSortWallTime / wallTime);
+	}
+}
+
+int main( int argc, char **argv ) {
+	ProbeGenerator::initDirections();
+	ProbeGenerator::initOrientations();
+
+	benchmarkPackedSampleSort( 1 << 22 );
+
+	// many small models
+	benchmarkCompile( 64, 4, 2.0f );
+	// a few big models with many instances
+	benchmarkCompile( 4, 32, 4.0f );
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+// compares probes in raster order (by direction, z, y, x) with the Morton order that ProbeGenerator::sortProbes produces:
+// measures how fast the CPU ray tracer samples them and how fast a FullQuery matches them against a synthetic database
+#include "probeDatabase.h"
+#include "cpuRayTracer.h"
+#include "radixSort.h"
+
+#include <boost/timer/timer.hpp>
+#include <boost/format.hpp>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+
+using namespace ProbeContext;
+using namespace Eigen;
+
+static void sortProbesInRasterOrder( RawProbes &probes ) {
+	RadixSort::sortByKey( probes, 29, [] ( const RawProbe &probe ) {
+		return
+				(unsigned( probe.directionIndex ) << 24)
+			|
+				(unsigned( probe.position.z() + 128 ) << 16)
+			|
+				(unsigned( probe.position.y() + 128 ) << 8)
+			|
+				unsigned( probe.position.x() + 128 )
+		;
+	} );
+}
+
+// the samples only depend on the probe, so both orders see the same data
+static RawProbeSamples makeProbeSamples( const RawProbes &probes, int seed ) {
+	RawProbeSamples probeSamples( probes.size() );
+	for( int probeIndex = 0 ; probeIndex < (int) probes.size() ; probeIndex++ ) {
+		const RawProbe &probe = probes[ probeIndex ];
+		const int hash = (probe.position.x() * 7 + probe.position.y() * 13 + probe.position.z() * 31 + probe.directionIndex * 3 + seed) & 0xFF;
+
+		RawProbeSample &probeSample = probeSamples[ probeIndex ];
+		probeSample.occlusion = hash % (OptixProgramInterface::numProbeSamples + 1);
+		probeSample.distance = float( hash % 16 ) * 0.25f;
+		probeSample.colorLab.x = char( hash % 100 );
+		probeSample.colorLab.y = char( hash % 64 - 32 );
+		probeSample.colorLab.z = char( (hash >> 2) % 64 - 32 );
+	}
+	return probeSamples;
+}
+
+static void createRandomTriangles( CpuRayTracer &tracer, int numTriangles, float sceneSize ) {
+	tracer.clearGeometry();
+
+	for( int triangleIndex = 0 ; triangleIndex < numTriangles ; triangleIndex++ ) {
+		const Vector3f center = Vector3f::Random().cwiseAbs() * sceneSize;
+		for( int corner = 0 ; corner < 3 ; corner++ ) {
+			SGSScene::Vertex vertex = {};
+			Vector3f::Map( vertex.position ) = center + Vector3f::Random() * 0.5f;
+			vertex.normal[2] = 1.0f;
+			tracer.vertices.push_back( vertex );
+			tracer.indices.push_back( triangleIndex * 3 + corner );
+		}
+
+		CpuRayTracer::MaterialInfo materialInfo = {};
+		materialInfo.objectIndex = triangleIndex;
+		materialInfo.modelIndex = triangleIndex;
+		materialInfo.textureIndex = -1;
+		materialInfo.alphaType = CpuRayTracer::MaterialInfo::AT_NONE;
+		materialInfo.alpha = 1.0f;
+
+		tracer.materialIndices.push_back( triangleIndex );
+		tracer.materialInfos.push_back( materialInfo );
+	}
+
+	tracer.build();
+}
+
+template< typename Function >
+static double measureBestWallTime( int numRuns, const Function &function ) {
+	double bestWallTime = 1e30;
+	for( int run = 0 ; run < numRuns ; run++ ) {
+		boost::timer::cpu_timer timer;
+		function();
+		bestWallTime = std::min( bestWallTime, timer.elapsed().wall * 1e-9 );
+	}
+	return bestWallTime;
+}
+
+static double benchmarkTrace( CpuRayTracer &tracer, const RawProbes &probes, float resolution, const Vector3f &center ) {
+	OptixProgramInterface::TransformedProbes transformedProbes;
+	ProbeGenerator::transformProbes( probes, Obb::Transformation( Translation3f( center ) ), resolution, transformedProbes );
+
+	const RenderContext renderContext;
+	OptixProgramInterface::ProbeSamples probeSamples;
+	return measureBestWallTime( 3, [&] () {
+		tracer.sampleProbes( transformedProbes, probeSamples, renderContext, 5.0f );
+	} );
+}
+
+static double benchmarkFullQuery( const RawProbes &probes, float modelSize, float resolution, int numInstances ) {
+	std::vector< std::string > modelNames;
+	modelNames.push_back( "model" );
+
+	ProbeDatabase probeDatabase;
+	probeDatabase.registerSceneModels( modelNames );
+	for( int instanceIndex = 0 ; instanceIndex < numInstances ; instanceIndex++ ) {
+		probeDatabase.addInstanceProbes( 0, Obb::Transformation::Identity(), resolution, probes, makeProbeSamples( probes, instanceIndex ) );
+	}
+	probeDatabase.compileAll( 5.0f );
+
+	const RawProbeSamples queryProbeSamples = makeProbeSamples( probes, 0 );
+	return measureBestWallTime( 3, [&] () {
+		ProbeDatabase::FullQuery query( probeDatabase );
+		query.setQueryVolume( Obb( Obb::Transformation::Identity(), Vector3f::Constant( modelSize ) ), resolution );
+		query.setQueryDataset( probes, queryProbeSamples );
+		query.execute();
+	} );
+}
+
+static void benchmarkProbeOrder( float modelSize, float resolution ) {
+	RawProbes mortonProbes;
+	ProbeGenerator::generateQueryProbes( Vector3f::Constant( modelSize ), resolution, mortonProbes );
+
+	RawProbes rasterProbes = mortonProbes;
+	sortProbesInRasterOrder( rasterProbes );
+
+	std::cout << boost::format( "model size %.1f, resolution %.2f: %i probes (%i workers)\n" )
+		% modelSize % resolution % mortonProbes.size() % TaskRuntime::ThreadPool::getDefault().getNumWorkers();
+
+	srand( 0 );
+	CpuRayTracer tracer;
+	createRandomTriangles( tracer, 20000, 2.0f * modelSize );
+
+	const Vector3f center = Vector3f::Constant( modelSize );
+	const double rasterTraceTime = benchmarkTrace( tracer, rasterProbes, resolution, center );
+	const double mortonTraceTime = benchmarkTrace( tracer, mortonProbes, resolution, center );
+	std::cout << boost::format( "\t%-12s raster %10.4fs, morton %10.4fs (speedup %.2f)\n" ) % "trace" % rasterTraceTime % mortonTraceTime % (rasterTraceTime / mortonTraceTime);
+
+	const double rasterQueryTime = benchmarkFullQuery( rasterProbes, modelSize, resolution, 4 );
+	const double mortonQueryTime = benchmarkFullQuery( mortonProbes, modelSize, resolution, 4 );
+	std::cout << boost::format( "\t%-12s raster %10.4fs, morton %10.4fs (speedup %.2f)\n" ) % "full query" % rasterQueryTime % mortonQueryTime % (rasterQueryTime / mortonQueryTime);
+}
+
+int main( int argc, char **argv ) {
+	ProbeGenerator::initDirections();
+	ProbeGenerator::initOrientations();
+
+	benchmarkProbeOrder( 2.0f, 0.25f );
+	benchmarkProbeOrder( 4.0f, 0.25f );
+
+	return 0;
+}
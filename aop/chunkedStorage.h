@@ -0,0 +1,216 @@
+#pragma once
+
+#define SERIALIZER_SUPPORT_STL
+#include <serializer.h>
+
+#include "mappedFile.h"
+#include "taskRuntime.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// container files for big arrays of serializable elements that are read piecewise
+//
+// layout:
+//	chunks: one (compressed) binary stream with numElementsPerChunk elements each
+//	table of contents: one binary stream with the header (written by the caller), the element count and the chunks
+//	trailer: offset of the table of contents and magic bytes
+//
+// every chunk can be decoded on its own, so readers map the file and only decode the chunks that overlap the
+// range of elements they need (in parallel)
+namespace ChunkedStorage {
+	namespace detail {
+		const unsigned MAGIC = 0x4b4e4843; // "CHNK"
+
+		struct Trailer {
+			unsigned long long tableOfContentsOffset;
+			unsigned magic;
+			unsigned reserved;
+		};
+
+		inline unsigned long long tell( FILE *file ) {
+#ifdef _WIN32
+			return _ftelli64( file );
+#else
+			return ftello( file );
+#endif
+		}
+	}
+
+	struct Chunk {
+		unsigned long long offset;
+		unsigned long long size;
+		// [beginIndex, endIndex) of the elements
+		int beginIndex;
+		int endIndex;
+
+		SERIALIZER_ENABLE_RAW_MODE();
+	};
+
+	// writeHeader( Serializer::BinaryWriter &writer ) writes everything that isn't part of the elements
+	template< typename Element, typename WriteHeader >
+	bool write( const std::string &filename, int version, const std::vector< Element > &elements, int numElementsPerChunk, const WriteHeader &writeHeader ) {
+		FILE *file = fopen( filename.c_str(), "wb" );
+		if( !file ) {
+			return false;
+		}
+
+		const int numElements = (int) elements.size();
+		std::vector< Chunk > chunks;
+		for( int beginIndex = 0 ; beginIndex < numElements ; beginIndex += numElementsPerChunk ) {
+			Chunk chunk;
+			chunk.offset = detail::tell( file );
+			chunk.beginIndex = beginIndex;
+			chunk.endIndex = std::min( beginIndex + numElementsPerChunk, numElements );
+
+			{
+				Serializer::BinaryWriter writer( file, version, Serializer::BinaryWriter::COMPRESSED );
+				for( int elementIndex = chunk.beginIndex ; elementIndex < chunk.endIndex ; elementIndex++ ) {
+					writer.put( elements[ elementIndex ] );
+				}
+			}
+
+			chunk.size = detail::tell( file ) - chunk.offset;
+			chunks.push_back( chunk );
+		}
+
+		detail::Trailer trailer;
+		trailer.tableOfContentsOffset = detail::tell( file );
+		trailer.magic = detail::MAGIC;
+		trailer.reserved = 0;
+		{
+			Serializer::BinaryWriter writer( file, version );
+			writeHeader( writer );
+			writer.put( numElements );
+			writer.put( chunks );
+		}
+
+		fwrite( &trailer, sizeof( trailer ), 1, file );
+		const bool success = !ferror( file );
+		fclose( file );
+		return success;
+	}
+
+	// the mapping (and thus the reader) has to stay open while elements are read
+	// read() can be called from multiple threads at the same time
+	template< typename Element >
+	class Reader {
+	public:
+		Reader() : version(), numElements() {}
+
+		// readHeader( Serializer::BinaryReader &reader ) reads what writeHeader has written
+		// returns false if the file is missing, has another version or isn't a chunked file
+		template< typename ReadHeader >
+		bool open( const std::string &filename, int version, const ReadHeader &readHeader ) {
+			close();
+
+			if( !file.open( filename ) || file.getSize() < sizeof( detail::Trailer ) ) {
+				return false;
+			}
+
+			detail::Trailer trailer;
+			memcpy( &trailer, file.getData() + file.getSize() - sizeof( trailer ), sizeof( trailer ) );
+			const unsigned long long tableOfContentsEnd = file.getSize() - sizeof( trailer );
+			if( trailer.magic != detail::MAGIC || trailer.tableOfContentsOffset > tableOfContentsEnd ) {
+				close();
+				return false;
+			}
+
+			Serializer::BinaryReader reader( file.getData() + trailer.tableOfContentsOffset, size_t( tableOfContentsEnd - trailer.tableOfContentsOffset ), version );
+			if( !reader.valid() ) {
+				close();
+				return false;
+			}
+
+			readHeader( reader );
+			reader.get( numElements );
+			reader.get( chunks );
+
+			for( auto chunk = chunks.begin() ; chunk != chunks.end() ; ++chunk ) {
+				if( chunk->offset + chunk->size > trailer.tableOfContentsOffset ) {
+					close();
+					return false;
+				}
+			}
+
+			this->version = version;
+			return true;
+		}
+
+		void close() {
+			file.close();
+			chunks.clear();
+			numElements = 0;
+		}
+
+		int getNumElements() const {
+			return numElements;
+		}
+
+		const std::vector< Chunk > &getChunks() const {
+			return chunks;
+		}
+
+		// replaces elements with [beginIndex, endIndex)
+		// returns false if a chunk doesn't start with a valid stream header
+		bool read( int beginIndex, int endIndex, std::vector< Element > &elements ) const {
+			beginIndex = std::max( beginIndex, 0 );
+			endIndex = std::min( endIndex, numElements );
+
+			elements.clear();
+			if( beginIndex >= endIndex ) {
+				return true;
+			}
+			elements.resize( endIndex - beginIndex );
+
+			// chunks are sorted by their element ranges
+			const auto firstChunk = std::upper_bound( chunks.begin(), chunks.end(), beginIndex,
+				[] ( int index, const Chunk &chunk ) {
+					return index < chunk.endIndex;
+				}
+			);
+			const auto lastChunk = std::lower_bound( firstChunk, chunks.end(), endIndex,
+				[] ( const Chunk &chunk, int index ) {
+					return chunk.beginIndex < index;
+				}
+			);
+
+			std::atomic<bool> success( true );
+			TaskRuntime::parallel_for( 0, int( lastChunk - firstChunk ), 1,
+				[&] ( int index ) {
+					const Chunk &chunk = firstChunk[ index ];
+
+					Serializer::BinaryReader reader( file.getData() + chunk.offset, size_t( chunk.size ), version );
+					if( !reader.valid() ) {
+						success = false;
+						return;
+					}
+
+					// elements are stored one after the other, so the ones before the range have to be decoded, too
+					const int chunkEndIndex = std::min( chunk.endIndex, endIndex );
+					for( int elementIndex = chunk.beginIndex ; elementIndex < chunkEndIndex ; elementIndex++ ) {
+						Element element;
+						reader.get( element );
+						if( elementIndex >= beginIndex ) {
+							elements[ elementIndex - beginIndex ] = std::move( element );
+						}
+					}
+				}
+			);
+			return success;
+		}
+
+	private:
+		MappedFile file;
+		int version;
+
+		int numElements;
+		std::vector< Chunk > chunks;
+
+		Reader( const Reader & );
+		Reader & operator = ( const Reader & );
+	};
+}
@@ -130,7 +130,7 @@ struct Editor : EventDispatcher {
 
 		void setTransformation( const Obb::Transformation &transformation ) {
 			if( editor->world->sceneRenderer.isDynamicInstance( instanceIndex ) ) {
-				editor->world->sceneRenderer.setInstanceTransformation( 
+				editor->world->setInstanceTransformation( 
 					instanceIndex,
 					transformation *
 					Eigen::Translation3f( -editor->world->sceneRenderer.getUntransformedInstanceBoundingBox( instanceIndex ).center() )
@@ -6,6 +6,12 @@ bool ModelDatabase::load( const std::string &filename ) {
 	Serializer::BinaryReader reader( filename, CACHE_FORMAT_VERSION );
 	if( reader.valid() ) {
 		reader.get( informationById );
+
+		// databases that have been stored before the probes were generated in Morton order have them in raster order,
+		// but the probe datasets and the query probes use the order of ProbeGenerator::sortProbes
+		for( auto information = informationById.begin() ; information != informationById.end() ; ++information ) {
+			ProbeGenerator::sortProbes( information->probes );
+		}
 		return true;
 	}
 	return false;
@@ -1 +1,103 @@
 #include "neighborhoodDatabase.h"
+
+namespace Neighborhood {
+	void NeighborhoodDatabaseV2::addInstances( const std::vector< Id > &ids, const std::vector< int > &offsets, const RawIdDistances &rawDatasets ) {
+		const int numNewInstances = ids.size();
+		if( numNewInstances == 0 ) {
+			return;
+		}
+
+		// look up every sampled model only once and count its new instances
+		std::vector< int > numNewInstancesBySampledModel( sampledModelsById.size() );
+		for( auto id = ids.begin() ; id != ids.end() ; ++id ) {
+			if( *id >= sampledModelIndicesById.size() || sampledModelIndicesById[ *id ] == -1 ) {
+				internal_getSampledModel( *id );
+				numNewInstancesBySampledModel.push_back( 0 );
+			}
+			++numNewInstancesBySampledModel[ sampledModelIndicesById[ *id ] ];
+		}
+
+		// make room for the new instances and determine where every new instance goes
+		std::vector< int > nextInstanceIndexBySampledModel( sampledModelsById.size() );
+		for( int sampledModelIndex = 0 ; sampledModelIndex < sampledModelsById.size() ; ++sampledModelIndex ) {
+			auto &instances = sampledModelsById[ sampledModelIndex ].second.instances;
+			nextInstanceIndexBySampledModel[ sampledModelIndex ] = instances.size();
+			instances.resize( instances.size() + numNewInstancesBySampledModel[ sampledModelIndex ] );
+		}
+
+		std::vector< NeighborhoodContext * > newContexts( numNewInstances );
+		for( int newInstanceIndex = 0 ; newInstanceIndex < numNewInstances ; ++newInstanceIndex ) {
+			const int sampledModelIndex = sampledModelIndicesById[ ids[ newInstanceIndex ] ];
+			const int instanceIndex = nextInstanceIndexBySampledModel[ sampledModelIndex ]++;
+			newContexts[ newInstanceIndex ] = &sampledModelsById[ sampledModelIndex ].second.instances[ instanceIndex ];
+		}
+
+		// build the contexts
+		TaskRuntime::Reducer< int > maxNumIds;
+		TaskRuntime::parallel_for( 0, numNewInstances, [&] ( int newInstanceIndex ) {
+			*newContexts[ newInstanceIndex ] = NeighborhoodContext(
+				rawDatasets.data() + offsets[ newInstanceIndex ],
+				rawDatasets.data() + offsets[ newInstanceIndex + 1 ]
+			);
+
+			int &localMaxNumIds = maxNumIds.local();
+			localMaxNumIds = std::max( localMaxNumIds, newContexts[ newInstanceIndex ]->getNumIds() );
+		} );
+
+		maxNumIds.combine_each( [&] ( int localMaxNumIds ) {
+			numIds = std::max( numIds, localMaxNumIds );
+		} );
+		totalNumInstances += numNewInstances;
+	}
+
+	void NeighborhoodDatabaseV2::compile() {
+		distanceIndex.clear();
+		distanceIndex.columnsById.resize( numIds );
+		distanceIndex.candidateModelIndicesByGlobalInstance.reserve( totalNumInstances );
+
+		// count the entries of every column first, so we only allocate once
+		std::vector< int > numInstancesById( numIds );
+		std::vector< int > numDistancesById( numIds );
+		for( auto idSampledModelPair = sampledModelsById.begin() ; idSampledModelPair != sampledModelsById.end() ; ++idSampledModelPair ) {
+			const auto &instances = idSampledModelPair->second.instances;
+			for( auto instance = instances.begin() ; instance != instances.end() ; ++instance ) {
+				const DistancesById &distancesById = instance->getDistancesById();
+				for( int id = 0 ; id < distancesById.size() ; ++id ) {
+					if( !distancesById[ id ].empty() ) {
+						++numInstancesById[ id ];
+						numDistancesById[ id ] += distancesById[ id ].size();
+					}
+				}
+			}
+		}
+
+		for( int id = 0 ; id < numIds ; ++id ) {
+			NeighborDistanceIndex::Column &column = distanceIndex.columnsById[ id ];
+			column.globalInstanceIndices.reserve( numInstancesById[ id ] );
+			column.offsets.reserve( numInstancesById[ id ] + 1 );
+			column.distances.reserve( numDistancesById[ id ] );
+		}
+
+		// the instance distances are already sorted, so we only have to append them
+		int globalInstanceIndex = 0;
+		for( int candidateModelIndex = 0 ; candidateModelIndex < sampledModelsById.size() ; ++candidateModelIndex ) {
+			const auto &instances = sampledModelsById[ candidateModelIndex ].second.instances;
+			for( auto instance = instances.begin() ; instance != instances.end() ; ++instance, ++globalInstanceIndex ) {
+				distanceIndex.candidateModelIndicesByGlobalInstance.push_back( candidateModelIndex );
+
+				const DistancesById &distancesById = instance->getDistancesById();
+				for( int id = 0 ; id < distancesById.size() ; ++id ) {
+					const Distances &distances = distancesById[ id ];
+					if( distances.empty() ) {
+						continue;
+					}
+
+					NeighborDistanceIndex::Column &column = distanceIndex.columnsById[ id ];
+					column.globalInstanceIndices.push_back( globalInstanceIndex );
+					boost::push_back( column.distances, distances );
+					column.offsets.push_back( column.distances.size() );
+				}
+			}
+		}
+	}
+}
@@ -7,6 +7,7 @@
 #include "boost/range/algorithm_ext/push_back.hpp"
 #include "boost/range/algorithm_ext/erase.hpp"
 #include "boost/range/algorithm/unique.hpp"
+#include "boost/range/algorithm/fill.hpp"
 
 #include <boost/accumulators/accumulators.hpp>
 #include <boost/accumulators/statistics/stats.hpp>
@@ -20,6 +21,7 @@
 #include "boost/tuple/tuple_comparison.hpp"
 
 #include <logger.h>
+#include <taskRuntime.h>
 
 #include "modelDatabase.h"
 
@@ -76,6 +78,36 @@ namespace Neighborhood {
 			}
 		}
 
+		// uses a counting sort by id, so the raw dataset doesn't have to be sorted
+		NeighborhoodContext( const IdDistancePair *rawDatasetBegin, const IdDistancePair *rawDatasetEnd ) {
+			if( rawDatasetBegin == rawDatasetEnd ) {
+				return;
+			}
+
+			int numIds = 0;
+			for( auto idDistancePair = rawDatasetBegin ; idDistancePair != rawDatasetEnd ; ++idDistancePair ) {
+				numIds = std::max( numIds, idDistancePair->first + 1 );
+			}
+
+			std::vector< int > numDistancesById( numIds );
+			for( auto idDistancePair = rawDatasetBegin ; idDistancePair != rawDatasetEnd ; ++idDistancePair ) {
+				++numDistancesById[ idDistancePair->first ];
+			}
+
+			distancesById.resize( numIds );
+			for( int id = 0 ; id < numIds ; ++id ) {
+				distancesById[ id ].reserve( numDistancesById[ id ] );
+			}
+
+			for( auto idDistancePair = rawDatasetBegin ; idDistancePair != rawDatasetEnd ; ++idDistancePair ) {
+				distancesById[ idDistancePair->first ].push_back( idDistancePair->second );
+			}
+
+			for( auto distances = distancesById.begin() ; distances != distancesById.end() ; ++distances ) {
+				boost::sort( *distances );
+			}
+		}
+
 		const DistancesById &getDistancesById() const {
 			return distancesById;
 		}
@@ -135,6 +167,47 @@ namespace Neighborhood {
 		SERIALIZER_FWD_FRIEND_EXTERN( Neighborhood::SampledModel );
 	};
 
+	// columnar copy of the distances of all instances (built by NeighborhoodDatabaseV2::compile)
+	// global instance indices enumerate the instances of all sampled models in the order of sampledModelsById
+	struct NeighborDistanceIndex {
+		// the distances of all instances to one neighbor model
+		struct Column {
+			// all instances that have at least one distance to the neighbor model (ascending)
+			std::vector< int > globalInstanceIndices;
+			// CSR offsets: the distances of globalInstanceIndices[ i ] are distances[ offsets[ i ] ] .. distances[ offsets[ i + 1 ] - 1 ]
+			std::vector< int > offsets;
+			// sorted for every instance
+			Distances distances;
+
+			Column() : offsets( 1, 0 ) {}
+
+			int getNumInstances() const {
+				return globalInstanceIndices.size();
+			}
+		};
+
+		// index with [id]!
+		std::vector< Column > columnsById;
+		std::vector< int > candidateModelIndicesByGlobalInstance;
+
+		void clear() {
+			columnsById.clear();
+			candidateModelIndicesByGlobalInstance.clear();
+		}
+
+		// never fails, returns an empty column if the id is not found
+		const Column &getColumn( Id id ) const {
+			static const Column emptyColumn;
+
+			if( id < columnsById.size() ) {
+				return columnsById[ id ];
+			}
+			else {
+				return emptyColumn;
+			}
+		}
+	};
+
 	struct NeighborhoodDatabaseV2 {
 		ModelDatabase *modelDatabase;
 
@@ -144,6 +217,11 @@ namespace Neighborhood {
 		int totalNumInstances;
 
 		std::vector< IdSampledModelPair > sampledModelsById;
+		// index into sampledModelsById by [id], -1 if there is no sampled model for id
+		std::vector< int > sampledModelIndicesById;
+
+		// used by the queries, compile() has to be called after adding instances
+		NeighborDistanceIndex distanceIndex;
 
 		NeighborhoodDatabaseV2() : numIds(), totalNumInstances(), modelDatabase() {}
 
@@ -154,6 +232,15 @@ namespace Neighborhood {
 			numIds = 0;
 			totalNumInstances = 0;
 			sampledModelsById.clear();
+			sampledModelIndicesById.clear();
+			distanceIndex.clear();
+		}
+
+		// rebuilds the distance index from the sampled models
+		void compile();
+
+		bool isCompiled() const {
+			return distanceIndex.candidateModelIndicesByGlobalInstance.size() == totalNumInstances;
 		}
 
 		int getNumSampledModels() const {
@@ -169,14 +256,28 @@ namespace Neighborhood {
 		}
 
 		SampledModel &internal_getSampledModel( Id id ) {
-			for( auto idSampledModelPair = sampledModelsById.begin() ; idSampledModelPair != sampledModelsById.end() ; ++idSampledModelPair ) {
-				if( idSampledModelPair->first == id ) {
-					return idSampledModelPair->second;
-				}
+			if( id >= sampledModelIndicesById.size() ) {
+				sampledModelIndicesById.resize( id + 1, -1 );
+			}
+
+			int &sampledModelIndex = sampledModelIndicesById[ id ];
+			if( sampledModelIndex == -1 ) {
+				sampledModelIndex = sampledModelsById.size();
+				sampledModelsById.push_back( std::make_pair( id, SampledModel() ) );
 			}
+			return sampledModelsById[ sampledModelIndex ].second;
+		}
 
-			sampledModelsById.push_back( std::make_pair( id, SampledModel() ) );
-			return sampledModelsById.back().second;
+		// rebuilds sampledModelIndicesById from sampledModelsById
+		void updateSampledModelIndices() {
+			sampledModelIndicesById.clear();
+			for( int sampledModelIndex = 0 ; sampledModelIndex < sampledModelsById.size() ; ++sampledModelIndex ) {
+				const Id id = sampledModelsById[ sampledModelIndex ].first;
+				if( id >= sampledModelIndicesById.size() ) {
+					sampledModelIndicesById.resize( id + 1, -1 );
+				}
+				sampledModelIndicesById[ id ] = sampledModelIndex;
+			}
 		}
 
 		void addInstance( Id id, NeighborhoodContext &&sortedDataset ) {
@@ -185,6 +286,10 @@ namespace Neighborhood {
 			internal_getSampledModel( id ).addInstance( std::move( sortedDataset ) );
 		}
 
+		// adds many instances at once and builds their contexts in parallel
+		// the raw dataset of instance i is rawDatasets[ offsets[ i ] ] .. rawDatasets[ offsets[ i + 1 ] - 1 ]
+		void addInstances( const std::vector< Id > &ids, const std::vector< int > &offsets, const RawIdDistances &rawDatasets );
+
 		struct Query {
 			const NeighborhoodDatabaseV2 &database;
 			const NeighborhoodContext queryDataset;
@@ -261,32 +366,55 @@ namespace Neighborhood {
 				int getNumQueryDistances() {
 					return numQueryDistances;
 				}
+
+				// clears all matches, so the buffers can be reused for another neighbor model
+				void reset( int numQueryDistances ) {
+					boost::fill( matchedQueryDistancesByGlobalInstance, 0 );
+					this->numQueryDistances = numQueryDistances;
+				}
 			};
 
-			struct FullMatchedDistances {
-				// counts all matches for a certain query distance and candidateModel
-				// by [ globalInstanceIndex ][ queryDistanceIndex ]
-				std::vector< boost::dynamic_bitset<> > matchedQueryDistancesByGlobalInstance;
+			struct SparseMatchedDistances {
+				struct Match {
+					int globalInstanceIndex;
+					int queryDistanceIndex;
+
+					Match( int globalInstanceIndex, int queryDistanceIndex )
+						: globalInstanceIndex( globalInstanceIndex )
+						, queryDistanceIndex( queryDistanceIndex )
+					{}
+				};
+
+				// all matched (globalInstanceIndex, queryDistanceIndex) pairs (every pair is matched at most once)
+				std::vector< Match > matches;
 				// counts all matches for a certain query distance
 				std::vector<int> matchedQueryDistanceCounters;
 
-				FullMatchedDistances( int totalNumInstances, int numQueryDistances )
-					: matchedQueryDistancesByGlobalInstance( totalNumInstances, boost::dynamic_bitset<>( numQueryDistances ) )
-					, matchedQueryDistanceCounters( numQueryDistances )
+				int totalNumInstances;
+
+				SparseMatchedDistances( int totalNumInstances, int numQueryDistances )
+					: matchedQueryDistanceCounters( numQueryDistances )
+					, totalNumInstances( totalNumInstances )
 				{}
 
 				void match( int globalInstanceIndex, int queryDistanceIndex ) {
-					matchedQueryDistancesByGlobalInstance[ globalInstanceIndex ][ queryDistanceIndex ] = true;
+					matches.push_back( Match( globalInstanceIndex, queryDistanceIndex ) );
 					++matchedQueryDistanceCounters[ queryDistanceIndex ];
 				}
 
 				int getTotalNumInstances() {
-					return matchedQueryDistancesByGlobalInstance.size();
+					return totalNumInstances;
 				}
 
 				int getNumQueryDistances() {
 					return matchedQueryDistanceCounters.size();
 				}
+
+				// clears all matches, so the buffers can be reused for another neighbor model
+				void reset( int numQueryDistances ) {
+					matches.clear();
+					matchedQueryDistanceCounters.assign( numQueryDistances, 0 );
+				}
 			};
 
 			struct UniformWeightPolicy : SharedPolicy {
@@ -308,6 +436,12 @@ namespace Neighborhood {
 						return totalImportanceWeight == 0.0f;
 					}
 
+					void reset() {
+						boost::fill( candidateInstanceScores, 0.0f );
+						totalImportanceWeight = 0.0f;
+						scoreOffset = 0.0f;
+					}
+
 					void integrateNeighborModelCandidateScores( float neighborModelWeight, const Scores &neighborModelCandidateScores ) {
 						const int totalNumInstances = candidateInstanceScores.size();
 						// update the total score
@@ -332,7 +466,7 @@ namespace Neighborhood {
 						}
 					}
 
-					void integrateCorrelatedUnmatchedDistances( std::vector< int > &&correlatedGlobalInstanceIndices ) {
+					void integrateCorrelatedUnmatchedDistances( const std::vector< int > &correlatedGlobalInstanceIndices ) {
 						totalImportanceWeight += 1;
 						scoreOffset += 1;
 
@@ -352,7 +486,7 @@ namespace Neighborhood {
 			};
 
 			struct ImportanceWeightPolicy : SharedPolicy {
-				typedef FullMatchedDistances MatchedDistances;
+				typedef SparseMatchedDistances MatchedDistances;
 
 				struct Scores {
 					std::vector<float> candidateInstanceScores;
@@ -370,6 +504,12 @@ namespace Neighborhood {
 						return false;
 					}
 
+					void reset() {
+						boost::fill( candidateInstanceScores, 0.0f );
+						boost::fill( candidateInstanceImportanceWeights, 0.0f );
+						offset = 0.0f;
+					}
+
 					void integrateNeighborModelCandidateScores( float neighborModelWeight, const Scores &neighborModelCandidateScores ) {
 						const int totalNumInstances = candidateInstanceScores.size();
 						// update the total score
@@ -406,23 +546,30 @@ namespace Neighborhood {
 							mismatchImportanceWeights[ queryDistanceIndex ] = positiveMessageLength + negativeMessageLength;
 						}
 
-						for( int globalInstanceIndex = 0 ; globalInstanceIndex < totalNumInstances ; ++globalInstanceIndex ) {
-							for( int queryDistanceIndex = 0 ; queryDistanceIndex < numQueryDistances ; ++queryDistanceIndex ) {
-								if( matchedDistances.matchedQueryDistancesByGlobalInstance[ globalInstanceIndex ][ queryDistanceIndex ] ) {
-									// this is a match
-									const float importanceWeight = matchImportanceWeights[ queryDistanceIndex ];
-									candidateInstanceScores[ globalInstanceIndex ] += importanceWeight;
-									candidateInstanceImportanceWeights[ globalInstanceIndex ] += importanceWeight;
-								}
-								else {
-									// this is a mismatch
-									candidateInstanceImportanceWeights[ globalInstanceIndex ] += mismatchImportanceWeights[ queryDistanceIndex ];
-								}
+						// every instance starts with mismatches for all query distances
+						float totalMismatchImportanceWeight = 0.0f;
+						for( int queryDistanceIndex = 0 ; queryDistanceIndex < numQueryDistances ; ++queryDistanceIndex ) {
+							// if every instance matches the distance, nobody can mismatch it
+							// (the mismatch weight can be infinite then, and we must not subtract it again below)
+							if( matchedDistances.matchedQueryDistanceCounters[ queryDistanceIndex ] == totalNumInstances ) {
+								mismatchImportanceWeights[ queryDistanceIndex ] = matchImportanceWeights[ queryDistanceIndex ];
 							}
+							totalMismatchImportanceWeight += mismatchImportanceWeights[ queryDistanceIndex ];
+						}
+
+						for( int globalInstanceIndex = 0 ; globalInstanceIndex < totalNumInstances ; ++globalInstanceIndex ) {
+							candidateInstanceImportanceWeights[ globalInstanceIndex ] += totalMismatchImportanceWeight;
+						}
+
+						// and then we turn the matches from mismatches into matches
+						for( auto match = matchedDistances.matches.begin() ; match != matchedDistances.matches.end() ; ++match ) {
+							const float importanceWeight = matchImportanceWeights[ match->queryDistanceIndex ];
+							candidateInstanceScores[ match->globalInstanceIndex ] += importanceWeight;
+							candidateInstanceImportanceWeights[ match->globalInstanceIndex ] += importanceWeight - mismatchImportanceWeights[ match->queryDistanceIndex ];
 						}
 					}
 
-					void integrateCorrelatedUnmatchedDistances( std::vector< int > &&correlatedGlobalInstanceIndices ) {
+					void integrateCorrelatedUnmatchedDistances( const std::vector< int > &correlatedGlobalInstanceIndices ) {
 						const int totalNumInstances = candidateInstanceScores.size();
 
 						const int numInstances = correlatedGlobalInstanceIndices.size();
@@ -466,7 +613,7 @@ namespace Neighborhood {
 			};
 
 			struct CrazyImportanceWeightPolicy : SharedPolicy {
-				typedef FullMatchedDistances MatchedDistances;
+				typedef SparseMatchedDistances MatchedDistances;
 
 				struct Scores {
 					std::vector<float> candidateInstanceScores;
@@ -484,6 +631,12 @@ namespace Neighborhood {
 						return false;
 					}
 
+					void reset() {
+						boost::fill( candidateInstanceScores, 0.0f );
+						boost::fill( candidateInstanceImportanceWeights, 0.0f );
+						offset = 0.0f;
+					}
+
 					void integrateNeighborModelCandidateScores( float neighborModelWeight, const Scores &neighborModelCandidateScores ) {
 						const int totalNumInstances = candidateInstanceScores.size();
 						// update the total score
@@ -520,23 +673,30 @@ namespace Neighborhood {
 							mismatchImportanceWeights[ queryDistanceIndex ] = positiveMessageLength + negativeMessageLength;
 						}
 
-						for( int globalInstanceIndex = 0 ; globalInstanceIndex < totalNumInstances ; ++globalInstanceIndex ) {
-							for( int queryDistanceIndex = 0 ; queryDistanceIndex < numQueryDistances ; ++queryDistanceIndex ) {
-								if( matchedDistances.matchedQueryDistancesByGlobalInstance[ globalInstanceIndex ][ queryDistanceIndex ] ) {
-									// this is a match
-									const float importanceWeight = matchImportanceWeights[ queryDistanceIndex ];
-									candidateInstanceScores[ globalInstanceIndex ] += importanceWeight;
-									candidateInstanceImportanceWeights[ globalInstanceIndex ] += importanceWeight;
-								}
-								else {
-									// this is a mismatch
-									candidateInstanceImportanceWeights[ globalInstanceIndex ] += mismatchImportanceWeights[ queryDistanceIndex ];
-								}
+						// every instance starts with mismatches for all query distances
+						float totalMismatchImportanceWeight = 0.0f;
+						for( int queryDistanceIndex = 0 ; queryDistanceIndex < numQueryDistances ; ++queryDistanceIndex ) {
+							// if every instance matches the distance, nobody can mismatch it
+							// (the mismatch weight can be infinite then, and we must not subtract it again below)
+							if( matchedDistances.matchedQueryDistanceCounters[ queryDistanceIndex ] == totalNumInstances ) {
+								mismatchImportanceWeights[ queryDistanceIndex ] = matchImportanceWeights[ queryDistanceIndex ];
 							}
+							totalMismatchImportanceWeight += mismatchImportanceWeights[ queryDistanceIndex ];
+						}
+
+						for( int globalInstanceIndex = 0 ; globalInstanceIndex < totalNumInstances ; ++globalInstanceIndex ) {
+							candidateInstanceImportanceWeights[ globalInstanceIndex ] += totalMismatchImportanceWeight;
+						}
+
+						// and then we turn the matches from mismatches into matches
+						for( auto match = matchedDistances.matches.begin() ; match != matchedDistances.matches.end() ; ++match ) {
+							const float importanceWeight = matchImportanceWeights[ match->queryDistanceIndex ];
+							candidateInstanceScores[ match->globalInstanceIndex ] += importanceWeight;
+							candidateInstanceImportanceWeights[ match->globalInstanceIndex ] += importanceWeight - mismatchImportanceWeights[ match->queryDistanceIndex ];
 						}
 					}
 
-					void integrateCorrelatedUnmatchedDistances( std::vector< int > &&correlatedGlobalInstanceIndices ) {
+					void integrateCorrelatedUnmatchedDistances( const std::vector< int > &correlatedGlobalInstanceIndices ) {
 						const int totalNumInstances = candidateInstanceScores.size();
 
 						const int numInstances = correlatedGlobalInstanceIndices.size();
@@ -598,6 +758,12 @@ namespace Neighborhood {
 						return false;
 					}
 
+					void reset() {
+						boost::fill( candidateInstanceScores, 0.0f );
+						boost::fill( candidateInstanceImportanceWeights, 0.0f );
+						weightOffset = 0.0f;
+					}
+
 					void integrateNeighborModelCandidateScores( float neighborModelWeight, const Scores &neighborModelCandidateScores ) {
 						const int totalNumInstances = candidateInstanceScores.size();
 						// update the total score
@@ -630,7 +796,7 @@ namespace Neighborhood {
 						}
 					}
 
-					void integrateCorrelatedUnmatchedDistances( std::vector< int > &&correlatedGlobalInstanceIndices ) {
+					void integrateCorrelatedUnmatchedDistances( const std::vector< int > &correlatedGlobalInstanceIndices ) {
 						// M01 += 1
 						for(
 							auto correlatedGlobalInstanceIndex = correlatedGlobalInstanceIndices.begin() ;
@@ -723,7 +889,7 @@ namespace Neighborhood {
 						}
 					}
 
-					void integrateCorrelatedUnmatchedDistances( std::vector< int > &&correlatedGlobalInstanceIndices ) {
+					void integrateCorrelatedUnmatchedDistances( const std::vector< int > &correlatedGlobalInstanceIndices ) {
 						weightedTotalNumUnmatchedDistances += 1;
 
 						for(
@@ -828,7 +994,7 @@ namespace Neighborhood {
 						}
 					}
 
-					void integrateCorrelatedUnmatchedDistances( std::vector< int > &&correlatedGlobalInstanceIndices ) {
+					void integrateCorrelatedUnmatchedDistances( const std::vector< int > &correlatedGlobalInstanceIndices ) {
 						const int totalNumInstances = candidateInstanceScores.size();
 
 						const int numInstances = correlatedGlobalInstanceIndices.size();
@@ -856,187 +1022,260 @@ namespace Neighborhood {
 				};
 			};
 #endif
+			// scratch buffers for matching against one neighbor model
+			// they are reused for all neighbor models a worker processes
+			template< class Policy >
+			struct NeighborModelScratch {
+				typename Policy::Scores neighborModelCandidateScores;
+				typename Policy::MatchedDistances matchedDistances;
+
+				UnmatchedDistances unmatchedDistances;
+
+				// tolerance intervals of the query distances
+				std::vector< float > queryIntervalBegins;
+				std::vector< float > queryIntervalEnds;
+
+				// the bin of a round that is still collecting mismatches
+				struct OpenBin {
+					int binId;
+					float endDistance;
+					std::vector< int > correlatedGlobalInstanceIndices;
+				};
+				std::vector< OpenBin > openBinsByRound;
+				// the last bin every instance has been added to, by [ round ][ globalInstanceIndex ]
+				// bin ids are never reused, so the markers never have to be cleared
+				std::vector< std::vector< int > > binMarkersByRound;
+				int nextBinId;
+
+				const int totalNumInstances;
+
+				NeighborModelScratch( int totalNumInstances )
+					: neighborModelCandidateScores( totalNumInstances )
+					, matchedDistances( totalNumInstances, 0 )
+					, nextBinId( 0 )
+					, totalNumInstances( totalNumInstances )
+				{
+				}
+			};
+
 			// TODO: remove numMatchedDistances
 			template< class Policy >
-			UnmatchedDistances matchDistances(
+			void matchDistances(
 				Id sceneNeighborModelId,
-				typename Policy::Scores &neighborModelCandidateScores
+				NeighborModelScratch< Policy > &scratch
 			) {
-				const int numSampledModels = database.sampledModelsById.size();
-				const int totalNumInstances = database.getTotalNumInstances();
-
 				// get the query volume's distances for the current neighbor model
 				const Distances &queryDistances = queryDataset.getDistances( sceneNeighborModelId );
 				const int numQueryDistances = queryDistances.size();
 
 				const float neighborModelTolerance = Policy::getNeighborModelTolerance( this, sceneNeighborModelId );
 
-				UnmatchedDistances unmatchedDistances;
-				typename Policy::MatchedDistances matchedDistances( totalNumInstances, numQueryDistances );
+				UnmatchedDistances &unmatchedDistances = scratch.unmatchedDistances;
+				unmatchedDistances.clear();
 
-				int globalInstanceIndex = 0;
-				for( int candidateModelIndex = 0 ; candidateModelIndex < numSampledModels ; ++candidateModelIndex ) {
-					const SampledModel &candidateModel = database.sampledModelsById[ candidateModelIndex ].second;
+				typename Policy::MatchedDistances &matchedDistances = scratch.matchedDistances;
+				matchedDistances.reset( numQueryDistances );
 
-					for( int instanceIndex = 0 ; instanceIndex < candidateModel.instances.size() ; ++instanceIndex, ++globalInstanceIndex ) {
-						const auto &instance = candidateModel.instances[ instanceIndex ];
-						const Distances &instanceDistances = instance.getDistances( sceneNeighborModelId );
+				// the query distances are the same for all instances, so compute their intervals only once
+				std::vector< float > &queryIntervalBegins = scratch.queryIntervalBegins;
+				std::vector< float > &queryIntervalEnds = scratch.queryIntervalEnds;
+				queryIntervalBegins.resize( numQueryDistances );
+				queryIntervalEnds.resize( numQueryDistances );
+				for( int queryDistanceIndex = 0 ; queryDistanceIndex < numQueryDistances ; ++queryDistanceIndex ) {
+					const float queryDistance = queryDistances[ queryDistanceIndex ];
+					const float queryDistanceToleranceScale = Policy::getDistanceToleranceScale( queryDistance );
 
-						auto instanceDistance = instanceDistances.begin();
-						for( int queryDistanceIndex = 0 ; queryDistanceIndex < numQueryDistances ; ++queryDistanceIndex ) {
-							const float queryDistance = queryDistances[ queryDistanceIndex ];
-							const float queryDistanceToleranceScale = Policy::getDistanceToleranceScale( queryDistance );
+					const float tolerance = queryDistanceToleranceScale * neighborModelTolerance + queryTolerance;
+					queryIntervalBegins[ queryDistanceIndex ] = queryDistance - tolerance;
+					queryIntervalEnds[ queryDistanceIndex ] = queryDistance + tolerance;
+				}
 
-							const float tolerance = queryDistanceToleranceScale * neighborModelTolerance + queryTolerance;
-							const float beginQueryDistanceInterval = queryDistance - tolerance;
-							const float endQueryDistanceInterval = queryDistance + tolerance;
+				// merge the sorted query distances with the sorted distances of every instance that has the neighbor model
+				const NeighborDistanceIndex::Column &column = database.distanceIndex.getColumn( sceneNeighborModelId );
+				const int numColumnInstances = column.getNumInstances();
+				for( int columnInstanceIndex = 0 ; columnInstanceIndex < numColumnInstances ; ++columnInstanceIndex ) {
+					const int globalInstanceIndex = column.globalInstanceIndices[ columnInstanceIndex ];
+					const int candidateModelIndex = database.distanceIndex.candidateModelIndicesByGlobalInstance[ globalInstanceIndex ];
 
-							for( ; instanceDistance != instanceDistances.end() && *instanceDistance < beginQueryDistanceInterval ; ++instanceDistance ) {
-								// there is no query distance that can match this instance distance, so its a mismatch
-								unmatchedDistances.emplace_back( UnmatchedDistance( *instanceDistance, candidateModelIndex, globalInstanceIndex ) );
-							}
+					const float *instanceDistance = column.distances.data() + column.offsets[ columnInstanceIndex ];
+					const float * const instanceDistancesEnd = column.distances.data() + column.offsets[ columnInstanceIndex + 1 ];
 
-							if( instanceDistance == instanceDistances.end() ) {
-								break;
-							}
+					for( int queryDistanceIndex = 0 ; queryDistanceIndex < numQueryDistances ; ++queryDistanceIndex ) {
+						const float beginQueryDistanceInterval = queryIntervalBegins[ queryDistanceIndex ];
+						const float endQueryDistanceInterval = queryIntervalEnds[ queryDistanceIndex ];
 
-							// can this instance distance be matched by this query?
-							if( *instanceDistance <= endQueryDistanceInterval ) {
-								// match
-								matchedDistances.match( globalInstanceIndex, queryDistanceIndex );
+						for( ; instanceDistance != instanceDistancesEnd && *instanceDistance < beginQueryDistanceInterval ; ++instanceDistance ) {
+							// there is no query distance that can match this instance distance, so its a mismatch
+							unmatchedDistances.emplace_back( UnmatchedDistance( *instanceDistance, candidateModelIndex, globalInstanceIndex ) );
+						}
 
-								// we're done with this instance distance
-								++instanceDistance;
-							}
+						if( instanceDistance == instanceDistancesEnd ) {
+							break;
 						}
 
-						// the remaining instance elements are mismatches, too
-						for( ; instanceDistance != instanceDistances.end() ; ++instanceDistance ) {
-							unmatchedDistances.emplace_back( UnmatchedDistance( *instanceDistance, candidateModelIndex, globalInstanceIndex ) );
+						// can this instance distance be matched by this query?
+						if( *instanceDistance <= endQueryDistanceInterval ) {
+							// match
+							matchedDistances.match( globalInstanceIndex, queryDistanceIndex );
+
+							// we're done with this instance distance
+							++instanceDistance;
 						}
 					}
-				}
 
-				neighborModelCandidateScores.integrateMatchedDistances( matchedDistances );
+					// the remaining instance elements are mismatches, too
+					for( ; instanceDistance != instanceDistancesEnd ; ++instanceDistance ) {
+						unmatchedDistances.emplace_back( UnmatchedDistance( *instanceDistance, candidateModelIndex, globalInstanceIndex ) );
+					}
+				}
 
-				return unmatchedDistances;
+				scratch.neighborModelCandidateScores.integrateMatchedDistances( matchedDistances );
 			}
 
+			// groups the mismatches into distance bins and integrates the instances of every bin as correlated mismatches
+			// a bin starts at the smallest mismatch that has not been binned yet and every instance can only appear once in a bin,
+			// so additional mismatches of an instance are deferred to the next round (which is binned the same way)
+			//
+			// the mismatches are only sorted once and then streamed through all rounds at the same time:
+			// every round keeps one open bin, and a mismatch moves on to the next round if its instance is already in the open bin
 			template< class Policy >
 			void processUnmatchedDistances(
 				Id sceneNeighborModelId,
-				UnmatchedDistances &&unmatchedDistances,
-				typename Policy::Scores &neighborModelCandidateScores
+				NeighborModelScratch< Policy > &scratch
 			) {
+				typedef typename NeighborModelScratch< Policy >::OpenBin OpenBin;
+
 				// initialize short-hand references
-				const int totalNumInstances = database.getTotalNumInstances();
 				const float neighborModelTolerance = Policy::getNeighborModelTolerance( this, sceneNeighborModelId );
 
-				// we need another vector to hold the mismatches we cant process
-				UnmatchedDistances deferredUnmatchedDistances;
-				deferredUnmatchedDistances.reserve( unmatchedDistances.size() );
+				UnmatchedDistances &unmatchedDistances = scratch.unmatchedDistances;
+				boost::sort( unmatchedDistances, UnmatchedDistance::less_by_distance );
 
-				// second pass: process mismatches
-				while( !unmatchedDistances.empty() ) {
-					// sort the mismatches by distance first
-					boost::sort( unmatchedDistances, UnmatchedDistance::less_by_distance );
+				std::vector< OpenBin > &openBinsByRound = scratch.openBinsByRound;
+				int numRounds = 0;
 
-					// process mismatches implicitly distance bin by distance bin
-					for( auto unmatchedDistance = unmatchedDistances.begin() ; unmatchedDistance != unmatchedDistances.end() ; ) {
-						const auto binBegin = unmatchedDistance;
-						{
-							const float beginDistance = binBegin->distance;
-							const float toleranceScale = Policy::getDistanceToleranceScale( binBegin->distance );
-							// this isn't exactly right but I dont want to write an inverter just now
-							// TODO: write an inverter [10/11/2012 kirschan2]
-							const float endDistance = beginDistance + 2 * neighborModelTolerance * toleranceScale + 2 * queryTolerance;
-							do {
-								++unmatchedDistance;
-							} while(
-									unmatchedDistance != unmatchedDistances.end()
-								&&
-									unmatchedDistance->distance <= endDistance
-							);
+				for( auto unmatchedDistance = unmatchedDistances.begin() ; unmatchedDistance != unmatchedDistances.end() ; ++unmatchedDistance ) {
+					const int globalInstanceIndex = unmatchedDistance->globalInstanceIndex;
+
+					for( int round = 0 ; ; ++round ) {
+						if( round == numRounds ) {
+							// no earlier round could take the mismatch, so we need another round
+							if( round == openBinsByRound.size() ) {
+								openBinsByRound.push_back( OpenBin() );
+							}
+							if( round == scratch.binMarkersByRound.size() ) {
+								scratch.binMarkersByRound.push_back( std::vector< int >( scratch.totalNumInstances, -1 ) );
+							}
+							++numRounds;
 						}
-						const auto binEnd = unmatchedDistance;
-
-						// sort by globalInstanceIndex and then entry (globalInstanceIndex is already sorted by entry implicitly)
-						std::sort( binBegin, binEnd, UnmatchedDistance::less_by_globalInstanceIndex );
-
-						// count the instances in this bin
-						std::vector<int> correlatedGlobalInstanceIndices;
-						correlatedGlobalInstanceIndices.reserve( binEnd - binBegin );
-						int numInstancesInBin = 0;
-						for( auto binElement = binBegin ; binElement != binEnd ; ) {
-							const int globalInstanceIndex = binElement->globalInstanceIndex;
-							correlatedGlobalInstanceIndices.push_back( globalInstanceIndex );
-							++binElement;
-							++numInstancesInBin;
-
-							// skip over additional mismatches from globalInstanceIndex in this bin
-							// and add them to the list of deferred mismatches because we cant process them this round
-							while(
-									binElement != binEnd
-								&&
-									binElement->globalInstanceIndex == globalInstanceIndex
-							) {
-								deferredUnmatchedDistances.push_back( *binElement );
-								++binElement;
+						else {
+							OpenBin &openBin = openBinsByRound[ round ];
+							int &binMarker = scratch.binMarkersByRound[ round ][ globalInstanceIndex ];
+
+							if( unmatchedDistance->distance <= openBin.endDistance ) {
+								if( binMarker == openBin.binId ) {
+									// the instance is already in this bin, try the next round
+									continue;
+								}
+
+								binMarker = openBin.binId;
+								openBin.correlatedGlobalInstanceIndices.push_back( globalInstanceIndex );
+								break;
 							}
+
+							// the mismatch is beyond the open bin, so the bin is complete
+							scratch.neighborModelCandidateScores.integrateCorrelatedUnmatchedDistances( openBin.correlatedGlobalInstanceIndices );
 						}
 
-						neighborModelCandidateScores.integrateCorrelatedUnmatchedDistances( std::move( correlatedGlobalInstanceIndices ) );
+						// start a new bin with this mismatch
+						OpenBin &openBin = openBinsByRound[ round ];
+						openBin.binId = scratch.nextBinId++;
+						{
+							const float beginDistance = unmatchedDistance->distance;
+							const float toleranceScale = Policy::getDistanceToleranceScale( beginDistance );
+							// this isn't exactly right but I dont want to write an inverter just now
+							// TODO: write an inverter [10/11/2012 kirschan2]
+							openBin.endDistance = beginDistance + 2 * neighborModelTolerance * toleranceScale + 2 * queryTolerance;
+						}
+						openBin.correlatedGlobalInstanceIndices.clear();
+						openBin.correlatedGlobalInstanceIndices.push_back( globalInstanceIndex );
+						scratch.binMarkersByRound[ round ][ globalInstanceIndex ] = openBin.binId;
+						break;
 					}
+				}
 
-					// use the left over mismatches for the next round until we're done with everything
-					unmatchedDistances.swap( deferredUnmatchedDistances );
-					deferredUnmatchedDistances.clear();
+				// integrate the bins that are still open
+				for( int round = 0 ; round < numRounds ; ++round ) {
+					scratch.neighborModelCandidateScores.integrateCorrelatedUnmatchedDistances( openBinsByRound[ round ].correlatedGlobalInstanceIndices );
 				}
 			}
 
+			// the scores for the neighbor model end up in scratch.neighborModelCandidateScores
 			template< class Policy >
-			typename Policy::Scores matchAgainstNeighborModel( Id sceneNeighborModelId ) {
-				const int totalNumInstances = database.getTotalNumInstances();
-
-				// scores for the current neighborModelIndex
-				typename Policy::Scores neighborModelCandidateScores( totalNumInstances );
+			void matchAgainstNeighborModel( Id sceneNeighborModelId, NeighborModelScratch< Policy > &scratch ) {
+				scratch.neighborModelCandidateScores.reset();
 
 				// first phase: matches + query mismatches
-				std::vector< UnmatchedDistance > unmatchedDistances = matchDistances<Policy>(
-					sceneNeighborModelId,
-					neighborModelCandidateScores
-				);
+				matchDistances<Policy>( sceneNeighborModelId, scratch );
 
 				// this is the number of merged mismatched distances
-				processUnmatchedDistances<Policy>(
-					sceneNeighborModelId,
-					std::move( unmatchedDistances ),
-					neighborModelCandidateScores
-				);
+				processUnmatchedDistances<Policy>( sceneNeighborModelId, scratch );
+			}
 
-				return neighborModelCandidateScores;
+			template< class Policy >
+			typename Policy::Scores matchAgainstNeighborModel( Id sceneNeighborModelId ) {
+				NeighborModelScratch< Policy > scratch( database.getTotalNumInstances() );
+				matchAgainstNeighborModel<Policy>( sceneNeighborModelId, scratch );
+				return std::move( scratch.neighborModelCandidateScores );
 			}
 
+			template< class Policy >
+			struct WorkerScores {
+				NeighborModelScratch< Policy > scratch;
+				// total score of all candidates over the neighbor models this worker has processed
+				typename Policy::Scores totalScores;
+
+				WorkerScores( int totalNumInstances )
+					: scratch( totalNumInstances )
+					, totalScores( totalNumInstances )
+				{
+				}
+			};
+
 			template< class Policy >
 			Results executeWithPolicy() {
-				const int totalNumInstances = database.getTotalNumInstances();
+				if( !database.isCompiled() ) {
+					logError( "the neighborhood database has to be compiled before it can be queried!" );
+					return Results();
+				}
 
-				// total score of all candidates
-				typename Policy::Scores totalScores( totalNumInstances );
+				const int totalNumInstances = database.getTotalNumInstances();
 
-				// we iterate over all model ids and compare the query distances against all sampled models---one neighbor model at a time
-				for( int sceneNeighborModelId = 0 ; sceneNeighborModelId < database.numIds ; ++sceneNeighborModelId ) {
+				// we compare the query distances against all sampled models---one neighbor model per task
+				// every worker accumulates its own total scores which are summed up afterwards
+				TaskRuntime::Reducer< WorkerScores< Policy > > workerScores( [totalNumInstances] () {
+					return WorkerScores< Policy >( totalNumInstances );
+				} );
+				TaskRuntime::parallel_for( 0, database.numIds, 1, [&] ( int sceneNeighborModelId ) {
 					// = P( D | N )
 					const float neighborModelWeight = Policy::getNeighborModelWeight( this, sceneNeighborModelId );
 
 					if( neighborModelWeight == 0.0f ) {
-						continue;
+						return;
 					}
 
-					const typename Policy::Scores neighborModelCandidateScores = matchAgainstNeighborModel<Policy>( sceneNeighborModelId );
+					WorkerScores< Policy > &localScores = workerScores.local();
+					matchAgainstNeighborModel<Policy>( sceneNeighborModelId, localScores.scratch );
 
-					totalScores.integrateNeighborModelCandidateScores( neighborModelWeight, neighborModelCandidateScores );
-				}
+					localScores.totalScores.integrateNeighborModelCandidateScores( neighborModelWeight, localScores.scratch.neighborModelCandidateScores );
+				} );
+
+				// total score of all candidates
+				// (the offsets of total scores are always 0, so they can be integrated with a weight of 1)
+				typename Policy::Scores totalScores( totalNumInstances );
+				workerScores.combine_each( [&] ( const WorkerScores< Policy > &localScores ) {
+					totalScores.integrateNeighborModelCandidateScores( 1.0f, localScores.totalScores );
+				} );
 
 				// compute the final score and store it in our results data structure
 				if( !totalScores.isEmpty() )	{
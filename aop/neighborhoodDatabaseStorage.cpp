@@ -1,7 +1,9 @@
 #include "neighborhoodDatabaseStorage.h"
 
 namespace Neighborhood {
-	const int CACHE_FORMAT_VERSION = 1;
+	const int CACHE_FORMAT_VERSION = 3;
+	// query datasets and results are versioned separately, so database format changes don't invalidate them
+	const int RAW_DATA_FORMAT_VERSION = 1;
 
 	bool NeighborhoodDatabaseV2::load( const std::string &filename ) {
 		Serializer::BinaryReader reader( filename.c_str(), CACHE_FORMAT_VERSION );
@@ -9,7 +11,9 @@ namespace Neighborhood {
 			reader.get( numIds );
 			reader.get( totalNumInstances );
 			reader.get( sampledModelsById );
+			reader.get( distanceIndex );
 
+			updateSampledModelIndices();
 
 			return true;
 		}
@@ -22,10 +26,11 @@ namespace Neighborhood {
 		writer.put( numIds );
 		writer.put( totalNumInstances );
 		writer.put( sampledModelsById );
+		writer.put( distanceIndex );
 	}
 
 	RawIdDistances loadRawIdDistances( const std::string &filename ) {
-		Serializer::BinaryReader reader( filename.c_str(), CACHE_FORMAT_VERSION );
+		Serializer::BinaryReader reader( filename.c_str(), RAW_DATA_FORMAT_VERSION );
 
 		if( reader.valid() ) {
 			RawIdDistances rawIdDistances;
@@ -40,12 +45,12 @@ namespace Neighborhood {
 	}
 
 	void storeRawIdDistances( const std::string &filename, RawIdDistances &rawIdDistances ) {
-		Serializer::BinaryWriter writer( filename.c_str(), CACHE_FORMAT_VERSION );
+		Serializer::BinaryWriter writer( filename.c_str(), RAW_DATA_FORMAT_VERSION );
 		writer.put( rawIdDistances );
 	}
 
 	Results loadResults( const std::string &filename ) {
-		Serializer::BinaryReader reader( filename.c_str(), CACHE_FORMAT_VERSION );
+		Serializer::BinaryReader reader( filename.c_str(), RAW_DATA_FORMAT_VERSION );
 		if( reader.valid() ) {
 			Results results;
 
@@ -59,7 +64,7 @@ namespace Neighborhood {
 	}
 
 	void storeResults( const std::string &filename, const Results &results ) {
-		Serializer::BinaryWriter writer( filename.c_str(), CACHE_FORMAT_VERSION );
+		Serializer::BinaryWriter writer( filename.c_str(), RAW_DATA_FORMAT_VERSION );
 
 		writer.put( results );
 	}
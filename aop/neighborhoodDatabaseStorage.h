@@ -12,4 +12,15 @@ SERIALIZER_DEFAULT_EXTERN_IMPL( Neighborhood::NeighborhoodContext,
 
 SERIALIZER_DEFAULT_EXTERN_IMPL( Neighborhood::SampledModel,
 	(instances)
-)
\ No newline at end of file
+)
+
+SERIALIZER_DEFAULT_EXTERN_IMPL( Neighborhood::NeighborDistanceIndex::Column,
+	(globalInstanceIndices)
+	(offsets)
+	(distances)
+)
+
+SERIALIZER_DEFAULT_EXTERN_IMPL( Neighborhood::NeighborDistanceIndex,
+	(columnsById)
+	(candidateModelIndicesByGlobalInstance)
+)
@@ -9,8 +9,8 @@ void IndexedProbeSamples::setOcclusionLowerBounds() {
 
 	// 0..numProbeSamples are valid occlusion values
 	// we store one additional end() lower bound for simple interval calculations
+	std::vector<int> occlusionLowerBounds;
 	occlusionLowerBounds.reserve( OptixProgramInterface::numProbeSamples + 2 );
-	occlusionLowerBounds.clear();
 
 	int level  = 0;
 
@@ -18,7 +18,7 @@ void IndexedProbeSamples::setOcclusionLowerBounds() {
 	occlusionLowerBounds.push_back( 0 );
 
 	for( int probeIndex = 0 ; probeIndex < size() ; ++probeIndex ) {
-		const auto current = getProbeSamples()[probeIndex].occlusion;
+		const auto current = occlusions[probeIndex];
 		for( ; level < current ; level++ ) {
 			occlusionLowerBounds.push_back( probeIndex );
 		}
@@ -29,6 +29,59 @@ void IndexedProbeSamples::setOcclusionLowerBounds() {
 	for( ; level <= OptixProgramInterface::numProbeSamples ; level++ ) {
 		occlusionLowerBounds.push_back( size() );
 	}
+
+	this->occlusionLowerBounds = std::move( occlusionLowerBounds );
+}
+
+void IndexedProbeSamples::setProbeSamples( const DBProbeSamples &sortedProbeSamples ) {
+	AUTO_TIMER_FOR_FUNCTION();
+
+	const int numSamples = (int) sortedProbeSamples.size();
+	std::vector<float> distances( numSamples );
+	std::vector<signed char> colorL( numSamples );
+	std::vector<signed char> colorA( numSamples );
+	std::vector<signed char> colorB( numSamples );
+	std::vector<unsigned char> occlusions( numSamples );
+	std::vector<int> probeIndices( numSamples );
+	std::vector<int> weights;
+
+	bool hasWeights = false;
+	for( int sampleIndex = 0 ; sampleIndex < numSamples ; sampleIndex++ ) {
+		const DBProbeSample &sample = sortedProbeSamples[ sampleIndex ];
+		distances[ sampleIndex ] = sample.distance;
+		colorL[ sampleIndex ] = sample.colorLab.x;
+		colorA[ sampleIndex ] = sample.colorLab.y;
+		colorB[ sampleIndex ] = sample.colorLab.z;
+		occlusions[ sampleIndex ] = sample.occlusion;
+		probeIndices[ sampleIndex ] = sample.probeIndex;
+		hasWeights |= sample.weight != 1;
+	}
+
+	if( hasWeights ) {
+		weights.resize( numSamples );
+		for( int sampleIndex = 0 ; sampleIndex < numSamples ; sampleIndex++ ) {
+			weights[ sampleIndex ] = sortedProbeSamples[ sampleIndex ].weight;
+		}
+	}
+
+	this->distances = std::move( distances );
+	this->colorL = std::move( colorL );
+	this->colorA = std::move( colorA );
+	this->colorB = std::move( colorB );
+	this->occlusions = std::move( occlusions );
+	this->probeIndices = std::move( probeIndices );
+	this->weights = std::move( weights );
+
+	setOcclusionLowerBounds();
+}
+
+DBProbeSamples IndexedProbeSamples::decodeProbeSamples() const {
+	DBProbeSamples probeSamples;
+	probeSamples.reserve( size() );
+	for( int sampleIndex = 0 ; sampleIndex < size() ; sampleIndex++ ) {
+		probeSamples.push_back( getProbeSample( sampleIndex ) );
+	}
+	return probeSamples;
 }
 
 void ProbeDatabase::registerSceneModels( const std::vector< std::string > &modelNames ) {
@@ -40,12 +93,31 @@ void ProbeDatabase::clearAll() {
 	sampledModels.clear();
 	localModelNames.clear();
 	modelIndexMapper.resetLocalMaps();
+	sampleBucketIndex.clear();
+	pendingModelIndices.clear();
+
+	// nothing refers to the mapped cache anymore
+	mappedFile.reset();
 }
 
 void ProbeDatabase::clear( int sceneModelIndex ) {
 	const int localModelIndex = modelIndexMapper.getLocalModelIndex( sceneModelIndex );
 	if( localModelIndex != ModelIndexMapper::INVALID_INDEX ) {
+		rememberCompiledGlobalState();
+		globalColorCounter.subtract( sampledModels[ localModelIndex ].getColorCounter() );
+
 		sampledModels.erase( sampledModels.begin() + localModelIndex );
+		// the local model indices are the indices into localModelNames
+		localModelNames.erase( localModelNames.begin() + localModelIndex );
+		modelsRemoved = true;
+
+		// the pending models behind the removed one move down by one
+		pendingModelIndices.erase( std::remove( pendingModelIndices.begin(), pendingModelIndices.end(), localModelIndex ), pendingModelIndices.end() );
+		for( auto pendingModelIndex = pendingModelIndices.begin() ; pendingModelIndex != pendingModelIndices.end() ; ++pendingModelIndex ) {
+			if( *pendingModelIndex > localModelIndex ) {
+				--*pendingModelIndex;
+			}
+		}
 	}
 	modelIndexMapper.registerLocalModels( localModelNames );
 }
@@ -71,12 +143,119 @@ void ProbeDatabase::addInstanceProbes(
 }
 
 void ProbeDatabase::compile( int sceneModelIndex ) {
-	throw std::exception( "not supported atm!" );
-
-	// globalColorCounter does not support partial updates
-	/*const int localModelIndex = modelIndexMapper.getLocalModelIndex( sceneModelIndex );
+	const int localModelIndex = modelIndexMapper.getLocalModelIndex( sceneModelIndex );
 	if( localModelIndex != ModelIndexMapper::INVALID_INDEX ) {
-		sampledModels[ localModelIndex ].mergeInstances( globalColorCounter );
-	}*/
+		sampledModels[ localModelIndex ].markDirty();
+	}
+
+	compileChangedModels( sampleQuantizer.maxDistance );
+}
+
+void ProbeDatabase::mergeChangedModels( float maxDistance ) {
+	AUTO_TIMER_FUNCTION();
+
+	// all samples would be quantized differently
+	if( maxDistance != sampleQuantizer.maxDistance ) {
+		compileAll( maxDistance );
+		return;
+	}
+
+	rememberCompiledGlobalState();
+
+	const int numSampledModels = (int) sampledModels.size();
+	std::vector<int> dirtyModelIndices;
+	for( int localModelIndex = 0 ; localModelIndex < numSampledModels ; localModelIndex++ ) {
+		auto &sampledModel = sampledModels[ localModelIndex ];
+		if( !sampledModel.isDirty() ) {
+			continue;
+		}
+
+		// the model's old samples are replaced with the new ones in the global color counter
+		globalColorCounter.subtract( sampledModel.getColorCounter() );
+
+		dirtyModelIndices.push_back( localModelIndex );
+	}
+
+	TaskRuntime::parallel_for( 0, (int) dirtyModelIndices.size(), 1, [&] ( int dirtyModelIndex ) {
+		sampledModels[ dirtyModelIndices[ dirtyModelIndex ] ].mergeInstances( sampleQuantizer, keepInstanceSamples );
+	} );
+	for( auto localModelIndex = dirtyModelIndices.begin() ; localModelIndex != dirtyModelIndices.end() ; ++localModelIndex ) {
+		globalColorCounter.add( sampledModels[ *localModelIndex ].getColorCounter() );
+	}
+
+	boost::push_back( pendingModelIndices, dirtyModelIndices );
+}
+
+void ProbeDatabase::rememberCompiledGlobalState() {
+	// later changes before the next compile must not overwrite it
+	if( pendingModelIndices.empty() && !modelsRemoved ) {
+		pendingOldGlobalBuckets = globalColorCounter.buckets;
+		pendingOldTotalNumSamples = globalColorCounter.totalNumSamples;
+	}
+}
+
+void ProbeDatabase::compileChangedModels( float maxDistance ) {
+	AUTO_TIMER_FUNCTION();
+
+	// all samples would be quantized differently
+	if( maxDistance != sampleQuantizer.maxDistance ) {
+		compileAll( maxDistance );
+		return;
+	}
+
+	mergeChangedModels( maxDistance );
+
+	const std::vector<unsigned> oldGlobalBuckets = std::move( pendingOldGlobalBuckets );
+	const int oldTotalNumSamples = pendingOldTotalNumSamples;
+
+	const int numSampledModels = (int) sampledModels.size();
+	std::vector<bool> recompiledModels( numSampledModels );
+	int numRecompiledModels = 0;
+	for( auto localModelIndex = pendingModelIndices.begin() ; localModelIndex != pendingModelIndices.end() ; ++localModelIndex ) {
+		if( !recompiledModels[ *localModelIndex ] ) {
+			recompiledModels[ *localModelIndex ] = true;
+			numRecompiledModels++;
+		}
+	}
+	pendingModelIndices.clear();
+
+	if( numRecompiledModels == 0 && !modelsRemoved ) {
+		return;
+	}
+
+	globalColorCounter.calculateEntropy();
+
+	// the adjusted frequencies depend on the total sample count, so if it has changed, all message lengths have changed
+	// otherwise only the buckets whose counts have changed matter
+	const bool totalNumSamplesChanged = globalColorCounter.totalNumSamples != oldTotalNumSamples;
+	std::vector<int> changedBucketIndices;
+	if( !totalNumSamplesChanged ) {
+		for( int bucketIndex = 0 ; bucketIndex < ColorCounter::numBuckets ; bucketIndex++ ) {
+			if( globalColorCounter.buckets[ bucketIndex ] != oldGlobalBuckets[ bucketIndex ] ) {
+				changedBucketIndices.push_back( bucketIndex );
+			}
+		}
+	}
+
+	int numUpdatedModels = 0;
+	for( int localModelIndex = 0 ; localModelIndex < numSampledModels ; localModelIndex++ ) {
+		auto &modelColorCounter = sampledModels[ localModelIndex ].modelColorCounter;
+
+		bool needsUpdate = recompiledModels[ localModelIndex ] || totalNumSamplesChanged;
+		for( auto bucketIndex = changedBucketIndices.begin() ; !needsUpdate && bucketIndex != changedBucketIndices.end() ; ++bucketIndex ) {
+			needsUpdate = modelColorCounter.buckets[ *bucketIndex ] != 0;
+		}
+
+		if( needsUpdate ) {
+			modelColorCounter.calculateGlobalMessageLength( globalColorCounter );
+			numUpdatedModels++;
+		}
+	}
+
+	// the bucket index only depends on the bit planes and histograms, so rebuilding it is cheap compared to merging instances
+	sampleBucketIndex.build( sampledModels );
+	modelsRemoved = false;
+
+	log( boost::format( "incremental compile: recompiled %i of %i models, updated %i global message lengths" ) % numRecompiledModels % numSampledModels % numUpdatedModels );
 }
 }
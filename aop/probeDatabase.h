@@ -14,8 +14,7 @@
 #include "boost/range/algorithm/count.hpp"
 #include <boost/dynamic_bitset.hpp>
 
-#include <ppl.h>
-#include <concurrent_vector.h>
+#include "taskRuntime.h"
 #include "boost/range/algorithm_ext/erase.hpp"
 #include "boost/range/algorithm/transform.hpp"
 #include "boost/range/numeric.hpp"
@@ -25,6 +24,7 @@
 #include <serializer_fwd.h>
 #include <algorithm>
 #include <unordered_map>
+#include <memory>
 
 #include "mathUtility.h"
 
@@ -40,6 +40,11 @@
 #include "queryResult.h"
 
 #include "flatImmutableMultiMap.h"
+#include "mappedArray.h"
+#include "mappedFile.h"
+#include "bitPlaneKernels.h"
+#include "sampleWindowKernels.h"
+#include "radixSort.h"
 
 namespace ProbeContext {
 
@@ -48,6 +53,8 @@ struct IndexedProbeSamples;
 struct SampledModel;
 struct ProbeDatabase;
 
+struct MappedStorage;
+
 }
 
 SERIALIZER_FWD_EXTERN_DECL( ProbeContext::InstanceProbeDataset )
@@ -197,6 +204,11 @@ struct ProbeContextTolerance {
 		colorLabTolerance = 5;
 		distanceTolerance = 0.25;
 	}
+
+	// in occlusion levels
+	int getOcclusionIntegerTolerance() const {
+		return int( OptixProgramInterface::numProbeSamples * occusionTolerance + 0.5 );
+	}
 };
 
 struct ProbeContextToleranceV2 {
@@ -305,6 +317,80 @@ struct DBProbeSample : RawProbeSample {
 typedef std::vector< DBProbe > DBProbes;
 typedef std::vector< DBProbeSample > DBProbeSamples;
 
+// 6 byte copy of a probe sample of an instance: 8 bit Lab, 8 bit occlusion and the distance as 16 bit fixed point relative to maxDistance
+// the probe index is the index of the sample and the weight is always 1
+struct CompactProbeSample {
+	optix::char3 colorLab;
+	unsigned char occlusion;
+	unsigned short distance;
+};
+
+// optional compact copy of the samples of one instance (for visualizations)
+// the queries only use the merged samples of the models, which keep the exact values
+struct CompactProbeSamples {
+	float maxDistance;
+	std::vector< CompactProbeSample > samples;
+
+	CompactProbeSamples()
+		: maxDistance()
+	{
+	}
+
+	CompactProbeSamples( CompactProbeSamples &&other )
+		: maxDistance( other.maxDistance )
+		, samples( std::move( other.samples ) )
+	{
+	}
+
+	CompactProbeSamples & operator = ( CompactProbeSamples &&other ) {
+		maxDistance = other.maxDistance;
+		samples = std::move( other.samples );
+
+		return *this;
+	}
+
+	bool empty() const {
+		return samples.empty();
+	}
+
+	void clear() {
+		samples.clear();
+		samples.shrink_to_fit();
+	}
+
+	// the samples have to be ordered by probe index
+	void encode( DBProbeSamples::const_iterator begin, DBProbeSamples::const_iterator end, float maxDistance ) {
+		this->maxDistance = maxDistance;
+
+		const float distanceScale = maxDistance > 0.0f ? 65535.0f / maxDistance : 0.0f;
+		samples.resize( end - begin );
+		for( auto compactSample = samples.begin() ; begin != end ; ++begin, ++compactSample ) {
+			compactSample->colorLab = begin->colorLab;
+			compactSample->occlusion = begin->occlusion;
+			compactSample->distance = (unsigned short) clamp<int>( int( begin->distance * distanceScale + 0.5f ), 0, 65535 );
+		}
+	}
+
+	DBProbeSamples decode() const {
+		DBProbeSamples probeSamples( samples.size() );
+		for( int probeIndex = 0 ; probeIndex < (int) samples.size() ; probeIndex++ ) {
+			const CompactProbeSample &compactSample = samples[ probeIndex ];
+			DBProbeSample &probeSample = probeSamples[ probeIndex ];
+			probeSample.colorLab = compactSample.colorLab;
+			probeSample.occlusion = compactSample.occlusion;
+			probeSample.distance = compactSample.distance * maxDistance / 65535.0f;
+			probeSample.probeIndex = probeIndex;
+			probeSample.weight = 1;
+		}
+		return probeSamples;
+	}
+
+private:
+	// better error messages than with boost::noncopyable
+	CompactProbeSamples( const CompactProbeSamples &other );
+	CompactProbeSamples & operator = ( const CompactProbeSamples &other );
+};
+
 // TODO: use this [10/27/2012 Andreas]
 namespace ProbeSampleTransformation {
 	inline DBProbeSamples transformSamples( const RawProbeSamples &rawProbeSamples ) {
@@ -445,7 +531,8 @@ struct SampleQuantizer {
 		BC_occlusion = 2,
 		BC_distance = 3
 	};
-	static const int numBuckets = 1<<(BC_L + BC_a + BC_b + BC_occlusion + BC_distance);
+	static const int numPackedSampleBits = BC_L + BC_a + BC_b + BC_occlusion + BC_distance;
+	static const int numBuckets = 1<<numPackedSampleBits;
 
 	typedef unsigned PackedSample;
 	union Index {
@@ -523,9 +610,64 @@ struct SampleBitPlane {
 	}
 };
 
+// sample counts for all buckets that are set in a bit plane
+// the counts are stored in bucket order, so a bucket's count is found via its rank in the bit plane
+struct SampleBucketHistogram {
+	// number of set buckets before each word of the bit plane
+	MappedArray<unsigned> rankOffsets;
+	MappedArray<unsigned> counts;
+
+	SampleBucketHistogram() {}
+
+	SampleBucketHistogram( SampleBucketHistogram &&other )
+		: rankOffsets( std::move( other.rankOffsets ) )
+		, counts( std::move( other.counts ) )
+	{
+	}
+
+	SampleBucketHistogram & operator =( SampleBucketHistogram &&other ) {
+		rankOffsets = std::move( other.rankOffsets );
+		counts = std::move( other.counts );
+
+		return *this;
+	}
+
+	// sortedSamples has to contain exactly the buckets that are set in bitPlane
+	void build( const SampleBitPlane &bitPlane, const std::vector<SampleQuantizer::PackedSample> &sortedSamples ) {
+		std::vector<unsigned> rankOffsets( SampleBitPlane::numInts );
+
+		unsigned rank = 0;
+		for( int wordIndex = 0 ; wordIndex < SampleBitPlane::numInts ; wordIndex++ ) {
+			rankOffsets[ wordIndex ] = rank;
+			rank += BitPlaneKernels::popcount( bitPlane.plane[ wordIndex ] );
+		}
+
+		std::vector<unsigned> counts;
+		counts.reserve( rank );
+		for( auto sample = sortedSamples.begin() ; sample != sortedSamples.end() ; ) {
+			const auto runEnd = std::upper_bound( sample, sortedSamples.end(), *sample );
+			counts.push_back( unsigned( runEnd - sample ) );
+			sample = runEnd;
+		}
+
+		this->rankOffsets = std::move( rankOffsets );
+		this->counts = std::move( counts );
+	}
+
+	// bitIndex has to be set in the bit plane
+	unsigned getCount( const SampleBitPlane &bitPlane, int wordIndex, int bitIndex ) const {
+		const unsigned lowerBitsMask = (1u << bitIndex) - 1;
+		return counts[ rankOffsets[ wordIndex ] + BitPlaneKernels::popcount( bitPlane.plane[ wordIndex ] & lowerBitsMask ) ];
+	}
+
+	bool empty() const {
+		return counts.empty();
+	}
+};
+
 struct LinearizedProbeSamples {
 	int numProbes;
-	std::vector<SampleQuantizer::PackedSample> samples;
+	MappedArray<SampleQuantizer::PackedSample> samples;
 
 	LinearizedProbeSamples()
 		: numProbes()
@@ -546,22 +688,24 @@ struct LinearizedProbeSamples {
 
 	void init( int numProbes, int numInstances ) {
 		samples.clear();
-		samples.reserve( numProbes * numInstances );
+		samples.makeOwning().reserve( numProbes * numInstances );
 		this->numProbes = numProbes;
 	}
 
 	// unsorted!
 	void push_back( const SampleQuantizer &quantizer, const RawProbeSample &rawProbeSample ) {
-		samples.push_back( quantizer.quantizeSample( rawProbeSample ) );
+		samples.makeOwning().push_back( quantizer.quantizeSample( rawProbeSample ) );
 	}
 
 	void push_back( const SampleQuantizer &quantizer, const RawProbeSamples &rawProbeSamples ) {
+		auto &samples = this->samples.makeOwning();
 		for( auto rawProbeSample = rawProbeSamples.begin() ; rawProbeSample != rawProbeSamples.end() ; ++rawProbeSample ) {
 			samples.push_back( quantizer.quantizeSample( *rawProbeSample ) );
 		}
 	}
 
 	void push_back( const SampleQuantizer &quantizer, const DBProbeSamples &dbProbeSamples ) {
+		auto &samples = this->samples.makeOwning();
 		for( auto dbProbeSample = dbProbeSamples.begin() ; dbProbeSample != dbProbeSamples.end() ; ++dbProbeSample ) {
 			samples.push_back( quantizer.quantizeSample( *dbProbeSample ) );
 		}
@@ -670,6 +814,35 @@ namespace SampleBitPlaneHelper {
 			targetPlane.set( quantizer.quantizeSample( *dbProbeSample ) );
 		}
 	}
+
+	// calls visitor( packedSample, wordIndex, bitIndex ) for every bucket that is set in the plane
+	template< typename Visitor >
+	void visitBuckets( const SampleBitPlane &plane, Visitor &&visitor ) {
+		for( int wordIndex = 0 ; wordIndex < SampleBitPlane::numInts ; wordIndex++ ) {
+			for( unsigned mask = plane.plane[ wordIndex ] ; mask ; mask &= mask - 1 ) {
+				const int bitIndex = BitPlaneKernels::lowestBitIndex( mask );
+				const SampleQuantizer::PackedSample packedSample = (wordIndex << 5) | bitIndex;
+				visitor( packedSample, wordIndex, bitIndex );
+			}
+		}
+	}
+
+	// calls visitor( packedSample, wordIndex, bitIndex ) for every bucket that is set in both planes
+	// the intersection is done by the vectorized bit plane kernels
+	template< typename Visitor >
+	void visitSharedBuckets( const SampleBitPlane &planeA, const SampleBitPlane &planeB, Visitor &&visitor ) {
+		BitPlaneKernels::MaskedWord maskedWords[ SampleBitPlane::numInts ];
+		const int numMaskedWords = BitPlaneKernels::intersect( planeA.plane, planeB.plane, SampleBitPlane::numInts, maskedWords );
+
+		for( int maskedWordIndex = 0 ; maskedWordIndex < numMaskedWords ; maskedWordIndex++ ) {
+			const auto &maskedWord = maskedWords[ maskedWordIndex ];
+			for( unsigned mask = maskedWord.mask ; mask ; mask &= mask - 1 ) {
+				const int bitIndex = BitPlaneKernels::lowestBitIndex( mask );
+				const SampleQuantizer::PackedSample packedSample = (maskedWord.wordIndex << 5) | bitIndex;
+				visitor( packedSample, maskedWord.wordIndex, bitIndex );
+			}
+		}
+	}
 }
 
 struct SampleProbeIndexMap {
@@ -682,18 +855,25 @@ struct SampleProbeIndexMap {
 	> SampleMultiMap;
 
 	SampleMultiMap sampleMultiMap;
-	SampleMultiMap::Builder *builder;
+	// (packedSample << 16) | probeIndex for every pushed sample
+	// radix sorting these is a lot faster than sorting every bucket of the multi map
+	std::vector<unsigned> pendingItems;
 
 	void startFilling( int numProbes, int numInstances ) {
 		// we create a hash that can be perfect if the hash function was perfect
 		const int numProbeSamples = numProbes * numInstances;
 		sampleMultiMap.init( numProbeSamples );
 
-		builder = new SampleMultiMap::Builder( sampleMultiMap, numProbeSamples );
+		pendingItems.clear();
+		pendingItems.reserve( numProbeSamples );
+	}
+
+	void pushInstanceSample( SampleQuantizer::PackedSample packedSample, unsigned short probeIndex ) {
+		pendingItems.push_back( (packedSample << 16) | probeIndex );
 	}
 
 	void pushInstanceSample( const SampleQuantizer &quantizer, unsigned short probeIndex, const RawProbeSample &rawProbeSample ) {
-		builder->push_back( quantizer.quantizeSample( rawProbeSample ), probeIndex );
+		pushInstanceSample( quantizer.quantizeSample( rawProbeSample ), probeIndex );
 	}
 
 	/*void pushInstanceSamples( const SampleQuantizer &quantizer, const RawProbeSamples &rawProbeSamples ) {
@@ -706,8 +886,17 @@ struct SampleProbeIndexMap {
 	}*/
 
 	void finishFilling() {
-		builder->build();
-		delete builder;
+		RadixSort::sort( pendingItems, SampleQuantizer::numPackedSampleBits + 16 );
+
+		SampleMultiMap::Builder builder( sampleMultiMap, (int) pendingItems.size() );
+		for( auto item = pendingItems.begin() ; item != pendingItems.end() ; ++item ) {
+			builder.push_back( *item >> 16, (unsigned short) (*item & 0xFFFF) );
+		}
+		// the items are pushed in order, so the buckets don't need to be sorted again
+		builder.build( false );
+
+		pendingItems.clear();
+		pendingItems.shrink_to_fit();
 	}
 
 	SampleMultiMap::const_iterator_range lookup( SampleQuantizer::PackedSample packedSample ) const {
@@ -770,12 +959,14 @@ struct ColorCounter {
 		entropy = other.entropy;
 		totalMessageLength = other.totalMessageLength;
 		globalMessageLength = other.globalMessageLength;
+
+		return *this;
 	}
 
-	void splat( const RawProbeSample &probeSample ) {
+	void splat( const RawProbeSample &probeSample, int weight = 1 ) {
 		const unsigned bucketIndex = getBucketIndex( probeSample );
-		buckets[ bucketIndex ]++;
-		totalNumSamples++;
+		buckets[ bucketIndex ] += weight;
+		totalNumSamples += weight;
 	}
 
 	void splatSamples( const RawProbeSamples &probeSamples ) {
@@ -784,6 +975,22 @@ struct ColorCounter {
 		}
 	}
 
+	// adds the samples of another counter (eg of a model that has been compiled in parallel)
+	void add( const ColorCounter &other ) {
+		for( int bucketIndex = 0 ; bucketIndex < numBuckets ; bucketIndex++ ) {
+			buckets[ bucketIndex ] += other.buckets[ bucketIndex ];
+		}
+		totalNumSamples += other.totalNumSamples;
+	}
+
+	// removes the samples of a counter that has been splatted into this one before
+	void subtract( const ColorCounter &other ) {
+		for( int bucketIndex = 0 ; bucketIndex < numBuckets ; bucketIndex++ ) {
+			buckets[ bucketIndex ] -= other.buckets[ bucketIndex ];
+		}
+		totalNumSamples -= other.totalNumSamples;
+	}
+
 	float getAdjustedFrequency( unsigned bucketIndex ) const {
 		const int matches = buckets[ bucketIndex & (numBuckets - 1) ]; // mask for packed samples
 		return (matches + 1.0) / (totalNumSamples + 2.0);
@@ -844,31 +1051,68 @@ struct ColorCounter {
 // this dataset creates auxiliary structures automatically
 // invariant: sorted and occlusionLowerBounds is correctlyset
 struct IndexedProbeSamples {
-	DBProbeSamples data;
-	std::vector<int> occlusionLowerBounds;
-
-	const DBProbeSamples &getProbeSamples() const {
-		return data;
-	}
+	// the samples are stored as compact columns (12 bytes per sample instead of 16 bytes per DBProbeSample)
+	// the vectorized matcher works on them directly (see SampleWindowKernels)
+	// (views of a mapped cache after loading one, see MappedStorage)
+	MappedArray<float> distances;
+	MappedArray<signed char> colorL;
+	MappedArray<signed char> colorA;
+	MappedArray<signed char> colorB;
+	MappedArray<unsigned char> occlusions;
+	MappedArray<int> probeIndices;
+	// only stored if a sample has a weight != 1 (see CompressedDataset)
+	MappedArray<int> weights;
+
+	MappedArray<int> occlusionLowerBounds;
+
+	int getWeight( int index ) const {
+		return weights.empty() ? 1 : weights[ index ];
+	}
+
+	DBProbeSample getProbeSample( int index ) const {
+		DBProbeSample probeSample;
+		probeSample.colorLab.x = colorL[ index ];
+		probeSample.colorLab.y = colorA[ index ];
+		probeSample.colorLab.z = colorB[ index ];
+		probeSample.occlusion = occlusions[ index ];
+		probeSample.distance = distances[ index ];
+		probeSample.probeIndex = probeIndices[ index ];
+		probeSample.weight = getWeight( index );
+		return probeSample;
+	}
+
+	// decodes all samples (in sorted order)
+	DBProbeSamples decodeProbeSamples() const;
 
 	IndexedProbeSamples() {}
 
-	IndexedProbeSamples( DBProbeSamples &&other ) :
-		data( std::move( other ) ),
-		occlusionLowerBounds()
-	{
-		sort();
-		setOcclusionLowerBounds();
+	IndexedProbeSamples( DBProbeSamples &&other ) {
+		sort( other );
+		setProbeSamples( other );
+
+		other.clear();
 	}
 
 	IndexedProbeSamples( IndexedProbeSamples &&other ) :
-		data( std::move( other.data ) ),
+		distances( std::move( other.distances ) ),
+		colorL( std::move( other.colorL ) ),
+		colorA( std::move( other.colorA ) ),
+		colorB( std::move( other.colorB ) ),
+		occlusions( std::move( other.occlusions ) ),
+		probeIndices( std::move( other.probeIndices ) ),
+		weights( std::move( other.weights ) ),
 		occlusionLowerBounds( std::move( other.occlusionLowerBounds ) )
 	{
 	}
 
 	IndexedProbeSamples & operator = ( IndexedProbeSamples && other ) {
-		data = std::move( other.data );
+		distances = std::move( other.distances );
+		colorL = std::move( other.colorL );
+		colorA = std::move( other.colorA );
+		colorB = std::move( other.colorB );
+		occlusions = std::move( other.occlusions );
+		probeIndices = std::move( other.probeIndices );
+		weights = std::move( other.weights );
 		occlusionLowerBounds = std::move( other.occlusionLowerBounds );
 
 		return *this;
@@ -876,13 +1120,24 @@ struct IndexedProbeSamples {
 
 	IndexedProbeSamples clone() const {
 		IndexedProbeSamples cloned;
-		cloned.data = data;
+		cloned.distances = distances;
+		cloned.colorL = colorL;
+		cloned.colorA = colorA;
+		cloned.colorB = colorB;
+		cloned.occlusions = occlusions;
+		cloned.probeIndices = probeIndices;
+		cloned.weights = weights;
 		cloned.occlusionLowerBounds = occlusionLowerBounds;
 		return cloned;
 	}
 
+	SampleWindowKernels::SampleColumns getSampleColumns() const {
+		const SampleWindowKernels::SampleColumns columns = { distances.data(), colorL.data(), colorA.data(), colorB.data() };
+		return columns;
+	}
+
 	int size() const {
-		return (int) data.size();
+		return (int) distances.size();
 	}
 
 	typedef std::pair< int, int > IntRange;
@@ -895,6 +1150,33 @@ struct IndexedProbeSamples {
 		return std::make_pair( occlusionLowerBounds[leftLevel], occlusionLowerBounds[ rightLevel + 1 ] );
 	}
 
+	// calls visitor( probeSample ) for every sample that has samples in other within the occlusion tolerance
+	// only these samples can ever be matched by a Matcher, so this is used to calculate cheap score upper bounds
+	template< typename Visitor >
+	void visitSamplesMatchableByOcclusion( const IndexedProbeSamples &other, int occlusionTolerance, Visitor &&visitor ) const {
+		if( size() == 0 || other.size() == 0 ) {
+			return;
+		}
+
+		for( int occlusionLevel = 0 ; occlusionLevel <= OptixProgramInterface::numProbeSamples ; occlusionLevel++ ) {
+			const IntRange range = getOcclusionRange( occlusionLevel );
+			if( range.first == range.second ) {
+				continue;
+			}
+
+			const int leftToleranceLevel = std::max( 0, occlusionLevel - occlusionTolerance );
+			const int rightToleranceLevel = std::min( occlusionLevel + occlusionTolerance, OptixProgramInterface::numProbeSamples );
+			const IntRange otherRange = other.getOcclusionRange( leftToleranceLevel, rightToleranceLevel );
+			if( otherRange.first == otherRange.second ) {
+				continue;
+			}
+
+			for( int index = range.first ; index < range.second ; index++ ) {
+				visitor( getProbeSample( index ) );
+			}
+		}
+	}
+
 #if 0
 	struct MatcherController {
 		void onMatch( int outerProbeSampleIndex, int innerProbeSampleIndex, const DBProbeSample &outer, const DBProbeSample &inner ) {
@@ -928,7 +1210,43 @@ struct IndexedProbeSamples {
 		{
 		}
 
+		typedef std::pair< IntRange, IntRange > RangeJob;
+
 		void match() {
+			std::vector< RangeJob > rangeJobs;
+			createRangeJobs( rangeJobs );
+
+			//AUTO_TIMER_BLOCK( "matching" )
+			{
+				TaskRuntime::parallel_for_each( rangeJobs.begin(), rangeJobs.end(),
+					[&] ( const RangeJob &rangeJob ) {
+						controller.onNewThreadStarted();
+
+						matchSortedRanges(
+							rangeJob.first,
+							rangeJob.second
+						);
+					}
+				);
+			}
+		}
+
+		// matches everything in the calling thread
+		// used when the caller already splits its work into enough tasks (eg the full queries)
+		void matchSerial() {
+			std::vector< RangeJob > rangeJobs;
+			createRangeJobs( rangeJobs );
+
+			controller.onNewThreadStarted();
+			for( auto rangeJob = rangeJobs.begin() ; rangeJob != rangeJobs.end() ; ++rangeJob ) {
+				matchSortedRanges(
+					rangeJob->first,
+					rangeJob->second
+				);
+			}
+		}
+
+		void createRangeJobs( std::vector< RangeJob > &rangeJobs ) const {
 			if( probeSamplesOuter.size() == 0 || probeSamplesInner.size() == 0 ) {
 				return;
 			}
@@ -944,12 +1262,10 @@ struct IndexedProbeSamples {
 			// assuming that the query set is smaller, we enlarge it, to have less items to sort than vice-versa
 			// we could determine this at runtime...
 			// if( sampledModels.size() > indexedProbeSamples.size() ) {...} else {...}
-			const int occlusionTolerance = int( OptixProgramInterface::numProbeSamples * probeContextTolerance.occusionTolerance + 0.5 );
+			const int occlusionTolerance = probeContextTolerance.getOcclusionIntegerTolerance();
 
 			// TODO: use a stack allocated array here? [9/27/2012 kirschan2]
 
-			typedef std::pair< IntRange, IntRange > RangeJob;
-			std::vector< RangeJob > rangeJobs;
 			rangeJobs.reserve( OptixProgramInterface::numProbeSamples );
 			for( int occulsionLevel = 0 ; occulsionLevel <= OptixProgramInterface::numProbeSamples ; occulsionLevel++ ) {
 				const IntRange rangeOuter = probeSamplesOuter.getOcclusionRange( occulsionLevel );
@@ -972,101 +1288,52 @@ struct IndexedProbeSamples {
 					rangeJobs.push_back( std::make_pair( rangeOuter, rangeInner ) );
 				}
 			}
-
-			//AUTO_TIMER_BLOCK( "matching" )
-			{
-				using namespace Concurrency;
-				parallel_for_each( rangeJobs.begin(), rangeJobs.end(),
-					[&] ( const RangeJob &rangeJob ) {
-						controller.onNewThreadStarted();
-
-						matchSortedRanges(
-							rangeJob.first,
-							rangeJob.second
-						);
-					}
-				);
-			}
 		}
 
+		// matches are passed to the controller in batches of at most this size
+		static const int matchBatchSize = 256;
+
+		// every range only contains a single occlusion level, so both ranges are sorted by distance
+		// the inner samples that can match an outer sample form a window that only ever moves forward
+		// the window bounds and the color tests are calculated with SampleWindowKernels on the sample columns
 		void matchSortedRanges(
 			const IntRange &rangeOuter,
 			const IntRange &rangeInner
 		) {
-			const float squaredColorTolerance = probeContextTolerance.colorLabTolerance * probeContextTolerance.colorLabTolerance;
+			// matchColor uses an integer tolerance, too
+			const float squaredColorTolerance = float( int( probeContextTolerance.colorLabTolerance * probeContextTolerance.colorLabTolerance ) );
+			const float distanceTolerance = probeContextTolerance.distanceTolerance;
 
-			// assert: the range is not empty
-			const int beginIndexOuter = rangeOuter.first;
-			const int endIndexOuter = rangeOuter.second;
-			int indexOuter = beginIndexOuter;
+			const SampleWindowKernels::SampleColumns innerColumns = probeSamplesInner.getSampleColumns();
 
-			const int beginIndexInner = rangeInner.first;
-			const int endIndexInner = rangeInner.second;
-			int indexInner = beginIndexInner;
+			int matchedIndices[ matchBatchSize ];
 
-			DBProbeSample probeSampleOuter = probeSamplesOuter.getProbeSamples()[ indexOuter ];
-			for( ; indexOuter < endIndexOuter - 1 ; indexOuter++ ) {
-				const DBProbeSample nextSampleOuter = probeSamplesOuter.getProbeSamples()[ indexOuter + 1 ];
-				int nextIndexInner = indexInner;
-
-				const float minDistance = probeSampleOuter.distance - probeContextTolerance.distanceTolerance;
-				const float maxDistance = probeSampleOuter.distance + probeContextTolerance.distanceTolerance;
-				const float minNextDistance = nextSampleOuter.distance - probeContextTolerance.distanceTolerance;
-
-				for( ; indexInner < endIndexInner ; indexInner++ ) {
-					const DBProbeSample probeSampleInner = probeSamplesInner.getProbeSamples()[ indexInner ];
-
-					// distance too small?
-					if( probeSampleInner.distance < minDistance ) {
-						// then the next one is too far away as well
-						nextIndexInner = indexInner + 1;
-						continue;
-					}
+			// assert: the range is not empty
+			const int endIndexInner = rangeInner.second;
+			int indexInner = rangeInner.first;
 
-					// if nextIndexInner can't use this probe, the next overlapped sample might be the first one it likes
-					if( probeSampleInner.distance < minNextDistance ) {
-						// set it to the next ref sample
-						nextIndexInner = indexInner + 1;
-					}
-					// else:
-					//  nextIndexInner points to the first overlapped sample the next pure sample might match
+			for( int indexOuter = rangeOuter.first ; indexOuter < rangeOuter.second && indexInner < endIndexInner ; indexOuter++ ) {
+				const float distanceOuter = probeSamplesOuter.distances[ indexOuter ];
 
-					// are we past our interval
-					if( probeSampleInner.distance > maxDistance ) {
-						// enough for this probe, do the next
-						break;
-					}
+				// inner samples that are too close for this outer sample are too close for all following ones, too
+				const int windowBegin = SampleWindowKernels::findFirstNotLess( innerColumns.distances, indexInner, endIndexInner, distanceOuter - distanceTolerance );
+				const int windowEnd = SampleWindowKernels::findFirstGreater( innerColumns.distances, windowBegin, endIndexInner, distanceOuter + distanceTolerance );
+				indexInner = windowBegin;
 
-					if( DBProbeSample::matchColor( probeSampleOuter, probeSampleInner, squaredColorTolerance ) ) {
-						controller.onMatch( indexOuter, indexInner, probeSampleOuter, probeSampleInner );
-					}
+				if( windowBegin == windowEnd ) {
+					continue;
 				}
 
-				probeSampleOuter = nextSampleOuter;
-				indexInner = nextIndexInner;
-			}
-
-			// process the last pure probe
-			{
-				const float minDistance = probeSampleOuter.distance - probeContextTolerance.distanceTolerance;
-				const float maxDistance = probeSampleOuter.distance + probeContextTolerance.distanceTolerance;
-
-				for( ; indexInner < endIndexInner ; indexInner++ ) {
-					const DBProbeSample probeSampleInner = probeSamplesInner.getProbeSamples()[ indexInner ];
-
-					// distance too small?
-					if( probeSampleInner.distance < minDistance ) {
-						continue;
-					}
+				const DBProbeSample probeSampleOuter = probeSamplesOuter.getProbeSample( indexOuter );
+				const float referenceColor[] = { float( probeSampleOuter.colorLab.x ), float( probeSampleOuter.colorLab.y ), float( probeSampleOuter.colorLab.z ) };
 
-					// are we past our interval
-					if( probeSampleInner.distance > maxDistance ) {
-						// enough for this probe, we're done
-						break;
-					}
+				for( int batchBegin = windowBegin ; batchBegin < windowEnd ; batchBegin += matchBatchSize ) {
+					const int batchEnd = std::min( batchBegin + matchBatchSize, windowEnd );
+					const int numMatches = SampleWindowKernels::matchColors( innerColumns, batchBegin, batchEnd, referenceColor, squaredColorTolerance, matchedIndices );
 
-					if( DBProbeSample::matchColor( probeSampleOuter, probeSampleInner, squaredColorTolerance ) ) {
-						controller.onMatch( indexOuter, indexInner, probeSampleOuter, probeSampleInner );
+					for( int matchIndex = 0 ; matchIndex < numMatches ; matchIndex++ ) {
+						const int matchedIndexInner = matchedIndices[ matchIndex ];
+						controller.onMatch( indexOuter, matchedIndexInner, probeSampleOuter, probeSamplesInner.getProbeSample( matchedIndexInner ) );
 					}
 				}
 			}
@@ -1074,12 +1341,24 @@ struct IndexedProbeSamples {
 	};
 
 private:
-	void sort() {
+	static void sort( DBProbeSamples &probeSamples ) {
 		AUTO_TIMER_FUNCTION();
 
-		boost::sort( data, DBProbeSample::lexicographicalLess );
+		// same order as DBProbeSample::lexicographicalLess (occlusion, distance, colorLab.x), but with a stable radix sort:
+		// 8 bits occlusion, 32 bits order-preserving distance and 8 bits L
+		RadixSort::sortByKey( probeSamples, 48,
+			[] ( const DBProbeSample &sample ) -> unsigned long long {
+				return
+						((unsigned long long) sample.occlusion << 40)
+					|	((unsigned long long) RadixSort::getOrderedBits( sample.distance ) << 8)
+					|	((unsigned char) sample.colorLab.x ^ 0x80)
+				;
+			}
+		);
 	}
 
+	// sortedProbeSamples have to be sorted already
+	void setProbeSamples( const DBProbeSamples &sortedProbeSamples );
 	void setOcclusionLowerBounds();
 
 	SERIALIZER_FWD_FRIEND_EXTERN( ProbeContext::IndexedProbeSamples );
@@ -1123,10 +1402,16 @@ namespace IndexedProbeSamplesHelper {
 struct SampledModel {
 	struct SampledInstance {
 		Obb::Transformation sourceTransformation;
-		DBProbeSamples probeSamples;
+		// only kept after compiling if the database keeps instance samples (see ProbeDatabase::setKeepInstanceSamples)
+		CompactProbeSamples probeSamples;
+
+		bool hasProbeSamples() const {
+			return !probeSamples.empty();
+		}
 
-		const DBProbeSamples &getProbeSamples() const {
-			return probeSamples;
+		// the distances are quantized
+		DBProbeSamples decodeProbeSamples() const {
+			return probeSamples.decode();
 		}
 
 		const Obb::Transformation &getSource() const {
@@ -1141,9 +1426,8 @@ struct SampledModel {
 		{
 		}
 
-		SampledInstance( Obb::Transformation sourceTransformation, DBProbeSamples &&probeSamples )
+		explicit SampledInstance( Obb::Transformation sourceTransformation )
 			: sourceTransformation( std::move( sourceTransformation ) )
-			, probeSamples( std::move( probeSamples ) )
 		{
 		}
 
@@ -1162,11 +1446,12 @@ struct SampledModel {
 		const DBProbes &datasetProbes,
 		DBProbeSamples &&probeSamples
 	) {
-		if( probes.size() != datasetProbes.size() || resolution != datasetResolution ) {
+		// compare the probes themselves: datasets that have been sampled before the probes were sorted use a different order
+		if( resolution != datasetResolution || !ProbeGenerator::haveSameProbes( probes, datasetProbes ) ) {
 			if( !probes.empty() ) {
 				logError(
 					boost::format(
-					"expected %i probes, but got %i probes!\ndumping %i instances (%i probes) and reseting this dataset!"
+					"expected %i probes, but got %i different probes!\ndumping %i instances (%i probes) and reseting this dataset!"
 					)
 					% probes.size()
 					% datasetProbes.size()
@@ -1189,11 +1474,15 @@ struct SampledModel {
 			resolution = datasetResolution;
 		}
 
-		instances.emplace_back( SampledInstance( sourceTransformation, std::move( probeSamples ) ) );
+		// the samples are merged into mergedInstances by the next compile
+		instances.emplace_back( SampledInstance( sourceTransformation ) );
+		boost::push_back( uncompiledProbeSamples, probeSamples );
+		dirty = true;
 	}
 
 	void clear() {
 		instances.clear();
+		DBProbeSamples().swap( uncompiledProbeSamples );
 
 		mergedInstances = IndexedProbeSamples();
 
@@ -1206,10 +1495,15 @@ struct SampledModel {
 		rotatedProbePositions.resize( ProbeGenerator::getNumOrientations() );
 
 		resolution = 0.f;
-		modelColorCounter.clear();
+
+		// modelColorCounter is kept until the next compile:
+		// it contains exactly what has been splatted into the global color counter, so it can be subtracted again
+		dirty = true;
 	}
 
 	SampleBitPlane sampleBitPlane;
+	// used by the fast queries to score bit plane intersections
+	SampleBucketHistogram sampleBucketHistogram;
 	LinearizedProbeSamples linearizedProbeSamples;
 	std::vector< std::pair< SampleBitPlane, SampleProbeIndexMap > > sampleProbeIndexMapByDirection;
 
@@ -1217,6 +1511,10 @@ struct SampledModel {
 
 private:
 	SampledInstances instances;
+	// samples of the instances that have been added since the last compile (instance by instance)
+	DBProbeSamples uncompiledProbeSamples;
+
+	// the merged samples are the only exact copy of the samples of all compiled instances
 	IndexedProbeSamples mergedInstances;
 
 	std::vector< IndexedProbeSamples > mergedInstancesByDirectionIndex;
@@ -1225,10 +1523,14 @@ private:
 	std::vector< ProbeGenerator::ProbePositions > rotatedProbePositions;
 	float resolution;
 
+	// instances have changed since the last compile (only stored in the mapped cache)
+	bool dirty;
+
 public:
 
 	SampledModel()
 		: resolution( 0.f )
+		, dirty( false )
 	{
 		mergedInstancesByDirectionIndex.resize( ProbeGenerator::getNumDirections() );
 		sampleProbeIndexMapByDirection.resize( ProbeGenerator::getNumDirections() );
@@ -1238,24 +1540,29 @@ public:
 
 	SampledModel( SampledModel &&other )
 		: instances( std::move( other.instances ) )
+		, uncompiledProbeSamples( std::move( other.uncompiledProbeSamples ) )
 		, mergedInstances( std::move( other.mergedInstances ) )
 		, mergedInstancesByDirectionIndex( std::move( other.mergedInstancesByDirectionIndex ) )
 		, probes( std::move( other.probes ) )
 		, rotatedProbePositions( std::move( other.rotatedProbePositions ) )
 		, resolution( other.resolution )
+		, dirty( other.dirty )
 		, modelColorCounter( std::move( other.modelColorCounter ) )
 
 		, sampleBitPlane( std::move( other.sampleBitPlane ) )
+		, sampleBucketHistogram( std::move( other.sampleBucketHistogram ) )
 		, linearizedProbeSamples( std::move( other.linearizedProbeSamples ) )
 		, sampleProbeIndexMapByDirection( std::move( other.sampleProbeIndexMapByDirection ) )
 	{}
 
 	SampledModel & operator = ( SampledModel &&other ) {
 		sampleBitPlane = std::move( other.sampleBitPlane );
+		sampleBucketHistogram = std::move( other.sampleBucketHistogram );
 		linearizedProbeSamples = std::move( other.linearizedProbeSamples );
 		sampleProbeIndexMapByDirection = std::move( other.sampleProbeIndexMapByDirection );
 
 		instances = std::move( other.instances );
+		uncompiledProbeSamples = std::move( other.uncompiledProbeSamples );
 
 		mergedInstances = std::move( other.mergedInstances );
 		mergedInstancesByDirectionIndex = std::move( other.mergedInstancesByDirectionIndex );
@@ -1264,121 +1571,124 @@ public:
 		rotatedProbePositions = std::move( other.rotatedProbePositions );
 
 		resolution = other.resolution;
+		dirty = other.dirty;
 
-		modelColorCounter = other.modelColorCounter;
+		modelColorCounter = std::move( other.modelColorCounter );
 
 		return *this;
 	}
 
+	// builds the structures of the fast queries from the merged samples
 	void mergeInstancesFast( const SampleQuantizer &quantizer ) {
 		AUTO_TIMER_FUNCTION();
 
-		sampleBitPlane.clear();
-		linearizedProbeSamples.init( probes.size(), instances.size() );
+		const int numProbes = (int) probes.size();
+		const int numInstances = (int) instances.size();
+		const int numDirections = ProbeGenerator::getNumDirections();
 
-		// now create a splat plane and a multi map for each direction
-		for( int directionIndex = 0 ; directionIndex < ProbeGenerator::getNumDirections() ; directionIndex++ ) {
+		// one job per direction that quantizes its samples and creates its splat plane and multi map
+		std::vector< std::vector< SampleQuantizer::PackedSample > > packedSamplesByDirection( numDirections );
+		TaskRuntime::parallel_for( 0, numDirections, 1, [&] ( int directionIndex ) {
+			const IndexedProbeSamples &probeSamples = mergedInstancesByDirectionIndex[ directionIndex ];
+			auto &packedSamples = packedSamplesByDirection[ directionIndex ];
 			auto &pair = sampleProbeIndexMapByDirection[ directionIndex ];
+
 			pair.first.clear();
-			pair.second.startFilling( probes.size(), instances.size() );
-		}
+			pair.second.startFilling( numProbes, numInstances );
 
-		// splat all probe samples into the maps
-		for( auto instance = instances.begin() ; instance < instances.end() ; instance++ ) {
-			const auto probeSamples = instance->getProbeSamples();
-			for( int probeIndex = 0 ; probeIndex < probes.size() ; probeIndex++ ) {
-				// TODO: only calculate packedSample once..? [11/11/2012 kirschan2]
-				const auto &probeSample = probeSamples[ probeIndex ];
-				SampleBitPlaneHelper::splatProbeSample( sampleBitPlane, quantizer, probeSample );
-				linearizedProbeSamples.push_back( quantizer, probeSample );
+			packedSamples.resize( probeSamples.size() );
+			for( int sampleIndex = 0 ; sampleIndex < probeSamples.size() ; sampleIndex++ ) {
+				const auto packedSample = quantizer.quantizeSample( probeSamples.getProbeSample( sampleIndex ) );
+				packedSamples[ sampleIndex ] = packedSample;
 
-				auto &pair = sampleProbeIndexMapByDirection[ probes[ probeIndex ].directionIndex ];
-				SampleBitPlaneHelper::splatProbeSample( pair.first, quantizer, probeSample );
-				pair.second.pushInstanceSample( quantizer, probeIndex, probeSample );
+				pair.first.set( packedSample );
+				pair.second.pushInstanceSample( packedSample, probeSamples.probeIndices[ sampleIndex ] );
 			}
-		}
 
-		for( int directionIndex = 0 ; directionIndex < ProbeGenerator::getNumDirections() ; directionIndex++ ) {
-			auto &pair = sampleProbeIndexMapByDirection[ directionIndex ];
 			pair.second.finishFilling();
+		} );
 
-			boost::sort( linearizedProbeSamples.samples );
+		// the model's plane, linearized samples and histogram contain the samples of all directions
+		sampleBitPlane.clear();
+		linearizedProbeSamples.init( numProbes, numInstances );
+		auto &linearizedSamples = linearizedProbeSamples.samples.makeOwning();
+		for( auto packedSamples = packedSamplesByDirection.begin() ; packedSamples != packedSamplesByDirection.end() ; ++packedSamples ) {
+			for( auto packedSample = packedSamples->begin() ; packedSample != packedSamples->end() ; ++packedSample ) {
+				sampleBitPlane.set( *packedSample );
+			}
+			boost::push_back( linearizedSamples, *packedSamples );
 		}
+
+		RadixSort::sortByKey( linearizedSamples, SampleQuantizer::numPackedSampleBits,
+			[] ( SampleQuantizer::PackedSample packedSample ) { return packedSample; }
+		);
+		sampleBucketHistogram.build( sampleBitPlane, linearizedSamples );
 	}
 
 	// TODO: rename to compile
-	void mergeInstances( const SampleQuantizer &quantizer, ColorCounter &colorCounter ) {
-		// fast handling
-		mergeInstancesFast( quantizer );
-
-		// splat the entropy
-		{
-			for( auto instance = instances.begin() ; instance < instances.end() ; instance++ ) {
-				const auto probeSamples = instance->getProbeSamples();
-
-				for( auto probeSample = probeSamples.begin() ; probeSample != probeSamples.end() ; probeSample++ ) {
-					colorCounter.splat( *probeSample );
-					modelColorCounter.splat( *probeSample );
-				}
+	// merges the samples of the instances that have been added since the last compile into the merged samples
+	// and rebuilds everything else from them
+	// only updates modelColorCounter, so models can be compiled in parallel:
+	// the caller has to remove the model's old samples from the global counter before and add the new ones afterwards (see ProbeDatabase::compileChangedModels)
+	// keepInstanceSamples: store compact copies of the new instances' samples (otherwise they are dropped)
+	void mergeInstances( const SampleQuantizer &quantizer, bool keepInstanceSamples ) {
+		dirty = false;
+
+		const int numProbes = (int) probes.size();
+		const int numDirections = ProbeGenerator::getNumDirections();
+
+		if( !uncompiledProbeSamples.empty() ) {
+			const int numUncompiledInstances = int( uncompiledProbeSamples.size() / numProbes );
+			const int firstUncompiledInstanceIndex = (int) instances.size() - numUncompiledInstances;
+
+			if( keepInstanceSamples ) {
+				TaskRuntime::parallel_for( 0, numUncompiledInstances, 1, [&] ( int uncompiledInstanceIndex ) {
+					const auto probeSamplesBegin = uncompiledProbeSamples.begin() + uncompiledInstanceIndex * numProbes;
+					instances[ firstUncompiledInstanceIndex + uncompiledInstanceIndex ].probeSamples.encode( probeSamplesBegin, probeSamplesBegin + numProbes, quantizer.maxDistance );
+				} );
 			}
 
-			modelColorCounter.calculateEntropy();
-		}
-
-		if( instances.empty() ) {
-			return;
-		}
-		else if( instances.size() == 1 ) {
-			mergedInstances = IndexedProbeSamples( DBProbeSamples( instances.front().getProbeSamples() ) );
-		}
-		else {
-			const int totalSize =  boost::accumulate(
-				instances,
-				0,
-				[] ( int totalLength, const SampledInstance &instance) {
-					return totalLength + int( instance.getProbeSamples().size() );
+			// one job per direction and one job for all merged instances
+			// the old samples stay in front of the new ones and the sort is stable, so the result is the same as merging all instances at once
+			TaskRuntime::parallel_for( 0, numDirections + 1, 1, [&] ( int jobIndex ) {
+				if( jobIndex == numDirections ) {
+					DBProbeSamples probeSamples = mergedInstances.decodeProbeSamples();
+					boost::push_back( probeSamples, uncompiledProbeSamples );
+
+					// TODO: magic constants!!! [10/17/2012 kirschan2]
+					//std::cout << OptixProgramInterface::numProbeSamples << "\n";
+					/*ProbeContextToleranceV2 pctv2( int( 0.124f * OptixProgramInterface::numProbeSamples ), 1.0f, 0.25f * 0.95f );
+					CompressedDataset::compress( instances.size(), probes.size(), mergedProbeSamples, pctv2 );*/
+					mergedInstances = IndexedProbeSamples( std::move( probeSamples ) );
+					return;
 				}
-			);
 
-			DBProbeSamples mergedProbeSamples;
-			mergedProbeSamples.reserve( totalSize );
+				const int directionIndex = jobIndex;
 
-			AUTO_TIMER_BLOCK( "push back all instances" ) {
-				for( auto instance = instances.begin() ; instance != instances.end() ; ++instance ) {
-					boost::push_back( mergedProbeSamples, instance->getProbeSamples() );
+				DBProbeSamples probeSamples = mergedInstancesByDirectionIndex[ directionIndex ].decodeProbeSamples();
+				for( auto probeSample = uncompiledProbeSamples.begin() ; probeSample != uncompiledProbeSamples.end() ; ++probeSample ) {
+					if( probes[ probeSample->probeIndex ].directionIndex == directionIndex ) {
+						probeSamples.push_back( *probeSample );
+					}
 				}
-			}
 
-			// TODO: magic constants!!! [10/17/2012 kirschan2]
-			//std::cout << OptixProgramInterface::numProbeSamples << "\n";
-			/*ProbeContextToleranceV2 pctv2( int( 0.124f * OptixProgramInterface::numProbeSamples ), 1.0f, 0.25f * 0.95f );
-			CompressedDataset::compress( instances.size(), probes.size(), mergedProbeSamples, pctv2 );*/
-			mergedInstances = IndexedProbeSamples( std::move( mergedProbeSamples ) );
-		}
+				mergedInstancesByDirectionIndex[ directionIndex ] = std::move( probeSamples );
+			} );
 
-		AUTO_TIMER_BLOCK( "push back all instances sorted by direction index" ) {
-			const auto directionCounts = ProbeHelpers::countProbeDirections( probes );
-
-			std::vector< DBProbeSamples > probeSamplesByDirectionIndex( ProbeGenerator::getNumDirections() );
-			for( int directionIndex = 0 ; directionIndex < ProbeGenerator::getNumDirections() ; directionIndex++ ) {
-				const int numProbesWithDirectionIndex = directionCounts[ directionIndex ] * (int) instances.size();
-				probeSamplesByDirectionIndex[ directionIndex ].reserve( numProbesWithDirectionIndex );
-			}
+			DBProbeSamples().swap( uncompiledProbeSamples );
+		}
 
-			const int probesCount = probes.size();
-			for( int probeIndex = 0 ; probeIndex < probesCount ; probeIndex++ ) {
-				const auto &probe = probes[ probeIndex ];
-				const auto directionIndex = probe.directionIndex;
+		// fast handling
+		mergeInstancesFast( quantizer );
 
-				auto &probeSamples = probeSamplesByDirectionIndex[ directionIndex ];
-				for( int instanceIndex = 0 ; instanceIndex < instances.size() ; instanceIndex++ ) {
-					probeSamples.push_back( instances[ instanceIndex ].getProbeSamples()[ probeIndex ] );
-				}
+		// splat the entropy
+		{
+			modelColorCounter.clear();
+			for( int sampleIndex = 0 ; sampleIndex < mergedInstances.size() ; sampleIndex++ ) {
+				modelColorCounter.splat( mergedInstances.getProbeSample( sampleIndex ), mergedInstances.getWeight( sampleIndex ) );
 			}
 
-			for( int directionIndex = 0 ; directionIndex < ProbeGenerator::getNumDirections() ; directionIndex++ ) {
-				mergedInstancesByDirectionIndex[ directionIndex ] = std::move( probeSamplesByDirectionIndex[ directionIndex ] );
-			}
+			modelColorCounter.calculateEntropy();
 		}
 	}
 
@@ -1386,6 +1696,15 @@ public:
 		return mergedInstances.size() == 0;
 	}
 
+	bool isDirty() const {
+		return dirty;
+	}
+
+	// forces a rebuild on the next compile
+	void markDirty() {
+		dirty = true;
+	}
+
 	int uncompressedProbeSampleCount() const {
 		return instances.size() * probes.size();
 	}
@@ -1394,6 +1713,10 @@ public:
 		return instances;
 	}
 
+	const DBProbeSamples & getUncompiledProbeSamples() const {
+		return uncompiledProbeSamples;
+	}
+
 	const IndexedProbeSamples & getMergedInstances() const {
 		return mergedInstances;
 	}
@@ -1415,6 +1738,7 @@ public:
 	}
 
 	SERIALIZER_FWD_FRIEND_EXTERN( ProbeContext::SampledModel );
+	friend struct MappedStorage;
 
 private:
 	// better error messages than with boost::noncopyable
@@ -1422,6 +1746,175 @@ private:
 	SampledModel & operator = ( const SampledModel &other );
 };
 
+// inverted index over all sampled models: packed sample bucket -> postings of (localModelIndex, count)
+// the postings of each bucket are stored as varints in one flat byte array (model indices are delta coded)
+struct SampleBucketIndex {
+	MappedArray<unsigned> bucketOffsets;
+	MappedArray<unsigned char> postings;
+	int numSampledModels;
+
+	SampleBucketIndex()
+		: numSampledModels()
+	{
+	}
+
+	void clear() {
+		bucketOffsets.clear();
+		postings.clear();
+		numSampledModels = 0;
+	}
+
+	bool isValid( int numSampledModels ) const {
+		return !bucketOffsets.empty() && this->numSampledModels == numSampledModels;
+	}
+
+	// checks everything visitPostings relies on (the index of a mapped cache comes straight from the file):
+	// monotonic offsets inside postings, and postings that decode to model indices below numSampledModels without running past their bucket
+	bool isConsistent( int numSampledModels ) const {
+		if(
+				this->numSampledModels != numSampledModels
+			||	bucketOffsets.size() != size_t( SampleQuantizer::numBuckets + 1 )
+			||	bucketOffsets[ 0 ] != 0
+			||	bucketOffsets[ SampleQuantizer::numBuckets ] != postings.size()
+		) {
+			return false;
+		}
+
+		for( int bucketIndex = 0 ; bucketIndex < SampleQuantizer::numBuckets ; bucketIndex++ ) {
+			if( bucketOffsets[ bucketIndex ] > bucketOffsets[ bucketIndex + 1 ] ) {
+				return false;
+			}
+
+			const unsigned char *current = postings.data() + bucketOffsets[ bucketIndex ];
+			const unsigned char *end = postings.data() + bucketOffsets[ bucketIndex + 1 ];
+
+			int localModelIndex = 0;
+			while( current != end ) {
+				unsigned delta, count;
+				if( !readCheckedVarint( current, end, delta ) || !readCheckedVarint( current, end, count ) ) {
+					return false;
+				}
+				if( delta >= unsigned( numSampledModels - localModelIndex ) ) {
+					return false;
+				}
+				localModelIndex += (int) delta;
+			}
+		}
+		return true;
+	}
+
+	void build( const std::vector<SampledModel> &sampledModels ) {
+		AUTO_TIMER_FUNCTION();
+
+		struct Posting {
+			SampleQuantizer::PackedSample packedSample;
+			int localModelIndex;
+			unsigned count;
+		};
+
+		std::vector< Posting > unsortedPostings;
+		std::vector< unsigned > bucketCounters( SampleQuantizer::numBuckets );
+
+		numSampledModels = (int) sampledModels.size();
+		for( int localModelIndex = 0 ; localModelIndex < numSampledModels ; localModelIndex++ ) {
+			const auto &sampledModel = sampledModels[ localModelIndex ];
+			const auto &counts = sampledModel.sampleBucketHistogram.counts;
+
+			// the buckets are visited in order, so their ranks are the indices into counts
+			int rank = 0;
+			SampleBitPlaneHelper::visitBuckets( sampledModel.sampleBitPlane,
+				[&] ( SampleQuantizer::PackedSample packedSample, int wordIndex, int bitIndex ) {
+					const Posting posting = { packedSample, localModelIndex, counts[ rank++ ] };
+					unsortedPostings.push_back( posting );
+					bucketCounters[ packedSample ]++;
+				}
+			);
+		}
+
+		// counting sort by bucket (stable, so the model indices stay sorted inside a bucket)
+		std::vector< unsigned > bucketBegins( SampleQuantizer::numBuckets + 1 );
+		for( int bucketIndex = 0 ; bucketIndex < SampleQuantizer::numBuckets ; bucketIndex++ ) {
+			bucketBegins[ bucketIndex + 1 ] = bucketBegins[ bucketIndex ] + bucketCounters[ bucketIndex ];
+		}
+
+		std::vector< Posting > sortedPostings( unsortedPostings.size() );
+		for( auto posting = unsortedPostings.begin() ; posting != unsortedPostings.end() ; ++posting ) {
+			sortedPostings[ bucketBegins[ posting->packedSample ]++ ] = *posting;
+		}
+		unsortedPostings.clear();
+
+		// encode
+		std::vector<unsigned> bucketOffsets( SampleQuantizer::numBuckets + 1 );
+		std::vector<unsigned char> postings;
+		postings.reserve( sortedPostings.size() * 2 );
+
+		auto posting = sortedPostings.begin();
+		for( int bucketIndex = 0 ; bucketIndex < SampleQuantizer::numBuckets ; bucketIndex++ ) {
+			bucketOffsets[ bucketIndex ] = (unsigned) postings.size();
+
+			int previousLocalModelIndex = 0;
+			for( ; posting != sortedPostings.end() && posting->packedSample == bucketIndex ; ++posting ) {
+				pushVarint( postings, posting->localModelIndex - previousLocalModelIndex );
+				pushVarint( postings, posting->count );
+				previousLocalModelIndex = posting->localModelIndex;
+			}
+		}
+		bucketOffsets[ SampleQuantizer::numBuckets ] = (unsigned) postings.size();
+
+		log( boost::format( "sample bucket index: %i postings in %i bytes" ) % sortedPostings.size() % postings.size() );
+
+		this->bucketOffsets = std::move( bucketOffsets );
+		this->postings = std::move( postings );
+	}
+
+	// calls visitor( localModelIndex, count ) for every sampled model that has samples in this bucket
+	template< typename Visitor >
+	void visitPostings( SampleQuantizer::PackedSample packedSample, Visitor &&visitor ) const {
+		const unsigned char *current = postings.data() + bucketOffsets[ packedSample ];
+		const unsigned char *end = postings.data() + bucketOffsets[ packedSample + 1 ];
+
+		int localModelIndex = 0;
+		while( current != end ) {
+			localModelIndex += (int) readVarint( current );
+			const unsigned count = readVarint( current );
+			visitor( localModelIndex, count );
+		}
+	}
+
+private:
+	static void pushVarint( std::vector<unsigned char> &postings, unsigned value ) {
+		while( value >= 0x80 ) {
+			postings.push_back( (unsigned char) (value | 0x80) );
+			value >>= 7;
+		}
+		postings.push_back( (unsigned char) value );
+	}
+
+	static unsigned readVarint( const unsigned char *&current ) {
+		unsigned value = 0;
+		int shift = 0;
+		while( *current & 0x80 ) {
+			value |= unsigned( *current++ & 0x7F ) << shift;
+			shift += 7;
+		}
+		value |= unsigned( *current++ ) << shift;
+		return value;
+	}
+
+	// like readVarint, but fails instead of reading past end or shifting out of the value
+	static bool readCheckedVarint( const unsigned char *&current, const unsigned char *end, unsigned &value ) {
+		value = 0;
+		for( int shift = 0 ; current != end && shift < 32 ; shift += 7 ) {
+			const unsigned char byte = *current++;
+			value |= unsigned( byte & 0x7F ) << shift;
+			if( !(byte & 0x80) ) {
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
 struct ProbeDatabase /*: IDatabase*/ {
 	struct Settings {
 		float maxDistance;
@@ -1449,8 +1942,12 @@ struct ProbeDatabase /*: IDatabase*/ {
 
 	virtual void registerSceneModels( const std::vector< std::string > &modelNames );
 
+	// load accepts both the mapped cache and the serialized format
 	virtual bool load( const std::string &filename );
+	// stores a mapped cache (see MappedStorage)
 	virtual void store( const std::string &filename ) const;
+	// stores the old serialized format (everything compileAll builds has to be rebuilt after loading it)
+	void storeSerialized( const std::string &filename ) const;
 
 	virtual void clear( int sceneModelIndex );
 	virtual void clearAll();
@@ -1463,18 +1960,42 @@ struct ProbeDatabase /*: IDatabase*/ {
 		const RawProbeSamples &probeSamples
 	);
 
+	// rebuilds the model and all other changed models (see compileChangedModels)
 	virtual void compile( int sceneModelIndex );
+	// only rebuilds models whose instances have changed since the last compile
+	// the global color counter is updated by removing the old and adding the new samples of these models
+	// falls back to compileAll if maxDistance changes the quantization
+	// this only saves merging the unchanged models: every change of the total sample count changes the adjusted frequencies of all buckets,
+	// so the global message lengths of all models are recomputed then, and the bucket index is always rebuilt from all models
+	// (both only look at the color counters and bit planes, which is cheap compared to merging)
+	virtual void compileChangedModels( float maxDistance );
+	// only merges the instances of the changed models and updates the global color counter
+	// the global message lengths and the bucket index are updated by the next compileChangedModels, which has to be called before querying or storing
+	// (this way models can be merged one by one, without updating all message lengths every time, see ProbeSamplingPipeline::compile)
+	void mergeChangedModels( float maxDistance );
 	virtual void compileAll( float maxDistance ) {
+		AUTO_TIMER_FUNCTION();
+
+		pendingModelIndices.clear();
+
 		sampleQuantizer.maxDistance = maxDistance;
 
+		// compile the models in parallel (big models parallelize internally, too)
+		TaskRuntime::parallel_for( 0, (int) sampledModels.size(), 1, [&] ( int localModelIndex ) {
+			sampledModels[ localModelIndex ].mergeInstances( sampleQuantizer, keepInstanceSamples );
+		} );
+
 		globalColorCounter.clear();
 		for( auto sampledModel = sampledModels.begin() ; sampledModel != sampledModels.end() ; ++sampledModel ) {
-			sampledModel->mergeInstances( sampleQuantizer, globalColorCounter );
+			globalColorCounter.add( sampledModel->modelColorCounter );
 		}
 		globalColorCounter.calculateEntropy();
 		for( auto sampledModel = sampledModels.begin() ; sampledModel != sampledModels.end() ; ++sampledModel ) {
 			sampledModel->modelColorCounter.calculateGlobalMessageLength( globalColorCounter );
 		}
+
+		sampleBucketIndex.build( sampledModels );
+		modelsRemoved = false;
 	}
 
 	int getNumSampledModels() const {
@@ -1497,14 +2018,53 @@ struct ProbeDatabase /*: IDatabase*/ {
 		return sampledModels;
 	}
 
-	ProbeDatabase() {}
+	const ColorCounter & getGlobalColorCounter() const {
+		return globalColorCounter;
+	}
+
+	// compiling drops the samples of the instances by default (the merged samples contain them already)
+	// compact copies are only needed for visualizations
+	void setKeepInstanceSamples( bool keepInstanceSamples ) {
+		this->keepInstanceSamples = keepInstanceSamples;
+	}
+
+	bool getKeepInstanceSamples() const {
+		return keepInstanceSamples;
+	}
+
+	ProbeDatabase()
+		: modelsRemoved( false )
+		, keepInstanceSamples( false )
+		, pendingOldTotalNumSamples( 0 )
+	{}
 
 private:
 	SampledModels sampledModels;
 	ColorCounter globalColorCounter;
 	SampleQuantizer sampleQuantizer;
 
+	// only stored in the mapped cache, rebuilt after loading the serialized format
+	SampleBucketIndex sampleBucketIndex;
+
+	// clear() has removed models since the last compile, so the global state has to be updated even if no model is dirty
+	bool modelsRemoved;
+	bool keepInstanceSamples;
+
+	// models that mergeChangedModels has merged since the last compile (their message lengths are outdated)
+	std::vector< int > pendingModelIndices;
+	// the global color counter of the last compile (from before the first pending merge or removal)
+	std::vector< unsigned > pendingOldGlobalBuckets;
+	int pendingOldTotalNumSamples;
+
+	// has to be called before changing the global color counter after a compile
+	void rememberCompiledGlobalState();
+
+	// the mapped cache the arrays of the sampled models and the bucket index are views of (if one has been loaded)
+	// it is only closed after the views have been dropped (see clearAll)
+	std::unique_ptr< MappedFile > mappedFile;
+
 	SERIALIZER_FWD_FRIEND_EXTERN( ProbeContext::ProbeDatabase );
+	friend struct MappedStorage;
 };
 
 }
@@ -0,0 +1,439 @@
+#include "probeDatabaseMappedStorage.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+
+namespace ProbeContext {
+	namespace {
+		const char mappedCacheMagic[ 8 ] = { 'P', 'R', 'O', 'B', 'E', 'D', 'B', 'M' };
+		const unsigned MAPPED_CACHE_FORMAT_VERSION = 3;
+
+		// 4 KB pages are the common denominator (Windows only maps views at 64 KB boundaries, but the whole file is mapped at once)
+		const unsigned long long pageSize = 4096;
+		const unsigned long long cacheLineSize = 64;
+
+		struct Header {
+			char magic[ 8 ];
+			unsigned version;
+
+			// the arrays are stored as raw memory, so the layout has to match this build
+			unsigned sizeofDBProbeSample;
+			unsigned sizeofDBProbe;
+			unsigned numProbeSamples;
+			unsigned numDirections;
+			unsigned numOrientations;
+			unsigned numQuantizerBuckets;
+			unsigned numColorCounterBuckets;
+
+			unsigned long long fileSize;
+			unsigned long long directoryOffset;
+			unsigned long long numDirectoryEntries;
+			unsigned long long valuesOffset;
+			unsigned long long valuesSize;
+
+			void setLayout() {
+				memcpy( magic, mappedCacheMagic, sizeof( magic ) );
+				version = MAPPED_CACHE_FORMAT_VERSION;
+				sizeofDBProbeSample = sizeof( DBProbeSample );
+				sizeofDBProbe = sizeof( DBProbe );
+				numProbeSamples = OptixProgramInterface::numProbeSamples;
+				numDirections = ProbeGenerator::getNumDirections();
+				numOrientations = ProbeGenerator::getNumOrientations();
+				numQuantizerBuckets = SampleQuantizer::numBuckets;
+				numColorCounterBuckets = ColorCounter::numBuckets;
+			}
+
+			bool hasSameLayout( const Header &other ) const {
+				return
+						version == other.version
+					&&	sizeofDBProbeSample == other.sizeofDBProbeSample
+					&&	sizeofDBProbe == other.sizeofDBProbe
+					&&	numProbeSamples == other.numProbeSamples
+					&&	numDirections == other.numDirections
+					&&	numOrientations == other.numOrientations
+					&&	numQuantizerBuckets == other.numQuantizerBuckets
+					&&	numColorCounterBuckets == other.numColorCounterBuckets
+				;
+			}
+		};
+
+		struct DirectoryEntry {
+			unsigned long long offset;
+			unsigned long long numElements;
+		};
+
+		unsigned long long alignOffset( unsigned long long offset, unsigned long long alignment ) {
+			return (offset + alignment - 1) / alignment * alignment;
+		}
+
+		struct MappedWriter {
+			FILE *file;
+			unsigned long long offset;
+
+			std::vector< DirectoryEntry > directory;
+			std::vector< unsigned char > values;
+
+			MappedWriter( FILE *file )
+				: file( file )
+				, offset( 0 )
+			{
+			}
+
+			void writeBytes( const void *data, size_t size ) {
+				if( size && fwrite( data, 1, size, file ) != size ) {
+					throw std::runtime_error( "MappedWriter: write failed!" );
+				}
+				offset += size;
+			}
+
+			void pad( unsigned long long alignment ) {
+				static const unsigned char zeros[ pageSize ] = {};
+				writeBytes( zeros, size_t( alignOffset( offset, alignment ) - offset ) );
+			}
+
+			void beginSection() {
+				pad( pageSize );
+			}
+
+			template< typename T >
+			void rawArray( const T *data, size_t numElements ) {
+				pad( cacheLineSize );
+
+				const DirectoryEntry entry = { offset, numElements };
+				directory.push_back( entry );
+
+				writeBytes( data, numElements * sizeof( T ) );
+			}
+
+			template< typename T >
+			void array( const std::vector< T > &data ) {
+				rawArray( data.data(), data.size() );
+			}
+
+			template< typename T >
+			void array( const MappedArray< T > &data ) {
+				rawArray( data.data(), data.size() );
+			}
+
+			// a big POD (like a bit plane) that should stay aligned
+			template< typename T >
+			void object( const T &data ) {
+				rawArray( &data, 1 );
+			}
+
+			template< typename T >
+			void value( const T &data ) {
+				const unsigned char *bytes = (const unsigned char *) &data;
+				values.insert( values.end(), bytes, bytes + sizeof( T ) );
+			}
+
+			template< typename Container >
+			void size( const Container &container ) {
+				value( (unsigned long long) container.size() );
+			}
+
+			void string( const std::string &text ) {
+				size( text );
+				values.insert( values.end(), text.begin(), text.end() );
+			}
+		};
+
+		struct MappedReader {
+			const unsigned char *fileData;
+			unsigned long long fileSize;
+
+			const DirectoryEntry *directory;
+			unsigned long long numDirectoryEntries;
+			unsigned long long directoryIndex;
+
+			const unsigned char *values;
+			unsigned long long valuesSize;
+			unsigned long long valuesOffset;
+
+			static void check( bool condition ) {
+				if( !condition ) {
+					throw std::runtime_error( "MappedReader: corrupt file!" );
+				}
+			}
+
+			void beginSection() {
+			}
+
+			template< typename T >
+			const T *rawArray( unsigned long long &numElements ) {
+				check( directoryIndex < numDirectoryEntries );
+				const DirectoryEntry &entry = directory[ directoryIndex++ ];
+
+				check( entry.offset % cacheLineSize == 0 );
+				check( entry.offset <= fileSize && entry.numElements <= (fileSize - entry.offset) / sizeof( T ) );
+
+				numElements = entry.numElements;
+				return (const T *) (fileData + entry.offset);
+			}
+
+			template< typename T >
+			void array( std::vector< T > &data ) {
+				unsigned long long numElements;
+				const T *elements = rawArray< T >( numElements );
+				// a single bulk copy straight from the mapped pages
+				data.assign( elements, elements + numElements );
+			}
+
+			// no copy at all: the array refers to the mapped pages
+			template< typename T >
+			void array( MappedArray< T > &data ) {
+				unsigned long long numElements;
+				const T *elements = rawArray< T >( numElements );
+				data.setView( elements, (size_t) numElements );
+			}
+
+			template< typename T >
+			void object( T &data ) {
+				unsigned long long numElements;
+				const T *elements = rawArray< T >( numElements );
+				check( numElements == 1 );
+				memcpy( &data, elements, sizeof( T ) );
+			}
+
+			template< typename T >
+			void value( T &data ) {
+				check( valuesSize - valuesOffset >= sizeof( T ) );
+				memcpy( &data, values + valuesOffset, sizeof( T ) );
+				valuesOffset += sizeof( T );
+			}
+
+			// every element of a container uses at least one value byte or one array,
+			// so bigger sizes can only come from a corrupt file (and mustn't be allocated)
+			template< typename Container >
+			void size( Container &container ) {
+				unsigned long long numElements;
+				value( numElements );
+				check( numElements <= (valuesSize - valuesOffset) + (numDirectoryEntries - directoryIndex) );
+				container.resize( (size_t) numElements );
+			}
+
+			void string( std::string &text ) {
+				unsigned long long length;
+				value( length );
+				check( length <= valuesSize - valuesOffset );
+				text.assign( (const char *) values + valuesOffset, (size_t) length );
+				valuesOffset += length;
+			}
+		};
+	}
+
+	template< typename Archive, typename Counter >
+	void MappedStorage::visitColorCounter( Archive &archive, Counter &colorCounter ) {
+		archive.array( colorCounter.buckets );
+		archive.value( colorCounter.totalNumSamples );
+		archive.value( colorCounter.entropy );
+		archive.value( colorCounter.totalMessageLength );
+		archive.value( colorCounter.globalMessageLength );
+	}
+
+	template< typename Archive, typename Samples >
+	void MappedStorage::visitIndexedProbeSamples( Archive &archive, Samples &indexedProbeSamples ) {
+		archive.array( indexedProbeSamples.distances );
+		archive.array( indexedProbeSamples.colorL );
+		archive.array( indexedProbeSamples.colorA );
+		archive.array( indexedProbeSamples.colorB );
+		archive.array( indexedProbeSamples.occlusions );
+		archive.array( indexedProbeSamples.probeIndices );
+		archive.array( indexedProbeSamples.weights );
+
+		archive.array( indexedProbeSamples.occlusionLowerBounds );
+	}
+
+	template< typename Archive, typename Model >
+	void MappedStorage::visitSampledModel( Archive &archive, Model &sampledModel ) {
+		archive.beginSection();
+
+		archive.size( sampledModel.instances );
+		for( auto instance = sampledModel.instances.begin() ; instance != sampledModel.instances.end() ; ++instance ) {
+			archive.value( instance->sourceTransformation );
+			archive.value( instance->probeSamples.maxDistance );
+			archive.array( instance->probeSamples.samples );
+		}
+		archive.array( sampledModel.uncompiledProbeSamples );
+
+		visitIndexedProbeSamples( archive, sampledModel.mergedInstances );
+		archive.size( sampledModel.mergedInstancesByDirectionIndex );
+		for( auto samples = sampledModel.mergedInstancesByDirectionIndex.begin() ; samples != sampledModel.mergedInstancesByDirectionIndex.end() ; ++samples ) {
+			visitIndexedProbeSamples( archive, *samples );
+		}
+
+		archive.array( sampledModel.probes );
+		archive.size( sampledModel.rotatedProbePositions );
+		for( auto probePositions = sampledModel.rotatedProbePositions.begin() ; probePositions != sampledModel.rotatedProbePositions.end() ; ++probePositions ) {
+			archive.array( *probePositions );
+		}
+		archive.value( sampledModel.resolution );
+		archive.value( sampledModel.dirty );
+
+		visitColorCounter( archive, sampledModel.modelColorCounter );
+
+		archive.object( sampledModel.sampleBitPlane );
+		archive.array( sampledModel.sampleBucketHistogram.rankOffsets );
+		archive.array( sampledModel.sampleBucketHistogram.counts );
+		archive.value( sampledModel.linearizedProbeSamples.numProbes );
+		archive.array( sampledModel.linearizedProbeSamples.samples );
+
+		archive.size( sampledModel.sampleProbeIndexMapByDirection );
+		for( auto pair = sampledModel.sampleProbeIndexMapByDirection.begin() ; pair != sampledModel.sampleProbeIndexMapByDirection.end() ; ++pair ) {
+			archive.object( pair->first );
+			archive.array( pair->second.sampleMultiMap.items );
+			archive.array( pair->second.sampleMultiMap.bucketOffsets );
+		}
+	}
+
+	template< typename Archive, typename Database >
+	void MappedStorage::visitProbeDatabase( Archive &archive, Database &probeDatabase ) {
+		archive.size( probeDatabase.localModelNames );
+		for( auto localModelName = probeDatabase.localModelNames.begin() ; localModelName != probeDatabase.localModelNames.end() ; ++localModelName ) {
+			archive.string( *localModelName );
+		}
+
+		archive.value( probeDatabase.sampleQuantizer.maxDistance );
+		visitColorCounter( archive, probeDatabase.globalColorCounter );
+
+		archive.size( probeDatabase.sampledModels );
+		for( auto sampledModel = probeDatabase.sampledModels.begin() ; sampledModel != probeDatabase.sampledModels.end() ; ++sampledModel ) {
+			visitSampledModel( archive, *sampledModel );
+		}
+
+		archive.beginSection();
+		archive.array( probeDatabase.sampleBucketIndex.bucketOffsets );
+		archive.array( probeDatabase.sampleBucketIndex.postings );
+		archive.value( probeDatabase.sampleBucketIndex.numSampledModels );
+	}
+
+	bool MappedStorage::isMappedCache( const MappedFile &file ) {
+		return file.getSize() >= sizeof( Header ) && memcmp( file.getData(), mappedCacheMagic, sizeof( mappedCacheMagic ) ) == 0;
+	}
+
+	bool MappedStorage::read( const MappedFile &file, ProbeDatabase &probeDatabase ) {
+		AUTO_TIMER_FUNCTION();
+
+		if( !isMappedCache( file ) ) {
+			return false;
+		}
+
+		Header header;
+		memcpy( &header, file.getData(), sizeof( Header ) );
+
+		Header expectedLayout;
+		expectedLayout.setLayout();
+		if( !header.hasSameLayout( expectedLayout ) ) {
+			logError( "the mapped probe database cache was created by an incompatible build!" );
+			return false;
+		}
+
+		const unsigned long long fileSize = file.getSize();
+		if(
+				header.fileSize != fileSize
+			||	header.directoryOffset % sizeof( DirectoryEntry ) != 0
+			||	header.directoryOffset > fileSize
+			||	header.numDirectoryEntries > (fileSize - header.directoryOffset) / sizeof( DirectoryEntry )
+			||	header.valuesOffset > fileSize
+			||	header.valuesSize > fileSize - header.valuesOffset
+		) {
+			logError( "the mapped probe database cache is truncated or corrupt!" );
+			return false;
+		}
+
+		MappedReader reader;
+		reader.fileData = file.getData();
+		reader.fileSize = fileSize;
+		reader.directory = (const DirectoryEntry *) (file.getData() + header.directoryOffset);
+		reader.numDirectoryEntries = header.numDirectoryEntries;
+		reader.directoryIndex = 0;
+		reader.values = file.getData() + header.valuesOffset;
+		reader.valuesSize = header.valuesSize;
+		reader.valuesOffset = 0;
+
+		try {
+			visitProbeDatabase( reader, probeDatabase );
+		}
+		catch( const std::runtime_error &error ) {
+			logError( error.what() );
+			probeDatabase.clearAll();
+			return false;
+		}
+
+		// the fast queries use the bucket index without any checks, so it is validated once here
+		if( !probeDatabase.sampleBucketIndex.isConsistent( (int) probeDatabase.sampledModels.size() ) ) {
+			logError( "the bucket index of the mapped probe database cache is corrupt, rebuilding it!" );
+			probeDatabase.sampleBucketIndex.build( probeDatabase.sampledModels );
+		}
+
+		return true;
+	}
+
+	void MappedStorage::write( const std::string &filename, const ProbeDatabase &probeDatabase ) {
+		AUTO_TIMER_FUNCTION();
+
+		// the old file may still be mapped by a loaded database, so it must not be overwritten in place:
+		// the new file is written next to it and replaces it afterwards
+		const std::string newFilename = filename + ".new";
+
+		FILE *file = fopen( newFilename.c_str(), "wb" );
+		if( !file ) {
+			logError( boost::format( "could not open '%s' for writing!" ) % newFilename );
+			return;
+		}
+
+		try {
+			MappedWriter writer( file );
+
+			// reserve space for the header
+			Header header = {};
+			writer.writeBytes( &header, sizeof( Header ) );
+
+			visitProbeDatabase( writer, probeDatabase );
+
+			writer.pad( sizeof( DirectoryEntry ) );
+			header.directoryOffset = writer.offset;
+			header.numDirectoryEntries = writer.directory.size();
+			writer.writeBytes( writer.directory.data(), writer.directory.size() * sizeof( DirectoryEntry ) );
+
+			header.valuesOffset = writer.offset;
+			header.valuesSize = writer.values.size();
+			writer.writeBytes( writer.values.data(), writer.values.size() );
+
+			header.fileSize = writer.offset;
+			header.setLayout();
+
+			if( fseek( file, 0, SEEK_SET ) != 0 ) {
+				throw std::runtime_error( "MappedWriter: seek failed!" );
+			}
+			writer.writeBytes( &header, sizeof( Header ) );
+		}
+		catch( const std::runtime_error &error ) {
+			logError( boost::format( "'%s': %s" ) % newFilename % error.what() );
+			fclose( file );
+			remove( newFilename.c_str() );
+			return;
+		}
+
+		// fclose flushes the buffered data, so it can fail, too
+		if( fclose( file ) != 0 ) {
+			logError( boost::format( "'%s': MappedWriter: write failed!" ) % newFilename );
+			remove( newFilename.c_str() );
+			return;
+		}
+
+		// rename doesn't replace existing files on Windows
+		// a mapped file can't be removed there either, but it can be moved away (MappedFile shares it for deletion)
+		if( rename( newFilename.c_str(), filename.c_str() ) != 0 ) {
+			const std::string oldFilename = filename + ".old";
+			remove( oldFilename.c_str() );
+			if( rename( filename.c_str(), oldFilename.c_str() ) != 0 || rename( newFilename.c_str(), filename.c_str() ) != 0 ) {
+				logError( boost::format( "could not replace '%s' with '%s'!" ) % filename % newFilename );
+				return;
+			}
+			// fails while the old file is still mapped (it is removed by the next store then)
+			remove( oldFilename.c_str() );
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "probeDatabase.h"
+#include "mappedFile.h"
+
+namespace ProbeContext {
+	// binary image of a compiled ProbeDatabase that is loaded from a memory mapping
+	// the query arrays (MappedArrays) become views of the mapped pages, so loading them doesn't copy anything
+	// (the database has to keep the file open, see ProbeDatabase::load)
+	// the remaining arrays are copied out of the mapping with one bulk copy each
+	//
+	// layout:
+	//	Header
+	//	all arrays (every sampled model starts on a new page, every array on a new cache line)
+	//	directory: offset and element count of every array
+	//	values: all scalars and strings
+	//
+	// arrays and values are visited in the same order when writing and reading, so the file needs no field names
+	// everything that compileAll builds is stored, too, so loading doesn't need to rebuild anything
+	struct MappedStorage {
+		// checks the magic bytes
+		static bool isMappedCache( const MappedFile &file );
+
+		// returns false if the layout of the file doesn't match this build or the file is corrupt
+		// the file has to stay open as long as probeDatabase uses views of it
+		static bool read( const MappedFile &file, ProbeDatabase &probeDatabase );
+		static void write( const std::string &filename, const ProbeDatabase &probeDatabase );
+
+	private:
+		template< typename Archive, typename Database >
+		static void visitProbeDatabase( Archive &archive, Database &probeDatabase );
+
+		template< typename Archive, typename Model >
+		static void visitSampledModel( Archive &archive, Model &sampledModel );
+
+		template< typename Archive, typename Samples >
+		static void visitIndexedProbeSamples( Archive &archive, Samples &indexedProbeSamples );
+
+		template< typename Archive, typename Counter >
+		static void visitColorCounter( Archive &archive, Counter &colorCounter );
+	};
+}
@@ -1,9 +1,253 @@
 #pragma once
 
 #include "probeDatabase.h"
-#include "boost\range\algorithm\max_element.hpp"
+#include "boost/range/algorithm/max_element.hpp"
+#include <algorithm>
+
+#include <cfloat>
+#include <memory>
+#include <mutex>
 
 namespace ProbeContext {
+// helpers for the top-k execution mode of the queries
+namespace TopKSearch {
+	template< typename DetailedQueryResult >
+	void insertResult( std::vector< DetailedQueryResult > &topKResults, int k, DetailedQueryResult &&result ) {
+		const auto position = std::upper_bound( topKResults.begin(), topKResults.end(), result, QueryResult::greaterByScoreAndModelIndex );
+		topKResults.insert( position, std::move( result ) );
+		if( (int) topKResults.size() > k ) {
+			topKResults.pop_back();
+		}
+	}
+
+	// visits the models in order of decreasing score upper bounds and stops once no remaining model can beat the k-th best score
+	// the results are sorted by greaterByScoreAndModelIndex and are exactly the first k results of an exhaustive search
+	template< typename DetailedQueryResult, typename MatchAgainst, typename IsMatch >
+	void executeWithUpperBounds(
+		int k,
+		const std::vector< float > &upperBounds,
+		MatchAgainst &&matchAgainst,
+		IsMatch &&isMatch,
+		std::vector< DetailedQueryResult > &topKResults
+	) {
+		const int numModels = (int) upperBounds.size();
+
+		std::vector< int > localModelIndices( boost::counting_iterator<int>( 0 ), boost::counting_iterator<int>( numModels ) );
+		boost::sort( localModelIndices, [&] ( int a, int b ) { return upperBounds[ a ] > upperBounds[ b ]; } );
+
+		topKResults.clear();
+		topKResults.reserve( k + 1 );
+
+		int numVisitedModels = 0;
+		for( auto localModelIndex = localModelIndices.begin() ; localModelIndex != localModelIndices.end() ; ++localModelIndex ) {
+			const float upperBound = upperBounds[ *localModelIndex ];
+			// no samples can be matched at all
+			if( upperBound <= 0.0f ) {
+				break;
+			}
+			// ties could still be won by the scene model index, so only stop if the bound is strictly worse
+			if( (int) topKResults.size() == k && upperBound < topKResults.back().score ) {
+				break;
+			}
+
+			DetailedQueryResult result = matchAgainst( *localModelIndex );
+			numVisitedModels++;
+
+			if( isMatch( result ) ) {
+				insertResult( topKResults, k, std::move( result ) );
+			}
+		}
+
+		log( boost::format( "top %i: visited %i of %i models" ) % k % numVisitedModels % numModels );
+	}
+
+	// keeps the k best results of an exhaustive search
+	template< typename DetailedQueryResult >
+	void selectTopK( std::vector< DetailedQueryResult > &detailedQueryResults, int k ) {
+		const int numResults = std::min<int>( k, detailedQueryResults.size() );
+		std::partial_sort( detailedQueryResults.begin(), detailedQueryResults.begin() + numResults, detailedQueryResults.end(), QueryResult::greaterByScoreAndModelIndex );
+		detailedQueryResults.resize( numResults );
+	}
+}
+
+// scheduling for the full queries
+// every (model, orientation) pair is split into tasks over ranges of directions, and all tasks of all models are
+// executed by one parallel_for, so the workers stay busy no matter how many and how big the models are
+namespace FullQueryScheduling {
+	// the cells of the query volume a task adds its matches to
+	// it keeps track of the range of cells it has touched, so merging and clearing it don't have to visit the whole grid
+	template< typename Value >
+	struct AccumulationGrid {
+		std::vector< Value > values;
+		// all cells outside of [beginTouched, endTouched) are zero
+		int beginTouched, endTouched;
+
+		explicit AccumulationGrid( int size )
+			: values( size )
+			, beginTouched( size )
+			, endTouched( 0 )
+		{
+		}
+
+		void add( int cellIndex, Value value ) {
+			values[ cellIndex ] += value;
+			beginTouched = std::min( beginTouched, cellIndex );
+			endTouched = std::max( endTouched, cellIndex + 1 );
+		}
+
+		void add( const AccumulationGrid &other ) {
+			for( int cellIndex = other.beginTouched ; cellIndex < other.endTouched ; cellIndex++ ) {
+				values[ cellIndex ] += other.values[ cellIndex ];
+			}
+			beginTouched = std::min( beginTouched, other.beginTouched );
+			endTouched = std::max( endTouched, other.endTouched );
+		}
+
+		void clear() {
+			if( beginTouched < endTouched ) {
+				std::fill( values.begin() + beginTouched, values.begin() + endTouched, Value() );
+			}
+			beginTouched = (int) values.size();
+			endTouched = 0;
+		}
+	};
+
+	// recycles the accumulation grids between tasks, so we only allocate about one grid per worker
+	template< typename Value >
+	struct AccumulationGridPool {
+		typedef AccumulationGrid< Value > Grid;
+
+		AccumulationGridPool( int gridSize ) : gridSize( gridSize ) {}
+
+		// returns a zeroed grid
+		std::unique_ptr< Grid > acquire() {
+			{
+				std::lock_guard< std::mutex > lock( mutex );
+				if( !freeGrids.empty() ) {
+					std::unique_ptr< Grid > grid = std::move( freeGrids.back() );
+					freeGrids.pop_back();
+					return grid;
+				}
+			}
+			return std::unique_ptr< Grid >( new Grid( gridSize ) );
+		}
+
+		void release( std::unique_ptr< Grid > &&grid ) {
+			grid->clear();
+
+			std::lock_guard< std::mutex > lock( mutex );
+			freeGrids.push_back( std::move( grid ) );
+		}
+
+	private:
+		int gridSize;
+
+		std::mutex mutex;
+		std::vector< std::unique_ptr< Grid > > freeGrids;
+	};
+
+	struct Task {
+		int localModelIndex;
+		int orientationIndex;
+		// [beginDirectionIndex, endDirectionIndex)
+		int beginDirectionIndex, endDirectionIndex;
+	};
+
+	// big models are split into more tasks than small ones
+	inline int getNumDirectionRanges( int numModelProbeSamples, int probeSamplesPerTask ) {
+		return clamp( numModelProbeSamples / std::max( probeSamplesPerTask, 1 ), 1, ProbeGenerator::getNumDirections() );
+	}
+
+	// the grid of a (model, orientation) pair
+	// the first finished task hands over its grid and the others add theirs to it
+	template< typename Value >
+	struct OrientationSlot {
+		std::mutex mutex;
+		std::unique_ptr< AccumulationGrid< Value > > grid;
+		int numPendingTasks;
+
+		OrientationSlot() : numPendingTasks() {}
+	};
+
+	// calls accumulateMatches( task, accumulationGrid ) for every task and onOrientationMatched( localModelIndex, orientationIndex, gridValues ) once
+	// for every (model, orientation) pair after all of its tasks have been accumulated
+	template< typename Value, typename AccumulateMatches, typename OnOrientationMatched >
+	void execute(
+		const std::vector< int > &numDirectionRangesByModel,
+		int gridSize,
+		AccumulateMatches &&accumulateMatches,
+		OnOrientationMatched &&onOrientationMatched
+	) {
+		const int numModels = (int) numDirectionRangesByModel.size();
+		const int numOrientations = ProbeGenerator::getNumOrientations();
+		const int numDirections = ProbeGenerator::getNumDirections();
+
+		std::vector< Task > tasks;
+		std::vector< OrientationSlot< Value > > orientationSlots( numModels * numOrientations );
+		for( int localModelIndex = 0 ; localModelIndex < numModels ; localModelIndex++ ) {
+			const int numDirectionRanges = numDirectionRangesByModel[ localModelIndex ];
+
+			for( int orientationIndex = 0 ; orientationIndex < numOrientations ; orientationIndex++ ) {
+				orientationSlots[ localModelIndex * numOrientations + orientationIndex ].numPendingTasks = numDirectionRanges;
+
+				for( int directionRangeIndex = 0 ; directionRangeIndex < numDirectionRanges ; directionRangeIndex++ ) {
+					const Task task = {
+						localModelIndex,
+						orientationIndex,
+						directionRangeIndex * numDirections / numDirectionRanges,
+						(directionRangeIndex + 1) * numDirections / numDirectionRanges
+					};
+					tasks.push_back( task );
+				}
+			}
+		}
+
+		AccumulationGridPool< Value > gridPool( gridSize );
+
+		int logScope = Log::getScope();
+
+		TaskRuntime::parallel_for(
+			0,
+			(int) tasks.size(),
+			1,
+			[&] ( int taskIndex ) {
+				Log::initThreadScope( logScope, 0 );
+
+				const Task &task = tasks[ taskIndex ];
+
+				std::unique_ptr< AccumulationGrid< Value > > grid = gridPool.acquire();
+				accumulateMatches( task, *grid );
+
+				auto &orientationSlot = orientationSlots[ task.localModelIndex * numOrientations + task.orientationIndex ];
+				std::unique_ptr< AccumulationGrid< Value > > orientationGrid;
+				{
+					std::lock_guard< std::mutex > lock( orientationSlot.mutex );
+
+					if( !orientationSlot.grid ) {
+						orientationSlot.grid = std::move( grid );
+					}
+					else {
+						orientationSlot.grid->add( *grid );
+					}
+
+					if( --orientationSlot.numPendingTasks == 0 ) {
+						orientationGrid = std::move( orientationSlot.grid );
+					}
+				}
+
+				if( grid ) {
+					gridPool.release( std::move( grid ) );
+				}
+
+				if( orientationGrid ) {
+					onOrientationMatched( task.localModelIndex, task.orientationIndex, orientationGrid->values );
+					gridPool.release( std::move( orientationGrid ) );
+				}
+			}
+		);
+	}
+}
+
 #if 1
 struct ProbeDatabase::FastQuery {
 	struct DetailedQueryResult : QueryResult {
@@ -39,6 +283,8 @@ struct ProbeDatabase::FastQuery {
 	void setQueryDataset( const RawProbeSamples &rawProbeSamples ) {
 		SampleBitPlaneHelper::splatProbeSamples( queryBitPlane, database.sampleQuantizer, rawProbeSamples );
 		queryLinearizedProbeSamples.push_back( database.sampleQuantizer, rawProbeSamples );
+
+		buildQueryBucketHistogram();
 	}
 
 	void execute() {
@@ -48,23 +294,38 @@ struct ProbeDatabase::FastQuery {
 
 		detailedQueryResults.resize( database.sampledModels.size() );
 
-		using namespace Concurrency;
+		if( database.sampleBucketIndex.isValid( (int) database.sampledModels.size() ) ) {
+			matchAgainstBucketIndex();
+		}
+		else {
+			AUTO_TIMER_MEASURE() {
+				int logScope = Log::getScope();
+
+				TaskRuntime::parallel_for(
+					0,
+					(int) database.sampledModels.size(),
+					1,
+					[&] ( int localModelIndex ) {
+						Log::initThreadScope( logScope, 0 );
+
+						detailedQueryResults[ localModelIndex ] = matchAgainst( localModelIndex, database.modelIndexMapper.getSceneModelIndex( localModelIndex ) );
+					}
+				);
+			}
+		}
 
-		AUTO_TIMER_MEASURE() {
-			int logScope = Log::getScope();
+		boost::remove_erase_if( detailedQueryResults, [] ( const DetailedQueryResult &r ) { return r.score == 0.0f; });
 
-			parallel_for< int >(
-				0,
-				(int) database.sampledModels.size(),
-				[&] ( int localModelIndex ) {
-					Log::initThreadScope( logScope, 0 );
+		queryResults.resize( detailedQueryResults.size() );
+		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
+	}
 
-					detailedQueryResults[ localModelIndex ] = matchAgainst( localModelIndex, database.modelIndexMapper.getSceneModelIndex( localModelIndex ) );
-				}
-			);
-		}
+	// only keeps the k best results (sorted by score)
+	// the bucket index already makes the full execution proportional to the query size, so there is nothing to skip
+	void executeTopK( int k ) {
+		execute();
 
-		boost::remove_erase_if( detailedQueryResults, [] ( const DetailedQueryResult &r ) { return r.score == 0.0f; });
+		TopKSearch::selectTopK( detailedQueryResults, k );
 
 		queryResults.resize( detailedQueryResults.size() );
 		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
@@ -82,6 +343,7 @@ protected:
 	const ProbeDatabase &database;
 
 	SampleBitPlane queryBitPlane;
+	SampleBucketHistogram queryBucketHistogram;
 	LinearizedProbeSamples queryLinearizedProbeSamples;
 
 	ProbeContextTolerance probeContextTolerance;
@@ -92,6 +354,12 @@ protected:
 	Eigen::Affine3f queryVolumeTransformation;
 
 protected:
+	void buildQueryBucketHistogram() {
+		std::vector<SampleQuantizer::PackedSample> sortedQuerySamples( queryLinearizedProbeSamples.samples.begin(), queryLinearizedProbeSamples.samples.end() );
+		boost::sort( sortedQuerySamples );
+		queryBucketHistogram.build( queryBitPlane, sortedQuerySamples );
+	}
+
 	DetailedQueryResult matchAgainst( int localSceneIndex, int sceneModelIndex ) {
 		const auto &sampledModel = database.sampledModels[ localSceneIndex ];
 
@@ -109,24 +377,62 @@ protected:
 			% queryVolume_numProbeSamples
 		);
 
-		// loop through the query linearized array and look up everything in the sampled model bit plane
-		// and vice versa
+		// intersect the query bit plane with the sampled model bit plane:
+		// every sample in a shared bucket is matched, so we only need to sum up the bucket counts on both sides
+		// (instead of looking up every single sample in the other bit plane)
 
 		int sampledModel_numMatchedProbeSamples = 0;
-		for( auto modelPackedSample = sampledModel.linearizedProbeSamples.samples.begin() ; modelPackedSample != sampledModel.linearizedProbeSamples.samples.end() ; ++modelPackedSample ) {
-			// look up
-			if( queryBitPlane.test( *modelPackedSample ) ) {
-				sampledModel_numMatchedProbeSamples++;
+		int queryVolume_numMatchedProbeSamples = 0;
+		SampleBitPlaneHelper::visitSharedBuckets( queryBitPlane, sampledModel.sampleBitPlane,
+			[&] ( SampleQuantizer::PackedSample packedSample, int wordIndex, int bitIndex ) {
+				sampledModel_numMatchedProbeSamples += sampledModel.sampleBucketHistogram.getCount( sampledModel.sampleBitPlane, wordIndex, bitIndex );
+				queryVolume_numMatchedProbeSamples += queryBucketHistogram.getCount( queryBitPlane, wordIndex, bitIndex );
 			}
+		);
+
+		return createDetailedQueryResult( sceneModelIndex, sampledModel, sampledModel_numMatchedProbeSamples, queryVolume_numMatchedProbeSamples );
+	}
+
+	// one pass over the query buckets that only visits the postings of these buckets
+	void matchAgainstBucketIndex() {
+		const int numSampledModels = (int) database.sampledModels.size();
+
+		std::vector< int > sampledModel_numMatchedProbeSamples( numSampledModels );
+		std::vector< int > queryVolume_numMatchedProbeSamples( numSampledModels );
+
+		AUTO_TIMER_MEASURE( boost::format( "%i query probes" ) % queryLinearizedProbeSamples.samples.size() ) {
+			SampleBitPlaneHelper::visitBuckets( queryBitPlane,
+				[&] ( SampleQuantizer::PackedSample packedSample, int wordIndex, int bitIndex ) {
+					const unsigned queryCount = queryBucketHistogram.getCount( queryBitPlane, wordIndex, bitIndex );
+
+					database.sampleBucketIndex.visitPostings( packedSample,
+						[&] ( int localModelIndex, unsigned modelCount ) {
+							sampledModel_numMatchedProbeSamples[ localModelIndex ] += modelCount;
+							queryVolume_numMatchedProbeSamples[ localModelIndex ] += queryCount;
+						}
+					);
+				}
+			);
 		}
 
-		int queryVolume_numMatchedProbeSamples = 0;
-		for( auto queryPackedSample = queryLinearizedProbeSamples.samples.begin() ; queryPackedSample != queryLinearizedProbeSamples.samples.end() ; ++queryPackedSample ) {
-			// look up
-			if( sampledModel.sampleBitPlane.test( *queryPackedSample ) ) {
-				queryVolume_numMatchedProbeSamples++;
+		for( int localModelIndex = 0 ; localModelIndex < numSampledModels ; localModelIndex++ ) {
+			const int sceneModelIndex = database.modelIndexMapper.getSceneModelIndex( localModelIndex );
+			if( sampledModel_numMatchedProbeSamples[ localModelIndex ] == 0 ) {
+				detailedQueryResults[ localModelIndex ] = DetailedQueryResult( sceneModelIndex );
+				continue;
 			}
+
+			detailedQueryResults[ localModelIndex ] = createDetailedQueryResult(
+				sceneModelIndex,
+				database.sampledModels[ localModelIndex ],
+				sampledModel_numMatchedProbeSamples[ localModelIndex ],
+				queryVolume_numMatchedProbeSamples[ localModelIndex ]
+			);
 		}
+	}
+
+	DetailedQueryResult createDetailedQueryResult( int sceneModelIndex, const SampledModel &sampledModel, int sampledModel_numMatchedProbeSamples, int queryVolume_numMatchedProbeSamples ) const {
+		const int queryVolume_numProbeSamples = queryLinearizedProbeSamples.samples.size();
 
 		DetailedQueryResult detailedQueryResult( sceneModelIndex );
 
@@ -179,6 +485,8 @@ struct ProbeDatabase::FastImportanceQuery {
 
 		SampleBitPlaneHelper::splatProbeSamples( queryBitPlane, database.sampleQuantizer, rawProbeSamples );
 		queryLinearizedProbeSamples.push_back( database.sampleQuantizer, rawProbeSamples );
+
+		buildQueryBucketHistogram();
 	}
 
 	void execute() {
@@ -188,23 +496,38 @@ struct ProbeDatabase::FastImportanceQuery {
 
 		detailedQueryResults.resize( database.sampledModels.size() );
 
-		using namespace Concurrency;
+		if( database.sampleBucketIndex.isValid( (int) database.sampledModels.size() ) ) {
+			matchAgainstBucketIndex();
+		}
+		else {
+			AUTO_TIMER_MEASURE() {
+				int logScope = Log::getScope();
+
+				TaskRuntime::parallel_for(
+					0,
+					(int) database.sampledModels.size(),
+					1,
+					[&] ( int localModelIndex ) {
+						Log::initThreadScope( logScope, 0 );
+
+						detailedQueryResults[ localModelIndex ] = matchAgainst( localModelIndex, database.modelIndexMapper.getSceneModelIndex( localModelIndex ) );
+					}
+				);
+			}
+		}
 
-		AUTO_TIMER_MEASURE() {
-			int logScope = Log::getScope();
+		boost::remove_erase_if( detailedQueryResults, [] ( const DetailedQueryResult &r ) { return r.score == 0.0f; });
 
-			parallel_for< int >(
-				0,
-				(int) database.sampledModels.size(),
-				[&] ( int localModelIndex ) {
-					Log::initThreadScope( logScope, 0 );
+		queryResults.resize( detailedQueryResults.size() );
+		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
+	}
 
-					detailedQueryResults[ localModelIndex ] = matchAgainst( localModelIndex, database.modelIndexMapper.getSceneModelIndex( localModelIndex ) );
-				}
-			);
-		}
+	// only keeps the k best results (sorted by score)
+	// the bucket index already makes the full execution proportional to the query size, so there is nothing to skip
+	void executeTopK( int k ) {
+		execute();
 
-		boost::remove_erase_if( detailedQueryResults, [] ( const DetailedQueryResult &r ) { return r.score == 0.0f; });
+		TopKSearch::selectTopK( detailedQueryResults, k );
 
 		queryResults.resize( detailedQueryResults.size() );
 		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
@@ -224,6 +547,7 @@ protected:
 	ColorCounter queryColorCounter;
 
 	SampleBitPlane queryBitPlane;
+	SampleBucketHistogram queryBucketHistogram;
 	LinearizedProbeSamples queryLinearizedProbeSamples;
 
 	ProbeContextTolerance probeContextTolerance;
@@ -234,6 +558,12 @@ protected:
 	Eigen::Affine3f queryVolumeTransformation;
 
 protected:
+	void buildQueryBucketHistogram() {
+		std::vector<SampleQuantizer::PackedSample> sortedQuerySamples( queryLinearizedProbeSamples.samples.begin(), queryLinearizedProbeSamples.samples.end() );
+		boost::sort( sortedQuerySamples );
+		queryBucketHistogram.build( queryBitPlane, sortedQuerySamples );
+	}
+
 	DetailedQueryResult matchAgainst( int localSceneIndex, int sceneModelIndex ) {
 		const auto &sampledModel = database.sampledModels[ localSceneIndex ];
 
@@ -251,35 +581,70 @@ protected:
 			% queryVolume_numProbeSamples
 		);
 
-		// loop through the query linearized array and look up everything in the sampled model bit plane
-		// and vice versa
+		// intersect the query bit plane with the sampled model bit plane:
+		// all samples in a shared bucket have the same importance weight, so we weight the bucket counts on both sides
 
 		float sampledModel_importanceScore = 0.0f;
-		for( auto modelPackedSample = sampledModel.linearizedProbeSamples.samples.begin() ; modelPackedSample != sampledModel.linearizedProbeSamples.samples.end() ; ++modelPackedSample ) {
-			// look up
-			if( queryBitPlane.test( *modelPackedSample ) ) {
-				const float importanceWeight =
-						database.globalColorCounter.getMessageLength( *modelPackedSample )
-					/*+
-						sampledModel.getColorCounter().getMessageLength( probeSample )*/
-				;
-				sampledModel_importanceScore += importanceWeight;
+		float queryVolume_importanceScore = 0.0f;
+		SampleBitPlaneHelper::visitSharedBuckets( queryBitPlane, sampledModel.sampleBitPlane,
+			[&] ( SampleQuantizer::PackedSample packedSample, int wordIndex, int bitIndex ) {
+				const float importanceWeight = getImportanceWeight( packedSample );
+				sampledModel_importanceScore += importanceWeight * sampledModel.sampleBucketHistogram.getCount( sampledModel.sampleBitPlane, wordIndex, bitIndex );
+				queryVolume_importanceScore += importanceWeight * queryBucketHistogram.getCount( queryBitPlane, wordIndex, bitIndex );
 			}
+		);
+
+		return createDetailedQueryResult( sceneModelIndex, sampledModel, sampledModel_importanceScore, queryVolume_importanceScore );
+	}
+
+	// one pass over the query buckets that only visits the postings of these buckets
+	void matchAgainstBucketIndex() {
+		const int numSampledModels = (int) database.sampledModels.size();
+
+		std::vector< float > sampledModel_importanceScores( numSampledModels );
+		std::vector< float > queryVolume_importanceScores( numSampledModels );
+
+		AUTO_TIMER_MEASURE( boost::format( "%i query probes" ) % queryLinearizedProbeSamples.samples.size() ) {
+			SampleBitPlaneHelper::visitBuckets( queryBitPlane,
+				[&] ( SampleQuantizer::PackedSample packedSample, int wordIndex, int bitIndex ) {
+					const float importanceWeight = getImportanceWeight( packedSample );
+					const float queryImportance = importanceWeight * queryBucketHistogram.getCount( queryBitPlane, wordIndex, bitIndex );
+
+					database.sampleBucketIndex.visitPostings( packedSample,
+						[&] ( int localModelIndex, unsigned modelCount ) {
+							sampledModel_importanceScores[ localModelIndex ] += importanceWeight * modelCount;
+							queryVolume_importanceScores[ localModelIndex ] += queryImportance;
+						}
+					);
+				}
+			);
 		}
 
-		float queryVolume_importanceScore = 0.0f;
-		for( auto queryPackedSample = queryLinearizedProbeSamples.samples.begin() ; queryPackedSample != queryLinearizedProbeSamples.samples.end() ; ++queryPackedSample ) {
-			// look up
-			if( sampledModel.sampleBitPlane.test( *queryPackedSample ) ) {
-				const float importanceWeight =
-						database.globalColorCounter.getMessageLength( *queryPackedSample )
-					/*+
-						queryColorCounter.getMessageLength( probeSample )*/
-				;
-				queryVolume_importanceScore += importanceWeight;
+		for( int localModelIndex = 0 ; localModelIndex < numSampledModels ; localModelIndex++ ) {
+			const int sceneModelIndex = database.modelIndexMapper.getSceneModelIndex( localModelIndex );
+			if( sampledModel_importanceScores[ localModelIndex ] == 0.0f ) {
+				detailedQueryResults[ localModelIndex ] = DetailedQueryResult( sceneModelIndex );
+				continue;
 			}
+
+			detailedQueryResults[ localModelIndex ] = createDetailedQueryResult(
+				sceneModelIndex,
+				database.sampledModels[ localModelIndex ],
+				sampledModel_importanceScores[ localModelIndex ],
+				queryVolume_importanceScores[ localModelIndex ]
+			);
 		}
+	}
+
+	float getImportanceWeight( SampleQuantizer::PackedSample packedSample ) const {
+		return
+				database.globalColorCounter.getMessageLength( packedSample )
+			/*+
+				sampledModel.getColorCounter().getMessageLength( probeSample )*/
+		;
+	}
 
+	DetailedQueryResult createDetailedQueryResult( int sceneModelIndex, const SampledModel &sampledModel, float sampledModel_importanceScore, float queryVolume_importanceScore ) const {
 		DetailedQueryResult detailedQueryResult( sceneModelIndex );
 
 		//const float avgTotalModelWeight = sampledModel.uncompressedProbeSampleCount() * database.globalColorCounter.entropy + sampledModel.getColorCounter().totalMessageLength;
@@ -354,16 +719,15 @@ struct ProbeDatabase::FastConfigurationQuery {
 
 		detailedQueryResults.resize( database.sampledModels.size() );
 
-		using namespace Concurrency;
-
 		log( boost::format( "executing fast conf query on %i models" ) % database.sampledModels.size() );
 
 		AUTO_TIMER_MEASURE() {
 			int logScope = Log::getScope();
 
-			parallel_for< int >(
+			TaskRuntime::parallel_for(
 				0,
 				(int) database.sampledModels.size(),
+				1,
 				[&] ( int localModelIndex ) {
 					Log::initThreadScope( logScope, 0 );
 
@@ -378,6 +742,17 @@ struct ProbeDatabase::FastConfigurationQuery {
 		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
 	}
 
+	// only keeps the k best results (sorted by score)
+	// the configuration scores depend on the probe positions, so there is no cheap upper bound to skip models with
+	void executeTopK( int k ) {
+		execute();
+
+		TopKSearch::selectTopK( detailedQueryResults, k );
+
+		queryResults.resize( detailedQueryResults.size() );
+		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
+	}
+
 	const QueryResults & getQueryResults() const {
 		return queryResults;
 	}
@@ -428,11 +803,11 @@ protected:
 
 			const int *rotatedDirections = ProbeGenerator::getRotatedDirections( orientationIndex );
 			for( int directionIndex = 0 ; directionIndex < ProbeGenerator::getNumDirections() ; directionIndex++ ) {
-				const auto model_probeIndexMap = sampledModel.sampleProbeIndexMapByDirection[ directionIndex ];
-				const auto model_rotatedProbePositions = sampledModel.getRotatedProbePositions( orientationIndex );
+				const auto &model_probeIndexMap = sampledModel.sampleProbeIndexMapByDirection[ directionIndex ];
+				const auto &model_rotatedProbePositions = sampledModel.getRotatedProbePositions( orientationIndex );
 
 				// we loop over all probes in the partial probe sample list for this direction
-				const auto queryPartialProbeSamples = queryPartialProbeSamplesByDirection[ rotatedDirections[ directionIndex ] ];
+				const auto &queryPartialProbeSamples = queryPartialProbeSamplesByDirection[ rotatedDirections[ directionIndex ] ];
 
 				for( int querySampleIndex = 0 ; querySampleIndex < queryPartialProbeSamples.getSize() ; querySampleIndex++ ) {
 					// look up in the model map
@@ -563,14 +938,13 @@ struct ProbeDatabase::Query {
 
 		detailedQueryResults.resize( database.sampledModels.size() );
 
-		using namespace Concurrency;
-
 		AUTO_TIMER_MEASURE() {
 			int logScope = Log::getScope();
 
-			parallel_for< int >(
+			TaskRuntime::parallel_for(
 				0,
 				(int) database.sampledModels.size(),
+				1,
 				[&] ( int localModelIndex ) {
 					Log::initThreadScope( logScope, 0 );
 
@@ -585,6 +959,36 @@ struct ProbeDatabase::Query {
 		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
 	}
 
+	// only determines the k best results (sorted by score)
+	// the models are matched in order of decreasing score upper bounds until no remaining model can beat the k-th best score
+	void executeTopK( int k ) {
+		if( !queryResults.empty() ) {
+			throw std::logic_error( "queryResults is not empty!" );
+		}
+
+		const int occlusionTolerance = probeContextTolerance.getOcclusionIntegerTolerance();
+
+		std::vector< float > upperBounds( database.sampledModels.size() );
+		for( int localModelIndex = 0 ; localModelIndex < upperBounds.size() ; localModelIndex++ ) {
+			upperBounds[ localModelIndex ] = calculateUpperBound( database.sampledModels[ localModelIndex ], occlusionTolerance );
+		}
+
+		AUTO_TIMER_MEASURE() {
+			TopKSearch::executeWithUpperBounds(
+				k,
+				upperBounds,
+				[&] ( int localModelIndex ) {
+					return matchAgainst( localModelIndex, database.modelIndexMapper.getSceneModelIndex( localModelIndex ) );
+				},
+				[] ( const DetailedQueryResult &r ) { return r.numMatches != 0; },
+				detailedQueryResults
+			);
+		}
+
+		queryResults.resize( detailedQueryResults.size() );
+		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
+	}
+
 	const QueryResults & getQueryResults() const {
 		return queryResults;
 	}
@@ -597,6 +1001,34 @@ protected:
 	typedef IndexedProbeSamples::IntRange IntRange;
 	typedef std::pair< IntRange, IntRange > OverlappedRange;
 
+	// only samples with matchable occlusion levels can be matched, and the score is monotonic in the matched samples
+	float calculateUpperBound( const SampledModel &sampledModel, int occlusionTolerance ) const {
+		const IndexedProbeSamples &sampledModelProbeSamples = sampledModel.getMergedInstances();
+
+		int numMatchableProbeSamplesSampledModel = 0;
+		sampledModelProbeSamples.visitSamplesMatchableByOcclusion( indexedProbeSamples, occlusionTolerance,
+			[&] ( const DBProbeSample &probeSample ) {
+				numMatchableProbeSamplesSampledModel += probeSample.weight;
+			}
+		);
+
+		int numMatchableProbeSamplesQueryVolume = 0;
+		indexedProbeSamples.visitSamplesMatchableByOcclusion( sampledModelProbeSamples, occlusionTolerance,
+			[&] ( const DBProbeSample &probeSample ) {
+				numMatchableProbeSamplesQueryVolume++;
+			}
+		);
+
+		if( numMatchableProbeSamplesSampledModel == 0 || numMatchableProbeSamplesQueryVolume == 0 ) {
+			return 0.0f;
+		}
+
+		// same arithmetic as in matchAgainst
+		const float probeMatchPercentage = float( numMatchableProbeSamplesSampledModel ) / sampledModel.uncompressedProbeSampleCount();
+		const float queryMatchPercentage = float( numMatchableProbeSamplesQueryVolume ) / indexedProbeSamples.size();
+		return probeMatchPercentage * queryMatchPercentage;
+	}
+
 	DetailedQueryResult matchAgainst( int localSceneIndex, int sceneModelIndex ) {
 		const auto &sampledModel = database.sampledModels[ localSceneIndex ];
 
@@ -609,11 +1041,9 @@ protected:
 
 		AUTO_TIMER_FOR_FUNCTION( boost::format( "id = %i, %i ref probes (%i query probes)" ) % sceneModelIndex % sampledModelProbeSamples.size() % indexedProbeSamples.size() );
 
-		using namespace Concurrency;
-
 		struct MatchController {
-			combinable< int > numMatches;
-			combinable< boost::dynamic_bitset<> > probesMatchedQueryVolume, probesMatchedSampledModel;
+			TaskRuntime::Reducer< int > numMatches;
+			TaskRuntime::Reducer< boost::dynamic_bitset<> > probesMatchedQueryVolume, probesMatchedSampledModel;
 
 			int numProbeSamplesSampledModel;
 			int numProbeSamplesQueryVolume;
@@ -663,7 +1093,7 @@ protected:
 		int numProbeSamplesMatchedSampledModel = 0;
 		for( int i = 0 ; i < mergedProbeSamplesSampledModel.size() ; ++i ) {
 			if( mergedProbeSamplesSampledModel[ i ] ) {
-				numProbeSamplesMatchedSampledModel += sampledModelProbeSamples.getProbeSamples()[ i ].weight;
+				numProbeSamplesMatchedSampledModel += sampledModelProbeSamples.getWeight( i );
 			}
 		}
 
@@ -746,14 +1176,13 @@ struct ProbeDatabase::ImportanceQuery {
 
 		detailedQueryResults.resize( database.sampledModels.size() );
 
-		using namespace Concurrency;
-
 		AUTO_TIMER_MEASURE() {
 			int logScope = Log::getScope();
 
-			parallel_for< int >(
+			TaskRuntime::parallel_for(
 				0,
 				(int) database.sampledModels.size(),
+				1,
 				[&] ( int localModelIndex ) {
 					Log::initThreadScope( logScope, 0 );
 
@@ -768,6 +1197,36 @@ struct ProbeDatabase::ImportanceQuery {
 		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
 	}
 
+	// only determines the k best results (sorted by score)
+	// the models are matched in order of decreasing score upper bounds until no remaining model can beat the k-th best score
+	void executeTopK( int k ) {
+		if( !queryResults.empty() ) {
+			throw std::logic_error( "queryResults is not empty!" );
+		}
+
+		const int occlusionTolerance = probeContextTolerance.getOcclusionIntegerTolerance();
+
+		std::vector< float > upperBounds( database.sampledModels.size() );
+		for( int localModelIndex = 0 ; localModelIndex < upperBounds.size() ; localModelIndex++ ) {
+			upperBounds[ localModelIndex ] = calculateUpperBound( database.sampledModels[ localModelIndex ], occlusionTolerance );
+		}
+
+		AUTO_TIMER_MEASURE() {
+			TopKSearch::executeWithUpperBounds(
+				k,
+				upperBounds,
+				[&] ( int localModelIndex ) {
+					return matchAgainst( localModelIndex, database.modelIndexMapper.getSceneModelIndex( localModelIndex ) );
+				},
+				[] ( const DetailedQueryResult &r ) { return r.numMatches != 0; },
+				detailedQueryResults
+			);
+		}
+
+		queryResults.resize( detailedQueryResults.size() );
+		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
+	}
+
 	const QueryResults & getQueryResults() const {
 		return queryResults;
 	}
@@ -780,6 +1239,51 @@ protected:
 	typedef IndexedProbeSamples::IntRange IntRange;
 	typedef std::pair< IntRange, IntRange > OverlappedRange;
 
+	// only samples with matchable occlusion levels can be matched, and the score is monotonic in the matched samples
+	// matchAgainst sums the weighted samples in float, which can round the score above the exact value,
+	// so the bound is summed in double and widened by the worst-case relative error of the float sums
+	float calculateUpperBound( const SampledModel &sampledModel, int occlusionTolerance ) const {
+		const IndexedProbeSamples &sampledModelProbeSamples = sampledModel.getMergedInstances();
+
+		// same importance weights as in matchAgainst
+		double numMatchableProbeSamplesSampledModel = 0.0;
+		sampledModelProbeSamples.visitSamplesMatchableByOcclusion( indexedProbeSamples, occlusionTolerance,
+			[&] ( const DBProbeSample &probeSample ) {
+				const float importanceWeight =
+						database.globalColorCounter.getMessageLength( probeSample )
+					+
+						sampledModel.getColorCounter().getMessageLength( probeSample )
+				;
+				numMatchableProbeSamplesSampledModel += double( probeSample.weight ) * importanceWeight;
+			}
+		);
+
+		double numMatchableProbeSamplesQueryVolume = 0.0;
+		indexedProbeSamples.visitSamplesMatchableByOcclusion( sampledModelProbeSamples, occlusionTolerance,
+			[&] ( const DBProbeSample &probeSample ) {
+				const float importanceWeight =
+						database.globalColorCounter.getMessageLength( probeSample )
+					+
+						queryColorCounter.getMessageLength( probeSample )
+				;
+				numMatchableProbeSamplesQueryVolume += double( probeSample.weight ) * importanceWeight;
+			}
+		);
+
+		if( numMatchableProbeSamplesSampledModel == 0.0 || numMatchableProbeSamplesQueryVolume == 0.0 ) {
+			return 0.0f;
+		}
+
+		const float avgTotalModelWeight = sampledModel.uncompressedProbeSampleCount() * database.globalColorCounter.entropy + sampledModel.getColorCounter().totalMessageLength;
+		const double probeMatchPercentage = numMatchableProbeSamplesSampledModel / avgTotalModelWeight;
+		const float avgTotalQueryWeight = indexedProbeSamples.size() * database.globalColorCounter.entropy + queryColorCounter.totalMessageLength;
+		const double queryMatchPercentage = numMatchableProbeSamplesQueryVolume / avgTotalQueryWeight;
+
+		// a float sum of n terms is off by at most n units of roundoff, each product and division adds one more
+		const double maxRelativeError = (sampledModelProbeSamples.size() + indexedProbeSamples.size() + 8) * double( FLT_EPSILON );
+		return float( probeMatchPercentage * queryMatchPercentage * (1.0 + maxRelativeError) );
+	}
+
 	DetailedQueryResult matchAgainst( int localSceneIndex, int sceneModelIndex ) {
 		const auto &sampledModel = database.sampledModels[ localSceneIndex ];
 
@@ -792,11 +1296,9 @@ protected:
 
 		AUTO_TIMER_FOR_FUNCTION( boost::format( "id = %i, %i ref probes (%i query probes)" ) % sceneModelIndex % sampledModelProbeSamples.size() % indexedProbeSamples.size() );
 
-		using namespace Concurrency;
-
 		struct MatchController {
-			combinable< int > numMatches;
-			combinable< boost::dynamic_bitset<> > probesMatchedQueryVolume, probesMatchedSampledModel;
+			TaskRuntime::Reducer< int > numMatches;
+			TaskRuntime::Reducer< boost::dynamic_bitset<> > probesMatchedQueryVolume, probesMatchedSampledModel;
 
 			int numProbeSamplesSampledModel;
 			int numProbeSamplesQueryVolume;
@@ -846,7 +1348,7 @@ protected:
 		float numProbeSamplesMatchedSampledModel = 0.0f;
 		for( int i = 0 ; i < mergedProbeSamplesSampledModel.size() ; ++i ) {
 			if( mergedProbeSamplesSampledModel[ i ] ) {
-				const auto probeSample = sampledModelProbeSamples.getProbeSamples()[ i ];
+				const auto probeSample = sampledModelProbeSamples.getProbeSample( i );
 
 				const float importanceWeight =
 						database.globalColorCounter.getMessageLength( probeSample )
@@ -860,7 +1362,7 @@ protected:
 		float numProbeSamplesMatchedQueryVolume = 0.0f;
 		for( int i = 0 ; i < mergedProbeSamplesQueryVolume.size() ; ++i ) {
 			if( mergedProbeSamplesQueryVolume[ i ] ) {
-				const auto probeSample = indexedProbeSamples.getProbeSamples()[ i ];
+				const auto probeSample = indexedProbeSamples.getProbeSample( i );
 
 				const float importanceWeight =
 						database.globalColorCounter.getMessageLength( probeSample )
@@ -919,12 +1421,27 @@ struct ProbeDatabase::FullQuery {
 	};
 	typedef std::vector<DetailedQueryResult> DetailedQueryResults;
 
-	FullQuery( const ProbeDatabase &database ) : database( database ) {}
+	FullQuery( const ProbeDatabase &database )
+		: database( database )
+		, storeMatchesByOrientation( false )
+		, probeSamplesPerTask( 4096 )
+	{
+	}
 
 	void setProbeContextTolerance( const ProbeContextTolerance &pct ) {
 		probeContextTolerance = pct;
 	}
 
+	// keep the accumulated grids of all orientations in DetailedQueryResult::matchesByOrientation (only needed for visualizations)
+	void setStoreMatchesByOrientation( bool storeMatchesByOrientation ) {
+		this->storeMatchesByOrientation = storeMatchesByOrientation;
+	}
+
+	// models with more probe samples are split into multiple tasks per orientation
+	void setProbeSamplesPerTask( int probeSamplesPerTask ) {
+		this->probeSamplesPerTask = probeSamplesPerTask;
+	}
+
 	void setQueryVolume( const Obb &queryVolume, float resolution ) {
 		// TODO: I should wrap this in a new Grid structure [10/28/2012 Andreas]
 		queryVolumeOffset = ProbeGenerator::getGridHalfExtent( queryVolume.size, resolution );
@@ -945,30 +1462,70 @@ struct ProbeDatabase::FullQuery {
 			throw std::logic_error( "queryResults is not empty!" );
 		}
 
-		// NOTE: this can be easily parallelized
+		const int numModels = (int) database.sampledModels.size();
+		const int numOrientations = ProbeGenerator::getNumOrientations();
+
 		detailedQueryResults.clear();
-		detailedQueryResults.resize( database.sampledModels.size() );
+		detailedQueryResults.resize( numModels );
+
+		std::vector< int > numDirectionRangesByModel( numModels );
+		for( int localModelIndex = 0 ; localModelIndex < numModels ; localModelIndex++ ) {
+			numDirectionRangesByModel[ localModelIndex ] = FullQueryScheduling::getNumDirectionRanges( database.sampledModels[ localModelIndex ].getMergedInstances().size(), probeSamplesPerTask );
+		}
 
-		using namespace Concurrency;
+		// the grids are reduced to their maxima as soon as all directions have been matched
+		std::vector< int > maxMatchesByOrientation( numModels * numOrientations );
+		std::vector< int > maxPositionIndexByOrientation( numModels * numOrientations );
 
 		AUTO_TIMER_MEASURE() {
-			int logScope = Log::getScope();
+			FullQueryScheduling::execute< int >(
+				numDirectionRangesByModel,
+				queryVolumeSize.prod(),
+				[&] ( const FullQueryScheduling::Task &task, FullQueryScheduling::AccumulationGrid< int > &queryVolumeMatches ) {
+					accumulateMatches( task, queryVolumeMatches );
+				},
+				[&] ( int localModelIndex, int orientationIndex, const std::vector< int > &queryVolumeMatches ) {
+					auto maxElement = boost::max_element( queryVolumeMatches );
+					maxMatchesByOrientation[ localModelIndex * numOrientations + orientationIndex ] = *maxElement;
+					maxPositionIndexByOrientation[ localModelIndex * numOrientations + orientationIndex ] = maxElement - queryVolumeMatches.begin();
+
+					if( storeMatchesByOrientation ) {
+						detailedQueryResults[ localModelIndex ].matchesByOrientation[ orientationIndex ] = queryVolumeMatches;
+					}
+				}
+			);
+		}
 
-			parallel_for< int >(
-				0,
-				database.sampledModels.size(),
-				[&] ( int id ) {
-					Log::initThreadScope( logScope, 0 );
+		for( int localModelIndex = 0 ; localModelIndex < numModels ; localModelIndex++ ) {
+			const auto &sampledModel = database.sampledModels[ localModelIndex ];
 
-					detailedQueryResults[ id ] = matchAgainst( id, database.modelIndexMapper.getSceneModelIndex( id ) );
+			DetailedQueryResult &detailedQueryResult = detailedQueryResults[ localModelIndex ];
+			detailedQueryResult.sceneModelIndex = database.modelIndexMapper.getSceneModelIndex( localModelIndex );
+
+			for( int orientationIndex = 0 ; orientationIndex < numOrientations ; ++orientationIndex ) {
+				const float score = float( maxMatchesByOrientation[ localModelIndex * numOrientations + orientationIndex ] ) / sampledModel.getProbes().size();
+				if( detailedQueryResult.score < score ) {
+					detailedQueryResult.score = score;
+					detailedQueryResult.transformation = getTransformation( orientationIndex, maxPositionIndexByOrientation[ localModelIndex * numOrientations + orientationIndex ] );
 				}
-			);
+			}
 		}
 
 		queryResults.resize( detailedQueryResults.size() );
 		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
 	}
 
+	// only keeps the k best results (sorted by score)
+	// the best transformation is only known after matching all orientations, so there is no cheap upper bound to skip models with
+	void executeTopK( int k ) {
+		execute();
+
+		TopKSearch::selectTopK( detailedQueryResults, k );
+
+		queryResults.resize( detailedQueryResults.size() );
+		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
+	}
+
 	const DetailedQueryResults & getDetailedQueryResults() const {
 		return detailedQueryResults;
 	}
@@ -978,110 +1535,84 @@ struct ProbeDatabase::FullQuery {
 	}
 
 protected:
-	DetailedQueryResult matchAgainst( int localSceneIndex, int sceneModelIndex ) {
-		const auto &sampledModel = database.sampledModels[ localSceneIndex ];
-
-		AUTO_TIMER_FOR_FUNCTION(
-			boost::format( "id = %i, %i ref probes (%i query probes)" )
-			% sceneModelIndex
-			% sampledModel.getMergedInstances().size()
-			% queryProbes.size()
-		);
-
-		DetailedQueryResult detailedQueryResult( sceneModelIndex );
-
-		for( int orientationIndex = 0 ; orientationIndex < ProbeGenerator::getNumOrientations() ; ++orientationIndex ) {
-			using namespace Concurrency;
-
-			struct MatchController {
-				FullQuery &query;
+	// adds the matches of all directions in the task's range to queryVolumeMatches
+	void accumulateMatches( const FullQueryScheduling::Task &task, FullQueryScheduling::AccumulationGrid< int > &queryVolumeMatches ) const {
+		const auto &sampledModel = database.sampledModels[ task.localModelIndex ];
 
-				combinable< std::vector< int > > queryVolumeMatches;
-
-				const ProbeGenerator::ProbePositions &modelProbePositions;
-				const DBProbes &queryProbes;
-
-				MatchController( FullQuery &query, const ProbeGenerator::ProbePositions &modelProbePositions, const DBProbes &queryProbes )
-					: query( query )
-					, modelProbePositions( modelProbePositions )
-					, queryProbes( queryProbes )
-				{
-				}
-
-				void onNewThreadStarted() {
-					queryVolumeMatches.local().resize( query.queryVolumeSize.prod() );
-				}
+		struct MatchController {
+			const FullQuery &query;
 
-				void onMatch( int sampledModelProbeSampleIndex, int queryProbeSampleIndex, const DBProbeSample &sampledModelProbeSample, const DBProbeSample &queryProbeSample ) {
-					// calculate the target position
-					const Eigen::Vector3i targetPosition =
-							queryProbes[ queryProbeSample.probeIndex ].position.cast<int>()
-						-
-							modelProbePositions[ sampledModelProbeSample.probeIndex ].cast<int>()
-					;
-
-					const Eigen::Vector3i targetCell = targetPosition + query.queryVolumeOffset;
-					if( (targetCell.array() < 0).any() || (targetCell.array() >= query.queryVolumeSize.array()).any() ) {
-						return;
-					}
-					const int targetCellIndex =
-							targetCell.x()
-						+
-							targetCell.y() * query.queryVolumeSize.x()
-						+
-							targetCell.z() * query.queryVolumeSize.y() * query.queryVolumeSize.x()
-					;
-					queryVolumeMatches.local()[ targetCellIndex ] += sampledModelProbeSample.weight * queryProbeSample.weight;
-				}
-			};
+			FullQueryScheduling::AccumulationGrid< int > &queryVolumeMatches;
 
-			MatchController matchController( *this, sampledModel.getRotatedProbePositions( orientationIndex ), queryProbes );
+			const ProbeGenerator::ProbePositions &modelProbePositions;
 
-			//AUTO_TIMER_BLOCK( "matching" )
+			MatchController(
+				const FullQuery &query,
+				FullQueryScheduling::AccumulationGrid< int > &queryVolumeMatches,
+				const ProbeGenerator::ProbePositions &modelProbePositions
+			)
+				: query( query )
+				, queryVolumeMatches( queryVolumeMatches )
+				, modelProbePositions( modelProbePositions )
 			{
-				const int *rotatedDirections = ProbeGenerator::getRotatedDirections( orientationIndex );
-				for( int directionIndex = 0 ; directionIndex < ProbeGenerator::getNumDirections() ; directionIndex++ ) {
-					IndexedProbeSamples::Matcher< MatchController& > matcher(
-						sampledModel.getMergedInstancesByDirectionIndex( directionIndex ),
-						indexedProbeSamplesByDirectionIndices[ rotatedDirections[ directionIndex ] ],
-						probeContextTolerance,
-						matchController
-					);
-					matcher.match();
-				}
 			}
 
-			std::vector< int > mergedQueryVolumeMatches( queryVolumeSize.prod() );
-			//AUTO_TIMER_BLOCK( "combining matches" )
-			{
-				matchController.queryVolumeMatches.combine_each(
-					[&] ( const std::vector< int > &matches) {
-						boost::transform( mergedQueryVolumeMatches, matches, mergedQueryVolumeMatches.begin(), std::plus<int>() );
-					}
-				);
+			void onNewThreadStarted() {
 			}
 
-			auto maxElement = boost::max_element( mergedQueryVolumeMatches );
-			const float score = float( *maxElement ) / sampledModel.getProbes().size();
-			if( detailedQueryResult.score < score ) {
-				detailedQueryResult.score = score;
-
-				const int positionIndex = maxElement - mergedQueryVolumeMatches.begin();
-				const int x = positionIndex % queryVolumeSize[0];
-				const int y = (positionIndex / queryVolumeSize[0]) % queryVolumeSize[1];
-				const int z = positionIndex / queryVolumeSize[0] / queryVolumeSize[1];
+			void onMatch( int sampledModelProbeSampleIndex, int queryProbeSampleIndex, const DBProbeSample &sampledModelProbeSample, const DBProbeSample &queryProbeSample ) {
+				// calculate the target position
+				const Eigen::Vector3i targetPosition =
+						query.queryProbes[ queryProbeSample.probeIndex ].position.cast<int>()
+					-
+						modelProbePositions[ sampledModelProbeSample.probeIndex ].cast<int>()
+				;
 
-				detailedQueryResult.transformation =
-						queryVolumeTransformation
-					*	Eigen::Translation3f( queryResolution * (Eigen::Vector3f( x, y, z ) - queryVolumeOffset.cast<float>()) )
-					*	Eigen::Affine3f( ProbeGenerator::getRotation( orientationIndex ) )
+				const Eigen::Vector3i targetCell = targetPosition + query.queryVolumeOffset;
+				if( (targetCell.array() < 0).any() || (targetCell.array() >= query.queryVolumeSize.array()).any() ) {
+					return;
+				}
+				const int targetCellIndex =
+						targetCell.x()
+					+
+						targetCell.y() * query.queryVolumeSize.x()
+					+
+						targetCell.z() * query.queryVolumeSize.y() * query.queryVolumeSize.x()
 				;
+
+				queryVolumeMatches.add( targetCellIndex, sampledModelProbeSample.weight * queryProbeSample.weight );
 			}
+		};
+
+		MatchController matchController(
+			*this,
+			queryVolumeMatches,
+			sampledModel.getRotatedProbePositions( task.orientationIndex )
+		);
 
-			detailedQueryResult.matchesByOrientation[ orientationIndex ] = std::move( mergedQueryVolumeMatches );
+		// the tasks already keep all workers busy, so match serially
+		const int *rotatedDirections = ProbeGenerator::getRotatedDirections( task.orientationIndex );
+		for( int directionIndex = task.beginDirectionIndex ; directionIndex < task.endDirectionIndex ; directionIndex++ ) {
+			IndexedProbeSamples::Matcher< MatchController& > matcher(
+				sampledModel.getMergedInstancesByDirectionIndex( directionIndex ),
+				indexedProbeSamplesByDirectionIndices[ rotatedDirections[ directionIndex ] ],
+				probeContextTolerance,
+				matchController
+			);
+			matcher.matchSerial();
 		}
+	}
 
-		return detailedQueryResult;
+	Eigen::Affine3f getTransformation( int orientationIndex, int positionIndex ) const {
+		const int x = positionIndex % queryVolumeSize[0];
+		const int y = (positionIndex / queryVolumeSize[0]) % queryVolumeSize[1];
+		const int z = positionIndex / queryVolumeSize[0] / queryVolumeSize[1];
+
+		return
+				queryVolumeTransformation
+			*	Eigen::Translation3f( queryResolution * (Eigen::Vector3f( x, y, z ) - queryVolumeOffset.cast<float>()) )
+			*	Eigen::Affine3f( ProbeGenerator::getRotation( orientationIndex ) )
+		;
 	}
 
 	// to be able to easily visualize stuff for now
@@ -1099,6 +1630,9 @@ public:
 	Eigen::Vector3i queryVolumeSize, queryVolumeOffset;
 	Eigen::Affine3f queryVolumeTransformation;
 	float queryResolution;
+
+	bool storeMatchesByOrientation;
+	int probeSamplesPerTask;
 };
 
 struct ProbeDatabase::ImportanceFullQuery {
@@ -1119,12 +1653,27 @@ struct ProbeDatabase::ImportanceFullQuery {
 	};
 	typedef std::vector<DetailedQueryResult> DetailedQueryResults;
 
-	ImportanceFullQuery( const ProbeDatabase &database ) : database( database ) {}
+	ImportanceFullQuery( const ProbeDatabase &database )
+		: database( database )
+		, storeMatchesByOrientation( false )
+		, probeSamplesPerTask( 4096 )
+	{
+	}
 
 	void setProbeContextTolerance( const ProbeContextTolerance &pct ) {
 		probeContextTolerance = pct;
 	}
 
+	// keep the accumulated grids of all orientations in DetailedQueryResult::matchesByOrientation (only needed for visualizations)
+	void setStoreMatchesByOrientation( bool storeMatchesByOrientation ) {
+		this->storeMatchesByOrientation = storeMatchesByOrientation;
+	}
+
+	// models with more probe samples are split into multiple tasks per orientation
+	void setProbeSamplesPerTask( int probeSamplesPerTask ) {
+		this->probeSamplesPerTask = probeSamplesPerTask;
+	}
+
 	void setQueryVolume( const Obb &queryVolume, float resolution ) {
 		// TODO: I should wrap this in a new Grid structure [10/28/2012 Andreas]
 		queryVolumeOffset = ProbeGenerator::getGridHalfExtent( queryVolume.size, resolution );
@@ -1148,30 +1697,70 @@ struct ProbeDatabase::ImportanceFullQuery {
 			throw std::logic_error( "queryResults is not empty!" );
 		}
 
-		// NOTE: this can be easily parallelized
+		const int numModels = (int) database.sampledModels.size();
+		const int numOrientations = ProbeGenerator::getNumOrientations();
+
 		detailedQueryResults.clear();
-		detailedQueryResults.resize( database.sampledModels.size() );
+		detailedQueryResults.resize( numModels );
+
+		std::vector< int > numDirectionRangesByModel( numModels );
+		for( int localModelIndex = 0 ; localModelIndex < numModels ; localModelIndex++ ) {
+			numDirectionRangesByModel[ localModelIndex ] = FullQueryScheduling::getNumDirectionRanges( database.sampledModels[ localModelIndex ].getMergedInstances().size(), probeSamplesPerTask );
+		}
 
-		using namespace Concurrency;
+		// the grids are reduced to their maxima as soon as all directions have been matched
+		std::vector< float > maxMatchesByOrientation( numModels * numOrientations );
+		std::vector< int > maxPositionIndexByOrientation( numModels * numOrientations );
 
 		AUTO_TIMER_MEASURE() {
-			int logScope = Log::getScope();
+			FullQueryScheduling::execute< float >(
+				numDirectionRangesByModel,
+				queryVolumeSize.prod(),
+				[&] ( const FullQueryScheduling::Task &task, FullQueryScheduling::AccumulationGrid< float > &queryVolumeMatches ) {
+					accumulateMatches( task, queryVolumeMatches );
+				},
+				[&] ( int localModelIndex, int orientationIndex, const std::vector< float > &queryVolumeMatches ) {
+					auto maxElement = boost::max_element( queryVolumeMatches );
+					maxMatchesByOrientation[ localModelIndex * numOrientations + orientationIndex ] = *maxElement;
+					maxPositionIndexByOrientation[ localModelIndex * numOrientations + orientationIndex ] = maxElement - queryVolumeMatches.begin();
+
+					if( storeMatchesByOrientation ) {
+						detailedQueryResults[ localModelIndex ].matchesByOrientation[ orientationIndex ] = queryVolumeMatches;
+					}
+				}
+			);
+		}
 
-			parallel_for< int >(
-				0,
-				database.sampledModels.size(),
-				[&] ( int id ) {
-					Log::initThreadScope( logScope, 0 );
+		for( int localModelIndex = 0 ; localModelIndex < numModels ; localModelIndex++ ) {
+			const auto &sampledModel = database.sampledModels[ localModelIndex ];
+
+			DetailedQueryResult &detailedQueryResult = detailedQueryResults[ localModelIndex ];
+			detailedQueryResult.sceneModelIndex = database.modelIndexMapper.getSceneModelIndex( localModelIndex );
 
-					detailedQueryResults[ id ] = matchAgainst( id, database.modelIndexMapper.getSceneModelIndex( id ) );
+			for( int orientationIndex = 0 ; orientationIndex < numOrientations ; ++orientationIndex ) {
+				const float score = float( maxMatchesByOrientation[ localModelIndex * numOrientations + orientationIndex ] ) / sampledModel.getProbes().size();
+				if( detailedQueryResult.score < score ) {
+					detailedQueryResult.score = score;
+					detailedQueryResult.transformation = getTransformation( orientationIndex, maxPositionIndexByOrientation[ localModelIndex * numOrientations + orientationIndex ] );
 				}
-			);
+			}
 		}
 
 		queryResults.resize( detailedQueryResults.size() );
 		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
 	}
 
+	// only keeps the k best results (sorted by score)
+	// the best transformation is only known after matching all orientations, so there is no cheap upper bound to skip models with
+	void executeTopK( int k ) {
+		execute();
+
+		TopKSearch::selectTopK( detailedQueryResults, k );
+
+		queryResults.resize( detailedQueryResults.size() );
+		boost::transform( detailedQueryResults, queryResults.begin(), [] ( const DetailedQueryResult &r ) { return QueryResult( r ); } );
+	}
+
 	const DetailedQueryResults & getDetailedQueryResults() const {
 		return detailedQueryResults;
 	}
@@ -1181,149 +1770,96 @@ struct ProbeDatabase::ImportanceFullQuery {
 	}
 
 protected:
-	DetailedQueryResult matchAgainst( int localSceneIndex, int sceneModelIndex ) {
-		const auto &sampledModel = database.sampledModels[ localSceneIndex ];
-
-		AUTO_TIMER_FOR_FUNCTION(
-			boost::format( "id = %i, %i ref probes (%i query probes)" )
-			% sceneModelIndex
-			% sampledModel.getMergedInstances().size()
-			% queryProbes.size()
-		);
-
-		DetailedQueryResult detailedQueryResult( sceneModelIndex );
-
-		for( int orientationIndex = 0 ; orientationIndex < ProbeGenerator::getNumOrientations() ; ++orientationIndex ) {
-			using namespace Concurrency;
-
-			struct MatchController {
-				ImportanceFullQuery &query;
-
-				combinable< std::vector< float > > queryVolumeMatches;
-
-				const ProbeGenerator::ProbePositions &modelProbePositions;
-				const DBProbes &queryProbes;
-
-				const ColorCounter &queryColorCounter;
-				const ColorCounter &modelColorCounter;
-				const ColorCounter &globalColorCounter;
-
-				MatchController(
-					ImportanceFullQuery &query,
-					const ProbeGenerator::ProbePositions &modelProbePositions,
-					const DBProbes &queryProbes,
-					const ColorCounter &queryColorCounter,
-					const ColorCounter &modelColorCounter,
-					const ColorCounter &globalColorCounter
-				)
-					: query( query )
-					, modelProbePositions( modelProbePositions )
-					, queryProbes( queryProbes )
-					, queryColorCounter( queryColorCounter )
-					, modelColorCounter( modelColorCounter )
-					, globalColorCounter( globalColorCounter )
-				{
-				}
-
-				void onNewThreadStarted() {
-					queryVolumeMatches.local().resize( query.queryVolumeSize.prod() );
-				}
-
-				void onMatch( int sampledModelProbeSampleIndex, int queryProbeSampleIndex, const DBProbeSample &sampledModelProbeSample, const DBProbeSample &queryProbeSample ) {
-					// calculate the target position
-					const Eigen::Vector3i targetPosition =
-							queryProbes[ queryProbeSample.probeIndex ].position.cast<int>()
-						-
-							modelProbePositions[ sampledModelProbeSample.probeIndex ].cast<int>()
-					;
-
-					const Eigen::Vector3i targetCell = targetPosition + query.queryVolumeOffset;
-					if( (targetCell.array() < 0).any() || (targetCell.array() >= query.queryVolumeSize.array()).any() ) {
-						return;
-					}
-					const int targetCellIndex =
-							targetCell.x()
-						+
-							targetCell.y() * query.queryVolumeSize.x()
-						+
-							targetCell.z() * query.queryVolumeSize.y() * query.queryVolumeSize.x()
-					;
-
-					const float importanceWeight =
-							globalColorCounter.getMessageLength( sampledModelProbeSample )
-						+
-							modelColorCounter.getMessageLength( sampledModelProbeSample )
-						+
-							queryColorCounter.getMessageLength( queryProbeSample )
-					;
-
-					queryVolumeMatches.local()[ targetCellIndex ] += importanceWeight * sampledModelProbeSample.weight * queryProbeSample.weight;
-				}
-			};
-
-			MatchController matchController(
-				*this,
-				sampledModel.getRotatedProbePositions( orientationIndex ),
-				queryProbes,
-
-				queryColorCounter,
-				sampledModel.getColorCounter(),
-				database.globalColorCounter
-			);
+	// adds the matches of all directions in the task's range to queryVolumeMatches
+	void accumulateMatches( const FullQueryScheduling::Task &task, FullQueryScheduling::AccumulationGrid< float > &queryVolumeMatches ) const {
+		const auto &sampledModel = database.sampledModels[ task.localModelIndex ];
 
-			//AUTO_TIMER_BLOCK( "matching" )
+		struct MatchController {
+			const ImportanceFullQuery &query;
+
+			FullQueryScheduling::AccumulationGrid< float > &queryVolumeMatches;
+
+			const ProbeGenerator::ProbePositions &modelProbePositions;
+			const ColorCounter &modelColorCounter;
+
+			MatchController(
+				const ImportanceFullQuery &query,
+				FullQueryScheduling::AccumulationGrid< float > &queryVolumeMatches,
+				const ProbeGenerator::ProbePositions &modelProbePositions,
+				const ColorCounter &modelColorCounter
+			)
+				: query( query )
+				, queryVolumeMatches( queryVolumeMatches )
+				, modelProbePositions( modelProbePositions )
+				, modelColorCounter( modelColorCounter )
 			{
-				const int *rotatedDirections = ProbeGenerator::getRotatedDirections( orientationIndex );
-				for( int directionIndex = 0 ; directionIndex < ProbeGenerator::getNumDirections() ; directionIndex++ ) {
-					IndexedProbeSamples::Matcher< MatchController& > matcher(
-						sampledModel.getMergedInstancesByDirectionIndex( directionIndex ),
-						indexedProbeSamplesByDirectionIndices[ rotatedDirections[ directionIndex ] ],
-						probeContextTolerance,
-						matchController
-					);
-					matcher.match();
-				}
 			}
 
-			std::vector< float > mergedQueryVolumeMatches( queryVolumeSize.prod() );
-			//AUTO_TIMER_BLOCK( "combining matches" )
-			{
-				matchController.queryVolumeMatches.combine_each(
-					[&] ( const std::vector< float > &matches) {
-						boost::transform( mergedQueryVolumeMatches, matches, mergedQueryVolumeMatches.begin(), std::plus<float>() );
-					}
-				);
+			void onNewThreadStarted() {
 			}
 
-			auto maxElement = boost::max_element( mergedQueryVolumeMatches );
-			const float normalizationFactor =
-					(sampledModel.getProbes().size() + queryProbes.size()) * database.globalColorCounter.entropy
-				+
-					sampledModel.getColorCounter().totalMessageLength
-				+
-					queryColorCounter.totalMessageLength
-			;
-
-			const float score = float( *maxElement ) / sampledModel.getProbes().size();
-			if( detailedQueryResult.score < score ) {
-				detailedQueryResult.score = score;
+			void onMatch( int sampledModelProbeSampleIndex, int queryProbeSampleIndex, const DBProbeSample &sampledModelProbeSample, const DBProbeSample &queryProbeSample ) {
+				// calculate the target position
+				const Eigen::Vector3i targetPosition =
+						query.queryProbes[ queryProbeSample.probeIndex ].position.cast<int>()
+					-
+						modelProbePositions[ sampledModelProbeSample.probeIndex ].cast<int>()
+				;
 
-				const int positionIndex = maxElement - mergedQueryVolumeMatches.begin();
-				const int x = positionIndex % queryVolumeSize[0];
-				const int y = (positionIndex / queryVolumeSize[0]) % queryVolumeSize[1];
-				const int z = positionIndex / queryVolumeSize[0] / queryVolumeSize[1];
+				const Eigen::Vector3i targetCell = targetPosition + query.queryVolumeOffset;
+				if( (targetCell.array() < 0).any() || (targetCell.array() >= query.queryVolumeSize.array()).any() ) {
+					return;
+				}
+				const int targetCellIndex =
+						targetCell.x()
+					+
+						targetCell.y() * query.queryVolumeSize.x()
+					+
+						targetCell.z() * query.queryVolumeSize.y() * query.queryVolumeSize.x()
+				;
 
-				detailedQueryResult.transformation =
-						queryVolumeTransformation
-					*	Eigen::Translation3f( queryResolution * (Eigen::Vector3f( x, y, z ) - queryVolumeOffset.cast<float>()) )
-					*	Eigen::Affine3f( ProbeGenerator::getRotation( orientationIndex ) )
+				const float importanceWeight =
+						query.database.globalColorCounter.getMessageLength( sampledModelProbeSample )
+					+
+						modelColorCounter.getMessageLength( sampledModelProbeSample )
+					+
+						query.queryColorCounter.getMessageLength( queryProbeSample )
 				;
+
+				queryVolumeMatches.add( targetCellIndex, importanceWeight * sampledModelProbeSample.weight * queryProbeSample.weight );
 			}
+		};
+
+		MatchController matchController(
+			*this,
+			queryVolumeMatches,
+			sampledModel.getRotatedProbePositions( task.orientationIndex ),
+			sampledModel.getColorCounter()
+		);
 
-			detailedQueryResult.matchesByOrientation[ orientationIndex ] = std::move( mergedQueryVolumeMatches );
+		// the tasks already keep all workers busy, so match serially
+		const int *rotatedDirections = ProbeGenerator::getRotatedDirections( task.orientationIndex );
+		for( int directionIndex = task.beginDirectionIndex ; directionIndex < task.endDirectionIndex ; directionIndex++ ) {
+			IndexedProbeSamples::Matcher< MatchController& > matcher(
+				sampledModel.getMergedInstancesByDirectionIndex( directionIndex ),
+				indexedProbeSamplesByDirectionIndices[ rotatedDirections[ directionIndex ] ],
+				probeContextTolerance,
+				matchController
+			);
+			matcher.matchSerial();
 		}
+	}
 
-		return detailedQueryResult;
+	Eigen::Affine3f getTransformation( int orientationIndex, int positionIndex ) const {
+		const int x = positionIndex % queryVolumeSize[0];
+		const int y = (positionIndex / queryVolumeSize[0]) % queryVolumeSize[1];
+		const int z = positionIndex / queryVolumeSize[0] / queryVolumeSize[1];
+
+		return
+				queryVolumeTransformation
+			*	Eigen::Translation3f( queryResolution * (Eigen::Vector3f( x, y, z ) - queryVolumeOffset.cast<float>()) )
+			*	Eigen::Affine3f( ProbeGenerator::getRotation( orientationIndex ) )
+		;
 	}
 
 	// to be able to easily visualize stuff for now
@@ -1342,5 +1878,8 @@ public:
 	Eigen::Vector3i queryVolumeSize, queryVolumeOffset;
 	Eigen::Affine3f queryVolumeTransformation;
 	float queryResolution;
+
+	bool storeMatchesByOrientation;
+	int probeSamplesPerTask;
 };
 }
\ No newline at end of file
@@ -1,22 +1,54 @@
 #include "probeDatabaseStorage.h"
+#include "probeDatabaseMappedStorage.h"
 
-const int CACHE_FORMAT_VERSION = 6;
+const int CACHE_FORMAT_VERSION = 9;
 
 namespace ProbeContext {
 bool ProbeDatabase::load( const std::string &filename ) {
-	Serializer::BinaryReader reader( filename.c_str(), CACHE_FORMAT_VERSION );
-	if( reader.valid() ) {
+	auto loadSerialized = [this] ( Serializer::BinaryReader &reader ) -> bool {
+		if( !reader.valid() ) {
+			return false;
+		}
+
 		Serializer::read( reader, *this );
-		
+
 		modelIndexMapper.registerLocalModels( localModelNames );
 
+		sampleBucketIndex.build( sampledModels );
+
 		return true;
+	};
+
+	std::unique_ptr< MappedFile > mappedFile( new MappedFile() );
+	if( mappedFile->open( filename ) ) {
+		// compiled caches are used as they are: the query arrays are views of the mapping, so it is kept open
+		if( MappedStorage::isMappedCache( *mappedFile ) ) {
+			clearAll();
+			if( !MappedStorage::read( *mappedFile, *this ) ) {
+				return false;
+			}
+			this->mappedFile = std::move( mappedFile );
+
+			modelIndexMapper.registerLocalModels( localModelNames );
+			return true;
+		}
+
+		// the serialized format is parsed straight out of the mapping
+		Serializer::BinaryReader reader( mappedFile->getData(), mappedFile->getSize(), CACHE_FORMAT_VERSION );
+		return loadSerialized( reader );
 	}
-	return false;
+
+	// fall back to buffered reads if the file can't be mapped
+	Serializer::BinaryReader reader( filename.c_str(), CACHE_FORMAT_VERSION );
+	return loadSerialized( reader );
 }
 
 void ProbeDatabase::store( const std::string &filename ) const {
-	Serializer::BinaryWriter writer( filename.c_str(), CACHE_FORMAT_VERSION );
+	MappedStorage::write( filename, *this );
+}
+
+void ProbeDatabase::storeSerialized( const std::string &filename ) const {
+	Serializer::BinaryWriter writer( filename.c_str(), CACHE_FORMAT_VERSION, Serializer::BinaryWriter::COMPRESSED );
 	Serializer::write( writer, *this );
 }
 
@@ -23,9 +23,41 @@ namespace Serializer {
 BOOST_STATIC_ASSERT( sizeof( ProbeContext::RawProbe ) == 4 );
 BOOST_STATIC_ASSERT( sizeof( ProbeContext::RawProbeSample ) == 8 );
 BOOST_STATIC_ASSERT( sizeof( ProbeContext::DBProbeSample ) == 8 + 8 );
+BOOST_STATIC_ASSERT( sizeof( ProbeContext::CompactProbeSample ) == 6 );
 
+SERIALIZER_ENABLE_RAW_MODE_EXTERN( ProbeContext::CompactProbeSample );
+SERIALIZER_DEFAULT_EXTERN_IMPL( ProbeContext::CompactProbeSamples, (maxDistance)(samples) )
 SERIALIZER_DEFAULT_EXTERN_IMPL( ProbeContext::SampledModel::SampledInstance, (sourceTransformation)(probeSamples) )
-SERIALIZER_DEFAULT_EXTERN_IMPL( ProbeContext::IndexedProbeSamples, (data)(occlusionLowerBounds) )
+
+// mapped arrays are serialized like vectors (views are copied)
+namespace Serializer {
+	template< typename Reader, typename Value >
+	void read( Reader &reader, MappedArray< Value > &value ) {
+		std::vector< Value > elements;
+		read( reader, elements );
+		value = std::move( elements );
+	}
+	template< typename Writer, typename Value >
+	void write( Writer &writer, const MappedArray< Value > &value ) {
+		write( writer, std::vector< Value >( value.begin(), value.end() ) );
+	}
+}
+
+// the serialized format stores the decoded samples, the columns are rebuilt after loading
+namespace Serializer {
+	template< typename Reader >
+	void read( Reader &reader, ProbeContext::IndexedProbeSamples &value ) {
+		ProbeContext::DBProbeSamples data;
+		Serializer::get( reader, "data", data );
+		Serializer::get( reader, "occlusionLowerBounds", value.occlusionLowerBounds );
+		value.setProbeSamples( data );
+	}
+	template< typename Writer >
+	void write( Writer &writer, const ProbeContext::IndexedProbeSamples &value ) {
+		Serializer::put( writer, "data", value.decodeProbeSamples() );
+		Serializer::put( writer, "occlusionLowerBounds", value.occlusionLowerBounds );
+	}
+}
 
 SERIALIZER_DEFAULT_EXTERN_IMPL( ProbeContext::ColorCounter,
 	(buckets)
@@ -37,6 +69,8 @@ SERIALIZER_DEFAULT_EXTERN_IMPL( ProbeContext::ColorCounter,
 
 SERIALIZER_DEFAULT_EXTERN_IMPL( ProbeContext::SampledModel,
 	(instances)
+	(uncompiledProbeSamples)
+	(dirty)
 	(mergedInstances)
 	(mergedInstancesByDirectionIndex)
 	(probes)
@@ -45,6 +79,7 @@ SERIALIZER_DEFAULT_EXTERN_IMPL( ProbeContext::SampledModel,
 	(modelColorCounter)
 
 	(sampleBitPlane)
+	(sampleBucketHistogram)
 	(linearizedProbeSamples)
 	(sampleProbeIndexMapByDirection)
 )
@@ -54,6 +89,11 @@ SERIALIZER_DEFAULT_EXTERN_IMPL( ProbeContext::LinearizedProbeSamples,
 	(samples)
 )
 
+SERIALIZER_DEFAULT_EXTERN_IMPL( ProbeContext::SampleBucketHistogram,
+	(rankOffsets)
+	(counts)
+)
+
 SERIALIZER_DEFAULT_EXTERN_IMPL( ProbeContext::SampleProbeIndexMap::SampleMultiMap,
 	(items)
 	(bucketOffsets)
@@ -6,6 +6,7 @@
 #include "boost/type_traits/extent.hpp"
 #include "boost/format.hpp"
 #include <mathUtility.h>
+#include "radixSort.h"
 
 using namespace Eigen;
 
@@ -151,6 +152,8 @@ namespace ProbeGenerator {
 				}
 			}
 		}
+
+		sortProbes( probes );
 	}
 
 	void generateQueryProbes(
@@ -184,6 +187,8 @@ namespace ProbeGenerator {
 				}
 			}
 		}
+
+		sortProbes( probes );
 	}
 
 	void appendProbesFromSample(
@@ -242,6 +247,43 @@ namespace ProbeGenerator {
 		}
 	}
 
+	// spreads the 8 bits of value out to every third bit
+	static unsigned spreadBits( unsigned value ) {
+		value = (value | (value << 8)) & 0x0000F00Fu;
+		value = (value | (value << 4)) & 0x000C30C3u;
+		value = (value | (value << 2)) & 0x00249249u;
+		return value;
+	}
+
+	unsigned getMortonCode( const char3 &position ) {
+		return
+				spreadBits( unsigned( position.x() + 128 ) )
+			|
+				(spreadBits( unsigned( position.y() + 128 ) ) << 1)
+			|
+				(spreadBits( unsigned( position.z() + 128 ) ) << 2)
+		;
+	}
+
+	void sortProbes( Probes &probes ) {
+		// 24 bits for the Morton code and 5 bits for the direction index
+		RadixSort::sortByKey( probes, 29, [] ( const Probe &probe ) {
+			return (unsigned( probe.directionIndex ) << 24) | getMortonCode( probe.position );
+		} );
+	}
+
+	bool haveSameProbes( const Probes &a, const Probes &b ) {
+		if( a.size() != b.size() ) {
+			return false;
+		}
+		for( int probeIndex = 0 ; probeIndex < (int) a.size() ; probeIndex++ ) {
+			if( a[ probeIndex ].position != b[ probeIndex ].position || a[ probeIndex ].directionIndex != b[ probeIndex ].directionIndex ) {
+				return false;
+			}
+		}
+		return true;
+	}
+
 	ProbePositions rotateProbePositions( const Probes &probes, int orientationIndex ) {
 		const Matrix3f rotation = getRotation( orientationIndex );
 
@@ -11,9 +11,6 @@ namespace ProbeGenerator {
 	using OptixProgramInterface::TransformedProbe;
 	using OptixProgramInterface::TransformedProbes;
 
-	/* Ideas:
-	 * could generate probes using Morton indexing, which should speed up the tracing because similar probes will always be next to each other
-	 */
 	typedef Eigen::Matrix< signed char, 3, 1 > char3;
 
 	struct Probe {
@@ -78,4 +75,14 @@ namespace ProbeGenerator {
 	);
 
 	int cullDirectionMask( const Eigen::Vector3f &averagedNormal, int directionMask );
+
+	// interleaves the bits of the probe position (offset by 128): bit 3i is bit i of x, bit 3i+1 of y and bit 3i+2 of z
+	unsigned getMortonCode( const char3 &position );
+
+	// sorts the probes by direction and then along a Z-order curve (the generate functions return sorted probes)
+	// so probes that are next to each other in the list are next to each other in space, too:
+	// their rays hit the same geometry and the full queries splat their matches into neighboring cells
+	void sortProbes( Probes &probes );
+
+	bool haveSameProbes( const Probes &a, const Probes &b );
 };
\ No newline at end of file
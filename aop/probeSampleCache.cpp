@@ -0,0 +1,298 @@
+#include "probeSampleCache.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+
+namespace ProbeContext {
+	namespace {
+		const unsigned indexMagic = 0x43535041;
+		const unsigned indexVersion = 1;
+
+		// index: header, number of entries, the entries and then all changes that have been appended since
+		// (old versions ignore the appended changes)
+		struct IndexEntry {
+			ProbeSampleCache::Key key;
+			// removedEntrySize for removed entries
+			unsigned long long size;
+			unsigned long long lastUse;
+		};
+
+		const unsigned long long removedEntrySize = ~0ull;
+
+		struct ScopedFile {
+			FILE *file;
+
+			ScopedFile( const std::string &filename, const char *mode ) : file( fopen( filename.c_str(), mode ) ) {}
+
+			~ScopedFile() {
+				if( file ) {
+					fclose( file );
+				}
+			}
+
+			template< typename T >
+			bool write( const T *data, size_t count ) {
+				return !count || fwrite( data, sizeof( T ), count, file ) == count;
+			}
+
+			template< typename T >
+			bool read( T *data, size_t count ) {
+				return !count || fread( data, sizeof( T ), count, file ) == count;
+			}
+
+			// fclose flushes the buffered data, so it can fail, too
+			bool close() {
+				const bool closed = fclose( file ) == 0;
+				file = nullptr;
+				return closed;
+			}
+		};
+
+		// removedEntrySize if the file doesn't exist
+		unsigned long long getFileSize( const std::string &filename ) {
+			std::ifstream file( filename, std::ios_base::binary | std::ios_base::ate );
+			if( !file.is_open() ) {
+				return removedEntrySize;
+			}
+			return (unsigned long long) file.tellg();
+		}
+	}
+
+	ProbeSampleCache::ProbeSampleCache( const std::string &filePrefix, unsigned long long maxSize )
+		: filePrefix( filePrefix )
+		, maxSize( maxSize )
+		, totalSize( 0 )
+		, useCounter( 0 )
+	{
+		readIndex();
+
+		for( auto entry = entries.begin() ; entry != entries.end() ; ++entry ) {
+			totalSize += entry->second.size;
+		}
+
+		// compact the index (or create a valid one)
+		writeIndexLocked();
+	}
+
+	void ProbeSampleCache::readIndex() {
+		ScopedFile indexFile( filePrefix + ".index", "rb" );
+		if( !indexFile.file ) {
+			return;
+		}
+
+		unsigned header[2];
+		unsigned long long numEntries;
+		if( !indexFile.read( header, 2 ) || header[0] != indexMagic || header[1] != indexVersion || !indexFile.read( &numEntries, 1 ) ) {
+			logError( boost::format( "ignoring invalid probe sample cache index '%s.index'!" ) % filePrefix );
+			return;
+		}
+
+		std::vector< IndexEntry > indexEntries( (size_t) numEntries );
+		if( !indexFile.read( indexEntries.data(), indexEntries.size() ) ) {
+			logError( boost::format( "ignoring truncated probe sample cache index '%s.index'!" ) % filePrefix );
+			return;
+		}
+
+		// replay the appended changes (a partially appended change at the end is ignored)
+		IndexEntry appendedEntry;
+		while( indexFile.read( &appendedEntry, 1 ) ) {
+			indexEntries.push_back( appendedEntry );
+		}
+
+		for( auto indexEntry = indexEntries.begin() ; indexEntry != indexEntries.end() ; ++indexEntry ) {
+			if( indexEntry->size == removedEntrySize ) {
+				entries.erase( indexEntry->key );
+				continue;
+			}
+
+			const Entry entry = { indexEntry->size, indexEntry->lastUse };
+			entries[ indexEntry->key ] = entry;
+			useCounter = std::max( useCounter, entry.lastUse + 1 );
+		}
+	}
+
+	ProbeSampleCache::~ProbeSampleCache() {
+		writeIndex();
+	}
+
+	std::string ProbeSampleCache::getEntryFilename( Key key ) const {
+		return boost::str( boost::format( "%s.%016x.samples" ) % filePrefix % key );
+	}
+
+	void ProbeSampleCache::appendToIndex( Key key, const Entry *entry ) {
+		const IndexEntry indexEntry = { key, entry ? entry->size : removedEntrySize, entry ? entry->lastUse : 0 };
+
+		ScopedFile indexFile( filePrefix + ".index", "ab" );
+		if( !indexFile.file || !indexFile.write( &indexEntry, 1 ) || !indexFile.close() ) {
+			logError( boost::format( "could not append to probe sample cache index '%s.index'!" ) % filePrefix );
+		}
+	}
+
+	bool ProbeSampleCache::get( Key key, RawProbeSamples &probeSamples ) {
+		std::lock_guard< std::mutex > lock( mutex );
+
+		auto found = entries.find( key );
+		if( found == entries.end() ) {
+			return false;
+		}
+
+		ScopedFile entryFile( getEntryFilename( key ), "rb" );
+		unsigned long long numSamples;
+		bool valid = entryFile.file && entryFile.read( &numSamples, 1 ) && sizeof( numSamples ) + numSamples * sizeof( RawProbeSample ) == found->second.size;
+		if( valid ) {
+			probeSamples.resize( (size_t) numSamples );
+			valid = entryFile.read( probeSamples.data(), probeSamples.size() );
+		}
+
+		if( !valid ) {
+			// the file has been removed or damaged behind our back
+			probeSamples.clear();
+			removeEntry( key );
+			return false;
+		}
+
+		found->second.lastUse = useCounter++;
+		appendToIndex( key, &found->second );
+		return true;
+	}
+
+	bool ProbeSampleCache::put( Key key, const RawProbeSamples &probeSamples, bool pinEntry ) {
+		std::lock_guard< std::mutex > lock( mutex );
+
+		removeEntry( key );
+
+		// the index learns about the file before it is written, so it can't be orphaned
+		// (get removes entries whose files are missing or incomplete)
+		const unsigned long long numSamples = probeSamples.size();
+		const Entry entry = { sizeof( numSamples ) + numSamples * sizeof( RawProbeSample ), useCounter++ };
+		entries[ key ] = entry;
+		totalSize += entry.size;
+		appendToIndex( key, &entry );
+
+		bool written;
+		{
+			ScopedFile entryFile( getEntryFilename( key ), "wb" );
+			written = entryFile.file && entryFile.write( &numSamples, 1 ) && entryFile.write( probeSamples.data(), probeSamples.size() ) && entryFile.close();
+		}
+		if( !written ) {
+			logError( boost::format( "could not write probe sample cache entry '%s'!" ) % getEntryFilename( key ) );
+			// don't keep half a file around
+			removeEntry( key );
+			return false;
+		}
+
+		if( pinEntry ) {
+			pinnedKeys.insert( key );
+		}
+		evict();
+		return true;
+	}
+
+	bool ProbeSampleCache::pin( Key key ) {
+		std::lock_guard< std::mutex > lock( mutex );
+
+		auto found = entries.find( key );
+		if( found == entries.end() ) {
+			return false;
+		}
+
+		// the entry has to be readable later, so check its file now
+		// (it could have been removed behind our back or be incomplete after a crash)
+		if( getFileSize( getEntryFilename( key ) ) != found->second.size ) {
+			removeEntry( key );
+			return false;
+		}
+
+		pinnedKeys.insert( key );
+
+		found->second.lastUse = useCounter++;
+		appendToIndex( key, &found->second );
+		return true;
+	}
+
+	void ProbeSampleCache::unpinAll() {
+		std::lock_guard< std::mutex > lock( mutex );
+
+		pinnedKeys.clear();
+		evict();
+	}
+
+	void ProbeSampleCache::removeEntry( Key key ) {
+		auto found = entries.find( key );
+		if( found == entries.end() ) {
+			return;
+		}
+
+		totalSize -= found->second.size;
+		entries.erase( found );
+		pinnedKeys.erase( key );
+
+		remove( getEntryFilename( key ).c_str() );
+		appendToIndex( key, nullptr );
+	}
+
+	void ProbeSampleCache::evict() {
+		if( totalSize <= maxSize ) {
+			return;
+		}
+
+		// oldest entries first
+		std::vector< std::pair< unsigned long long, Key > > entriesByLastUse;
+		entriesByLastUse.reserve( entries.size() );
+		for( auto entry = entries.begin() ; entry != entries.end() ; ++entry ) {
+			if( !pinnedKeys.count( entry->first ) ) {
+				entriesByLastUse.push_back( std::make_pair( entry->second.lastUse, entry->first ) );
+			}
+		}
+		std::sort( entriesByLastUse.begin(), entriesByLastUse.end() );
+
+		for( auto entry = entriesByLastUse.begin() ; entry != entriesByLastUse.end() && totalSize > maxSize ; ++entry ) {
+			removeEntry( entry->second );
+		}
+	}
+
+	void ProbeSampleCache::clear() {
+		std::lock_guard< std::mutex > lock( mutex );
+
+		while( !entries.empty() ) {
+			removeEntry( entries.begin()->first );
+		}
+		useCounter = 0;
+		writeIndexLocked();
+	}
+
+	void ProbeSampleCache::writeIndex() {
+		std::lock_guard< std::mutex > lock( mutex );
+		writeIndexLocked();
+	}
+
+	void ProbeSampleCache::writeIndexLocked() {
+		std::vector< IndexEntry > indexEntries;
+		indexEntries.reserve( entries.size() );
+		for( auto entry = entries.begin() ; entry != entries.end() ; ++entry ) {
+			const IndexEntry indexEntry = { entry->first, entry->second.size, entry->second.lastUse };
+			indexEntries.push_back( indexEntry );
+		}
+
+		// write a new file and replace the old one, so there is always a complete index
+		const std::string indexFilename = filePrefix + ".index";
+		const std::string newIndexFilename = indexFilename + ".new";
+		bool written;
+		{
+			ScopedFile indexFile( newIndexFilename, "wb" );
+			const unsigned header[2] = { indexMagic, indexVersion };
+			const unsigned long long numEntries = indexEntries.size();
+			written = indexFile.file && indexFile.write( header, 2 ) && indexFile.write( &numEntries, 1 ) && indexFile.write( indexEntries.data(), indexEntries.size() ) && indexFile.close();
+		}
+		// rename doesn't replace existing files on Windows
+		if( written && rename( newIndexFilename.c_str(), indexFilename.c_str() ) != 0 ) {
+			remove( indexFilename.c_str() );
+			written = rename( newIndexFilename.c_str(), indexFilename.c_str() ) == 0;
+		}
+		if( !written ) {
+			logError( boost::format( "could not write probe sample cache index '%s'!" ) % indexFilename );
+			remove( newIndexFilename.c_str() );
+		}
+	}
+}
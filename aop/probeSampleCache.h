@@ -0,0 +1,119 @@
+#pragma once
+
+#include "probeDatabase.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace ProbeContext {
+	// on-disk cache of the probe samples of single instances, so sampling unchanged instances again only costs I/O
+	//
+	// the key has to cover everything the samples depend on (see Application::ProbeDatabase_sampleModels):
+	// the scene with all instances, the sampling settings, the probes and the sampled instance
+	//
+	// every entry is stored in its own file (filePrefix.<key>.samples), an index file (filePrefix.index) remembers
+	// the entries and when they have been used last, so the least recently used entries can be removed once the
+	// entries take up more than maxSize bytes
+	//
+	// every change is appended to the index right away (before an entry file is written and after it is removed),
+	// so the index knows all entry files even if the application is killed
+	// the index is compacted when the cache is opened and closed
+	//
+	// all methods can be called from different threads
+	struct ProbeSampleCache {
+		typedef unsigned long long Key;
+
+		// 64 bit FNV-1a hash
+		struct KeyBuilder {
+			Key key;
+
+			KeyBuilder() : key( 14695981039346656037ull ) {}
+
+			KeyBuilder &add( const void *data, size_t size ) {
+				const unsigned char *bytes = (const unsigned char *) data;
+				for( size_t byteIndex = 0 ; byteIndex < size ; byteIndex++ ) {
+					key = (key ^ bytes[ byteIndex ]) * 1099511628211ull;
+				}
+				return *this;
+			}
+
+			// only for types without padding
+			template< typename T >
+			KeyBuilder &add( const T &value ) {
+				return add( &value, sizeof( T ) );
+			}
+
+			template< typename T >
+			KeyBuilder &add( const std::vector< T > &values ) {
+				add( values.size() );
+				return add( values.data(), values.size() * sizeof( T ) );
+			}
+
+			KeyBuilder &add( const Eigen::Affine3f &transformation ) {
+				return add( transformation.matrix().data(), 16 * sizeof( float ) );
+			}
+		};
+
+		ProbeSampleCache( const std::string &filePrefix, unsigned long long maxSize );
+		// compacts the index
+		~ProbeSampleCache();
+
+		// returns false if there is no (valid) entry for the key
+		bool get( Key key, RawProbeSamples &probeSamples );
+		// adds or replaces the entry and removes the least recently used entries if the cache has become too big
+		// pinned entries are never removed (see pin)
+		// returns false if the entry couldn't be written
+		bool put( Key key, const RawProbeSamples &probeSamples, bool pinEntry = false );
+
+		// keeps the entry until unpinAll is called, so it can be read later (see ProbeSamplingPipeline)
+		// returns false if there is no entry for the key or its file is missing or incomplete (the entry is removed then)
+		bool pin( Key key );
+		// removes the least recently used entries if the pinned entries have made the cache too big
+		void unpinAll();
+
+		void clear();
+		// rewrites the index without the changes that have been appended to it
+		void writeIndex();
+
+		int getNumEntries() const {
+			std::lock_guard< std::mutex > lock( mutex );
+			return (int) entries.size();
+		}
+
+		unsigned long long getTotalSize() const {
+			std::lock_guard< std::mutex > lock( mutex );
+			return totalSize;
+		}
+
+	private:
+		struct Entry {
+			unsigned long long size;
+			// value of useCounter when the entry has been used last
+			unsigned long long lastUse;
+		};
+
+		std::string filePrefix;
+		unsigned long long maxSize;
+
+		std::unordered_map< Key, Entry > entries;
+		std::unordered_set< Key > pinnedKeys;
+		unsigned long long totalSize;
+		unsigned long long useCounter;
+
+		mutable std::mutex mutex;
+
+		std::string getEntryFilename( Key key ) const;
+		void readIndex();
+		// appends the entry (or its removal if entry is null) to the index
+		void appendToIndex( Key key, const Entry *entry );
+		void removeEntry( Key key );
+		void evict();
+		void writeIndexLocked();
+
+		ProbeSampleCache( const ProbeSampleCache & );
+		ProbeSampleCache & operator = ( const ProbeSampleCache & );
+	};
+}
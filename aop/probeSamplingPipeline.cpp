@@ -0,0 +1,245 @@
+#include "probeSamplingPipeline.h"
+
+#include <stdio.h>
+#include <stdexcept>
+#include <thread>
+
+namespace ProbeContext {
+	namespace {
+		// closes the file on exceptions
+		struct SpillFile {
+			FILE *file;
+			std::string filename;
+
+			SpillFile( const std::string &filename, const char *mode )
+				: file( fopen( filename.c_str(), mode ) )
+				, filename( filename )
+			{
+				if( !file ) {
+					throw std::runtime_error( boost::str( boost::format( "could not open spill file '%s'!" ) % filename ) );
+				}
+			}
+
+			~SpillFile() {
+				fclose( file );
+			}
+
+			void write( const void *data, size_t size ) {
+				if( size && fwrite( data, 1, size, file ) != size ) {
+					throw std::runtime_error( boost::str( boost::format( "could not write to spill file '%s'!" ) % filename ) );
+				}
+			}
+
+			void read( void *data, size_t size ) {
+				if( size && fread( data, 1, size, file ) != size ) {
+					throw std::runtime_error( boost::str( boost::format( "spill file '%s' is truncated!" ) % filename ) );
+				}
+			}
+
+		private:
+			SpillFile( const SpillFile & );
+			SpillFile & operator = ( const SpillFile & );
+		};
+
+		// one instance on its way through the stages
+		struct Batch {
+			// index into the instances
+			int index;
+			// the samples are in the probe sample cache (and pinned there), so the batch isn't traced or spilled
+			bool cached;
+			ProbeSamplingPipeline::TransformedProbes transformedProbes;
+			RawProbeSamples probeSamples;
+		};
+	}
+
+	ProbeSamplingPipeline::ProbeSamplingPipeline( const std::string &spillFilePrefix, float resolution, int queueCapacity, ProbeSampleCache *probeSampleCache )
+		: spillFilePrefix( spillFilePrefix )
+		, resolution( resolution )
+		, queueCapacity( queueCapacity )
+		, probeSampleCache( probeSampleCache )
+	{
+	}
+
+	ProbeSamplingPipeline::~ProbeSamplingPipeline() {
+		for( auto spilledModel = spilledModels.begin() ; spilledModel != spilledModels.end() ; ++spilledModel ) {
+			remove( spilledModel->filename.c_str() );
+		}
+		if( probeSampleCache ) {
+			probeSampleCache->unpinAll();
+		}
+	}
+
+	int ProbeSamplingPipeline::sampleModel( int sceneModelIndex, const RawProbes &probes, const Instances &instances, const Tracer &tracer, int *numCachedInstances ) {
+		AUTO_TIMER_FUNCTION();
+
+		const int numInstances = (int) instances.size();
+		const std::string filename = boost::str( boost::format( "%s.%i.spill" ) % spillFilePrefix % spilledModels.size() );
+
+		// pin all cached instances before anything is put into the cache, so new entries can't evict them
+		// (pin only looks at the cache's index and the entry files, the samples are read by compile())
+		std::vector< char > cachedInstances( numInstances );
+		if( probeSampleCache ) {
+			for( int index = 0 ; index < numInstances ; index++ ) {
+				cachedInstances[ index ] = probeSampleCache->pin( instances[ index ].cacheKey );
+			}
+		}
+
+		TaskRuntime::BoundedQueue< Batch > transformedBatches( queueCapacity );
+		TaskRuntime::BoundedQueue< Batch > tracedBatches( queueCapacity );
+
+		// the stages block on the queues, so they get their own threads instead of blocking workers of the task runtime
+		std::exception_ptr transformException;
+		std::thread transformer( [&] () {
+			try {
+				for( int index = 0 ; index < numInstances ; index++ ) {
+					Batch batch;
+					batch.index = index;
+					batch.cached = cachedInstances[ index ] != 0;
+					if( !batch.cached ) {
+						ProbeGenerator::transformProbes( probes, instances[ index ].transformation, resolution, batch.transformedProbes );
+					}
+
+					// the queue is closed if a later stage has failed
+					if( !transformedBatches.push( std::move( batch ) ) ) {
+						break;
+					}
+				}
+			}
+			catch( ... ) {
+				transformException = std::current_exception();
+
+				// stop the other stages
+				tracedBatches.close();
+			}
+			transformedBatches.close();
+		} );
+
+		std::exception_ptr spillException;
+		int numSpilledInstances = 0;
+		int numCachedBatches = 0;
+		std::thread spiller( [&] () {
+			try {
+				SpillFile spillFile( filename, "wb" );
+
+				Batch batch;
+				while( tracedBatches.pop( batch ) ) {
+					const Instance &instance = instances[ batch.index ];
+
+					// new samples go into the cache instead of the spill file if possible
+					unsigned char inCache = batch.cached;
+					if( !batch.cached && probeSampleCache ) {
+						inCache = probeSampleCache->put( instance.cacheKey, batch.probeSamples, true );
+					}
+
+					spillFile.write( &instance.transformation, sizeof( Obb::Transformation ) );
+					spillFile.write( &inCache, sizeof( inCache ) );
+					if( inCache ) {
+						spillFile.write( &instance.cacheKey, sizeof( ProbeSampleCache::Key ) );
+					}
+					else {
+						spillFile.write( batch.probeSamples.data(), batch.probeSamples.size() * sizeof( RawProbeSample ) );
+					}
+					numSpilledInstances++;
+					numCachedBatches += batch.cached;
+				}
+			}
+			catch( ... ) {
+				spillException = std::current_exception();
+
+				// stop the other stages
+				tracedBatches.close();
+				transformedBatches.close();
+			}
+		} );
+
+		std::exception_ptr traceException;
+		int numSampledProbes = 0;
+		try {
+			Batch batch;
+			while( transformedBatches.pop( batch ) ) {
+				if( !batch.cached ) {
+					tracer( instances[ batch.index ].instanceIndex, batch.transformedProbes, batch.probeSamples );
+					if( batch.probeSamples.size() != probes.size() ) {
+						throw std::runtime_error( boost::str( boost::format( "expected %i probe samples, but got %i!" ) % probes.size() % batch.probeSamples.size() ) );
+					}
+					numSampledProbes += (int) batch.transformedProbes.size();
+
+					// the spiller doesn't need them
+					TransformedProbes().swap( batch.transformedProbes );
+				}
+
+				if( !tracedBatches.push( std::move( batch ) ) ) {
+					break;
+				}
+			}
+		}
+		catch( ... ) {
+			traceException = std::current_exception();
+			transformedBatches.close();
+		}
+		tracedBatches.close();
+
+		transformer.join();
+		spiller.join();
+
+		if( transformException || traceException || spillException ) {
+			remove( filename.c_str() );
+			std::rethrow_exception( transformException ? transformException : traceException ? traceException : spillException );
+		}
+
+		SpilledModel spilledModel;
+		spilledModel.sceneModelIndex = sceneModelIndex;
+		spilledModel.probes = probes;
+		spilledModel.filename = filename;
+		spilledModel.numInstances = numSpilledInstances;
+		spilledModels.push_back( std::move( spilledModel ) );
+
+		if( numCachedInstances ) {
+			*numCachedInstances = numCachedBatches;
+		}
+		return numSampledProbes;
+	}
+
+	void ProbeSamplingPipeline::compile( ProbeDatabase &probeDatabase, float maxDistance ) {
+		AUTO_TIMER_FUNCTION();
+
+		Obb::Transformation transformation;
+		RawProbeSamples probeSamples;
+		for( auto spilledModel = spilledModels.begin() ; spilledModel != spilledModels.end() ; ++spilledModel ) {
+			{
+				SpillFile spillFile( spilledModel->filename, "rb" );
+
+				for( int instanceIndex = 0 ; instanceIndex < spilledModel->numInstances ; instanceIndex++ ) {
+					unsigned char inCache;
+					spillFile.read( &transformation, sizeof( Obb::Transformation ) );
+					spillFile.read( &inCache, sizeof( inCache ) );
+					if( inCache ) {
+						ProbeSampleCache::Key cacheKey;
+						spillFile.read( &cacheKey, sizeof( cacheKey ) );
+						// sampleModel has checked and pinned the entry, so it can only be missing if it has been removed behind our back since
+						if( !probeSampleCache || !probeSampleCache->get( cacheKey, probeSamples ) || probeSamples.size() != spilledModel->probes.size() ) {
+							throw std::runtime_error( boost::str( boost::format( "probe sample cache entry %016x of spill file '%s' is missing!" ) % cacheKey % spilledModel->filename ) );
+						}
+					}
+					else {
+						probeSamples.resize( spilledModel->probes.size() );
+						spillFile.read( probeSamples.data(), probeSamples.size() * sizeof( RawProbeSample ) );
+					}
+
+					probeDatabase.addInstanceProbes( spilledModel->sceneModelIndex, transformation, resolution, spilledModel->probes, probeSamples );
+				}
+			}
+			remove( spilledModel->filename.c_str() );
+
+			// merge the model's samples right away, so the uncompiled samples of only one model are in memory
+			probeDatabase.mergeChangedModels( maxDistance );
+		}
+		// the global message lengths only need to be updated once
+		probeDatabase.compileChangedModels( maxDistance );
+
+		spilledModels.clear();
+		if( probeSampleCache ) {
+			probeSampleCache->unpinAll();
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "probeDatabase.h"
+#include "probeSampleCache.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace ProbeContext {
+	// samples the instances of models for a ProbeDatabase without keeping all samples in memory
+	//
+	// three stages run concurrently and are connected by bounded queues:
+	//	1. a thread looks up the instance in the probe sample cache or transforms its probes, one instance at a time
+	//	2. the calling thread traces the instances that aren't cached (World::sampleProbes needs the GL/optix context)
+	//	3. a thread stores the traced samples in the cache or appends them to the spill file of the model
+	// so tracing never waits for disk or database and only a few instances are in flight at any time
+	//
+	// compile() streams the spill files (and the cached samples) into the database afterwards and merges one model at a time,
+	// so only the new samples of one model are in memory in addition to the database itself
+	//
+	// spill file: one record per instance, the transformation, whether the samples are in the cache, and then
+	// either the cache key or the raw samples in probe order
+	// (raw samples are exact and smaller than DBProbeSamples, the database quantizes them when it compiles)
+	// so every sample is written to disk only once, and cached samples are only read when compiling
+	struct ProbeSamplingPipeline {
+		typedef OptixProgramInterface::TransformedProbes TransformedProbes;
+		// traces the transformed probes of an instance (called from the thread that calls sampleModel)
+		typedef std::function< void ( int instanceIndex, const TransformedProbes &transformedProbes, RawProbeSamples &probeSamples ) > Tracer;
+
+		struct Instance {
+			int instanceIndex;
+			Obb::Transformation transformation;
+			// only used if there is a probe sample cache
+			ProbeSampleCache::Key cacheKey;
+		};
+		typedef std::vector< Instance > Instances;
+
+		// the spill files are named spillFilePrefix.<index>.spill
+		// queueCapacity is the number of instances each queue can hold
+		// the cache is optional, its entries are pinned until compile() has read them
+		ProbeSamplingPipeline( const std::string &spillFilePrefix, float resolution, int queueCapacity = 4, ProbeSampleCache *probeSampleCache = nullptr );
+		// removes the spill files that haven't been compiled
+		~ProbeSamplingPipeline();
+
+		// samples all instances and spills their samples
+		// returns the number of traced probes (numCachedInstances is set to the number of instances found in the cache)
+		int sampleModel( int sceneModelIndex, const RawProbes &probes, const Instances &instances, const Tracer &tracer, int *numCachedInstances = nullptr );
+
+		// adds the spilled samples to the database and compiles the models one by one
+		// the spill files are removed afterwards
+		void compile( ProbeDatabase &probeDatabase, float maxDistance );
+
+	private:
+		struct SpilledModel {
+			int sceneModelIndex;
+			RawProbes probes;
+			std::string filename;
+			int numInstances;
+		};
+
+		std::string spillFilePrefix;
+		float resolution;
+		int queueCapacity;
+		ProbeSampleCache *probeSampleCache;
+
+		std::vector< SpilledModel > spilledModels;
+
+		ProbeSamplingPipeline( const ProbeSamplingPipeline & );
+		ProbeSamplingPipeline & operator = ( const ProbeSamplingPipeline & );
+	};
+}
@@ -0,0 +1,215 @@
+#include "sceneGrid.h"
+#include "mathUtility.h"
+
+#include "taskRuntime.h"
+
+#include <boost/range/algorithm/sort.hpp>
+#include <boost/range/algorithm/unique.hpp>
+#include <boost/range/algorithm/copy.hpp>
+#include <boost/range/algorithm_ext/erase.hpp>
+
+using namespace Eigen;
+
+namespace SGSInterface {
+	SceneGrid::Entry SceneGrid::createEntry( int instanceIndex ) const {
+		return Entry(
+			instanceSource.getInstancePosition( instanceIndex ),
+			instanceSource.getModelIndex( instanceIndex ),
+			instanceIndex
+		);
+	}
+
+	void SceneGrid::build( float resolution ) {
+		dirty = false;
+		this->resolution = resolution;
+
+		const Eigen::AlignedBox3f sceneBoundingBox = instanceSource.getBoundingBox();
+		mapping = createCenteredIndexMapping( resolution, sceneBoundingBox.sizes(), sceneBoundingBox.center() );
+
+		const int numInstances = instanceSource.getNumInstances();
+
+		movedInstanceIndices.clear();
+		looseEntries.clear();
+
+		// this just adds the origin of the instance to the cell it belongs into
+		std::vector< int > cellIndicesByInstance( numInstances );
+		cellOffsets.assign( mapping.count + 1, 0 );
+		for( int instanceIndex = 0 ; instanceIndex < numInstances ; ++instanceIndex ) {
+			const auto index3 = floor( Vector3f::Constant( 0.5f ) + mapping.getIndex3( instanceSource.getInstancePosition( instanceIndex ) ) );
+			if( mapping.isValid( index3 ) ) {
+				const int cellIndex = mapping.getIndex( index3 );
+				cellIndicesByInstance[ instanceIndex ] = cellIndex;
+				++cellOffsets[ cellIndex + 1 ];
+			}
+			else {
+				cellIndicesByInstance[ instanceIndex ] = -1;
+			}
+		}
+
+		for( int cellIndex = 0 ; cellIndex < mapping.count ; ++cellIndex ) {
+			cellOffsets[ cellIndex + 1 ] += cellOffsets[ cellIndex ];
+		}
+
+		// fill the cells (instances outside of the grid become loose entries)
+		cellEntries.assign( cellOffsets.back(), Entry( Vector3f::Zero(), -1, -1 ) );
+		cellEntryIndicesByInstance.resize( numInstances );
+
+		std::vector< int > cellFillCounts( cellOffsets.begin(), cellOffsets.end() - 1 );
+		for( int instanceIndex = 0 ; instanceIndex < numInstances ; ++instanceIndex ) {
+			const int cellIndex = cellIndicesByInstance[ instanceIndex ];
+			if( cellIndex != -1 ) {
+				const int cellEntryIndex = cellFillCounts[ cellIndex ]++;
+				cellEntries[ cellEntryIndex ] = createEntry( instanceIndex );
+				cellEntryIndicesByInstance[ instanceIndex ] = cellEntryIndex;
+			}
+			else {
+				looseEntries.push_back( createEntry( instanceIndex ) );
+				cellEntryIndicesByInstance[ instanceIndex ] = -1;
+			}
+		}
+	}
+
+	void SceneGrid::update() {
+		if( !dirty && !movedInstanceIndices.empty() ) {
+			boost::sort( movedInstanceIndices );
+			boost::erase( movedInstanceIndices, boost::unique< boost::return_found_end >( movedInstanceIndices ) );
+
+			for( auto movedInstanceIndex = movedInstanceIndices.begin() ; movedInstanceIndex != movedInstanceIndices.end() ; ++movedInstanceIndex ) {
+				const int instanceIndex = *movedInstanceIndex;
+
+				if( instanceIndex < cellEntryIndicesByInstance.size() ) {
+					// remove the old entry
+					int &cellEntryIndex = cellEntryIndicesByInstance[ instanceIndex ];
+					if( cellEntryIndex != -1 ) {
+						cellEntries[ cellEntryIndex ].instanceIndex = -1;
+						cellEntryIndex = -1;
+					}
+					else {
+						boost::remove_erase_if( looseEntries, [instanceIndex] ( const Entry &entry ) {
+							return entry.instanceIndex == instanceIndex;
+						} );
+					}
+				}
+				else if( instanceIndex == cellEntryIndicesByInstance.size() ) {
+					// a new instance
+					cellEntryIndicesByInstance.push_back( -1 );
+				}
+				else {
+					// we have missed an instance somehow
+					dirty = true;
+					break;
+				}
+
+				looseEntries.push_back( createEntry( instanceIndex ) );
+			}
+			movedInstanceIndices.clear();
+
+			// the loose entries are checked by every query, so rebuild the grid before there are too many of them
+			const int maxNumLooseEntries = std::max< int >( 64, cellEntries.size() / 16 );
+			if( looseEntries.size() > maxNumLooseEntries ) {
+				dirty = true;
+			}
+		}
+
+		if( dirty || cellEntryIndicesByInstance.size() != instanceSource.getNumInstances() ) {
+			rebuild();
+		}
+	}
+
+	// TODO: createCenteredIndexMapping creates a mess because I have to add an offset of 0.5 everywhere [10/9/2012 kirschan2]
+	void SceneGrid::queryEntries( const Query &query, QueryResults &results ) const {
+		const Vector3f diagonal = Vector3f::Constant( 1.0 );
+		const Vector3f minCorner = query.position - query.radius * diagonal;
+		const Vector3f maxCorner = query.position + query.radius * diagonal;
+
+		const float squaredRadius = query.radius * query.radius;
+		auto checkEntry = [&] ( const Entry &entry ) {
+			if(
+				entry.instanceIndex == -1 ||
+				entry.instanceIndex == query.disabledInstanceIndex ||
+				entry.modelIndex == query.disabledModelIndex
+			) {
+				return;
+			}
+
+			const float squaredDistance = (entry.position - query.position).squaredNorm();
+			if( squaredDistance <= squaredRadius ) {
+				results.emplace_back( std::make_pair( entry.modelIndex, sqrtf( squaredDistance ) ) );
+			}
+		};
+
+		const Vector3i beginIndex3 = mapping.clampIndex3( floor( Vector3f::Constant( 0.5f ) + mapping.getIndex3( minCorner ) ) );
+		const Vector3i endIndex3 = mapping.clampIndex3( ceil( Vector3f::Constant( 0.5f ) + mapping.getIndex3( maxCorner ) + diagonal ) );
+		for( int z = beginIndex3[2] ; z < endIndex3[2] ; ++z ) {
+			for( int y = beginIndex3[1] ; y < endIndex3[1] ; ++y ) {
+				for( int x = beginIndex3[0] ; x < endIndex3[0] ; ++x ) {
+					Vector3i index3( x, y, z );
+					if( !mapping.isValid( index3 ) ) {
+						continue;
+					}
+
+					const int cellIndex = mapping.getIndex( index3 );
+					const int cellEntriesEnd = cellOffsets[ cellIndex + 1 ];
+					for( int cellEntryIndex = cellOffsets[ cellIndex ] ; cellEntryIndex < cellEntriesEnd ; ++cellEntryIndex ) {
+						checkEntry( cellEntries[ cellEntryIndex ] );
+					}
+				}
+			}
+		}
+
+		for( auto looseEntry = looseEntries.begin() ; looseEntry != looseEntries.end() ; ++looseEntry ) {
+			checkEntry( *looseEntry );
+		}
+	}
+
+	SGSInterface::SceneGrid::QueryResults SceneGrid::query( int disableModelIndex, int disabledInstanceIndex, const Vector3f &position, float radius ) {
+		update();
+
+		QueryResults results;
+		queryEntries( Query( disableModelIndex, disabledInstanceIndex, position, radius ), results );
+		return results;
+	}
+
+	void SceneGrid::queryBatch( const Queries &queries, BatchQueryResults &batchResults ) {
+		update();
+
+		const int numQueries = queries.size();
+
+		// every block of queries collects its results in its own buffer first
+		const int blockSize = 64;
+		const int numBlocks = (numQueries + blockSize - 1) / blockSize;
+		std::vector< QueryResults > blockResults( numBlocks );
+
+		batchResults.offsets.resize( numQueries + 1 );
+		batchResults.offsets[ 0 ] = 0;
+
+		TaskRuntime::parallel_for( 0, numBlocks, 1, [&] ( int blockIndex ) {
+			const int beginQueryIndex = blockIndex * blockSize;
+			const int endQueryIndex = std::min( beginQueryIndex + blockSize, numQueries );
+
+			QueryResults &results = blockResults[ blockIndex ];
+			for( int queryIndex = beginQueryIndex ; queryIndex < endQueryIndex ; ++queryIndex ) {
+				queryEntries( queries[ queryIndex ], results );
+				// store the end of the query's results relative to the block for now
+				batchResults.offsets[ queryIndex + 1 ] = results.size();
+			}
+		} );
+
+		// turn the offsets into global offsets
+		std::vector< int > blockOffsets( numBlocks + 1, 0 );
+		for( int blockIndex = 0 ; blockIndex < numBlocks ; ++blockIndex ) {
+			blockOffsets[ blockIndex + 1 ] = blockOffsets[ blockIndex ] + int( blockResults[ blockIndex ].size() );
+		}
+
+		batchResults.results.resize( blockOffsets.back() );
+		TaskRuntime::parallel_for( 0, numBlocks, 1, [&] ( int blockIndex ) {
+			const int beginQueryIndex = blockIndex * blockSize;
+			const int endQueryIndex = std::min( beginQueryIndex + blockSize, numQueries );
+			for( int queryIndex = beginQueryIndex ; queryIndex < endQueryIndex ; ++queryIndex ) {
+				batchResults.offsets[ queryIndex + 1 ] += blockOffsets[ blockIndex ];
+			}
+
+			boost::copy( blockResults[ blockIndex ], batchResults.results.begin() + blockOffsets[ blockIndex ] );
+		} );
+	}
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "grid.h"
+
+#include <Eigen/Eigen>
+#include <vector>
+
+namespace SGSInterface {
+	// allows for queries of object centers in a certain distance
+	// the instances are packed cell by cell (CSR) together with their positions and model indices,
+	// so queries don't have to touch the scene
+	struct SceneGrid {
+		// the instances the grid is built from (see SGSInterface::RendererInstanceSource)
+		struct InstanceSource {
+			virtual ~InstanceSource() {}
+
+			virtual int getNumInstances() const = 0;
+			virtual int getModelIndex( int instanceIndex ) const = 0;
+			virtual Eigen::Vector3f getInstancePosition( int instanceIndex ) const = 0;
+			virtual Eigen::AlignedBox3f getBoundingBox() const = 0;
+		};
+
+		bool dirty;
+
+		const InstanceSource &instanceSource;
+
+		typedef std::vector< int > InstanceIndices;
+		// modelIndex, distance
+		typedef std::pair< int, float > QueryResult;
+		typedef std::vector< QueryResult > QueryResults;
+
+		struct Query {
+			int disabledModelIndex;
+			int disabledInstanceIndex;
+			Eigen::Vector3f position;
+			float radius;
+
+			Query( int disabledModelIndex, int disabledInstanceIndex, const Eigen::Vector3f &position, float radius )
+				: disabledModelIndex( disabledModelIndex )
+				, disabledInstanceIndex( disabledInstanceIndex )
+				, position( position )
+				, radius( radius )
+			{}
+		};
+		typedef std::vector< Query > Queries;
+
+		// the results of all queries of a batch in one array
+		struct BatchQueryResults {
+			// the results of query i are results[ offsets[ i ] ] .. results[ offsets[ i + 1 ] - 1 ]
+			std::vector< int > offsets;
+			QueryResults results;
+
+			int getNumQueries() const {
+				return offsets.empty() ? 0 : int( offsets.size() ) - 1;
+			}
+
+			const QueryResult *begin( int queryIndex ) const {
+				return results.data() + offsets[ queryIndex ];
+			}
+
+			const QueryResult *end( int queryIndex ) const {
+				return results.data() + offsets[ queryIndex + 1 ];
+			}
+
+			QueryResults getQueryResults( int queryIndex ) const {
+				return QueryResults( begin( queryIndex ), end( queryIndex ) );
+			}
+		};
+
+		/*void load();
+		void store();*/
+
+		SceneGrid( const InstanceSource &instanceSource )
+			: dirty( true )
+			, instanceSource( instanceSource )
+			, resolution()
+		{}
+
+		void build( float resolution );
+		void rebuild() {
+			build( resolution );
+		}
+
+		QueryResults query(
+			int disableModelIndex,
+			int disabledInstanceIndex,
+			const Eigen::Vector3f &position,
+			float radius
+		);
+
+		// answers all queries in parallel
+		void queryBatch( const Queries &queries, BatchQueryResults &batchResults );
+
+		void markDirty() {
+			dirty = true;
+		}
+
+		// only instanceIndex has been moved or added, so we can update the grid instead of rebuilding it
+		void markDirty( int instanceIndex ) {
+			movedInstanceIndices.push_back( instanceIndex );
+		}
+
+		// number of instances that are checked by every query (see update)
+		int getNumLooseEntries() const {
+			return (int) looseEntries.size();
+		}
+
+	private:
+		struct Entry {
+			Eigen::Vector3f position;
+			int modelIndex;
+			// -1 if the instance has moved since the grid has been built
+			int instanceIndex;
+
+			Entry( const Eigen::Vector3f &position, int modelIndex, int instanceIndex )
+				: position( position )
+				, modelIndex( modelIndex )
+				, instanceIndex( instanceIndex )
+			{}
+		};
+
+		float resolution;
+		SimpleIndexMapping3 mapping;
+
+		// the entries of cell i are cellEntries[ cellOffsets[ i ] ] .. cellEntries[ cellOffsets[ i + 1 ] - 1 ]
+		std::vector< int > cellOffsets;
+		std::vector< Entry > cellEntries;
+		// instances that have moved since the grid has been built or that lie outside of it
+		// they are checked by every query
+		std::vector< Entry > looseEntries;
+		// index into cellEntries by [instanceIndex], -1 for loose entries
+		std::vector< int > cellEntryIndicesByInstance;
+
+		std::vector< int > movedInstanceIndices;
+
+		Entry createEntry( int instanceIndex ) const;
+		// rebuilds the grid if it is dirty or moves the moved instances into the loose entries
+		void update();
+		void queryEntries( const Query &query, QueryResults &results ) const;
+	};
+}
@@ -78,6 +78,21 @@ namespace SGSInterface {
 		SGSInterface::generateProbes( instanceIndex, resolution, sceneRenderer, probes, transformedProbes );
 	}
 
+	void World::sampleProbes( const TransformedProbes &transformedProbes, ProbeSamples &probeSamples, const RenderContext &renderContext, float maxDistance, int sampleOffset ) {
+		if( !useCpuRayTracer ) {
+			optixRenderer.sampleProbes( transformedProbes, probeSamples, renderContext, maxDistance, sampleOffset );
+			return;
+		}
+
+		if( !cpuRayTracer.initialized ) {
+			sceneRenderer.initCpuRayTracer( &cpuRayTracer );
+		}
+		else if( cpuRayTracer.dirty ) {
+			sceneRenderer.refillCpuRayTracer( &cpuRayTracer );
+		}
+		cpuRayTracer.sampleProbes( transformedProbes, probeSamples, renderContext, maxDistance, sampleOffset );
+	}
+
 	bool World::selectFromView( const View &view, float xh, float yh, SelectionResult *result, int forceDisabledInstanceIndex ) {
 		OptixRenderer::SelectionRays selectionRays;
 		selectionRays.push_back( optix::make_float2( xh, yh ) );
@@ -101,7 +116,8 @@ namespace SGSInterface {
 		instance.transformation = Translation3f( center );
 
 		auto id = sceneRenderer.addInstance( instance );
-		sceneGrid.markDirty();
+		sceneGrid.markDirty( id );
+		cpuRayTracer.markDirty();
 		return id;
 	}
 
@@ -111,7 +127,8 @@ namespace SGSInterface {
 		instance.transformation = transformation;
 
 		auto id = sceneRenderer.addInstance( instance );
-		sceneGrid.markDirty();
+		sceneGrid.markDirty( id );
+		cpuRayTracer.markDirty();
 		return id;
 	}
 
@@ -119,92 +136,13 @@ namespace SGSInterface {
 		sceneRenderer.removeInstance( instanceIndex );
 
 		sceneGrid.markDirty();
+		cpuRayTracer.markDirty();
 	}
 
-	void SceneGrid::build( float resolution ) {
-		dirty = false;
-		this->resolution = resolution;
-
-		const auto &sceneBoundingBox = renderer.sceneBoundingBox;
-		mapping = createCenteredIndexMapping( resolution, sceneBoundingBox.sizes(), sceneBoundingBox.center() );
-		instanceGrid.clear();
-		instanceGrid.resize( mapping.count );
-
-#if 0
-		const Vector3f diagonal = Vector3f::Constant( 1.0 );
-#endif
-		const int numInstances = renderer.getNumInstances();
-		for( int instanceIndex = 0 ; instanceIndex < numInstances ; ++instanceIndex ) {
-#if 0
-			// this adds the instanceIndex to all bounding boxes that might contain its bbox
-			auto boundingSphere = renderer.getUntransformedInstanceBoundingSphere( instanceIndex );
-			boundingSphere.center = renderer.getInstanceTransformation( instanceIndex ) * boundingSphere.center;
-			VolumeIterator3 iter(
-				floor( mapping.getIndex3( boundingSphere.center - diagonal * boundingSphere.radius ) ),
-				ceil( mapping.getIndex3( boundingSphere.center - diagonal * boundingSphere.radius ) + Vector3f::Constant( 1.0 ) )
-			);
-			for( ; iter.hasMore() ; ++iter ) {
-				const auto &index3 = iter.getIndex3();
-				if( mapping.isValid( index3 ) ) {
-					const int index = mapping.getIndex( index3 );
-					instanceGrid[ index ].push_back( instanceIndex );
-				}
-			}
-#else
-			// this just adds the origin of the instance to the cell it belongs into
-			const auto index3 = floor( Vector3f::Constant( 0.5f ) + mapping.getIndex3( renderer.getInstanceTransformation( instanceIndex ).translation() ) );
-			if( mapping.isValid( index3 ) ) {
-				instanceGrid[ mapping.getIndex( index3 ) ].push_back( instanceIndex );
-			}
-			else {
-				__debugbreak();
-			}
-#endif
-		}
-	}
-
-	// TODO: createCenteredIndexMapping creates a mess because I have to add an offset of 0.5 everywhere [10/9/2012 kirschan2]
-	SGSInterface::SceneGrid::QueryResults SceneGrid::query( int disableModelIndex, int disabledInstanceIndex, const Vector3f &position, float radius ) {
-		if( dirty ) {
-			rebuild();
-		}
-
-		QueryResults results;
-
-		const Vector3f diagonal = Vector3f::Constant( 1.0 );
-		const Vector3f minCorner = position - radius * diagonal;
-		const Vector3f maxCorner = position + radius * diagonal;
-
-		const Vector3i beginIndex3 = mapping.clampIndex3( floor( Vector3f::Constant( 0.5f ) + mapping.getIndex3( minCorner ) ) );
-		const Vector3i endIndex3 = mapping.clampIndex3( ceil( Vector3f::Constant( 0.5f ) + mapping.getIndex3( maxCorner ) + diagonal ) );
-		for( int z = beginIndex3[2] ; z < endIndex3[2] ; ++z ) {
-			for( int y = beginIndex3[1] ; y < endIndex3[1] ; ++y ) {
-				for( int x = beginIndex3[0] ; x < endIndex3[0] ; ++x ) {
-					Vector3i index3( x, y, z );
-					if( !mapping.isValid( index3 ) ) {
-						continue;
-					}
-
-					const InstanceIndices &instanceIndices = instanceGrid[ mapping.getIndex( index3 ) ];
-
-					for( auto instanceIndex = instanceIndices.begin() ; instanceIndex != instanceIndices.end() ; ++instanceIndex ) {
-						const int modelIndex = renderer.getModelIndex( *instanceIndex );
-						if(
-							*instanceIndex == disabledInstanceIndex ||
-							modelIndex == disableModelIndex
-						) {
-								continue;
-						}
-
-						const float distance = (renderer.getInstanceTransformation( *instanceIndex ).translation() - position).norm();
-						if( distance <= radius ) {
-							results.emplace_back( std::make_pair( modelIndex, distance ) );
-						}
-					}
-				}
-			}
-		}
+	void World::setInstanceTransformation( int instanceIndex, const Eigen::Affine3f &transformation ) {
+		sceneRenderer.setInstanceTransformation( instanceIndex, transformation );
 
-		return results;
+		sceneGrid.markDirty( instanceIndex );
+		cpuRayTracer.markDirty();
 	}
 }
\ No newline at end of file
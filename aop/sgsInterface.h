@@ -4,13 +4,15 @@
 #include "sgsSceneRenderer.h"
 #include "camera.h"
 #include "optixRenderer.h"
-#include "grid.h"
+#include "cpuRayTracer.h"
 #include "probeGenerator.h"
+#include "sceneGrid.h"
 
 #include "make_nonallocated_shared.h"
 
 namespace SGSInterface {
 	typedef OptixProgramInterface::TransformedProbes TransformedProbes;
+	typedef OptixProgramInterface::ProbeSamples ProbeSamples;
 	typedef OptixProgramInterface::SelectionResult SelectionResult;
 
 	void generateProbes(
@@ -34,54 +36,46 @@ namespace SGSInterface {
 		}
 	};
 
-	// allows for queries of object centers in a certain distance
-	struct SceneGrid {
-		bool dirty;
-
+	// the instances of the renderer for the scene grid
+	struct RendererInstanceSource : SceneGrid::InstanceSource {
 		const SGSSceneRenderer &renderer;
 
-		typedef std::vector< int > InstanceIndices;
-		// modelIndex, distance
-		typedef std::vector< std::pair< int, float > > QueryResults;
-
-		/*void load();
-		void store();*/
-
-		SceneGrid( const SGSSceneRenderer &renderer )
-			: renderer( renderer )
-			, resolution()
-			, dirty( true )
-		{}
+		RendererInstanceSource( const SGSSceneRenderer &renderer ) : renderer( renderer ) {}
 
-		void build( float resolution );
-		void rebuild() {
-			build( resolution );
+		virtual int getNumInstances() const {
+			return renderer.getNumInstances();
 		}
 
-		QueryResults query(
-			int disableModelIndex,
-			int disabledInstanceIndex,
-			const Eigen::Vector3f &position,
-			float radius
-		);
+		virtual int getModelIndex( int instanceIndex ) const {
+			return renderer.getModelIndex( instanceIndex );
+		}
 
-		void markDirty() {
-			dirty = true;
+		virtual Eigen::Vector3f getInstancePosition( int instanceIndex ) const {
+			return renderer.getInstanceTransformation( instanceIndex ).translation();
 		}
 
-	private:
-		float resolution;
-		SimpleIndexMapping3 mapping;
-		std::vector< InstanceIndices > instanceGrid;
+		virtual Eigen::AlignedBox3f getBoundingBox() const {
+			return renderer.sceneBoundingBox;
+		}
 	};
 
 	struct World {
 		SGSScene scene;
 		SGSSceneRenderer sceneRenderer;
 		OptixRenderer optixRenderer;
+		// only set up when it is used for the first time
+		CpuRayTracer cpuRayTracer;
+		RendererInstanceSource sceneGridInstances;
 		SceneGrid sceneGrid;
 
-		World() : sceneGrid( sceneRenderer ) {}
+		// sample probes with cpuRayTracer instead of optixRenderer
+		bool useCpuRayTracer;
+
+		World()
+			: sceneGridInstances( sceneRenderer )
+			, sceneGrid( sceneGridInstances )
+			, useCpuRayTracer( false )
+		{}
 
 		void init( const char *scenePath);
 		void renderViewFrame( const View &view );
@@ -95,6 +89,15 @@ namespace SGSInterface {
 			TransformedProbes &transformedProbes
 		);
 
+		// uses either optixRenderer or cpuRayTracer (see useCpuRayTracer)
+		void sampleProbes(
+			const TransformedProbes &transformedProbes,
+			ProbeSamples &probeSamples,
+			const RenderContext &renderContext,
+			float maxDistance,
+			int sampleOffset = 0
+		);
+
 		bool selectFromView(
 			const View &view,
 			float xh,
@@ -106,5 +109,6 @@ namespace SGSInterface {
 		int addInstance( int modelIndex, const Eigen::Vector3f &center );
 		int addInstance( int modelIndex, const Eigen::Affine3f &transformation );
 		void removeInstance( int instanceIndex );
+		void setInstanceTransformation( int instanceIndex, const Eigen::Affine3f &transformation );
 	};
 }
\ No newline at end of file
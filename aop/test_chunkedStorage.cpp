@@ -0,0 +1,70 @@
+#include "chunkedStorage.h"
+
+#include "gtest.h"
+
+#include <stdio.h>
+
+namespace {
+	// elements of different sizes, so chunks have different sizes, too
+	std::vector< std::vector< int > > makeElements( int numElements ) {
+		std::vector< std::vector< int > > elements( numElements );
+		for( int elementIndex = 0 ; elementIndex < numElements ; elementIndex++ ) {
+			for( int valueIndex = 0 ; valueIndex < elementIndex % 7 ; valueIndex++ ) {
+				elements[ elementIndex ].push_back( elementIndex * 10 + valueIndex );
+			}
+		}
+		return elements;
+	}
+}
+
+TEST( ChunkedStorage, readRanges ) {
+	const int numElements = 103;
+	const auto elements = makeElements( numElements );
+	const std::string header = "header";
+
+	ASSERT_TRUE( ChunkedStorage::write( "test_chunkedStorage", 1, elements, 10,
+		[&] ( Serializer::BinaryWriter &writer ) {
+			writer.put( header );
+		}
+	) );
+
+	ChunkedStorage::Reader< std::vector< int > > reader;
+	std::string readHeader;
+	ASSERT_TRUE( reader.open( "test_chunkedStorage", 1,
+		[&] ( Serializer::BinaryReader &headerReader ) {
+			headerReader.get( readHeader );
+		}
+	) );
+	EXPECT_EQ( header, readHeader );
+	EXPECT_EQ( numElements, reader.getNumElements() );
+	EXPECT_EQ( 11, reader.getChunks().size() );
+
+	std::vector< std::vector< int > > readElements;
+	ASSERT_TRUE( reader.read( 0, numElements, readElements ) );
+	EXPECT_EQ( elements, readElements );
+
+	// ranges inside a chunk, across chunk boundaries and past the end
+	const int ranges[][2] = { { 3, 7 }, { 10, 20 }, { 15, 42 }, { 99, 200 }, { 50, 50 } };
+	for( int rangeIndex = 0 ; rangeIndex < 5 ; rangeIndex++ ) {
+		const int beginIndex = ranges[ rangeIndex ][ 0 ];
+		const int endIndex = std::min( ranges[ rangeIndex ][ 1 ], numElements );
+
+		ASSERT_TRUE( reader.read( ranges[ rangeIndex ][ 0 ], ranges[ rangeIndex ][ 1 ], readElements ) );
+		EXPECT_EQ( std::vector< std::vector< int > >( elements.begin() + beginIndex, elements.begin() + endIndex ), readElements ) << beginIndex;
+	}
+}
+
+TEST( ChunkedStorage, rejectsOtherFiles ) {
+	ASSERT_TRUE( ChunkedStorage::write( "test_chunkedStorage", 1, makeElements( 5 ), 2, [] ( Serializer::BinaryWriter & ) {} ) );
+
+	ChunkedStorage::Reader< std::vector< int > > reader;
+	EXPECT_FALSE( reader.open( "test_chunkedStorage", 2, [] ( Serializer::BinaryReader & ) {} ) );
+	EXPECT_FALSE( reader.open( "test_chunkedStorage_missing", 1, [] ( Serializer::BinaryReader & ) {} ) );
+
+	// plain binary streams aren't chunked files
+	{
+		Serializer::BinaryWriter writer( "test_chunkedStorage", 1 );
+		writer.put( makeElements( 5 ) );
+	}
+	EXPECT_FALSE( reader.open( "test_chunkedStorage", 1, [] ( Serializer::BinaryReader & ) {} ) );
+}
@@ -0,0 +1,207 @@
+#include "cpuRayTracer.h"
+
+#include "gtest.h"
+
+#include <stdlib.h>
+
+using namespace Eigen;
+
+static float randomFloat() {
+	return (rand() % 10000) * 0.0001f;
+}
+
+static Vector3f randomPosition( float size ) {
+	return Vector3f( randomFloat(), randomFloat(), randomFloat() ) * size;
+}
+
+// one model with a single quad in the xy plane ([-1,1]^2)
+static void createQuadScene( SGSScene &scene ) {
+	const float corners[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+	for( int cornerIndex = 0 ; cornerIndex < 4 ; cornerIndex++ ) {
+		SGSScene::Vertex vertex = {};
+		vertex.position[0] = corners[ cornerIndex ][0];
+		vertex.position[1] = corners[ cornerIndex ][1];
+		vertex.normal[2] = 1.0f;
+		scene.vertices.push_back( vertex );
+	}
+	const unsigned quadIndices[] = { 0, 1, 2, 0, 2, 3 };
+	scene.indices.assign( quadIndices, quadIndices + 6 );
+
+	SGSScene::SubObject subObject;
+	subObject.material.textureIndex[0] = SGSScene::NO_TEXTURE;
+	subObject.material.alphaType = SGSScene::Material::AT_NONE;
+	subObject.material.alpha = 255;
+	subObject.material.diffuse.r = subObject.material.diffuse.g = subObject.material.diffuse.b = 255;
+	subObject.startIndex = 0;
+	subObject.numIndices = 6;
+	subObject.startVertex = 0;
+	subObject.numVertices = 4;
+	scene.subObjects.push_back( subObject );
+
+	SGSScene::Model model;
+	model.startSubObject = 0;
+	model.numSubObjects = 1;
+	scene.models.push_back( model );
+}
+
+// fills the tracer with random triangles, every triangle is its own instance
+static void createRandomTriangles( CpuRayTracer &tracer, int numTriangles ) {
+	tracer.clearGeometry();
+
+	for( int triangleIndex = 0 ; triangleIndex < numTriangles ; triangleIndex++ ) {
+		const Vector3f center = randomPosition( 10.0f );
+		for( int corner = 0 ; corner < 3 ; corner++ ) {
+			SGSScene::Vertex vertex = {};
+			Vector3f::Map( vertex.position ) = center + randomPosition( 1.0f );
+			vertex.normal[2] = 1.0f;
+			tracer.vertices.push_back( vertex );
+			tracer.indices.push_back( triangleIndex * 3 + corner );
+		}
+
+		CpuRayTracer::MaterialInfo materialInfo = {};
+		materialInfo.objectIndex = triangleIndex;
+		materialInfo.modelIndex = triangleIndex % 7;
+		materialInfo.textureIndex = -1;
+		materialInfo.alphaType = CpuRayTracer::MaterialInfo::AT_NONE;
+		materialInfo.alpha = 1.0f;
+
+		tracer.materialIndices.push_back( triangleIndex );
+		tracer.materialInfos.push_back( materialInfo );
+	}
+
+	tracer.build();
+}
+
+static CpuRayTracer::Hit traceBruteForce( const CpuRayTracer &tracer, const CpuRayTracer::Ray &ray, const RenderContext &renderContext ) {
+	CpuRayTracer::Hit closestHit;
+	float closestDistance = ray.tMax;
+
+	const int numTriangles = tracer.materialIndices.size();
+	for( int triangleIndex = 0 ; triangleIndex < numTriangles ; triangleIndex++ ) {
+		const auto &materialInfo = tracer.materialInfos[ tracer.materialIndices[ triangleIndex ] ];
+		if( materialInfo.objectIndex == renderContext.disabledInstanceIndex || materialInfo.modelIndex == renderContext.disabledModelIndex ) {
+			continue;
+		}
+
+		const Vector3f p0 = Vector3f::Map( tracer.vertices[ tracer.indices[ triangleIndex * 3 ] ].position );
+		const Vector3f p1 = Vector3f::Map( tracer.vertices[ tracer.indices[ triangleIndex * 3 + 1 ] ].position );
+		const Vector3f p2 = Vector3f::Map( tracer.vertices[ tracer.indices[ triangleIndex * 3 + 2 ] ].position );
+
+		const Vector3f e0 = p1 - p0;
+		const Vector3f e1 = p0 - p2;
+		const Vector3f n = e1.cross( e0 );
+		const Vector3f e2 = (p0 - ray.origin) / n.dot( ray.direction );
+		const Vector3f i = ray.direction.cross( e2 );
+		const float beta = i.dot( e1 );
+		const float gamma = i.dot( e0 );
+		const float t = n.dot( e2 );
+
+		if( t < closestDistance && t > ray.tMin && beta >= 0.0f && gamma >= 0.0f && beta + gamma <= 1.0f ) {
+			closestDistance = t;
+			closestHit.triangleIndex = triangleIndex;
+			closestHit.distance = t;
+		}
+	}
+	return closestHit;
+}
+
+TEST( CpuRayTracer, closestHitMatchesBruteForce ) {
+	srand( 0 );
+
+	CpuRayTracer tracer;
+	createRandomTriangles( tracer, 500 );
+
+	RenderContext renderContext;
+	renderContext.disabledModelIndex = 3;
+
+	for( int rayIndex = 0 ; rayIndex < 500 ; rayIndex++ ) {
+		const CpuRayTracer::Ray ray( randomPosition( 10.0f ), (randomPosition( 2.0f ) - Vector3f::Constant( 1.0f )).normalized(), 0.005f, 20.0f );
+
+		const auto hit = tracer.traceClosest( ray, renderContext );
+		const auto expectedHit = traceBruteForce( tracer, ray, renderContext );
+
+		ASSERT_EQ( expectedHit.hasHit(), hit.hasHit() );
+		if( hit.hasHit() ) {
+			EXPECT_EQ( expectedHit.triangleIndex, hit.triangleIndex );
+			EXPECT_FLOAT_EQ( expectedHit.distance, hit.distance );
+		}
+	}
+}
+
+TEST( CpuRayTracer, packetsMatchSingleRays ) {
+	srand( 1 );
+
+	CpuRayTracer tracer;
+	createRandomTriangles( tracer, 500 );
+
+	RenderContext renderContext;
+	renderContext.disabledInstanceIndex = 17;
+
+	for( int packetIndex = 0 ; packetIndex < 200 ; packetIndex++ ) {
+		const Vector3f origin = randomPosition( 10.0f );
+		const Vector3f mainDirection = (randomPosition( 2.0f ) - Vector3f::Constant( 1.0f )).normalized();
+
+		Vector3f directions[4];
+		float tMaxs[4];
+		for( int lane = 0 ; lane < 4 ; lane++ ) {
+			directions[ lane ] = (mainDirection + (randomPosition( 0.4f ) - Vector3f::Constant( 0.2f ))).normalized();
+			// the last lane is inactive in every other packet
+			tMaxs[ lane ] = (lane == 3 && packetIndex % 2) ? -1.0f : 20.0f;
+		}
+
+		CpuRayTracer::Hit hits[4];
+		tracer.traceClosestPacket( origin, directions, 0.005f, tMaxs, renderContext, hits );
+
+		for( int lane = 0 ; lane < 4 ; lane++ ) {
+			if( tMaxs[ lane ] < 0.0f ) {
+				EXPECT_FALSE( hits[ lane ].hasHit() );
+				continue;
+			}
+
+			const auto expectedHit = tracer.traceClosest( CpuRayTracer::Ray( origin, directions[ lane ], 0.005f, tMaxs[ lane ] ), renderContext );
+			ASSERT_EQ( expectedHit.hasHit(), hits[ lane ].hasHit() );
+			if( expectedHit.hasHit() ) {
+				EXPECT_EQ( expectedHit.triangleIndex, hits[ lane ].triangleIndex );
+				// the packets multiply by the reciprocal instead of dividing
+				EXPECT_NEAR( expectedHit.distance, hits[ lane ].distance, 1e-5f * (1.0f + expectedHit.distance) );
+			}
+		}
+	}
+}
+
+TEST( CpuRayTracer, sampleProbesInFrontOfWall ) {
+	SGSScene scene;
+	createQuadScene( scene );
+
+	CpuRayTracer tracer;
+	// a big wall at z = 0 and a small quad behind the probe which is disabled
+	tracer.addInstance( scene, 0, 0, Affine3f( Scaling( 100.0f ) ) );
+	tracer.addInstance( scene, 1, 0, Affine3f( Translation3f( 0.0f, 0.0f, 5.0f ) ) );
+	tracer.build();
+
+	CpuRayTracer::TransformedProbes probes( 2 );
+	// looks at the wall from z = 2
+	probes[0].position = optix::make_float3( 0.0f, 0.0f, 2.0f );
+	probes[0].direction = optix::make_float3( 0.0f, 0.0f, -1.0f );
+	// looks away from the wall (and at the disabled quad)
+	probes[1].position = optix::make_float3( 0.0f, 0.0f, 2.0f );
+	probes[1].direction = optix::make_float3( 0.0f, 0.0f, 1.0f );
+
+	RenderContext renderContext;
+	renderContext.disabledInstanceIndex = 1;
+
+	CpuRayTracer::ProbeSamples probeSamples;
+	tracer.sampleProbes( probes, probeSamples, renderContext, 10.0f );
+
+	ASSERT_EQ( 2, probeSamples.size() );
+
+	EXPECT_EQ( OptixProgramInterface::numProbeSamples, probeSamples[0].occlusion );
+	// the rays are at most 22.5 deg off the probe direction
+	EXPECT_LE( 2.0f, probeSamples[0].distance );
+	EXPECT_GE( 2.0f / cosf( 22.5f / 180.0f * 3.1415926f ), probeSamples[0].distance );
+	// the wall is white and lit
+	EXPECT_LT( 0, probeSamples[0].colorLab.x );
+
+	EXPECT_EQ( 0, probeSamples[1].occlusion );
+	EXPECT_EQ( 0.0f, probeSamples[1].distance );
+}
@@ -0,0 +1,44 @@
+#include "modelDatabaseStorage.h"
+
+#include "gtest.h"
+
+#include <stdio.h>
+
+TEST( ModelDatabase, loadSortsTheProbesOfOldDatabases ) {
+	ProbeGenerator::initDirections();
+
+	// databases that have been stored before the probes were sorted have them in raster order (by direction, z, y, x)
+	ModelDatabase::ModelInformation::Probes rasterProbes;
+	for( int directionIndex = 0 ; directionIndex < 3 ; directionIndex++ ) {
+		for( int z = -2 ; z <= 2 ; z++ ) {
+			for( int y = -2 ; y <= 2 ; y++ ) {
+				for( int x = -2 ; x <= 2 ; x++ ) {
+					ProbeGenerator::Probe probe;
+					probe.position = ProbeGenerator::char3( x, y, z );
+					probe.directionIndex = directionIndex;
+					rasterProbes.push_back( probe );
+				}
+			}
+		}
+	}
+
+	ModelDatabase::ModelInformation::Probes sortedProbes = rasterProbes;
+	ProbeGenerator::sortProbes( sortedProbes );
+	ASSERT_FALSE( ProbeGenerator::haveSameProbes( rasterProbes, sortedProbes ) );
+
+	{
+		ModelDatabase modelDatabase( nullptr );
+		modelDatabase.informationById.push_back( ModelDatabase::ModelInformation() );
+		modelDatabase.informationById.back().name = "model";
+		modelDatabase.informationById.back().probes = rasterProbes;
+		modelDatabase.store( "test_modelDatabase" );
+	}
+
+	ModelDatabase modelDatabase( nullptr );
+	ASSERT_TRUE( modelDatabase.load( "test_modelDatabase" ) );
+	ASSERT_EQ( 1, modelDatabase.informationById.size() );
+	EXPECT_EQ( "model", modelDatabase.informationById[ 0 ].name );
+	EXPECT_TRUE( ProbeGenerator::haveSameProbes( sortedProbes, modelDatabase.informationById[ 0 ].probes ) );
+
+	remove( "test_modelDatabase" );
+}
@@ -2,6 +2,8 @@
 
 #include "gtest.h"
 
+#include <boost/range/algorithm/equal.hpp>
+
 using namespace Neighborhood;
 
 //////////////////////////////////////////////////////////////////////////
@@ -10,7 +12,94 @@ using namespace Neighborhood;
 
 using namespace Neighborhood;
 
+typedef NeighborhoodDatabaseV2::Query::UnmatchedDistance UnmatchedDistance;
+typedef NeighborhoodDatabaseV2::Query::UnmatchedDistances UnmatchedDistances;
+
+// the old implementation of processUnmatchedDistances: it sorts all remaining mismatches again in every round
+// (it used an unstable sort for the bins, so it kept an arbitrary mismatch of an instance that appears more than once in a bin;
+// the streaming implementation always keeps the closest one, which is what the stable sort does here, too)
+template< typename Policy >
+static void processUnmatchedDistancesBySorting(
+	NeighborhoodDatabaseV2::Query &query,
+	Id sceneNeighborModelId,
+	UnmatchedDistances &&unmatchedDistances,
+	typename Policy::Scores &neighborModelCandidateScores
+) {
+	const float neighborModelTolerance = Policy::getNeighborModelTolerance( &query, sceneNeighborModelId );
+
+	UnmatchedDistances deferredUnmatchedDistances;
+	while( !unmatchedDistances.empty() ) {
+		boost::sort( unmatchedDistances, UnmatchedDistance::less_by_distance );
+
+		for( auto unmatchedDistance = unmatchedDistances.begin() ; unmatchedDistance != unmatchedDistances.end() ; ) {
+			const auto binBegin = unmatchedDistance;
+			{
+				const float beginDistance = binBegin->distance;
+				const float toleranceScale = Policy::getDistanceToleranceScale( binBegin->distance );
+				const float endDistance = beginDistance + 2 * neighborModelTolerance * toleranceScale + 2 * query.queryTolerance;
+				do {
+					++unmatchedDistance;
+				} while(
+						unmatchedDistance != unmatchedDistances.end()
+					&&
+						unmatchedDistance->distance <= endDistance
+				);
+			}
+			const auto binEnd = unmatchedDistance;
+
+			std::stable_sort( binBegin, binEnd, UnmatchedDistance::less_by_globalInstanceIndex );
+
+			std::vector<int> correlatedGlobalInstanceIndices;
+			for( auto binElement = binBegin ; binElement != binEnd ; ) {
+				const int globalInstanceIndex = binElement->globalInstanceIndex;
+				correlatedGlobalInstanceIndices.push_back( globalInstanceIndex );
+				++binElement;
+
+				while(
+						binElement != binEnd
+					&&
+						binElement->globalInstanceIndex == globalInstanceIndex
+				) {
+					deferredUnmatchedDistances.push_back( *binElement );
+					++binElement;
+				}
+			}
+
+			neighborModelCandidateScores.integrateCorrelatedUnmatchedDistances( correlatedGlobalInstanceIndices );
+		}
+
+		unmatchedDistances.swap( deferredUnmatchedDistances );
+		deferredUnmatchedDistances.clear();
+	}
+}
+
+// compares the streaming binning of the mismatches with the old implementation for every neighbor model
+template< typename Policy >
+static void expectSameScoresAsSortingImplementation( NeighborhoodDatabaseV2::Query &query ) {
+	const int totalNumInstances = query.database.getTotalNumInstances();
+
+	NeighborhoodDatabaseV2::Query::NeighborModelScratch< Policy > scratch( totalNumInstances );
+	for( int sceneNeighborModelId = 0 ; sceneNeighborModelId < query.database.numIds ; ++sceneNeighborModelId ) {
+		scratch.neighborModelCandidateScores.reset();
+		query.matchDistances<Policy>( sceneNeighborModelId, scratch );
+
+		typename Policy::Scores expectedScores( scratch.neighborModelCandidateScores );
+		processUnmatchedDistancesBySorting<Policy>( query, sceneNeighborModelId, UnmatchedDistances( scratch.unmatchedDistances ), expectedScores );
+
+		query.processUnmatchedDistances<Policy>( sceneNeighborModelId, scratch );
+
+		for( int globalInstanceIndex = 0 ; globalInstanceIndex < totalNumInstances ; ++globalInstanceIndex ) {
+			EXPECT_FLOAT_EQ(
+				expectedScores.getInstanceScore( globalInstanceIndex ),
+				scratch.neighborModelCandidateScores.getInstanceScore( globalInstanceIndex )
+			);
+		}
+	}
+}
+
 Results myExecuteQuery( NeighborhoodDatabaseV2::Query &query ) {
+	expectSameScoresAsSortingImplementation< NeighborhoodDatabaseV2::Query::JaccardIndexPolicy >( query );
+
 	auto queryResults = query.execute();
 	boost::sort( queryResults, std::greater<Result>() );
 	return queryResults;
@@ -18,6 +107,8 @@ Results myExecuteQuery( NeighborhoodDatabaseV2::Query &query ) {
 
 template<typename Policy>
 Results myExecuteQueryPolicy( NeighborhoodDatabaseV2::Query &query ) {
+	expectSameScoresAsSortingImplementation< Policy >( query );
+
 	auto queryResults = query.executeWithPolicy<Policy>();
 	boost::sort( queryResults, std::greater<Result>() );
 	return queryResults;
@@ -92,6 +183,98 @@ TEST( NeighborhoodDatabaseV2_Entry, addInstance ) {
 	ASSERT_EQ( 1, constEntry.instances.size() );
 }
 
+TEST( NeighborhoodDatabaseV2, compile ) {
+	NeighborhoodDatabaseV2 db;
+
+	RawIdDistances rawDataset;
+	rawDataset.push_back( std::make_pair( 0, 2.0f ) );
+	rawDataset.push_back( std::make_pair( 2, 3.0f ) );
+	rawDataset.push_back( std::make_pair( 0, 1.0f ) );
+	db.addInstance( 5, RawIdDistances( rawDataset ) );
+
+	db.addInstance( 3, RawIdDistances( 1, std::make_pair( 2, 4.0f ) ) );
+	db.addInstance( 5, RawIdDistances( 1, std::make_pair( 2, 5.0f ) ) );
+
+	ASSERT_FALSE( db.isCompiled() );
+	db.compile();
+	ASSERT_TRUE( db.isCompiled() );
+
+	const NeighborDistanceIndex &index = db.distanceIndex;
+
+	// the instances of model 5 come first, then the instance of model 3
+	const int expectedCandidateModelIndices[] = { 0, 0, 1 };
+	EXPECT_TRUE( boost::equal( expectedCandidateModelIndices, index.candidateModelIndicesByGlobalInstance ) );
+
+	const NeighborDistanceIndex::Column &column0 = index.getColumn( 0 );
+	ASSERT_EQ( 1, column0.getNumInstances() );
+	EXPECT_EQ( 0, column0.globalInstanceIndices[0] );
+	const float expectedDistances0[] = { 1.0f, 2.0f };
+	EXPECT_TRUE( boost::equal( expectedDistances0, column0.distances ) );
+
+	EXPECT_EQ( 0, index.getColumn( 1 ).getNumInstances() );
+
+	const NeighborDistanceIndex::Column &column2 = index.getColumn( 2 );
+	const int expectedGlobalInstanceIndices2[] = { 0, 1, 2 };
+	const int expectedOffsets2[] = { 0, 1, 2, 3 };
+	const float expectedDistances2[] = { 3.0f, 5.0f, 4.0f };
+	EXPECT_TRUE( boost::equal( expectedGlobalInstanceIndices2, column2.globalInstanceIndices ) );
+	EXPECT_TRUE( boost::equal( expectedOffsets2, column2.offsets ) );
+	EXPECT_TRUE( boost::equal( expectedDistances2, column2.distances ) );
+
+	// unknown ids have no distances
+	EXPECT_EQ( 0, index.getColumn( 100 ).getNumInstances() );
+
+	db.addInstance( 3, RawIdDistances( rawDataset ) );
+	EXPECT_FALSE( db.isCompiled() );
+}
+
+TEST( NeighborhoodDatabaseV2_Query, sparseImportanceScoring ) {
+	typedef NeighborhoodDatabaseV2::Query::ImportanceWeightPolicy Policy;
+
+	const int totalNumInstances = 50;
+	const int numQueryDistances = 7;
+
+	// [ globalInstanceIndex ][ queryDistanceIndex ]
+	bool matched[ totalNumInstances ][ numQueryDistances ] = {};
+
+	Policy::MatchedDistances matchedDistances( totalNumInstances, numQueryDistances );
+	srand( 0 );
+	for( int globalInstanceIndex = 0 ; globalInstanceIndex < totalNumInstances ; globalInstanceIndex++ ) {
+		for( int queryDistanceIndex = 0 ; queryDistanceIndex < numQueryDistances ; queryDistanceIndex++ ) {
+			// the last query distance is matched by everybody
+			if( queryDistanceIndex == numQueryDistances - 1 || rand() % (queryDistanceIndex + 2) == 0 ) {
+				matched[ globalInstanceIndex ][ queryDistanceIndex ] = true;
+				matchedDistances.match( globalInstanceIndex, queryDistanceIndex );
+			}
+		}
+	}
+
+	Policy::Scores scores( totalNumInstances );
+	scores.integrateMatchedDistances( matchedDistances );
+
+	// dense reference: add up the weights of all (instance, query distance) pairs
+	for( int globalInstanceIndex = 0 ; globalInstanceIndex < totalNumInstances ; globalInstanceIndex++ ) {
+		float expectedScore = 0.0f;
+		float expectedWeight = 0.0f;
+		for( int queryDistanceIndex = 0 ; queryDistanceIndex < numQueryDistances ; queryDistanceIndex++ ) {
+			const float frequency = (matchedDistances.matchedQueryDistanceCounters[ queryDistanceIndex ] + 1.0f) / (totalNumInstances + 2.0f);
+			const float positiveMessageLength = getMessageLength( frequency );
+			const float negativeMessageLength = getMessageLength( 1.0f - frequency );
+
+			if( matched[ globalInstanceIndex ][ queryDistanceIndex ] ) {
+				expectedScore += positiveMessageLength * 2.0f;
+				expectedWeight += positiveMessageLength * 2.0f;
+			}
+			else {
+				expectedWeight += positiveMessageLength + negativeMessageLength;
+			}
+		}
+
+		EXPECT_NEAR( expectedScore, scores.candidateInstanceScores[ globalInstanceIndex ], 1e-4f );
+		EXPECT_NEAR( expectedWeight, scores.candidateInstanceImportanceWeights[ globalInstanceIndex ], 1e-4f );
+	}
+}
+
 TEST( NeighborhoodDatabaseV2_Query, all ) {
 	NeighborhoodDatabaseV2 db;
 
@@ -112,6 +295,7 @@ TEST( NeighborhoodDatabaseV2_Query, all ) {
 	db.modelDatabase = &modelDatabase;
 
 	db.addInstance( 1, RawIdDistances( rawDataset ) );
+	db.compile();
 
 	NeighborhoodDatabaseV2::Query query( db, 2.0, std::move( rawDataset ) );
 
@@ -175,6 +359,8 @@ static void addSimpleScene( int distance, NeighborhoodDatabaseV2 &database, cons
 			database.addInstance( modelIndex, std::move( rawDataset ) );
 		}
 	}
+
+	database.compile();
 }
 
 struct SimpleInstance {
@@ -210,6 +396,8 @@ static void addInstances( NeighborhoodDatabaseV2 &database, std::vector< SimpleI
 		const int modelIndex = simpleInstances[instanceIndex].modelIndex;
 		database.addInstance( modelIndex, std::move( rawDataset ) );
 	}
+
+	database.compile();
 }
 
 template< int numCircles, int numModels >
@@ -784,6 +972,160 @@ TEST( NeighborhoodDatabase_Query, compcase1b ) {
 }
 
 
+// executes the query one neighbor model after another (like executeWithPolicy before it ran in parallel)
+template< typename Policy >
+static Results executeSerially( NeighborhoodDatabaseV2::Query &query ) {
+	const NeighborhoodDatabaseV2 &database = query.database;
+
+	typename Policy::Scores totalScores( database.getTotalNumInstances() );
+	for( int sceneNeighborModelId = 0 ; sceneNeighborModelId < database.numIds ; ++sceneNeighborModelId ) {
+		const float neighborModelWeight = Policy::getNeighborModelWeight( &query, sceneNeighborModelId );
+		if( neighborModelWeight == 0.0f ) {
+			continue;
+		}
+
+		totalScores.integrateNeighborModelCandidateScores( neighborModelWeight, query.matchAgainstNeighborModel<Policy>( sceneNeighborModelId ) );
+	}
+
+	Results results;
+	int globalInstanceIndex = 0;
+	for( int candidateModelIndex = 0 ; candidateModelIndex < database.getNumSampledModels() ; ++candidateModelIndex ) {
+		const int numCandidateInstances = database.sampledModelsById[ candidateModelIndex ].second.instances.size();
+
+		float bestCandidateInstanceScore = 0;
+		for( int instanceIndex = 0 ; instanceIndex < numCandidateInstances ; ++instanceIndex, ++globalInstanceIndex ) {
+			bestCandidateInstanceScore = std::max( bestCandidateInstanceScore, totalScores.getInstanceScore( globalInstanceIndex ) );
+		}
+		results.push_back( Result( bestCandidateInstanceScore, database.sampledModelsById[ candidateModelIndex ].first ) );
+	}
+	return results;
+}
+
+template< typename Policy >
+static void expectSameResultsAsSerialExecution( const NeighborhoodDatabaseV2 &database, const RawIdDistances &queryDataset ) {
+	NeighborhoodDatabaseV2::Query query( database, 0.5, RawIdDistances( queryDataset ) );
+
+	const Results expectedResults = executeSerially<Policy>( query );
+	// run it twice to make sure that the reused scratch buffers don't leak into the next query
+	for( int i = 0 ; i < 2 ; i++ ) {
+		const Results results = query.executeWithPolicy<Policy>();
+
+		ASSERT_EQ( expectedResults.size(), results.size() );
+		for( int resultIndex = 0 ; resultIndex < results.size() ; resultIndex++ ) {
+			EXPECT_EQ( expectedResults[ resultIndex ].second, results[ resultIndex ].second );
+			EXPECT_NEAR( expectedResults[ resultIndex ].first, results[ resultIndex ].first, 1e-4f );
+		}
+	}
+}
+
+// a dense scene with lots of instances of the same models at similar distances
+static void createRandomScene( ModelDatabase &modelDatabase, NeighborhoodDatabaseV2 &database, RawIdDistances &queryDataset ) {
+	const int numModels = 24;
+
+	srand( 0 );
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		ModelDatabase::ModelInformation info;
+		info.area = info.volume = 1.0;
+		info.diagonalLength = 0.1f + (rand() % 100) * 0.01f;
+		modelDatabase.informationById.emplace_back( std::move( info ) );
+	}
+
+	database.modelDatabase = &modelDatabase;
+
+	std::vector< SimpleInstance > simpleInstances;
+	for( int instanceIndex = 0 ; instanceIndex < 300 ; instanceIndex++ ) {
+		const Eigen::Vector3f position( (rand() % 1000) * 0.01f, (rand() % 1000) * 0.01f, 0.0f );
+		simpleInstances.emplace_back( SimpleInstance( rand() % numModels, position ) );
+	}
+	addInstances( database, std::move( simpleInstances ), 4.0f );
+
+	for( int distanceIndex = 0 ; distanceIndex < 40 ; distanceIndex++ ) {
+		queryDataset.push_back( IdDistancePair( rand() % numModels, (rand() % 400) * 0.01f ) );
+	}
+}
+
+TEST( NeighborhoodDatabaseV2_Query, streamingBinningMatchesSortingImplementation ) {
+	ModelDatabase modelDatabase( nullptr );
+	NeighborhoodDatabaseV2 database;
+	RawIdDistances queryDataset;
+	createRandomScene( modelDatabase, database, queryDataset );
+
+	NeighborhoodDatabaseV2::Query query( database, 0.5, std::move( queryDataset ) );
+
+	expectSameScoresAsSortingImplementation< NeighborhoodDatabaseV2::Query::UniformWeightPolicy >( query );
+	expectSameScoresAsSortingImplementation< NeighborhoodDatabaseV2::Query::ImportanceWeightPolicy >( query );
+	expectSameScoresAsSortingImplementation< NeighborhoodDatabaseV2::Query::CrazyImportanceWeightPolicy >( query );
+	expectSameScoresAsSortingImplementation< NeighborhoodDatabaseV2::Query::JaccardIndexPolicy >( query );
+}
+
+TEST( NeighborhoodDatabaseV2_Query, parallelExecutionMatchesSerialExecution ) {
+	ModelDatabase modelDatabase( nullptr );
+	NeighborhoodDatabaseV2 database;
+	RawIdDistances queryDataset;
+	createRandomScene( modelDatabase, database, queryDataset );
+
+	expectSameResultsAsSerialExecution< NeighborhoodDatabaseV2::Query::UniformWeightPolicy >( database, queryDataset );
+	expectSameResultsAsSerialExecution< NeighborhoodDatabaseV2::Query::ImportanceWeightPolicy >( database, queryDataset );
+	expectSameResultsAsSerialExecution< NeighborhoodDatabaseV2::Query::CrazyImportanceWeightPolicy >( database, queryDataset );
+	expectSameResultsAsSerialExecution< NeighborhoodDatabaseV2::Query::JaccardIndexPolicy >( database, queryDataset );
+}
+
+
+TEST( NeighborhoodDatabaseV2, addInstancesMatchesAddInstance ) {
+	const int numModels = 16;
+	const int numInstances = 200;
+
+	srand( 1 );
+	std::vector< Id > ids;
+	std::vector< int > offsets( 1, 0 );
+	RawIdDistances rawDatasets;
+	for( int instanceIndex = 0 ; instanceIndex < numInstances ; instanceIndex++ ) {
+		ids.push_back( rand() % numModels );
+
+		const int numDistances = rand() % 30;
+		for( int distanceIndex = 0 ; distanceIndex < numDistances ; distanceIndex++ ) {
+			rawDatasets.push_back( IdDistancePair( rand() % numModels, (rand() % 400) * 0.01f ) );
+		}
+		offsets.push_back( rawDatasets.size() );
+	}
+
+	NeighborhoodDatabaseV2 serialDatabase;
+	for( int instanceIndex = 0 ; instanceIndex < numInstances ; instanceIndex++ ) {
+		serialDatabase.addInstance( ids[ instanceIndex ], RawIdDistances( rawDatasets.begin() + offsets[ instanceIndex ], rawDatasets.begin() + offsets[ instanceIndex + 1 ] ) );
+	}
+
+	// add the instances in two batches to make sure we append to existing sampled models
+	NeighborhoodDatabaseV2 batchDatabase;
+	const int numFirstBatchInstances = numInstances / 2;
+	batchDatabase.addInstances(
+		std::vector< Id >( ids.begin(), ids.begin() + numFirstBatchInstances ),
+		std::vector< int >( offsets.begin(), offsets.begin() + numFirstBatchInstances + 1 ),
+		rawDatasets
+	);
+	batchDatabase.addInstances(
+		std::vector< Id >( ids.begin() + numFirstBatchInstances, ids.end() ),
+		std::vector< int >( offsets.begin() + numFirstBatchInstances, offsets.end() ),
+		rawDatasets
+	);
+
+	EXPECT_EQ( serialDatabase.numIds, batchDatabase.numIds );
+	EXPECT_EQ( serialDatabase.totalNumInstances, batchDatabase.totalNumInstances );
+	ASSERT_EQ( serialDatabase.getNumSampledModels(), batchDatabase.getNumSampledModels() );
+
+	for( int sampledModelIndex = 0 ; sampledModelIndex < serialDatabase.getNumSampledModels() ; sampledModelIndex++ ) {
+		const Id id = serialDatabase.sampledModelsById[ sampledModelIndex ].first;
+		const auto &serialInstances = serialDatabase.sampledModelsById[ sampledModelIndex ].second.instances;
+		const auto &batchInstances = batchDatabase.getSampledModel( id ).instances;
+
+		ASSERT_EQ( serialInstances.size(), batchInstances.size() );
+		for( int instanceIndex = 0 ; instanceIndex < serialInstances.size() ; instanceIndex++ ) {
+			for( int otherId = 0 ; otherId < numModels ; otherId++ ) {
+				EXPECT_EQ( serialInstances[ instanceIndex ].getDistances( otherId ), batchInstances[ instanceIndex ].getDistances( otherId ) );
+			}
+		}
+	}
+}
+
 //incubation/unused code
 #if 0
 TEST( NeighborhoodDatabase_Query, compcase1 ) {
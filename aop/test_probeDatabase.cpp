@@ -1,5 +1,8 @@
 #include "probeDatabase.h"
+#include "probeSamplingPipeline.h"
+#include "probeSampleCache.h"
 #include "gtest.h"
+#include <fstream>
 
 using namespace ProbeContext;
 
@@ -149,6 +152,151 @@ TEST( IndexedProbeSamples, setOcclusionLowerBounds ) {
 		EXPECT_EQ( dataset.occlusionLowerBounds[i], dataset.size() );
 	}
 }
+
+static DBProbeSamples makeRandomProbeSamples( int numSamples ) {
+	DBProbeSamples probeSamples;
+	for( int probeIndex = 0 ; probeIndex < numSamples ; probeIndex++ ) {
+		// multiples of 1/8 keep the distance comparisons exact
+		DBProbeSample probeSample = makeProbeSample( rand() % (OptixProgramInterface::numProbeSamples + 1), float( rand() % 64 ) * 0.125f );
+		probeSample.colorLab.x = char( rand() % 16 );
+		probeSample.colorLab.y = char( rand() % 16 - 8 );
+		probeSample.colorLab.z = char( rand() % 16 - 8 );
+		probeSample.probeIndex = probeIndex;
+		probeSample.weight = 1;
+		probeSamples.push_back( probeSample );
+	}
+	return probeSamples;
+}
+
+struct RecordingMatcherController {
+	std::vector< std::pair< int, int > > *matches;
+
+	RecordingMatcherController( std::vector< std::pair< int, int > > *matches ) : matches( matches ) {}
+
+	void onMatch( int outerProbeSampleIndex, int innerProbeSampleIndex, const DBProbeSample &outer, const DBProbeSample &inner ) {
+		matches->push_back( std::make_pair( outerProbeSampleIndex, innerProbeSampleIndex ) );
+	}
+
+	void onNewThreadStarted() {
+	}
+};
+
+TEST( IndexedProbeSamples, matcher_matchesNaiveSearch ) {
+	srand( 0 );
+	const IndexedProbeSamples outer( makeRandomProbeSamples( 1000 ) );
+	const IndexedProbeSamples inner( makeRandomProbeSamples( 3000 ) );
+
+	ProbeContextTolerance probeContextTolerance;
+	probeContextTolerance.occusionTolerance = 2.0f / OptixProgramInterface::numProbeSamples;
+	probeContextTolerance.colorLabTolerance = 6.5f;
+	probeContextTolerance.distanceTolerance = 0.25f;
+
+	std::vector< std::pair< int, int > > expectedMatches;
+	for( int indexOuter = 0 ; indexOuter < outer.size() ; indexOuter++ ) {
+		for( int indexInner = 0 ; indexInner < inner.size() ; indexInner++ ) {
+			if( DBProbeSample::matchOcclusionDistanceColor(
+					outer.getProbeSample( indexOuter ),
+					inner.getProbeSample( indexInner ),
+					probeContextTolerance.getOcclusionIntegerTolerance(),
+					probeContextTolerance.distanceTolerance,
+					int( probeContextTolerance.colorLabTolerance * probeContextTolerance.colorLabTolerance )
+				)
+			) {
+				expectedMatches.push_back( std::make_pair( indexOuter, indexInner ) );
+			}
+		}
+	}
+	ASSERT_FALSE( expectedMatches.empty() );
+
+	const BitPlaneKernels::InstructionSet instructionSets[] = { BitPlaneKernels::IS_SCALAR, BitPlaneKernels::IS_SSE42, BitPlaneKernels::IS_AVX2 };
+	for( int i = 0 ; i < 3 ; i++ ) {
+		SampleWindowKernels::setInstructionSet( instructionSets[ i ] );
+
+		std::vector< std::pair< int, int > > matches;
+		IndexedProbeSamples::Matcher< RecordingMatcherController > matcher( outer, inner, probeContextTolerance, RecordingMatcherController( &matches ) );
+		matcher.matchSerial();
+
+		std::sort( matches.begin(), matches.end() );
+		EXPECT_EQ( expectedMatches, matches ) << BitPlaneKernels::getInstructionSetName( SampleWindowKernels::getInstructionSet() );
+	}
+	SampleWindowKernels::setInstructionSet( SampleWindowKernels::getSupportedInstructionSet() );
+
+	// the columns have to survive clones, too
+	const IndexedProbeSamples clonedInner = inner.clone();
+	EXPECT_EQ( inner.distances, clonedInner.distances );
+	EXPECT_EQ( inner.colorL, clonedInner.colorL );
+	EXPECT_EQ( inner.colorA, clonedInner.colorA );
+	EXPECT_EQ( inner.colorB, clonedInner.colorB );
+}
+
+TEST( IndexedProbeSamples, sortIsLexicographical ) {
+	srand( 0 );
+	DBProbeSamples probeSamples = makeRandomProbeSamples( 5000 );
+	// negative colors and distances have to be ordered correctly by the radix sort, too
+	for( int probeIndex = 0 ; probeIndex < 100 ; probeIndex++ ) {
+		probeSamples[ probeIndex ].distance = -probeSamples[ probeIndex ].distance;
+		probeSamples[ probeIndex ].colorLab.x = -probeSamples[ probeIndex ].colorLab.x;
+	}
+
+	const IndexedProbeSamples indexedProbeSamples( std::move( probeSamples ) );
+	const DBProbeSamples sortedProbeSamples = indexedProbeSamples.decodeProbeSamples();
+	ASSERT_EQ( 5000, sortedProbeSamples.size() );
+	for( int index = 0 ; index + 1 < sortedProbeSamples.size() ; index++ ) {
+		ASSERT_FALSE( DBProbeSample::lexicographicalLess( sortedProbeSamples[ index + 1 ], sortedProbeSamples[ index ] ) ) << index;
+	}
+}
+
+TEST( CompactProbeSamples, encodeDecode ) {
+	const DBProbeSamples probeSamples = makeRandomProbeSamples( 1000 );
+	const float maxDistance = 8.0f;
+
+	CompactProbeSamples compactProbeSamples;
+	compactProbeSamples.encode( probeSamples.begin(), probeSamples.end(), maxDistance );
+	ASSERT_EQ( probeSamples.size(), compactProbeSamples.samples.size() );
+
+	const DBProbeSamples decodedProbeSamples = compactProbeSamples.decode();
+	ASSERT_EQ( probeSamples.size(), decodedProbeSamples.size() );
+	for( int probeIndex = 0 ; probeIndex < probeSamples.size() ; probeIndex++ ) {
+		const DBProbeSample &expected = probeSamples[ probeIndex ];
+		const DBProbeSample &decoded = decodedProbeSamples[ probeIndex ];
+		EXPECT_EQ( expected.probeIndex, decoded.probeIndex );
+		EXPECT_EQ( expected.occlusion, decoded.occlusion );
+		EXPECT_EQ( expected.colorLab.x, decoded.colorLab.x );
+		EXPECT_EQ( expected.colorLab.y, decoded.colorLab.y );
+		EXPECT_EQ( expected.colorLab.z, decoded.colorLab.z );
+		EXPECT_NEAR( expected.distance, decoded.distance, maxDistance / 65535.0f );
+	}
+}
+
+TEST( SampleProbeIndexMap, lookup ) {
+	const int numProbes = 100, numInstances = 10;
+
+	SampleProbeIndexMap sampleProbeIndexMap;
+	sampleProbeIndexMap.startFilling( numProbes, numInstances );
+
+	srand( 0 );
+	std::vector< std::vector< unsigned short > > expectedProbeIndices( 64 );
+	for( int instanceIndex = 0 ; instanceIndex < numInstances ; instanceIndex++ ) {
+		for( int probeIndex = 0 ; probeIndex < numProbes ; probeIndex++ ) {
+			const SampleQuantizer::PackedSample packedSample = rand() % 64;
+			sampleProbeIndexMap.pushInstanceSample( packedSample, probeIndex );
+			expectedProbeIndices[ packedSample ].push_back( probeIndex );
+		}
+	}
+	sampleProbeIndexMap.finishFilling();
+
+	for( int packedSample = 0 ; packedSample < 64 ; packedSample++ ) {
+		boost::sort( expectedProbeIndices[ packedSample ] );
+
+		std::vector< unsigned short > probeIndices;
+		const auto range = sampleProbeIndexMap.lookup( packedSample );
+		for( auto item = range.first ; item != range.second ; ++item ) {
+			EXPECT_EQ( packedSample, item->first );
+			probeIndices.push_back( item->second );
+		}
+		EXPECT_EQ( expectedProbeIndices[ packedSample ], probeIndices ) << packedSample;
+	}
+}
 #if 0
 TEST( InstanceProbeDataset, subSet ) {
 	OptixProbeSamples rawProbeSamples;
@@ -570,3 +718,934 @@ TEST( ProbeDatabase, bigWithTolerance ) {
 	}
 }
 #endif
+
+TEST( SampleBucketHistogram, build ) {
+	SampleBitPlane bitPlane;
+	std::vector< SampleQuantizer::PackedSample > sortedSamples;
+
+	// bucket i gets i + 1 samples
+	const SampleQuantizer::PackedSample buckets[] = { 0, 1, 31, 32, 100, SampleQuantizer::numBuckets - 1 };
+	for( int i = 0 ; i < 6 ; i++ ) {
+		bitPlane.set( buckets[ i ] );
+		for( int j = 0 ; j <= i ; j++ ) {
+			sortedSamples.push_back( buckets[ i ] );
+		}
+	}
+
+	SampleBucketHistogram histogram;
+	histogram.build( bitPlane, sortedSamples );
+
+	ASSERT_EQ( 6, histogram.counts.size() );
+	for( int i = 0 ; i < 6 ; i++ ) {
+		EXPECT_EQ( i + 1, histogram.getCount( bitPlane, buckets[ i ] >> 5, buckets[ i ] & 31 ) );
+	}
+}
+
+TEST( ProbeDatabase, fastQuery_selfMatch ) {
+	RawProbeSamples rawProbeSamples;
+	for( int i = 0 ; i < 1000 ; i++ ) {
+		for( int j = 0 ; j < 5 ; j++ ) {
+			rawProbeSamples.push_back( makeProbeSample( j * 30, i * 0.005f ) );
+		}
+	}
+
+	auto probes = std::vector< DBProbe >( 5*1000 );
+
+	ProbeDatabase probeDatabase;
+
+	std::vector< std::string > modelNames;
+	modelNames.push_back( "test" );
+	probeDatabase.registerSceneModels( modelNames );
+
+	probeDatabase.addInstanceProbes( 0, Obb::Transformation(), 1.0, probes, rawProbeSamples );
+	probeDatabase.compileAll( 5.0 );
+
+	ProbeDatabase::FastQuery query( probeDatabase );
+	query.setQueryDataset( rawProbeSamples );
+	query.execute();
+
+	const auto &detailedQueryResults = query.getDetailedQueryResults();
+
+	ASSERT_EQ( 1, detailedQueryResults.size() );
+	EXPECT_FLOAT_EQ( 1.0, detailedQueryResults[0].probeMatchPercentage );
+	EXPECT_FLOAT_EQ( 1.0, detailedQueryResults[0].queryMatchPercentage );
+	EXPECT_EQ( 0, detailedQueryResults[0].sceneModelIndex );
+}
+
+TEST( ProbeDatabase, fastQuery_bucketIndex ) {
+	// model a and the query share all buckets, model b shares none
+	RawProbeSamples rawProbeSamplesA, rawProbeSamplesB;
+	for( int i = 0 ; i < 1000 ; i++ ) {
+		rawProbeSamplesA.push_back( makeProbeSample( 0, i * 0.001f ) );
+		rawProbeSamplesB.push_back( makeProbeSample( OptixProgramInterface::numProbeSamples, 4.0f + i * 0.001f ) );
+	}
+
+	auto probes = std::vector< DBProbe >( 1000 );
+
+	ProbeDatabase probeDatabase;
+
+	std::vector< std::string > modelNames;
+	modelNames.push_back( "a" );
+	modelNames.push_back( "b" );
+	probeDatabase.registerSceneModels( modelNames );
+
+	probeDatabase.addInstanceProbes( 0, Obb::Transformation(), 1.0, probes, rawProbeSamplesA );
+	probeDatabase.addInstanceProbes( 1, Obb::Transformation(), 1.0, probes, rawProbeSamplesB );
+	probeDatabase.compileAll( 5.0 );
+
+	ProbeDatabase::FastQuery query( probeDatabase );
+	query.setQueryDataset( rawProbeSamplesA );
+	query.execute();
+
+	const auto &detailedQueryResults = query.getDetailedQueryResults();
+
+	ASSERT_EQ( 1, detailedQueryResults.size() );
+	EXPECT_EQ( 0, detailedQueryResults[0].sceneModelIndex );
+	EXPECT_FLOAT_EQ( 1.0, detailedQueryResults[0].probeMatchPercentage );
+	EXPECT_FLOAT_EQ( 1.0, detailedQueryResults[0].queryMatchPercentage );
+}
+
+template< typename Query >
+void expectTopKMatchesExhaustiveSearch( const ProbeDatabase &probeDatabase, const RawProbeSamples &queryProbeSamples ) {
+	Query exhaustiveQuery( probeDatabase );
+	exhaustiveQuery.setQueryDataset( queryProbeSamples );
+	exhaustiveQuery.execute();
+
+	auto expectedResults = exhaustiveQuery.getDetailedQueryResults();
+	boost::sort( expectedResults, QueryResult::greaterByScoreAndModelIndex );
+
+	for( int k = 1 ; k <= probeDatabase.getNumSampledModels() + 1 ; k++ ) {
+		Query topKQuery( probeDatabase );
+		topKQuery.setQueryDataset( queryProbeSamples );
+		topKQuery.executeTopK( k );
+
+		const auto &topKResults = topKQuery.getDetailedQueryResults();
+		ASSERT_EQ( std::min<int>( k, expectedResults.size() ), topKResults.size() );
+		for( int i = 0 ; i < topKResults.size() ; i++ ) {
+			EXPECT_EQ( expectedResults[i].sceneModelIndex, topKResults[i].sceneModelIndex );
+			EXPECT_FLOAT_EQ( expectedResults[i].score, topKResults[i].score );
+		}
+	}
+}
+
+TEST( ProbeDatabase, query_topK ) {
+	// the models overlap the query more and more, the last one not at all
+	const int numModels = 5;
+
+	ProbeDatabase probeDatabase;
+
+	std::vector< std::string > modelNames;
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		modelNames.push_back( boost::str( boost::format( "model%i" ) % modelIndex ) );
+	}
+	probeDatabase.registerSceneModels( modelNames );
+
+	RawProbeSamples queryProbeSamples;
+	for( int i = 0 ; i < 400 ; i++ ) {
+		queryProbeSamples.push_back( makeProbeSample( i % 8, (i % 20) * 0.5f ) );
+	}
+
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		RawProbeSamples rawProbeSamples;
+		for( int i = 0 ; i < 400 ; i++ ) {
+			const bool overlaps = modelIndex < numModels - 1 && (i % (numModels - 1)) <= modelIndex;
+			rawProbeSamples.push_back( overlaps ? queryProbeSamples[i] : makeProbeSample( OptixProgramInterface::numProbeSamples, 50.0f + i ) );
+		}
+
+		auto probes = std::vector< DBProbe >( rawProbeSamples.size() );
+		probeDatabase.addInstanceProbes( modelIndex, Obb::Transformation(), 1.0, probes, rawProbeSamples );
+	}
+	probeDatabase.compileAll( 5.0 );
+
+	expectTopKMatchesExhaustiveSearch< ProbeDatabase::Query >( probeDatabase, queryProbeSamples );
+	expectTopKMatchesExhaustiveSearch< ProbeDatabase::ImportanceQuery >( probeDatabase, queryProbeSamples );
+	expectTopKMatchesExhaustiveSearch< ProbeDatabase::FastQuery >( probeDatabase, queryProbeSamples );
+	expectTopKMatchesExhaustiveSearch< ProbeDatabase::FastImportanceQuery >( probeDatabase, queryProbeSamples );
+}
+
+TEST( FullQueryScheduling, AccumulationGrid ) {
+	FullQueryScheduling::AccumulationGrid< int > grid( 100 ), otherGrid( 100 );
+	EXPECT_EQ( 0, grid.endTouched );
+
+	grid.add( 40, 2 );
+	grid.add( 10, 1 );
+	otherGrid.add( 70, 3 );
+	otherGrid.add( 40, 1 );
+	grid.add( otherGrid );
+	EXPECT_EQ( 10, grid.beginTouched );
+	EXPECT_EQ( 71, grid.endTouched );
+	EXPECT_EQ( 1, grid.values[ 10 ] );
+	EXPECT_EQ( 3, grid.values[ 40 ] );
+	EXPECT_EQ( 3, grid.values[ 70 ] );
+
+	// clearing only visits the touched cells, so they have to contain all non-zero cells
+	grid.clear();
+	EXPECT_EQ( std::vector< int >( 100 ), grid.values );
+	EXPECT_EQ( 100, grid.beginTouched );
+	EXPECT_EQ( 0, grid.endTouched );
+}
+
+template< typename FullQuery >
+void executeFullQuery_selfMatch( FullQuery &query, const RawProbes &probes, const RawProbeSamples &rawProbeSamples ) {
+	query.setQueryVolume( Obb( Obb::Transformation::Identity(), Eigen::Vector3f::Constant( 2.0f ) ), 1.0f );
+	query.setQueryDataset( probes, rawProbeSamples );
+	query.execute();
+}
+
+TEST( ProbeDatabase, fullQuery_selfMatch ) {
+	ProbeGenerator::initDirections();
+	ProbeGenerator::initOrientations();
+
+	RawProbes probes;
+	ProbeGenerator::generateQueryProbes( Eigen::Vector3f::Constant( 2.0f ), 1.0f, probes );
+
+	// every sample only matches itself
+	RawProbeSamples rawProbeSamples;
+	for( int probeIndex = 0 ; probeIndex < probes.size() ; probeIndex++ ) {
+		rawProbeSamples.push_back( makeProbeSample( 0, float( probeIndex ) ) );
+	}
+
+	ProbeDatabase probeDatabase;
+
+	std::vector< std::string > modelNames;
+	modelNames.push_back( "a" );
+	probeDatabase.registerSceneModels( modelNames );
+
+	probeDatabase.addInstanceProbes( 0, Obb::Transformation::Identity(), 1.0f, probes, rawProbeSamples );
+	probeDatabase.compileAll( 5.0 );
+
+	// one task per orientation
+	ProbeDatabase::FullQuery coarseQuery( probeDatabase );
+	coarseQuery.setProbeSamplesPerTask( INT_MAX );
+	executeFullQuery_selfMatch( coarseQuery, probes, rawProbeSamples );
+
+	// one task per direction
+	ProbeDatabase::FullQuery fineQuery( probeDatabase );
+	fineQuery.setProbeSamplesPerTask( 1 );
+	fineQuery.setStoreMatchesByOrientation( true );
+	executeFullQuery_selfMatch( fineQuery, probes, rawProbeSamples );
+
+	ASSERT_EQ( 1, coarseQuery.getDetailedQueryResults().size() );
+	ASSERT_EQ( 1, fineQuery.getDetailedQueryResults().size() );
+
+	const auto &coarseResult = coarseQuery.getDetailedQueryResults()[0];
+	const auto &fineResult = fineQuery.getDetailedQueryResults()[0];
+
+	// the identity is the only transformation that matches all samples
+	EXPECT_EQ( 0, coarseResult.sceneModelIndex );
+	EXPECT_FLOAT_EQ( 1.0f, coarseResult.score );
+	EXPECT_TRUE( coarseResult.transformation.isApprox( Eigen::Affine3f::Identity() ) );
+
+	EXPECT_EQ( coarseResult.score, fineResult.score );
+	EXPECT_TRUE( fineResult.transformation.isApprox( coarseResult.transformation ) );
+
+	// the grids are only stored on request
+	for( int orientationIndex = 0 ; orientationIndex < ProbeGenerator::getNumOrientations() ; orientationIndex++ ) {
+		EXPECT_TRUE( coarseResult.matchesByOrientation[ orientationIndex ].empty() );
+		EXPECT_EQ( fineQuery.queryVolumeSize.prod(), fineResult.matchesByOrientation[ orientationIndex ].size() );
+	}
+	EXPECT_EQ( probes.size(), *boost::max_element( fineResult.matchesByOrientation[ 0 ] ) );
+
+	ProbeDatabase::ImportanceFullQuery importanceQuery( probeDatabase );
+	importanceQuery.setProbeSamplesPerTask( 1 );
+	executeFullQuery_selfMatch( importanceQuery, probes, rawProbeSamples );
+
+	ASSERT_EQ( 1, importanceQuery.getDetailedQueryResults().size() );
+	EXPECT_TRUE( importanceQuery.getDetailedQueryResults()[0].transformation.isApprox( Eigen::Affine3f::Identity() ) );
+}
+
+static void expectSameIndexedProbeSamples( const IndexedProbeSamples &expected, const IndexedProbeSamples &actual ) {
+	ASSERT_EQ( expected.size(), actual.size() );
+	EXPECT_EQ( expected.distances, actual.distances );
+	EXPECT_EQ( expected.colorL, actual.colorL );
+	EXPECT_EQ( expected.colorA, actual.colorA );
+	EXPECT_EQ( expected.colorB, actual.colorB );
+	EXPECT_EQ( expected.occlusions, actual.occlusions );
+	EXPECT_EQ( expected.probeIndices, actual.probeIndices );
+	EXPECT_EQ( expected.weights, actual.weights );
+	EXPECT_EQ( expected.occlusionLowerBounds, actual.occlusionLowerBounds );
+}
+
+template< typename Query >
+void expectSameQueryResults( const ProbeDatabase &expectedDatabase, const ProbeDatabase &probeDatabase, const RawProbeSamples &queryProbeSamples ) {
+	Query expectedQuery( expectedDatabase );
+	expectedQuery.setQueryDataset( queryProbeSamples );
+	expectedQuery.execute();
+
+	Query query( probeDatabase );
+	query.setQueryDataset( queryProbeSamples );
+	query.execute();
+
+	const auto &expectedResults = expectedQuery.getDetailedQueryResults();
+	const auto &results = query.getDetailedQueryResults();
+	ASSERT_EQ( expectedResults.size(), results.size() );
+	for( int i = 0 ; i < results.size() ; i++ ) {
+		EXPECT_EQ( expectedResults[i].sceneModelIndex, results[i].sceneModelIndex );
+		EXPECT_EQ( expectedResults[i].score, results[i].score );
+	}
+}
+
+TEST( ProbeDatabase, mappedCache ) {
+	const int numModels = 3;
+
+	std::vector< std::string > modelNames;
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		modelNames.push_back( boost::str( boost::format( "model%i" ) % modelIndex ) );
+	}
+
+	ProbeDatabase probeDatabase;
+	probeDatabase.registerSceneModels( modelNames );
+
+	srand( 0 );
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		for( int instanceIndex = 0 ; instanceIndex < 2 ; instanceIndex++ ) {
+			const DBProbeSamples probeSamples = makeRandomProbeSamples( 500 );
+			const RawProbeSamples rawProbeSamples( probeSamples.begin(), probeSamples.end() );
+
+			auto probes = std::vector< DBProbe >( rawProbeSamples.size() );
+			probeDatabase.addInstanceProbes( modelIndex, Obb::Transformation::Identity(), 1.0, probes, rawProbeSamples );
+		}
+	}
+	probeDatabase.compileAll( 5.0 );
+
+	const DBProbeSamples queryProbeSamples = makeRandomProbeSamples( 300 );
+	const RawProbeSamples rawQueryProbeSamples( queryProbeSamples.begin(), queryProbeSamples.end() );
+
+	const char *mappedFilename = "test_probeDatabase_mapped.cache";
+	probeDatabase.store( mappedFilename );
+
+	{
+		ProbeDatabase mappedDatabase;
+		mappedDatabase.registerSceneModels( modelNames );
+		ASSERT_TRUE( mappedDatabase.load( mappedFilename ) );
+
+		ASSERT_EQ( probeDatabase.getNumSampledModels(), mappedDatabase.getNumSampledModels() );
+		for( int localModelIndex = 0 ; localModelIndex < numModels ; localModelIndex++ ) {
+			const auto &expectedModel = probeDatabase.getSampledModels()[ localModelIndex ];
+			const auto &sampledModel = mappedDatabase.getSampledModels()[ localModelIndex ];
+
+			EXPECT_EQ( expectedModel.getInstances().size(), sampledModel.getInstances().size() );
+			ASSERT_EQ( expectedModel.getMergedInstances().size(), sampledModel.getMergedInstances().size() );
+			expectSameIndexedProbeSamples( expectedModel.getMergedInstances(), sampledModel.getMergedInstances() );
+			EXPECT_EQ( 0, memcmp( expectedModel.sampleBitPlane.plane, sampledModel.sampleBitPlane.plane, sizeof( SampleBitPlane ) ) );
+			EXPECT_EQ( expectedModel.sampleBucketHistogram.counts, sampledModel.sampleBucketHistogram.counts );
+			EXPECT_EQ( expectedModel.getColorCounter().entropy, sampledModel.getColorCounter().entropy );
+
+			// the query arrays are not copied out of the mapping
+			EXPECT_TRUE( sampledModel.getMergedInstances().distances.isView() );
+			EXPECT_TRUE( sampledModel.getMergedInstancesByDirectionIndex( 0 ).colorL.isView() );
+			EXPECT_TRUE( sampledModel.linearizedProbeSamples.samples.isView() );
+			EXPECT_TRUE( sampledModel.sampleBucketHistogram.counts.isView() );
+			EXPECT_TRUE( sampledModel.sampleProbeIndexMapByDirection[ 0 ].second.sampleMultiMap.items.isView() );
+		}
+
+		expectSameQueryResults< ProbeDatabase::Query >( probeDatabase, mappedDatabase, rawQueryProbeSamples );
+		expectSameQueryResults< ProbeDatabase::FastQuery >( probeDatabase, mappedDatabase, rawQueryProbeSamples );
+
+		// the file can be replaced while the database still uses it
+		mappedDatabase.store( mappedFilename );
+		expectSameQueryResults< ProbeDatabase::FastQuery >( probeDatabase, mappedDatabase, rawQueryProbeSamples );
+		{
+			ProbeDatabase reloadedDatabase;
+			reloadedDatabase.registerSceneModels( modelNames );
+			ASSERT_TRUE( reloadedDatabase.load( mappedFilename ) );
+			expectSameQueryResults< ProbeDatabase::FastQuery >( probeDatabase, reloadedDatabase, rawQueryProbeSamples );
+		}
+
+		// compiling copies the views before changing them (the mapped pages are read-only)
+		const DBProbeSamples probeSamples = makeRandomProbeSamples( 500 );
+		const RawProbeSamples rawProbeSamples( probeSamples.begin(), probeSamples.end() );
+		auto probes = std::vector< DBProbe >( rawProbeSamples.size() );
+		probeDatabase.addInstanceProbes( 1, Obb::Transformation::Identity(), 1.0, probes, rawProbeSamples );
+		probeDatabase.compileChangedModels( 5.0 );
+		mappedDatabase.addInstanceProbes( 1, Obb::Transformation::Identity(), 1.0, probes, rawProbeSamples );
+		mappedDatabase.compileChangedModels( 5.0 );
+
+		EXPECT_FALSE( mappedDatabase.getSampledModels()[ 1 ].getMergedInstances().distances.isView() );
+		expectSameQueryResults< ProbeDatabase::Query >( probeDatabase, mappedDatabase, rawQueryProbeSamples );
+		expectSameQueryResults< ProbeDatabase::FastQuery >( probeDatabase, mappedDatabase, rawQueryProbeSamples );
+	}
+
+	// the serialized format is still supported
+	const char *serializedFilename = "test_probeDatabase_serialized.cache";
+	probeDatabase.storeSerialized( serializedFilename );
+	{
+		ProbeDatabase serializedDatabase;
+		serializedDatabase.registerSceneModels( modelNames );
+		ASSERT_TRUE( serializedDatabase.load( serializedFilename ) );
+
+		expectSameQueryResults< ProbeDatabase::Query >( probeDatabase, serializedDatabase, rawQueryProbeSamples );
+		expectSameQueryResults< ProbeDatabase::FastQuery >( probeDatabase, serializedDatabase, rawQueryProbeSamples );
+	}
+
+	// truncated caches are rejected
+	{
+		FILE *mappedFile = fopen( mappedFilename, "rb" );
+		ASSERT_TRUE( mappedFile != nullptr );
+		std::vector< char > truncatedData( 8192 );
+		ASSERT_EQ( truncatedData.size(), fread( truncatedData.data(), 1, truncatedData.size(), mappedFile ) );
+		fclose( mappedFile );
+
+		FILE *truncatedFile = fopen( mappedFilename, "wb" );
+		fwrite( truncatedData.data(), 1, truncatedData.size(), truncatedFile );
+		fclose( truncatedFile );
+
+		ProbeDatabase truncatedDatabase;
+		EXPECT_FALSE( truncatedDatabase.load( mappedFilename ) );
+		EXPECT_EQ( 0, truncatedDatabase.getNumSampledModels() );
+	}
+
+	remove( mappedFilename );
+	remove( serializedFilename );
+}
+
+TEST( SampleBucketIndex, isConsistent ) {
+	const int numModels = 3;
+
+	std::vector< std::string > modelNames;
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		modelNames.push_back( boost::str( boost::format( "model%i" ) % modelIndex ) );
+	}
+
+	ProbeDatabase probeDatabase;
+	probeDatabase.registerSceneModels( modelNames );
+
+	srand( 0 );
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		const DBProbeSamples probeSamples = makeRandomProbeSamples( 500 );
+		const RawProbeSamples rawProbeSamples( probeSamples.begin(), probeSamples.end() );
+
+		auto probes = std::vector< DBProbe >( rawProbeSamples.size() );
+		probeDatabase.addInstanceProbes( modelIndex, Obb::Transformation::Identity(), 1.0, probes, rawProbeSamples );
+	}
+	probeDatabase.compileAll( 5.0 );
+
+	SampleBucketIndex sampleBucketIndex;
+	sampleBucketIndex.build( probeDatabase.getSampledModels() );
+	EXPECT_TRUE( sampleBucketIndex.isConsistent( numModels ) );
+	EXPECT_FALSE( sampleBucketIndex.isConsistent( numModels + 1 ) );
+
+	int bucketIndex = 0;
+	while( sampleBucketIndex.bucketOffsets[ bucketIndex ] == sampleBucketIndex.bucketOffsets[ bucketIndex + 1 ] ) {
+		bucketIndex++;
+	}
+	const unsigned bucketBegin = sampleBucketIndex.bucketOffsets[ bucketIndex ];
+	const unsigned bucketEnd = sampleBucketIndex.bucketOffsets[ bucketIndex + 1 ];
+
+	// offsets that go backwards
+	{
+		SampleBucketIndex corruptIndex( sampleBucketIndex );
+		corruptIndex.bucketOffsets.makeOwning()[ bucketIndex ] = bucketEnd + 1;
+		EXPECT_FALSE( corruptIndex.isConsistent( numModels ) );
+	}
+	// offsets past the postings
+	{
+		SampleBucketIndex corruptIndex( sampleBucketIndex );
+		corruptIndex.bucketOffsets.makeOwning().back()++;
+		EXPECT_FALSE( corruptIndex.isConsistent( numModels ) );
+	}
+	// model indices past the models
+	{
+		SampleBucketIndex corruptIndex( sampleBucketIndex );
+		corruptIndex.postings.makeOwning()[ bucketBegin ] = 0x7F;
+		EXPECT_FALSE( corruptIndex.isConsistent( numModels ) );
+	}
+	// postings that run past the end of their bucket
+	{
+		SampleBucketIndex corruptIndex( sampleBucketIndex );
+		corruptIndex.postings.makeOwning()[ bucketEnd - 1 ] |= 0x80;
+		EXPECT_FALSE( corruptIndex.isConsistent( numModels ) );
+	}
+}
+
+static void expectSameCompiledState( const ProbeDatabase &expectedDatabase, const ProbeDatabase &probeDatabase ) {
+	const auto &expectedGlobalColorCounter = expectedDatabase.getGlobalColorCounter();
+	const auto &globalColorCounter = probeDatabase.getGlobalColorCounter();
+	EXPECT_EQ( expectedGlobalColorCounter.buckets, globalColorCounter.buckets );
+	EXPECT_EQ( expectedGlobalColorCounter.totalNumSamples, globalColorCounter.totalNumSamples );
+	EXPECT_FLOAT_EQ( expectedGlobalColorCounter.entropy, globalColorCounter.entropy );
+
+	ASSERT_EQ( expectedDatabase.getNumSampledModels(), probeDatabase.getNumSampledModels() );
+	for( int localModelIndex = 0 ; localModelIndex < probeDatabase.getNumSampledModels() ; localModelIndex++ ) {
+		const auto &expectedModel = expectedDatabase.getSampledModels()[ localModelIndex ];
+		const auto &sampledModel = probeDatabase.getSampledModels()[ localModelIndex ];
+
+		EXPECT_FALSE( sampledModel.isDirty() );
+		expectSameIndexedProbeSamples( expectedModel.getMergedInstances(), sampledModel.getMergedInstances() );
+		EXPECT_EQ( expectedModel.linearizedProbeSamples.samples, sampledModel.linearizedProbeSamples.samples );
+		EXPECT_EQ( expectedModel.getColorCounter().buckets, sampledModel.getColorCounter().buckets );
+		EXPECT_FLOAT_EQ( expectedModel.getColorCounter().globalMessageLength, sampledModel.getColorCounter().globalMessageLength );
+	}
+}
+
+TEST( ProbeDatabase, compileChangedModels ) {
+	const int numModels = 3;
+
+	std::vector< std::string > modelNames;
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		modelNames.push_back( boost::str( boost::format( "model%i" ) % modelIndex ) );
+	}
+
+	srand( 0 );
+	std::vector< RawProbeSamples > instanceProbeSamples;
+	for( int instanceIndex = 0 ; instanceIndex < numModels + 1 ; instanceIndex++ ) {
+		const DBProbeSamples probeSamples = makeRandomProbeSamples( 400 );
+		instanceProbeSamples.push_back( RawProbeSamples( probeSamples.begin(), probeSamples.end() ) );
+	}
+	const auto probes = std::vector< DBProbe >( 400 );
+
+	ProbeDatabase probeDatabase;
+	probeDatabase.registerSceneModels( modelNames );
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		probeDatabase.addInstanceProbes( modelIndex, Obb::Transformation(), 1.0, probes, instanceProbeSamples[ modelIndex ] );
+	}
+	probeDatabase.compileAll( 5.0 );
+
+	// merging replaces the arrays of a model, so the untouched models have to keep theirs
+	std::vector< const float * > oldMergedDistances;
+	std::vector< const SampleQuantizer::PackedSample * > oldLinearizedSamples;
+	for( int localModelIndex = 0 ; localModelIndex < numModels ; localModelIndex++ ) {
+		const auto &sampledModel = probeDatabase.getSampledModels()[ localModelIndex ];
+		oldMergedDistances.push_back( sampledModel.getMergedInstances().distances.data() );
+		oldLinearizedSamples.push_back( sampledModel.linearizedProbeSamples.samples.data() );
+	}
+
+	// add another instance to one model and only recompile that one
+	probeDatabase.addInstanceProbes( 1, Obb::Transformation(), 1.0, probes, instanceProbeSamples[ numModels ] );
+	EXPECT_TRUE( probeDatabase.getSampledModels()[ 1 ].isDirty() );
+	EXPECT_FALSE( probeDatabase.getSampledModels()[ 0 ].isDirty() );
+	probeDatabase.compileChangedModels( 5.0 );
+
+	for( int localModelIndex = 0 ; localModelIndex < numModels ; localModelIndex++ ) {
+		const auto &sampledModel = probeDatabase.getSampledModels()[ localModelIndex ];
+		const bool rebuilt = localModelIndex == 1;
+		EXPECT_EQ( rebuilt, oldMergedDistances[ localModelIndex ] != sampledModel.getMergedInstances().distances.data() ) << localModelIndex;
+		EXPECT_EQ( rebuilt, oldLinearizedSamples[ localModelIndex ] != sampledModel.linearizedProbeSamples.samples.data() ) << localModelIndex;
+	}
+
+	{
+		ProbeDatabase expectedDatabase;
+		expectedDatabase.registerSceneModels( modelNames );
+		for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+			expectedDatabase.addInstanceProbes( modelIndex, Obb::Transformation(), 1.0, probes, instanceProbeSamples[ modelIndex ] );
+		}
+		expectedDatabase.addInstanceProbes( 1, Obb::Transformation(), 1.0, probes, instanceProbeSamples[ numModels ] );
+		expectedDatabase.compileAll( 5.0 );
+
+		expectSameCompiledState( expectedDatabase, probeDatabase );
+	}
+
+	// remove a model
+	probeDatabase.clear( 0 );
+	probeDatabase.compileChangedModels( 5.0 );
+
+	{
+		ProbeDatabase expectedDatabase;
+		expectedDatabase.registerSceneModels( modelNames );
+		for( int modelIndex = 1 ; modelIndex < numModels ; modelIndex++ ) {
+			expectedDatabase.addInstanceProbes( modelIndex, Obb::Transformation(), 1.0, probes, instanceProbeSamples[ modelIndex ] );
+		}
+		expectedDatabase.addInstanceProbes( 1, Obb::Transformation(), 1.0, probes, instanceProbeSamples[ numModels ] );
+		expectedDatabase.compileAll( 5.0 );
+
+		expectSameCompiledState( expectedDatabase, probeDatabase );
+		EXPECT_EQ( 1, probeDatabase.getSceneModelIndex( 0 ) );
+		EXPECT_EQ( 2, probeDatabase.getSceneModelIndex( 1 ) );
+	}
+}
+
+TEST( ProbeDatabase, mergeChangedModels ) {
+	const int numModels = 3;
+
+	std::vector< std::string > modelNames;
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		modelNames.push_back( boost::str( boost::format( "model%i" ) % modelIndex ) );
+	}
+
+	srand( 0 );
+	std::vector< RawProbeSamples > instanceProbeSamples;
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		const DBProbeSamples probeSamples = makeRandomProbeSamples( 400 );
+		instanceProbeSamples.push_back( RawProbeSamples( probeSamples.begin(), probeSamples.end() ) );
+	}
+	const auto probes = std::vector< DBProbe >( 400 );
+
+	// merge the models one by one (like ProbeSamplingPipeline::compile) and update the global state once
+	ProbeDatabase probeDatabase;
+	probeDatabase.registerSceneModels( modelNames );
+	probeDatabase.compileAll( 5.0 );
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		probeDatabase.addInstanceProbes( modelIndex, Obb::Transformation(), 1.0, probes, instanceProbeSamples[ modelIndex ] );
+		probeDatabase.mergeChangedModels( 5.0 );
+		EXPECT_TRUE( probeDatabase.getSampledModels()[ modelIndex ].getUncompiledProbeSamples().empty() );
+	}
+	// a removed model must not be updated
+	probeDatabase.clear( 0 );
+	probeDatabase.compileChangedModels( 5.0 );
+
+	ProbeDatabase expectedDatabase;
+	expectedDatabase.registerSceneModels( modelNames );
+	for( int modelIndex = 1 ; modelIndex < numModels ; modelIndex++ ) {
+		expectedDatabase.addInstanceProbes( modelIndex, Obb::Transformation(), 1.0, probes, instanceProbeSamples[ modelIndex ] );
+	}
+	expectedDatabase.compileAll( 5.0 );
+
+	expectSameCompiledState( expectedDatabase, probeDatabase );
+}
+
+TEST( ProbeDatabase, keepInstanceSamples ) {
+	std::vector< std::string > modelNames( 1, "model" );
+
+	srand( 0 );
+	const DBProbeSamples probeSamples = makeRandomProbeSamples( 400 );
+	const RawProbeSamples rawProbeSamples( probeSamples.begin(), probeSamples.end() );
+	const auto probes = std::vector< DBProbe >( rawProbeSamples.size() );
+
+	// the instance copies are dropped by default
+	{
+		ProbeDatabase probeDatabase;
+		probeDatabase.registerSceneModels( modelNames );
+		probeDatabase.addInstanceProbes( 0, Obb::Transformation(), 1.0, probes, rawProbeSamples );
+		probeDatabase.compileAll( 5.0 );
+
+		const auto &sampledModel = probeDatabase.getSampledModels()[ 0 ];
+		ASSERT_EQ( 1, sampledModel.getInstances().size() );
+		EXPECT_FALSE( sampledModel.getInstances()[ 0 ].hasProbeSamples() );
+		EXPECT_TRUE( sampledModel.getUncompiledProbeSamples().empty() );
+		EXPECT_LT( 0, sampledModel.getMergedInstances().size() );
+	}
+
+	{
+		ProbeDatabase probeDatabase;
+		probeDatabase.setKeepInstanceSamples( true );
+		probeDatabase.registerSceneModels( modelNames );
+		probeDatabase.addInstanceProbes( 0, Obb::Transformation(), 1.0, probes, rawProbeSamples );
+		probeDatabase.compileAll( 5.0 );
+
+		const auto &sampledModel = probeDatabase.getSampledModels()[ 0 ];
+		ASSERT_EQ( 1, sampledModel.getInstances().size() );
+		ASSERT_TRUE( sampledModel.getInstances()[ 0 ].hasProbeSamples() );
+		EXPECT_EQ( probeSamples.size(), sampledModel.getInstances()[ 0 ].decodeProbeSamples().size() );
+	}
+}
+
+TEST( ProbeSamplingPipeline, compileMatchesAddInstanceProbes ) {
+	const int numModels = 2, numInstancesPerModel = 5;
+
+	std::vector< std::string > modelNames;
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		modelNames.push_back( boost::str( boost::format( "model%i" ) % modelIndex ) );
+	}
+
+	srand( 0 );
+	// indexed by instance index
+	std::vector< RawProbeSamples > instanceProbeSamples;
+	for( int instanceIndex = 0 ; instanceIndex < numModels * numInstancesPerModel ; instanceIndex++ ) {
+		const DBProbeSamples probeSamples = makeRandomProbeSamples( 400 );
+		instanceProbeSamples.push_back( RawProbeSamples( probeSamples.begin(), probeSamples.end() ) );
+	}
+	const auto probes = std::vector< DBProbe >( 400 );
+
+	const auto tracer = [&] ( int instanceIndex, const ProbeSamplingPipeline::TransformedProbes &transformedProbes, RawProbeSamples &probeSamples ) {
+		EXPECT_EQ( probes.size(), transformedProbes.size() );
+		probeSamples = instanceProbeSamples[ instanceIndex ];
+	};
+
+	ProbeDatabase probeDatabase;
+	probeDatabase.registerSceneModels( modelNames );
+	{
+		// small queues, so the stages have to wait for each other
+		ProbeSamplingPipeline pipeline( "test_probeSamplingPipeline", 1.0f, 1 );
+		for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+			ProbeSamplingPipeline::Instances instances( numInstancesPerModel );
+			for( int index = 0 ; index < numInstancesPerModel ; index++ ) {
+				instances[ index ].instanceIndex = modelIndex * numInstancesPerModel + index;
+				instances[ index ].transformation = Eigen::Translation3f( float( index ), 0.0f, 0.0f );
+			}
+			EXPECT_EQ( numInstancesPerModel * probes.size(), pipeline.sampleModel( modelIndex, probes, instances, tracer ) );
+		}
+		pipeline.compile( probeDatabase, 5.0 );
+	}
+
+	ProbeDatabase expectedDatabase;
+	expectedDatabase.registerSceneModels( modelNames );
+	for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+		for( int index = 0 ; index < numInstancesPerModel ; index++ ) {
+			const Obb::Transformation transformation( Eigen::Translation3f( float( index ), 0.0f, 0.0f ) );
+			expectedDatabase.addInstanceProbes( modelIndex, transformation, 1.0, probes, instanceProbeSamples[ modelIndex * numInstancesPerModel + index ] );
+		}
+	}
+	expectedDatabase.compileAll( 5.0 );
+
+	expectSameCompiledState( expectedDatabase, probeDatabase );
+
+	const auto &instances = probeDatabase.getSampledModels()[ 1 ].getInstances();
+	ASSERT_EQ( numInstancesPerModel, instances.size() );
+	EXPECT_TRUE( instances[ 3 ].getSource().isApprox( Obb::Transformation( Eigen::Translation3f( 3.0f, 0.0f, 0.0f ) ) ) );
+}
+
+TEST( ProbeSamplingPipeline, tracerExceptionsArePropagated ) {
+	const auto probes = std::vector< DBProbe >( 100 );
+	ProbeSamplingPipeline::Instances instances( 20 );
+	for( int index = 0 ; index < (int) instances.size() ; index++ ) {
+		instances[ index ].instanceIndex = index;
+		instances[ index ].transformation.setIdentity();
+	}
+
+	ProbeSamplingPipeline pipeline( "test_probeSamplingPipeline", 1.0f, 2 );
+	EXPECT_THROW(
+		pipeline.sampleModel( 0, probes, instances, [] ( int instanceIndex, const ProbeSamplingPipeline::TransformedProbes &, RawProbeSamples &probeSamples ) {
+			if( instanceIndex == 7 ) {
+				throw std::runtime_error( "trace failed" );
+			}
+			probeSamples.resize( 100 );
+		} ),
+		std::runtime_error
+	);
+
+	// nothing has been spilled
+	ProbeDatabase probeDatabase;
+	probeDatabase.registerSceneModels( std::vector< std::string >( 1, "model" ) );
+	pipeline.compile( probeDatabase, 5.0 );
+	EXPECT_EQ( 0, probeDatabase.getNumSampledModels() );
+}
+
+TEST( ProbeSamplingPipeline, cachedInstancesAreNotTraced ) {
+	const int numInstances = 6;
+
+	srand( 0 );
+	std::vector< RawProbeSamples > instanceProbeSamples;
+	for( int instanceIndex = 0 ; instanceIndex < numInstances ; instanceIndex++ ) {
+		const DBProbeSamples probeSamples = makeRandomProbeSamples( 200 );
+		instanceProbeSamples.push_back( RawProbeSamples( probeSamples.begin(), probeSamples.end() ) );
+	}
+	const auto probes = std::vector< DBProbe >( 200 );
+
+	ProbeSamplingPipeline::Instances instances( numInstances );
+	for( int index = 0 ; index < numInstances ; index++ ) {
+		instances[ index ].instanceIndex = index;
+		instances[ index ].transformation = Eigen::Translation3f( float( index ), 0.0f, 0.0f );
+		instances[ index ].cacheKey = ProbeSampleCache::KeyBuilder().add( index ).key;
+	}
+
+	int numTracedInstances = 0;
+	const auto tracer = [&] ( int instanceIndex, const ProbeSamplingPipeline::TransformedProbes &, RawProbeSamples &probeSamples ) {
+		probeSamples = instanceProbeSamples[ instanceIndex ];
+		numTracedInstances++;
+	};
+
+	// the cache is too small for all instances, but the instances of a pipeline are pinned until it has compiled
+	const unsigned long long entrySize = sizeof( unsigned long long ) + probes.size() * sizeof( RawProbeSample );
+	ProbeSampleCache cache( "test_probeSampleCache", 2 * entrySize );
+	cache.clear();
+
+	// cache the first half of the instances
+	{
+		ProbeSamplingPipeline::Instances firstInstances( instances.begin(), instances.begin() + numInstances / 2 );
+
+		ProbeDatabase probeDatabase;
+		probeDatabase.registerSceneModels( std::vector< std::string >( 1, "model" ) );
+
+		ProbeSamplingPipeline pipeline( "test_probeSamplingPipeline", 1.0f, 1, &cache );
+		pipeline.sampleModel( 0, probes, firstInstances, tracer );
+		pipeline.compile( probeDatabase, 5.0 );
+		EXPECT_EQ( numInstances / 2, numTracedInstances );
+		EXPECT_EQ( 2, cache.getNumEntries() );
+	}
+
+	ProbeDatabase probeDatabase;
+	probeDatabase.registerSceneModels( std::vector< std::string >( 1, "model" ) );
+	{
+		numTracedInstances = 0;
+		int numCachedInstances = 0;
+
+		ProbeSamplingPipeline pipeline( "test_probeSamplingPipeline", 1.0f, 1, &cache );
+		EXPECT_EQ( (numInstances - 2) * probes.size(), pipeline.sampleModel( 0, probes, instances, tracer, &numCachedInstances ) );
+		EXPECT_EQ( 2, numCachedInstances );
+		EXPECT_EQ( numInstances - 2, numTracedInstances );
+		EXPECT_EQ( numInstances, cache.getNumEntries() );
+
+		pipeline.compile( probeDatabase, 5.0 );
+		EXPECT_EQ( 2, cache.getNumEntries() );
+	}
+
+	ProbeDatabase expectedDatabase;
+	expectedDatabase.registerSceneModels( std::vector< std::string >( 1, "model" ) );
+	for( int index = 0 ; index < numInstances ; index++ ) {
+		expectedDatabase.addInstanceProbes( 0, instances[ index ].transformation, 1.0, probes, instanceProbeSamples[ index ] );
+	}
+	expectedDatabase.compileAll( 5.0 );
+
+	expectSameCompiledState( expectedDatabase, probeDatabase );
+
+	// instances whose entry files have gone missing are traced again
+	{
+		ASSERT_EQ( 2, cache.getNumEntries() );
+		for( int index = 0 ; index < numInstances ; index++ ) {
+			remove( boost::str( boost::format( "test_probeSampleCache.%016x.samples" ) % instances[ index ].cacheKey ).c_str() );
+		}
+
+		numTracedInstances = 0;
+		int numCachedInstances = 0;
+
+		ProbeDatabase probeDatabase;
+		probeDatabase.registerSceneModels( std::vector< std::string >( 1, "model" ) );
+
+		ProbeSamplingPipeline pipeline( "test_probeSamplingPipeline", 1.0f, 1, &cache );
+		pipeline.sampleModel( 0, probes, instances, tracer, &numCachedInstances );
+		pipeline.compile( probeDatabase, 5.0 );
+
+		EXPECT_EQ( 0, numCachedInstances );
+		EXPECT_EQ( numInstances, numTracedInstances );
+		expectSameCompiledState( expectedDatabase, probeDatabase );
+	}
+
+	cache.clear();
+}
+
+static bool sameRawProbeSamples( const RawProbeSamples &a, const RawProbeSamples &b ) {
+	return a.size() == b.size() && memcmp( a.data(), b.data(), a.size() * sizeof( RawProbeSample ) ) == 0;
+}
+
+TEST( ProbeSampleCache, putAndGet ) {
+	srand( 0 );
+	const DBProbeSamples dbProbeSamples = makeRandomProbeSamples( 300 );
+	const RawProbeSamples probeSamples( dbProbeSamples.begin(), dbProbeSamples.end() );
+
+	const auto key = ProbeSampleCache::KeyBuilder().add( 1 ).add( Obb::Transformation( Eigen::Translation3f( 1.0f, 2.0f, 3.0f ) ) ).key;
+	const auto otherKey = ProbeSampleCache::KeyBuilder().add( 1 ).add( Obb::Transformation( Eigen::Translation3f( 1.0f, 2.0f, 4.0f ) ) ).key;
+	ASSERT_NE( key, otherKey );
+
+	{
+		ProbeSampleCache cache( "test_probeSampleCache", 1 << 20 );
+		cache.clear();
+
+		RawProbeSamples cachedProbeSamples;
+		EXPECT_FALSE( cache.get( key, cachedProbeSamples ) );
+
+		cache.put( key, probeSamples );
+		ASSERT_TRUE( cache.get( key, cachedProbeSamples ) );
+		EXPECT_TRUE( sameRawProbeSamples( probeSamples, cachedProbeSamples ) );
+		EXPECT_FALSE( cache.get( otherKey, cachedProbeSamples ) );
+	}
+
+	// the index is stored with the entries
+	{
+		ProbeSampleCache cache( "test_probeSampleCache", 1 << 20 );
+		EXPECT_EQ( 1, cache.getNumEntries() );
+
+		RawProbeSamples cachedProbeSamples;
+		ASSERT_TRUE( cache.get( key, cachedProbeSamples ) );
+		EXPECT_TRUE( sameRawProbeSamples( probeSamples, cachedProbeSamples ) );
+
+		cache.clear();
+	}
+}
+
+TEST( ProbeSampleCache, indexIsUpToDateWithoutClosing ) {
+	const RawProbeSamples probeSamples( 100 );
+
+	ProbeSampleCache cache( "test_probeSampleCache", 1 << 20 );
+	cache.clear();
+
+	cache.put( 1, probeSamples );
+	cache.put( 2, probeSamples );
+	cache.put( 3, probeSamples );
+	cache.put( 2, RawProbeSamples( 50 ) );
+
+	// the changes have been appended to the index (as if the first cache had been killed)
+	{
+		ProbeSampleCache reopenedCache( "test_probeSampleCache", 1 << 20 );
+		EXPECT_EQ( 3, reopenedCache.getNumEntries() );
+		EXPECT_EQ( cache.getTotalSize(), reopenedCache.getTotalSize() );
+
+		RawProbeSamples cachedProbeSamples;
+		EXPECT_TRUE( reopenedCache.get( 2, cachedProbeSamples ) );
+		EXPECT_EQ( 50, cachedProbeSamples.size() );
+	}
+
+	cache.clear();
+	{
+		ProbeSampleCache reopenedCache( "test_probeSampleCache", 1 << 20 );
+		EXPECT_EQ( 0, reopenedCache.getNumEntries() );
+	}
+}
+
+TEST( ProbeSampleCache, pinnedEntriesAreNotEvicted ) {
+	const RawProbeSamples probeSamples( 100 );
+	const unsigned long long entrySize = sizeof( unsigned long long ) + probeSamples.size() * sizeof( RawProbeSample );
+
+	ProbeSampleCache cache( "test_probeSampleCache", entrySize );
+	cache.clear();
+
+	cache.put( 1, probeSamples );
+	EXPECT_TRUE( cache.pin( 1 ) );
+	EXPECT_FALSE( cache.pin( 2 ) );
+	cache.put( 2, probeSamples, true );
+	cache.put( 3, probeSamples );
+
+	// 3 is the only entry that may be evicted
+	EXPECT_EQ( 2, cache.getNumEntries() );
+	RawProbeSamples cachedProbeSamples;
+	EXPECT_TRUE( cache.get( 1, cachedProbeSamples ) );
+	EXPECT_TRUE( cache.get( 2, cachedProbeSamples ) );
+
+	// 2 has been used last
+	cache.unpinAll();
+	EXPECT_EQ( 1, cache.getNumEntries() );
+	EXPECT_TRUE( cache.get( 2, cachedProbeSamples ) );
+
+	cache.clear();
+}
+
+TEST( ProbeSampleCache, pinChecksTheEntryFiles ) {
+	const RawProbeSamples probeSamples( 100 );
+
+	ProbeSampleCache cache( "test_probeSampleCache", 1 << 20 );
+	cache.clear();
+
+	cache.put( 1, probeSamples );
+	cache.put( 2, probeSamples );
+	cache.put( 3, probeSamples );
+
+	// remove the file of 1 and truncate the file of 2 behind the cache's back
+	remove( boost::str( boost::format( "test_probeSampleCache.%016x.samples" ) % 1 ).c_str() );
+	{
+		std::ofstream truncatedFile( boost::str( boost::format( "test_probeSampleCache.%016x.samples" ) % 2 ), std::ios_base::binary );
+		truncatedFile.write( (const char *) probeSamples.data(), 16 );
+	}
+
+	EXPECT_FALSE( cache.pin( 1 ) );
+	EXPECT_FALSE( cache.pin( 2 ) );
+	EXPECT_TRUE( cache.pin( 3 ) );
+	EXPECT_EQ( 1, cache.getNumEntries() );
+
+	cache.clear();
+}
+
+TEST( ProbeSampleCache, evictsLeastRecentlyUsedEntries ) {
+	const RawProbeSamples probeSamples( 100 );
+	const unsigned long long entrySize = sizeof( unsigned long long ) + probeSamples.size() * sizeof( RawProbeSample );
+
+	ProbeSampleCache cache( "test_probeSampleCache", 3 * entrySize );
+	cache.clear();
+
+	cache.put( 1, probeSamples );
+	cache.put( 2, probeSamples );
+	cache.put( 3, probeSamples );
+
+	// 1 is used more recently than 2 now
+	RawProbeSamples cachedProbeSamples;
+	ASSERT_TRUE( cache.get( 1, cachedProbeSamples ) );
+
+	cache.put( 4, probeSamples );
+	EXPECT_EQ( 3, cache.getNumEntries() );
+	EXPECT_EQ( 3 * entrySize, cache.getTotalSize() );
+
+	EXPECT_TRUE( cache.get( 1, cachedProbeSamples ) );
+	EXPECT_FALSE( cache.get( 2, cachedProbeSamples ) );
+	EXPECT_TRUE( cache.get( 3, cachedProbeSamples ) );
+	EXPECT_TRUE( cache.get( 4, cachedProbeSamples ) );
+
+	cache.clear();
+}
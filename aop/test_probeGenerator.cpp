@@ -2,6 +2,8 @@
 
 #include "gtest.h"
 
+#include <algorithm>
+
 TEST( ProbeGenerator, uniqureDirections ) {
 	ProbeGenerator::initDirections();
 	for( int i = 0 ;  i < ProbeGenerator::getNumDirections() ; ++i ) {
@@ -63,4 +65,44 @@ TEST( ProbeGenerator, bijectiveRotatedDirections ) {
 		}
 	}
 #endif
+}
+
+TEST( ProbeGenerator, mortonCode ) {
+	// the positions are offset by 128, so the smallest position has code 0
+	EXPECT_EQ( 0u, ProbeGenerator::getMortonCode( ProbeGenerator::char3( -128, -128, -128 ) ) );
+	EXPECT_EQ( 1u, ProbeGenerator::getMortonCode( ProbeGenerator::char3( -127, -128, -128 ) ) );
+	EXPECT_EQ( 2u, ProbeGenerator::getMortonCode( ProbeGenerator::char3( -128, -127, -128 ) ) );
+	EXPECT_EQ( 4u, ProbeGenerator::getMortonCode( ProbeGenerator::char3( -128, -128, -127 ) ) );
+	EXPECT_EQ( 7u << 21, ProbeGenerator::getMortonCode( ProbeGenerator::char3( 0, 0, 0 ) ) );
+	EXPECT_EQ( (1u << 24) - 1, ProbeGenerator::getMortonCode( ProbeGenerator::char3( 127, 127, 127 ) ) );
+}
+
+TEST( ProbeGenerator, probesAreSortedByDirectionAndMortonCode ) {
+	ProbeGenerator::initDirections();
+
+	ProbeGenerator::Probes probes;
+	ProbeGenerator::generateQueryProbes( Eigen::Vector3f( 4.0f, 3.0f, 5.0f ), 0.5f, probes );
+	ASSERT_FALSE( probes.empty() );
+
+	for( int probeIndex = 1 ; probeIndex < (int) probes.size() ; probeIndex++ ) {
+		const auto &previous = probes[ probeIndex - 1 ];
+		const auto &current = probes[ probeIndex ];
+
+		ASSERT_LE( previous.directionIndex, current.directionIndex );
+		if( previous.directionIndex == current.directionIndex ) {
+			// every probe is only generated once
+			ASSERT_LT( ProbeGenerator::getMortonCode( previous.position ), ProbeGenerator::getMortonCode( current.position ) );
+		}
+	}
+
+	// sorting again doesn't change anything
+	ProbeGenerator::Probes sortedProbes = probes;
+	ProbeGenerator::sortProbes( sortedProbes );
+	EXPECT_TRUE( ProbeGenerator::haveSameProbes( probes, sortedProbes ) );
+
+	// neither does sorting a shuffled copy
+	std::reverse( sortedProbes.begin(), sortedProbes.end() );
+	EXPECT_FALSE( ProbeGenerator::haveSameProbes( probes, sortedProbes ) );
+	ProbeGenerator::sortProbes( sortedProbes );
+	EXPECT_TRUE( ProbeGenerator::haveSameProbes( probes, sortedProbes ) );
 }
\ No newline at end of file
@@ -0,0 +1,295 @@
+#include "sceneGrid.h"
+
+#include "gtest.h"
+
+#include <algorithm>
+#include <random>
+
+using namespace Eigen;
+using namespace SGSInterface;
+
+namespace {
+	struct TestInstances : SceneGrid::InstanceSource {
+		std::vector< Vector3f > positions;
+		std::vector< int > modelIndices;
+		AlignedBox3f boundingBox;
+
+		TestInstances() : boundingBox( Vector3f::Zero(), Vector3f::Constant( 10.0f ) ) {}
+
+		int getNumInstances() const {
+			return (int) positions.size();
+		}
+
+		int getModelIndex( int instanceIndex ) const {
+			return modelIndices[ instanceIndex ];
+		}
+
+		Vector3f getInstancePosition( int instanceIndex ) const {
+			return positions[ instanceIndex ];
+		}
+
+		AlignedBox3f getBoundingBox() const {
+			return boundingBox;
+		}
+	};
+
+	struct SceneGridTest : testing::Test {
+		std::mt19937 generator;
+		TestInstances instances;
+
+		Vector3f randomPosition() {
+			std::uniform_real_distribution< float > coordinate( 0.0f, 10.0f );
+			return Vector3f( coordinate( generator ), coordinate( generator ), coordinate( generator ) );
+		}
+
+		void addInstances( int numInstances ) {
+			for( int i = 0 ; i < numInstances ; i++ ) {
+				instances.positions.push_back( randomPosition() );
+				instances.modelIndices.push_back( int( instances.modelIndices.size() % 5 ) );
+			}
+		}
+
+		SceneGrid::QueryResults bruteForceQuery( const SceneGrid::Query &query ) const {
+			SceneGrid::QueryResults results;
+			for( int instanceIndex = 0 ; instanceIndex < instances.getNumInstances() ; instanceIndex++ ) {
+				if( instanceIndex == query.disabledInstanceIndex || instances.modelIndices[ instanceIndex ] == query.disabledModelIndex ) {
+					continue;
+				}
+
+				const float distance = (instances.positions[ instanceIndex ] - query.position).norm();
+				if( distance <= query.radius ) {
+					results.push_back( std::make_pair( instances.modelIndices[ instanceIndex ], distance ) );
+				}
+			}
+			return results;
+		}
+
+		SceneGrid::Queries makeQueries( int numQueries ) {
+			SceneGrid::Queries queries;
+			for( int queryIndex = 0 ; queryIndex < numQueries ; queryIndex++ ) {
+				const int instanceIndex = queryIndex % instances.getNumInstances();
+				queries.push_back( SceneGrid::Query( queryIndex % 7 == 0 ? 3 : -1, instanceIndex, instances.positions[ instanceIndex ], 0.5f + (queryIndex % 4) * 0.5f ) );
+			}
+			// queries outside of the grid
+			queries.push_back( SceneGrid::Query( -1, -1, Vector3f::Constant( -1.0f ), 2.0f ) );
+			queries.push_back( SceneGrid::Query( -1, -1, Vector3f::Constant( 12.0f ), 3.0f ) );
+			return queries;
+		}
+
+		static void expectSameResults( SceneGrid::QueryResults expected, SceneGrid::QueryResults actual ) {
+			std::sort( expected.begin(), expected.end() );
+			std::sort( actual.begin(), actual.end() );
+
+			ASSERT_EQ( expected.size(), actual.size() );
+			for( size_t i = 0 ; i < expected.size() ; i++ ) {
+				EXPECT_EQ( expected[ i ].first, actual[ i ].first );
+				EXPECT_FLOAT_EQ( expected[ i ].second, actual[ i ].second );
+			}
+		}
+
+		// checks query and queryBatch against a brute force search
+		void checkQueries( SceneGrid &grid ) {
+			const SceneGrid::Queries queries = makeQueries( 300 );
+
+			SceneGrid::BatchQueryResults batchResults;
+			grid.queryBatch( queries, batchResults );
+			ASSERT_EQ( queries.size(), batchResults.getNumQueries() );
+			EXPECT_EQ( 0, batchResults.offsets.front() );
+			EXPECT_EQ( batchResults.results.size(), batchResults.offsets.back() );
+
+			for( int queryIndex = 0 ; queryIndex < (int) queries.size() ; queryIndex++ ) {
+				const SceneGrid::Query &query = queries[ queryIndex ];
+				const SceneGrid::QueryResults expected = bruteForceQuery( query );
+
+				SCOPED_TRACE( queryIndex );
+				ASSERT_LE( batchResults.offsets[ queryIndex ], batchResults.offsets[ queryIndex + 1 ] );
+				expectSameResults( expected, batchResults.getQueryResults( queryIndex ) );
+				expectSameResults( expected, grid.query( query.disabledModelIndex, query.disabledInstanceIndex, query.position, query.radius ) );
+			}
+		}
+	};
+}
+
+TEST_F( SceneGridTest, initialBuild ) {
+	addInstances( 1000 );
+
+	SceneGrid grid( instances );
+	grid.build( 1.0f );
+	EXPECT_EQ( 0, grid.getNumLooseEntries() );
+
+	checkQueries( grid );
+}
+
+TEST_F( SceneGridTest, queryBatchOffsets ) {
+	addInstances( 200 );
+
+	SceneGrid grid( instances );
+	grid.build( 1.0f );
+
+	// a few blocks of queries, some of them without any results
+	SceneGrid::Queries queries;
+	for( int queryIndex = 0 ; queryIndex < 200 ; queryIndex++ ) {
+		queries.push_back( SceneGrid::Query( -1, -1, instances.positions[ queryIndex ], queryIndex % 3 == 0 ? 0.0f : 1.5f ) );
+	}
+
+	SceneGrid::BatchQueryResults batchResults;
+	grid.queryBatch( queries, batchResults );
+
+	ASSERT_EQ( queries.size() + 1, batchResults.offsets.size() );
+	int offset = 0;
+	for( int queryIndex = 0 ; queryIndex < (int) queries.size() ; queryIndex++ ) {
+		EXPECT_EQ( offset, batchResults.offsets[ queryIndex ] );
+		offset += (int) bruteForceQuery( queries[ queryIndex ] ).size();
+	}
+	EXPECT_EQ( offset, batchResults.offsets.back() );
+	EXPECT_EQ( offset, batchResults.results.size() );
+
+	// an empty batch
+	grid.queryBatch( SceneGrid::Queries(), batchResults );
+	EXPECT_EQ( 0, batchResults.getNumQueries() );
+	EXPECT_TRUE( batchResults.results.empty() );
+}
+
+TEST_F( SceneGridTest, movedInstances ) {
+	addInstances( 1000 );
+
+	SceneGrid grid( instances );
+	grid.build( 1.0f );
+
+	for( int instanceIndex = 0 ; instanceIndex < 1000 ; instanceIndex += 50 ) {
+		instances.positions[ instanceIndex ] = randomPosition();
+		grid.markDirty( instanceIndex );
+	}
+	// moving the same instance twice only creates one loose entry
+	instances.positions[ 0 ] = randomPosition();
+	grid.markDirty( 0 );
+
+	checkQueries( grid );
+	EXPECT_EQ( 20, grid.getNumLooseEntries() );
+
+	// move a loose instance again
+	instances.positions[ 50 ] = randomPosition();
+	grid.markDirty( 50 );
+
+	checkQueries( grid );
+	EXPECT_EQ( 20, grid.getNumLooseEntries() );
+}
+
+TEST_F( SceneGridTest, movedInstancesAreRemovedFromTheirOldCells ) {
+	addInstances( 100 );
+	instances.positions[ 0 ] = Vector3f::Constant( 5.0f );
+
+	SceneGrid grid( instances );
+	grid.build( 1.0f );
+
+	// tombstone the old entry
+	instances.positions[ 0 ] = Vector3f::Constant( 1.0f );
+	grid.markDirty( 0 );
+
+	const SceneGrid::QueryResults results = grid.query( -1, -1, Vector3f::Constant( 5.0f ), 0.01f );
+	for( auto result = results.begin() ; result != results.end() ; ++result ) {
+		EXPECT_NE( 0.0f, result->second );
+	}
+
+	const SceneGrid::QueryResults newResults = grid.query( -1, -1, Vector3f::Constant( 1.0f ), 0.01f );
+	ASSERT_EQ( 1, newResults.size() );
+	EXPECT_EQ( instances.modelIndices[ 0 ], newResults[ 0 ].first );
+	EXPECT_EQ( 0.0f, newResults[ 0 ].second );
+
+	checkQueries( grid );
+}
+
+TEST_F( SceneGridTest, appendedInstances ) {
+	addInstances( 1000 );
+
+	SceneGrid grid( instances );
+	grid.build( 1.0f );
+
+	addInstances( 10 );
+	for( int instanceIndex = 1000 ; instanceIndex < 1010 ; instanceIndex++ ) {
+		grid.markDirty( instanceIndex );
+	}
+
+	checkQueries( grid );
+	EXPECT_EQ( 10, grid.getNumLooseEntries() );
+}
+
+TEST_F( SceneGridTest, unannouncedInstancesRebuildTheGrid ) {
+	addInstances( 1000 );
+
+	SceneGrid grid( instances );
+	grid.build( 1.0f );
+
+	// instance 1000 is never marked as dirty, so the grid can't just append 1001
+	addInstances( 2 );
+	grid.markDirty( 1001 );
+
+	checkQueries( grid );
+	EXPECT_EQ( 0, grid.getNumLooseEntries() );
+}
+
+TEST_F( SceneGridTest, instancesOutsideOfTheGrid ) {
+	addInstances( 1000 );
+	instances.positions[ 10 ] = Vector3f::Constant( -2.0f );
+	instances.positions[ 20 ] = Vector3f( 5.0f, 5.0f, 11.5f );
+
+	SceneGrid grid( instances );
+	grid.build( 1.0f );
+	EXPECT_EQ( 2, grid.getNumLooseEntries() );
+
+	checkQueries( grid );
+
+	// move instances out of the grid and back into it
+	instances.positions[ 10 ] = randomPosition();
+	grid.markDirty( 10 );
+	instances.positions[ 30 ] = Vector3f::Constant( 12.0f );
+	grid.markDirty( 30 );
+
+	checkQueries( grid );
+	EXPECT_EQ( 3, grid.getNumLooseEntries() );
+
+	// the loose entries survive a rebuild if they are still outside of the grid
+	grid.markDirty();
+	checkQueries( grid );
+	EXPECT_EQ( 2, grid.getNumLooseEntries() );
+}
+
+TEST_F( SceneGridTest, rebuildThreshold ) {
+	// max( 64, 2000 / 16 ) = 125 loose entries are allowed
+	addInstances( 2000 );
+
+	SceneGrid grid( instances );
+	grid.build( 1.0f );
+
+	for( int instanceIndex = 0 ; instanceIndex < 125 ; instanceIndex++ ) {
+		instances.positions[ instanceIndex ] = randomPosition();
+		grid.markDirty( instanceIndex );
+	}
+	checkQueries( grid );
+	EXPECT_EQ( 125, grid.getNumLooseEntries() );
+
+	instances.positions[ 125 ] = randomPosition();
+	grid.markDirty( 125 );
+	checkQueries( grid );
+	EXPECT_EQ( 0, grid.getNumLooseEntries() );
+}
+
+TEST_F( SceneGridTest, rebuildThresholdForSmallScenes ) {
+	// at least 64 loose entries are allowed
+	addInstances( 100 );
+
+	SceneGrid grid( instances );
+	grid.build( 1.0f );
+
+	for( int instanceIndex = 0 ; instanceIndex < 64 ; instanceIndex++ ) {
+		instances.positions[ instanceIndex ] = randomPosition();
+		grid.markDirty( instanceIndex );
+	}
+	checkQueries( grid );
+	EXPECT_EQ( 64, grid.getNumLooseEntries() );
+
+	instances.positions[ 64 ] = randomPosition();
+	grid.markDirty( 64 );
+	checkQueries( grid );
+	EXPECT_EQ( 0, grid.getNumLooseEntries() );
+}
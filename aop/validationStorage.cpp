@@ -1,13 +1,23 @@
 #include "validationStorage.h"
 
 namespace Validation {
-	const int CACHE_FORMAT_VERSION = 1;
+	// 2: queries are stored in chunks
+	const int CACHE_FORMAT_VERSION = 2;
 
-	bool NeighborhoodData::load( const std::string &filename, NeighborhoodData &neighborhoodData ) {
-		Serializer::BinaryReader reader( filename, CACHE_FORMAT_VERSION );
-		if( reader.valid() ) {
-			reader.get( neighborhoodData );
+	// big enough to compress well, small enough that slices don't decode many queries they don't need
+	const int NUM_QUERY_DATASETS_PER_CHUNK = 256;
+	const int NUM_PROBE_QUERIES_PER_CHUNK = 64;
 
+	bool NeighborhoodData::load( const std::string &filename, NeighborhoodData &neighborhoodData ) {
+		ChunkedStorage::Reader< Neighborhood::RawIdDistances > reader;
+		const bool success = reader.open( filename, CACHE_FORMAT_VERSION,
+			[&] ( Serializer::BinaryReader &headerReader ) {
+				headerReader.get( neighborhoodData.settings );
+				headerReader.get( neighborhoodData.queryInfos );
+				headerReader.get( neighborhoodData.instanceCounts );
+			}
+		);
+		if( success && reader.read( 0, reader.getNumElements(), neighborhoodData.queryDatasets ) ) {
 			return true;
 		}
 
@@ -16,16 +26,32 @@ namespace Validation {
 	}
 
 	void NeighborhoodData::store( const std::string &filename, const NeighborhoodData &neighborhoodData ) {
-		Serializer::BinaryWriter writer( filename, CACHE_FORMAT_VERSION );
+		ChunkedStorage::write( filename, CACHE_FORMAT_VERSION, neighborhoodData.queryDatasets, NUM_QUERY_DATASETS_PER_CHUNK,
+			[&] ( Serializer::BinaryWriter &headerWriter ) {
+				headerWriter.put( neighborhoodData.settings );
+				headerWriter.put( neighborhoodData.queryInfos );
+				headerWriter.put( neighborhoodData.instanceCounts );
+			}
+		);
+	}
 
-		writer.put( neighborhoodData );
+	bool ProbeDataReader::open( const std::string &filename, ProbeData &probeData ) {
+		return reader.open( filename, CACHE_FORMAT_VERSION,
+			[&] ( Serializer::BinaryReader &headerReader ) {
+				headerReader.get( probeData.settings );
+				headerReader.get( probeData.instanceCounts );
+				headerReader.get( probeData.localModelNames );
+			}
+		);
 	}
 
-	bool ProbeData::load( const std::string &filename, ProbeData &probeData ) {
-		Serializer::BinaryReader reader( filename, CACHE_FORMAT_VERSION );
-		if( reader.valid() ) {
-			reader.get( probeData );
+	bool ProbeDataReader::readQueries( int beginIndex, int endIndex, std::vector< ProbeData::QueryData > &queries ) const {
+		return reader.read( beginIndex, endIndex, queries );
+	}
 
+	bool ProbeData::load( const std::string &filename, ProbeData &probeData ) {
+		ProbeDataReader reader;
+		if( reader.open( filename, probeData ) && reader.readQueries( 0, reader.getNumQueries(), probeData.queries ) ) {
 			return true;
 		}
 
@@ -34,8 +60,12 @@ namespace Validation {
 	}
 
 	void ProbeData::store( const std::string &filename, const ProbeData &probeData ) {
-		Serializer::BinaryWriter writer( filename, CACHE_FORMAT_VERSION );
-
-		writer.put( probeData );
+		ChunkedStorage::write( filename, CACHE_FORMAT_VERSION, probeData.queries, NUM_PROBE_QUERIES_PER_CHUNK,
+			[&] ( Serializer::BinaryWriter &headerWriter ) {
+				headerWriter.put( probeData.settings );
+				headerWriter.put( probeData.instanceCounts );
+				headerWriter.put( probeData.localModelNames );
+			}
+		);
 	}
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "validation.h"
 
 #include "probeDatabaseStorage.h"
+#include "chunkedStorage.h"
 
 SERIALIZER_DEFAULT_EXTERN_IMPL( Validation::InstanceCounts,
 	(instanceCounts)
@@ -51,3 +52,21 @@ SERIALIZER_DEFAULT_EXTERN_IMPL( Validation::ProbeData,
 	(localModelNames)
 )
 
+namespace Validation {
+	// validation data files store the queries in chunks (see ChunkedStorage), so validators only have to decode the
+	// queries they actually use
+	struct ProbeDataReader {
+		// reads everything but the queries
+		bool open( const std::string &filename, ProbeData &probeData );
+
+		int getNumQueries() const {
+			return reader.getNumElements();
+		}
+
+		// replaces queries with [beginIndex, endIndex)
+		bool readQueries( int beginIndex, int endIndex, std::vector< ProbeData::QueryData > &queries ) const;
+
+	private:
+		ChunkedStorage::Reader< ProbeData::QueryData > reader;
+	};
+}
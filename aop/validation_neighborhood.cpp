@@ -3,6 +3,7 @@
 #include "modelDatabase.h"
 #include "neighborhoodDatabase.h"
 #include "validation.h"
+#include "taskRuntime.h"
 
 #include <string>
 #include "boost/format.hpp"
@@ -223,12 +224,12 @@ void executeKernel(
 	rankResults.resize( numTotalSamples );
 	unsortedResults.resize( numTotalSamples );
 
-	int rankSum = 0;
+	TaskRuntime::Reducer< int > rankSums;
 
 	boost::timer::cpu_timer cpuTimer;
 
-#pragma omp parallel for reduction(+ : rankSum)
-	for( int sampleIndex = 0 ; sampleIndex < numTotalSamples ; sampleIndex++  ) {
+	// every query is a lot of work, so no grain size
+	TaskRuntime::parallel_for( 0, numTotalSamples, 1, [&] ( int sampleIndex ) {
 		const int queryIndex = sampleIndex * numSamples + sampleSelector;
 		const int modelIndex = validationData.queryInfos[ queryIndex ];
 
@@ -245,7 +246,7 @@ void executeKernel(
 		for( int resultIndex = 0 ; resultIndex < results.size() ; ++resultIndex ) {
 			if( results[ resultIndex ].second == modelIndex ) {
 				rankResults[ sampleIndex ] = resultIndex;
-				rankSum += resultIndex;
+				rankSums.local() += resultIndex;
 				break;
 			}
 		}
@@ -253,10 +254,12 @@ void executeKernel(
 		if( (sampleIndex % 100) == 0 ) {
 			std::cout << "*";
 		}
-	}
+	} );
 	timerResults = cpuTimer.elapsed();
 	std::cout << "\n";
 
+	const int rankSum = rankSums.combine( std::plus< int >() );
+
 	const float rankExpectation = double( rankSum ) / numTotalSamples;
 	expectationResult = rankExpectation;
 
@@ -409,8 +412,6 @@ void testNeighborDatabase(
 }
 
 void main( int argc, const char **argv ) {
-	omp_set_num_threads( 12*4 );
-
 	// load config
 	std::string configName = defaultConfigName;
 	if( argc == 2 ) {
@@ -3,6 +3,7 @@
 #include "modelDatabase.h"
 #include "probeDatabase.h"
 #include "probeGenerator.h"
+#include "taskRuntime.h"
 
 #include <string>
 #include <boost/format.hpp>
@@ -361,16 +362,17 @@ void executeKernel(
 	rankResults.resize( numTotalSamples );
 	unsortedResults.resize( numTotalSamples );
 
-	int rankSum = 0;
+	TaskRuntime::Reducer< int > rankSums;
 
 	boost::timer::cpu_timer cpuTimer;
 
-#pragma omp parallel for reduction(+ : rankSum)
-	for( int sampleIndex = beginSampleIndex ; sampleIndex < endSampleIndex ; sampleIndex++  ) {
+	// every query is a lot of work, so no grain size
+	TaskRuntime::parallel_for( beginSampleIndex, endSampleIndex, 1, [&] ( int sampleIndex ) {
 		const int outputIndex = sampleIndex - beginSampleIndex;
 		const int queryIndex = sampleIndex * numSamples + config.sampleSelector;
 
-		const auto &queryData = validationData.queries[ sampleIndex ];
+		// validationData only contains the queries of [beginSampleIndex, endSampleIndex)
+		const auto &queryData = validationData.queries[ outputIndex ];
 		const int sceneModelIndex = queryData.expectedSceneModelIndex;
 
 		QueryResults queryResults = ExecutionKernel::execute( probeDatabase, validationData.settings, queryData );
@@ -394,7 +396,7 @@ void executeKernel(
 		for( int resultIndex = 0 ; resultIndex < queryResults.size() ; ++resultIndex ) {
 			if( queryResults[ resultIndex ].sceneModelIndex == sceneModelIndex ) {
 				rankResults[ outputIndex ] = resultIndex;
-				rankSum += resultIndex;
+				rankSums.local() += resultIndex;
 				break;
 			}
 		}
@@ -402,10 +404,12 @@ void executeKernel(
 		if( (outputIndex % 2) == 0 ) {
 			std::cout << "*";
 		}
-	}
+	} );
 	timerResults = cpuTimer.elapsed();
 	std::cout << "\n";
 
+	const int rankSum = rankSums.combine( std::plus< int >() );
+
 	const float rankExpectation = double( rankSum ) / numTotalSamples;
 	expectationResult = rankExpectation;
 
@@ -419,9 +423,11 @@ void testValidationData(
 	ExpectationsResults &expectationsResults
 ) {
 	Validation::ProbeData validationData;
+	// the queries are only read for the sample range of this machine
+	Validation::ProbeDataReader validationDataReader;
 
 	{
-		bool success = Validation::ProbeData::load( validationDataFilePath, validationData );
+		bool success = validationDataReader.open( validationDataFilePath, validationData );
 
 		if( !success ) {
 			logError( boost::format( "Failed to load validationData '%s'!\n" ) % validationDataFilePath );
@@ -447,7 +453,7 @@ void testValidationData(
 	fullResults.maxFrequency_expectedRank = validationDataRanks.maxFrequency_expectedRank = maxFrequency_expectedRank;
 
 	if( config.sampleSelector < validationData.settings.numSamples ) {
-		expectationResult.numQueries = validationData.queries.size() / validationData.settings.numSamples;
+		expectationResult.numQueries = validationDataReader.getNumQueries() / validationData.settings.numSamples;
 
 		log(
 			boost::format(
@@ -472,7 +478,7 @@ void testValidationData(
 
 		// determine the sample range
 		const int numSamples = validationData.settings.numSamples;
-		const int numInstances = validationData.queries.size() / numSamples;
+		const int numInstances = validationDataReader.getNumQueries() / numSamples;
 		// split onto machines and round up
 		const int averageNumInstancesPerMachine = (numInstances + config.numMachines - 1)/ config.numMachines;
 		const int beginIndex = averageNumInstancesPerMachine * config.machineIndex;
@@ -491,6 +497,11 @@ void testValidationData(
 			% config.numCores
 		);
 
+		if( !validationDataReader.readQueries( beginIndex, endIndex, validationData.queries ) ) {
+			logError( boost::format( "Failed to read the queries of validationData '%s'!\n" ) % validationDataFilePath );
+			return;
+		}
+
 		log( "FastUniformBidirectional" );
 		executeKernel<FastUniformBidirectional_ExecutionKernel>(
 			probeDatabase,
@@ -657,8 +668,6 @@ void testProbeDatabase(
 
 
 void real_main( int argc, const char **argv ) {
-	omp_set_num_threads( 6 );
-
 	ProbeGenerator::initDirections();
 	ProbeGenerator::initOrientations();
 
@@ -0,0 +1,68 @@
+// compares the grain sizes of TaskRuntime::parallel_for for cheap uniform items and expensive skewed items
+// (roughly the range jobs of IndexedProbeSamples::Matcher and the per-model loops of the queries)
+#include "taskRuntime.h"
+
+#include <boost/timer/timer.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <iostream>
+#include <vector>
+#include <math.h>
+
+// some floating point work that the compiler can't remove
+static float work( int index, int numIterations ) {
+	float value = float( index );
+	for( int iteration = 0 ; iteration < numIterations ; iteration++ ) {
+		value = sqrtf( value * value + 1.0f );
+	}
+	return value;
+}
+
+template< typename Workload >
+static void benchmarkGrainSizes( const char *name, int numItems, Workload &&workload ) {
+	std::cout << boost::format( "%s (%i items, %i workers)\n" ) % name % numItems % TaskRuntime::ThreadPool::getDefault().getNumWorkers();
+
+	std::vector< float > results( numItems );
+
+	double serialWallTime;
+	{
+		boost::timer::cpu_timer timer;
+		for( int index = 0 ; index < numItems ; index++ ) {
+			results[ index ] = workload( index );
+		}
+		serialWallTime = timer.elapsed().wall * 1e-9;
+	}
+	std::cout << boost::format( "\t%-12s %10.4fs\n" ) % "serial" % serialWallTime;
+
+	const int grainSizes[] = { 1, 4, 16, 64, 256, 1024, 4096, TaskRuntime::getDefaultGrainSize( numItems ) };
+	for( int i = 0 ; i < sizeof( grainSizes ) / sizeof( *grainSizes ) ; i++ ) {
+		const int grainSize = grainSizes[ i ];
+
+		boost::timer::cpu_timer timer;
+		TaskRuntime::parallel_for( 0, numItems, grainSize, [&] ( int index ) {
+			results[ index ] = workload( index );
+		} );
+		const double wallTime = timer.elapsed().wall * 1e-9;
+
+		const std::string label = (i + 1 == sizeof( grainSizes ) / sizeof( *grainSizes )) ? boost::str( boost::format( "%i (auto)" ) % grainSize ) : boost::lexical_cast< std::string >( grainSize );
+		std::cout << boost::format( "\t%-12s %10.4fs (speedup %.2f)\n" ) % label % wallTime % (serialWallTime / wallTime);
+	}
+}
+
+int main( int argc, char **argv ) {
+	benchmarkGrainSizes( "uniform cheap items", 1 << 20,
+		[] ( int index ) {
+			return work( index, 16 );
+		}
+	);
+
+	// a few items are a lot more expensive than the rest, like big models
+	benchmarkGrainSizes( "skewed expensive items", 1 << 12,
+		[] ( int index ) {
+			return work( index, (index % 64 == 0) ? 100000 : 1000 );
+		}
+	);
+
+	return 0;
+}
@@ -0,0 +1,228 @@
+#include "bitPlaneKernels.h"
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#	include <intrin.h>
+	// MSVC allows intrinsics for any instruction set without changing the target
+#	define BIT_PLANE_KERNELS_TARGET( instructionSets )
+#else
+#	define BIT_PLANE_KERNELS_TARGET( instructionSets ) __attribute__(( target( instructionSets ) ))
+#endif
+
+namespace BitPlaneKernels {
+	namespace Scalar {
+		int intersect( const unsigned *planeA, const unsigned *planeB, int numWords, MaskedWord *maskedWords ) {
+			int numMaskedWords = 0;
+			for( int wordIndex = 0 ; wordIndex < numWords ; wordIndex++ ) {
+				const unsigned mask = planeA[ wordIndex ] & planeB[ wordIndex ];
+				if( mask ) {
+					maskedWords[ numMaskedWords ].wordIndex = wordIndex;
+					maskedWords[ numMaskedWords ].mask = mask;
+					numMaskedWords++;
+				}
+			}
+			return numMaskedWords;
+		}
+
+		int countIntersection( const unsigned *planeA, const unsigned *planeB, int numWords ) {
+			int count = 0;
+			for( int wordIndex = 0 ; wordIndex < numWords ; wordIndex++ ) {
+				count += popcount( planeA[ wordIndex ] & planeB[ wordIndex ] );
+			}
+			return count;
+		}
+	}
+
+	namespace SSE42 {
+		BIT_PLANE_KERNELS_TARGET( "sse4.2,popcnt" )
+		int intersect( const unsigned *planeA, const unsigned *planeB, int numWords, MaskedWord *maskedWords ) {
+			int numMaskedWords = 0;
+
+			int wordIndex = 0;
+			for( ; wordIndex + 4 <= numWords ; wordIndex += 4 ) {
+				const __m128i a = _mm_loadu_si128( (const __m128i*) (planeA + wordIndex) );
+				const __m128i b = _mm_loadu_si128( (const __m128i*) (planeB + wordIndex) );
+				const __m128i masks = _mm_and_si128( a, b );
+				// most words are empty, so skip whole blocks
+				if( _mm_testz_si128( masks, masks ) ) {
+					continue;
+				}
+
+				unsigned blockMasks[ 4 ];
+				_mm_storeu_si128( (__m128i*) blockMasks, masks );
+				for( int i = 0 ; i < 4 ; i++ ) {
+					if( blockMasks[ i ] ) {
+						maskedWords[ numMaskedWords ].wordIndex = wordIndex + i;
+						maskedWords[ numMaskedWords ].mask = blockMasks[ i ];
+						numMaskedWords++;
+					}
+				}
+			}
+
+			return numMaskedWords + Scalar::intersect( planeA + wordIndex, planeB + wordIndex, numWords - wordIndex, maskedWords + numMaskedWords );
+		}
+
+		BIT_PLANE_KERNELS_TARGET( "sse4.2,popcnt" )
+		int countIntersection( const unsigned *planeA, const unsigned *planeB, int numWords ) {
+			int count = 0;
+			for( int wordIndex = 0 ; wordIndex < numWords ; wordIndex++ ) {
+				count += _mm_popcnt_u32( planeA[ wordIndex ] & planeB[ wordIndex ] );
+			}
+			return count;
+		}
+	}
+
+	namespace AVX2 {
+		BIT_PLANE_KERNELS_TARGET( "avx2,popcnt" )
+		int intersect( const unsigned *planeA, const unsigned *planeB, int numWords, MaskedWord *maskedWords ) {
+			int numMaskedWords = 0;
+
+			int wordIndex = 0;
+			for( ; wordIndex + 8 <= numWords ; wordIndex += 8 ) {
+				const __m256i a = _mm256_loadu_si256( (const __m256i*) (planeA + wordIndex) );
+				const __m256i b = _mm256_loadu_si256( (const __m256i*) (planeB + wordIndex) );
+				const __m256i masks = _mm256_and_si256( a, b );
+				if( _mm256_testz_si256( masks, masks ) ) {
+					continue;
+				}
+
+				// one bit per non-empty word
+				const unsigned nonEmptyWords = ~unsigned( _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( masks, _mm256_setzero_si256() ) ) ) ) & 0xFFu;
+
+				unsigned blockMasks[ 8 ];
+				_mm256_storeu_si256( (__m256i*) blockMasks, masks );
+				for( unsigned remainingWords = nonEmptyWords ; remainingWords ; remainingWords &= remainingWords - 1 ) {
+					const int i = lowestBitIndex( remainingWords );
+					maskedWords[ numMaskedWords ].wordIndex = wordIndex + i;
+					maskedWords[ numMaskedWords ].mask = blockMasks[ i ];
+					numMaskedWords++;
+				}
+			}
+
+			return numMaskedWords + Scalar::intersect( planeA + wordIndex, planeB + wordIndex, numWords - wordIndex, maskedWords + numMaskedWords );
+		}
+
+		BIT_PLANE_KERNELS_TARGET( "avx2,popcnt" )
+		int countIntersection( const unsigned *planeA, const unsigned *planeB, int numWords ) {
+			long long count = 0;
+
+			int wordIndex = 0;
+			for( ; wordIndex + 8 <= numWords ; wordIndex += 8 ) {
+				const __m256i a = _mm256_loadu_si256( (const __m256i*) (planeA + wordIndex) );
+				const __m256i b = _mm256_loadu_si256( (const __m256i*) (planeB + wordIndex) );
+				const __m256i masks = _mm256_and_si256( a, b );
+
+				count += _mm_popcnt_u64( (unsigned long long) _mm256_extract_epi64( masks, 0 ) );
+				count += _mm_popcnt_u64( (unsigned long long) _mm256_extract_epi64( masks, 1 ) );
+				count += _mm_popcnt_u64( (unsigned long long) _mm256_extract_epi64( masks, 2 ) );
+				count += _mm_popcnt_u64( (unsigned long long) _mm256_extract_epi64( masks, 3 ) );
+			}
+
+			return int( count ) + Scalar::countIntersection( planeA + wordIndex, planeB + wordIndex, numWords - wordIndex );
+		}
+	}
+
+	static InstructionSet detectInstructionSet() {
+#ifdef _MSC_VER
+		int cpuInfo[ 4 ];
+		__cpuid( cpuInfo, 0 );
+		const int maxFunctionId = cpuInfo[ 0 ];
+
+		bool hasSSE42 = false, hasAVX2 = false;
+		if( maxFunctionId >= 1 ) {
+			__cpuid( cpuInfo, 1 );
+			const bool hasPopcnt = (cpuInfo[ 2 ] & (1<<23)) != 0;
+			hasSSE42 = hasPopcnt && (cpuInfo[ 2 ] & (1<<20)) != 0;
+
+			// the OS has to save the ymm registers, too
+			const bool hasOSXSave = (cpuInfo[ 2 ] & (1<<27)) != 0;
+			const bool hasAVX = (cpuInfo[ 2 ] & (1<<28)) != 0;
+			const bool ymmEnabled = hasOSXSave && hasAVX && (_xgetbv( 0 ) & 6) == 6;
+
+			if( ymmEnabled && maxFunctionId >= 7 ) {
+				__cpuidex( cpuInfo, 7, 0 );
+				hasAVX2 = hasSSE42 && (cpuInfo[ 1 ] & (1<<5)) != 0;
+			}
+		}
+#else
+		__builtin_cpu_init();
+		const bool hasSSE42 = __builtin_cpu_supports( "sse4.2" ) && __builtin_cpu_supports( "popcnt" );
+		const bool hasAVX2 = hasSSE42 && __builtin_cpu_supports( "avx2" );
+#endif
+		if( hasAVX2 ) {
+			return IS_AVX2;
+		}
+		if( hasSSE42 ) {
+			return IS_SSE42;
+		}
+		return IS_SCALAR;
+	}
+
+	struct Dispatch {
+		InstructionSet instructionSet;
+
+		int (*intersect)( const unsigned *planeA, const unsigned *planeB, int numWords, MaskedWord *maskedWords );
+		int (*countIntersection)( const unsigned *planeA, const unsigned *planeB, int numWords );
+
+		Dispatch() {
+			select( getSupportedInstructionSet() );
+		}
+
+		void select( InstructionSet requestedInstructionSet ) {
+			instructionSet = requestedInstructionSet <= getSupportedInstructionSet() ? requestedInstructionSet : getSupportedInstructionSet();
+
+			switch( instructionSet ) {
+			case IS_AVX2:
+				intersect = &AVX2::intersect;
+				countIntersection = &AVX2::countIntersection;
+				break;
+			case IS_SSE42:
+				intersect = &SSE42::intersect;
+				countIntersection = &SSE42::countIntersection;
+				break;
+			default:
+				intersect = &Scalar::intersect;
+				countIntersection = &Scalar::countIntersection;
+				break;
+			}
+		}
+	};
+
+	static Dispatch &getDispatch() {
+		static Dispatch dispatch;
+		return dispatch;
+	}
+
+	InstructionSet getSupportedInstructionSet() {
+		static const InstructionSet supportedInstructionSet = detectInstructionSet();
+		return supportedInstructionSet;
+	}
+
+	InstructionSet getInstructionSet() {
+		return getDispatch().instructionSet;
+	}
+
+	void setInstructionSet( InstructionSet instructionSet ) {
+		getDispatch().select( instructionSet );
+	}
+
+	const char *getInstructionSetName( InstructionSet instructionSet ) {
+		switch( instructionSet ) {
+		case IS_AVX2:
+			return "AVX2";
+		case IS_SSE42:
+			return "SSE4.2";
+		default:
+			return "scalar";
+		}
+	}
+
+	int intersect( const unsigned *planeA, const unsigned *planeB, int numWords, MaskedWord *maskedWords ) {
+		return getDispatch().intersect( planeA, planeB, numWords, maskedWords );
+	}
+
+	int countIntersection( const unsigned *planeA, const unsigned *planeB, int numWords ) {
+		return getDispatch().countIntersection( planeA, planeB, numWords );
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+// vectorized kernels for intersecting big bit planes (eg SampleBitPlane)
+// the implementation is picked at runtime depending on what the CPU supports
+namespace BitPlaneKernels {
+	enum InstructionSet {
+		IS_SCALAR,
+		IS_SSE42,
+		IS_AVX2
+	};
+
+	// a non-empty word of an intersection (planeA & planeB)
+	struct MaskedWord {
+		int wordIndex;
+		unsigned mask;
+	};
+
+	// the best instruction set the CPU supports
+	InstructionSet getSupportedInstructionSet();
+
+	InstructionSet getInstructionSet();
+	// force a specific implementation (for tests and benchmarks)
+	// falls back to the supported instruction set if the CPU cannot execute the requested one
+	void setInstructionSet( InstructionSet instructionSet );
+
+	const char *getInstructionSetName( InstructionSet instructionSet );
+
+	// writes all non-empty words of planeA & planeB into maskedWords and returns how many were written
+	// maskedWords has to have room for numWords entries
+	int intersect( const unsigned *planeA, const unsigned *planeB, int numWords, MaskedWord *maskedWords );
+
+	// number of bits that are set in both planes
+	int countIntersection( const unsigned *planeA, const unsigned *planeB, int numWords );
+
+	// portable popcount for the scalar code paths
+	inline int popcount( unsigned value ) {
+		value = value - ((value >> 1) & 0x55555555u);
+		value = (value & 0x33333333u) + ((value >> 2) & 0x33333333u);
+		return int( (((value + (value >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24 );
+	}
+
+	// index of the lowest set bit (value must not be 0)
+	inline int lowestBitIndex( unsigned value ) {
+		int index = 0;
+		if( (value & 0xFFFFu) == 0 ) {
+			value >>= 16;
+			index += 16;
+		}
+		if( (value & 0xFFu) == 0 ) {
+			value >>= 8;
+			index += 8;
+		}
+		if( (value & 0xFu) == 0 ) {
+			value >>= 4;
+			index += 4;
+		}
+		if( (value & 0x3u) == 0 ) {
+			value >>= 2;
+			index += 2;
+		}
+		if( (value & 0x1u) == 0 ) {
+			index += 1;
+		}
+		return index;
+	}
+}
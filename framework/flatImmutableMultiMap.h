@@ -4,9 +4,12 @@
 #include <functional>
 #include <algorithm>
 
+#include "mappedArray.h"
+
 
 // everything is stored in a flat vector
 // sorted by Key and T
+// (the arrays can be views of a mapped file, see MappedArray)
 template<
 	typename Key,
 	typename T,
@@ -24,9 +27,9 @@ struct FlatImmutableOrderedMultiMap {
 	typedef BucketIndex bucket_index_type;
 
 	typedef std::pair<key_type, value_type> item_type;
-	typedef std::vector<item_type> items_type;
+	typedef MappedArray<item_type> items_type;
 
-	typedef std::vector<item_index_type> buckets_type;
+	typedef MappedArray<item_index_type> buckets_type;
 
 	typedef typename items_type::const_iterator const_iterator;
 	typedef std::pair< const_iterator, const_iterator > const_iterator_range;
@@ -46,7 +49,7 @@ struct FlatImmutableOrderedMultiMap {
 		items.clear();
 
 		bucketOffsets.clear();
-		bucketOffsets.resize( numBuckets + 1 );
+		bucketOffsets.makeOwning().resize( numBuckets + 1 );
 	}
 
 	bool empty() const {
@@ -102,7 +105,7 @@ struct FlatImmutableOrderedMultiMap {
 			bucketCounters.resize( multiMap.getNumBuckets() );
 
 			if( numElements > 0 ) {
-				multiMap.items.reserve( numElements );
+				multiMap.items.makeOwning().reserve( numElements );
 				unsortedItems.reserve( numElements );
 			}
 		}
@@ -113,28 +116,33 @@ struct FlatImmutableOrderedMultiMap {
 			unsortedItems.push_back( std::make_pair( bucketIndex, std::make_pair( key, value ) ) );
 		}
 
-		void build() {
+		// sortBuckets = false: the items have been pushed in (key, value) order already
+		// (the counting placement below is stable, so every bucket stays sorted)
+		void build( bool sortBuckets = true ) {
+			auto &bucketOffsets = multiMap.bucketOffsets.makeOwning();
+			auto &items = multiMap.items.makeOwning();
+
 			// set the bucket offsets
-			multiMap.bucketOffsets[ 0 ] = 0;
+			bucketOffsets[ 0 ] = 0;
 			for( bucket_index_type bucketIndex = 0 ; bucketIndex < multiMap.getNumBuckets() ; bucketIndex++ ) {
-				multiMap.bucketOffsets[ bucketIndex + 1 ] = multiMap.bucketOffsets[ bucketIndex ] + bucketCounters[ bucketIndex ];
+				bucketOffsets[ bucketIndex + 1 ] = bucketOffsets[ bucketIndex ] + bucketCounters[ bucketIndex ];
 			}
 
 			// allocate the data
-			multiMap.items.resize( unsortedItems.size() );
+			items.resize( unsortedItems.size() );
 
 			// now count the the objects into their buckets
 			for( auto unsortedItem = unsortedItems.begin() ; unsortedItem != unsortedItems.end() ; unsortedItem++ ) {
 				const auto bucketIndex = unsortedItem->first;
 				// example: bucketOffsets 0,3... we have 3 items for bucket 0, bucketCounter[0] = 3
 				// we insert the first object at 3-3 and then decrement bucketCounter
-				const auto itemIndex = multiMap.bucketOffsets[ bucketIndex + 1 ] - bucketCounters[ bucketIndex ]--;
-				multiMap.items[ itemIndex ] = std::move( unsortedItem->second );
+				const auto itemIndex = bucketOffsets[ bucketIndex + 1 ] - bucketCounters[ bucketIndex ]--;
+				items[ itemIndex ] = std::move( unsortedItem->second );
 
-				if( bucketCounters[ bucketIndex ] == 0 ) {
+				if( sortBuckets && bucketCounters[ bucketIndex ] == 0 ) {
 					// this bucket is done
 					// we now sort the range
-					std::sort( multiMap.items.begin() + multiMap.bucketOffsets[ bucketIndex ], multiMap.items.begin() + multiMap.bucketOffsets[ bucketIndex + 1 ] );
+					std::sort( items.begin() + bucketOffsets[ bucketIndex ], items.begin() + bucketOffsets[ bucketIndex + 1 ] );
 				}
 			}
 
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+// read-only array that either owns its elements or is a view of elements owned by someone else (eg a MappedFile)
+// the owner has to outlive the view
+//
+// views are never written to (the mapped pages are read-only):
+// makeOwning copies the elements of a view before they can be modified
+template< typename T >
+class MappedArray {
+public:
+	typedef T value_type;
+	typedef const T *const_iterator;
+	typedef const T *iterator;
+
+	MappedArray()
+		: viewData( nullptr )
+		, viewSize( 0 )
+	{
+	}
+
+	MappedArray( std::vector< T > &&elements )
+		: elements( std::move( elements ) )
+		, viewData( nullptr )
+		, viewSize( 0 )
+	{
+	}
+
+	// copies are always owning, so they can't outlive the owner of a view
+	MappedArray( const MappedArray &other )
+		: elements( other.begin(), other.end() )
+		, viewData( nullptr )
+		, viewSize( 0 )
+	{
+	}
+
+	MappedArray( MappedArray &&other )
+		: elements( std::move( other.elements ) )
+		, viewData( other.viewData )
+		, viewSize( other.viewSize )
+	{
+		other.viewData = nullptr;
+		other.viewSize = 0;
+	}
+
+	MappedArray & operator = ( const MappedArray &other ) {
+		if( this != &other ) {
+			std::vector< T >( other.begin(), other.end() ).swap( elements );
+			viewData = nullptr;
+			viewSize = 0;
+		}
+		return *this;
+	}
+
+	MappedArray & operator = ( MappedArray &&other ) {
+		elements = std::move( other.elements );
+		viewData = other.viewData;
+		viewSize = other.viewSize;
+
+		other.viewData = nullptr;
+		other.viewSize = 0;
+
+		return *this;
+	}
+
+	MappedArray & operator = ( std::vector< T > &&elements ) {
+		this->elements = std::move( elements );
+		viewData = nullptr;
+		viewSize = 0;
+
+		return *this;
+	}
+
+	// drops the owned elements
+	void setView( const T *data, size_t size ) {
+		std::vector< T >().swap( elements );
+		viewData = data;
+		viewSize = size;
+	}
+
+	bool isView() const {
+		return viewData != nullptr;
+	}
+
+	// turns a view into an owning copy and returns the elements for modification
+	std::vector< T > &makeOwning() {
+		if( viewData ) {
+			elements.assign( viewData, viewData + viewSize );
+			viewData = nullptr;
+			viewSize = 0;
+		}
+		return elements;
+	}
+
+	void clear() {
+		elements.clear();
+		viewData = nullptr;
+		viewSize = 0;
+	}
+
+	const T *data() const {
+		return viewData ? viewData : elements.data();
+	}
+
+	size_t size() const {
+		return viewData ? viewSize : elements.size();
+	}
+
+	bool empty() const {
+		return size() == 0;
+	}
+
+	const T *begin() const {
+		return data();
+	}
+
+	const T *end() const {
+		return data() + size();
+	}
+
+	const T &operator []( size_t index ) const {
+		return data()[ index ];
+	}
+
+	const T &front() const {
+		return *data();
+	}
+
+	const T &back() const {
+		return data()[ size() - 1 ];
+	}
+
+	friend bool operator == ( const MappedArray &a, const MappedArray &b ) {
+		return a.size() == b.size() && std::equal( a.begin(), a.end(), b.begin() );
+	}
+
+	friend bool operator != ( const MappedArray &a, const MappedArray &b ) {
+		return !(a == b);
+	}
+
+private:
+	std::vector< T > elements;
+
+	const T *viewData;
+	size_t viewSize;
+};
@@ -0,0 +1,111 @@
+#include "mappedFile.h"
+
+#ifdef _WIN32
+#	define NOMINMAX
+#	define WIN32_LEAN_AND_MEAN
+#	include <windows.h>
+#else
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+	: data( nullptr )
+	, size( 0 )
+#ifdef _WIN32
+	, fileHandle( INVALID_HANDLE_VALUE )
+	, mappingHandle( nullptr )
+#endif
+{
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef _WIN32
+bool MappedFile::open( const std::string &filename ) {
+	close();
+
+	// FILE_SHARE_DELETE: the file can be moved away and replaced while it is mapped (see MappedStorage::write)
+	fileHandle = CreateFileA( filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if( fileHandle == INVALID_HANDLE_VALUE ) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if( !GetFileSizeEx( fileHandle, &fileSize ) || fileSize.QuadPart == 0 ) {
+		close();
+		return false;
+	}
+
+	mappingHandle = CreateFileMappingA( fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr );
+	if( !mappingHandle ) {
+		close();
+		return false;
+	}
+
+	data = (const unsigned char *) MapViewOfFile( mappingHandle, FILE_MAP_READ, 0, 0, 0 );
+	if( !data ) {
+		close();
+		return false;
+	}
+	size = (size_t) fileSize.QuadPart;
+	return true;
+}
+
+void MappedFile::close() {
+	if( data ) {
+		UnmapViewOfFile( data );
+		data = nullptr;
+	}
+	if( mappingHandle ) {
+		CloseHandle( mappingHandle );
+		mappingHandle = nullptr;
+	}
+	if( fileHandle != INVALID_HANDLE_VALUE ) {
+		CloseHandle( fileHandle );
+		fileHandle = INVALID_HANDLE_VALUE;
+	}
+	size = 0;
+}
+#else
+bool MappedFile::open( const std::string &filename ) {
+	close();
+
+	const int fileDescriptor = ::open( filename.c_str(), O_RDONLY );
+	if( fileDescriptor == -1 ) {
+		return false;
+	}
+
+	struct stat fileStatus;
+	if( fstat( fileDescriptor, &fileStatus ) != 0 || fileStatus.st_size == 0 ) {
+		::close( fileDescriptor );
+		return false;
+	}
+
+	void *mapping = mmap( nullptr, (size_t) fileStatus.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0 );
+	// the mapping keeps its own reference to the file
+	::close( fileDescriptor );
+	if( mapping == MAP_FAILED ) {
+		return false;
+	}
+
+	// the whole file is used, but not necessarily front to back (arrays can be views of the mapping)
+	madvise( mapping, (size_t) fileStatus.st_size, MADV_WILLNEED );
+
+	data = (const unsigned char *) mapping;
+	size = (size_t) fileStatus.st_size;
+	return true;
+}
+
+void MappedFile::close() {
+	if( data ) {
+		munmap( (void *) data, size );
+		data = nullptr;
+	}
+	size = 0;
+}
+#endif
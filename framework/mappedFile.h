@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+
+// read-only memory mapping of a whole file
+// the mapping stays valid until close() is called or the object is destroyed
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	// returns false if the file cannot be opened or mapped (empty files can't be mapped either)
+	bool open( const std::string &filename );
+	void close();
+
+	bool isOpen() const {
+		return data != nullptr;
+	}
+
+	const unsigned char *getData() const {
+		return data;
+	}
+
+	size_t getSize() const {
+		return size;
+	}
+
+private:
+	const unsigned char *data;
+	size_t size;
+
+#ifdef _WIN32
+	void *fileHandle;
+	void *mappingHandle;
+#endif
+
+	MappedFile( const MappedFile & );
+	MappedFile & operator = ( const MappedFile & );
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <string.h>
+
+// stable least-significant-digit radix sort with 8 bit digits
+// compiling the probe database sorts millions of small integer keys (eg 16 bit packed samples), which is a lot faster this way than with comparison sorts
+namespace RadixSort {
+	// sorts items by getKey( item ), which has to return an unsigned integer that fits into numKeyBits bits
+	// items with equal keys keep their order
+	// buffer is scratch space (pass the same one for repeated sorts to avoid reallocations)
+	template< typename T, typename KeyFunction >
+	void sortByKey( std::vector< T > &items, std::vector< T > &buffer, int numKeyBits, const KeyFunction &getKey ) {
+		const int numItems = (int) items.size();
+		if( numItems < 2 ) {
+			return;
+		}
+		buffer.resize( numItems );
+
+		for( int shift = 0 ; shift < numKeyBits ; shift += 8 ) {
+			// counts[ digit + 1 ] is the number of items with this digit
+			unsigned digitOffsets[ 257 ] = {};
+			for( int itemIndex = 0 ; itemIndex < numItems ; itemIndex++ ) {
+				digitOffsets[ ((unsigned long long) getKey( items[ itemIndex ] ) >> shift & 0xFF) + 1 ]++;
+			}
+
+			// nothing to do if all items have the same digit
+			bool isUniform = false;
+			for( int digit = 0 ; digit < 256 && !isUniform ; digit++ ) {
+				isUniform = digitOffsets[ digit + 1 ] == (unsigned) numItems;
+			}
+			if( isUniform ) {
+				continue;
+			}
+
+			for( int digit = 0 ; digit < 256 ; digit++ ) {
+				digitOffsets[ digit + 1 ] += digitOffsets[ digit ];
+			}
+
+			for( int itemIndex = 0 ; itemIndex < numItems ; itemIndex++ ) {
+				const int digit = int( (unsigned long long) getKey( items[ itemIndex ] ) >> shift & 0xFF );
+				buffer[ digitOffsets[ digit ]++ ] = std::move( items[ itemIndex ] );
+			}
+			items.swap( buffer );
+		}
+	}
+
+	template< typename T, typename KeyFunction >
+	void sortByKey( std::vector< T > &items, int numKeyBits, const KeyFunction &getKey ) {
+		std::vector< T > buffer;
+		sortByKey( items, buffer, numKeyBits, getKey );
+	}
+
+	// sorts unsigned integers that fit into numKeyBits bits
+	inline void sort( std::vector< unsigned > &keys, int numKeyBits = 32 ) {
+		sortByKey( keys, numKeyBits, [] ( unsigned key ) { return key; } );
+	}
+
+	// maps a float to an unsigned integer with the same order (for all values but NaNs)
+	inline unsigned getOrderedBits( float value ) {
+		unsigned bits;
+		memcpy( &bits, &value, sizeof( bits ) );
+		// negative values are stored as sign + magnitude, so their order has to be reversed
+		return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+	}
+}
@@ -0,0 +1,225 @@
+#include "sampleWindowKernels.h"
+
+#include <immintrin.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+	// MSVC allows intrinsics for any instruction set without changing the target
+#	define SAMPLE_WINDOW_KERNELS_TARGET( instructionSets )
+#else
+#	define SAMPLE_WINDOW_KERNELS_TARGET( instructionSets ) __attribute__(( target( instructionSets ) ))
+#endif
+
+namespace SampleWindowKernels {
+	using BitPlaneKernels::lowestBitIndex;
+
+	namespace Scalar {
+		int findFirstNotLess( const float *values, int begin, int end, float threshold ) {
+			int index = begin;
+			for( ; index < end && !(values[ index ] >= threshold) ; index++ )
+				;
+			return index;
+		}
+
+		int findFirstGreater( const float *values, int begin, int end, float threshold ) {
+			int index = begin;
+			for( ; index < end && !(values[ index ] > threshold) ; index++ )
+				;
+			return index;
+		}
+
+		int matchColors( const SampleColumns &columns, int begin, int end, const float *referenceColor, float squaredTolerance, int *matchedIndices ) {
+			int numMatches = 0;
+			for( int index = begin ; index < end ; index++ ) {
+				const float deltaL = columns.colorL[ index ] - referenceColor[ 0 ];
+				const float deltaA = columns.colorA[ index ] - referenceColor[ 1 ];
+				const float deltaB = columns.colorB[ index ] - referenceColor[ 2 ];
+				if( deltaL * deltaL + deltaA * deltaA + deltaB * deltaB <= squaredTolerance ) {
+					matchedIndices[ numMatches++ ] = index;
+				}
+			}
+			return numMatches;
+		}
+	}
+
+	namespace SSE42 {
+		// sign extends 4 color values to floats
+		SAMPLE_WINDOW_KERNELS_TARGET( "sse4.2" )
+		static __m128 loadColors( const signed char *colors ) {
+			int packedColors;
+			memcpy( &packedColors, colors, sizeof( packedColors ) );
+			return _mm_cvtepi32_ps( _mm_cvtepi8_epi32( _mm_cvtsi32_si128( packedColors ) ) );
+		}
+
+		SAMPLE_WINDOW_KERNELS_TARGET( "sse4.2" )
+		int findFirstNotLess( const float *values, int begin, int end, float threshold ) {
+			const __m128 thresholds = _mm_set1_ps( threshold );
+
+			int index = begin;
+			for( ; index + 4 <= end ; index += 4 ) {
+				const int mask = _mm_movemask_ps( _mm_cmpge_ps( _mm_loadu_ps( values + index ), thresholds ) );
+				if( mask ) {
+					return index + lowestBitIndex( mask );
+				}
+			}
+			return Scalar::findFirstNotLess( values, index, end, threshold );
+		}
+
+		SAMPLE_WINDOW_KERNELS_TARGET( "sse4.2" )
+		int findFirstGreater( const float *values, int begin, int end, float threshold ) {
+			const __m128 thresholds = _mm_set1_ps( threshold );
+
+			int index = begin;
+			for( ; index + 4 <= end ; index += 4 ) {
+				const int mask = _mm_movemask_ps( _mm_cmpgt_ps( _mm_loadu_ps( values + index ), thresholds ) );
+				if( mask ) {
+					return index + lowestBitIndex( mask );
+				}
+			}
+			return Scalar::findFirstGreater( values, index, end, threshold );
+		}
+
+		SAMPLE_WINDOW_KERNELS_TARGET( "sse4.2" )
+		int matchColors( const SampleColumns &columns, int begin, int end, const float *referenceColor, float squaredTolerance, int *matchedIndices ) {
+			const __m128 referenceL = _mm_set1_ps( referenceColor[ 0 ] );
+			const __m128 referenceA = _mm_set1_ps( referenceColor[ 1 ] );
+			const __m128 referenceB = _mm_set1_ps( referenceColor[ 2 ] );
+			const __m128 squaredTolerances = _mm_set1_ps( squaredTolerance );
+
+			int numMatches = 0;
+
+			int index = begin;
+			for( ; index + 4 <= end ; index += 4 ) {
+				const __m128 deltaL = _mm_sub_ps( loadColors( columns.colorL + index ), referenceL );
+				const __m128 deltaA = _mm_sub_ps( loadColors( columns.colorA + index ), referenceA );
+				const __m128 deltaB = _mm_sub_ps( loadColors( columns.colorB + index ), referenceB );
+				const __m128 squaredDistances = _mm_add_ps( _mm_add_ps( _mm_mul_ps( deltaL, deltaL ), _mm_mul_ps( deltaA, deltaA ) ), _mm_mul_ps( deltaB, deltaB ) );
+
+				for( unsigned mask = _mm_movemask_ps( _mm_cmple_ps( squaredDistances, squaredTolerances ) ) ; mask ; mask &= mask - 1 ) {
+					matchedIndices[ numMatches++ ] = index + lowestBitIndex( mask );
+				}
+			}
+
+			return numMatches + Scalar::matchColors( columns, index, end, referenceColor, squaredTolerance, matchedIndices + numMatches );
+		}
+	}
+
+	namespace AVX2 {
+		// sign extends 8 color values to floats
+		SAMPLE_WINDOW_KERNELS_TARGET( "avx2" )
+		static __m256 loadColors( const signed char *colors ) {
+			return _mm256_cvtepi32_ps( _mm256_cvtepi8_epi32( _mm_loadl_epi64( (const __m128i *) colors ) ) );
+		}
+
+		SAMPLE_WINDOW_KERNELS_TARGET( "avx2" )
+		int findFirstNotLess( const float *values, int begin, int end, float threshold ) {
+			const __m256 thresholds = _mm256_set1_ps( threshold );
+
+			int index = begin;
+			for( ; index + 8 <= end ; index += 8 ) {
+				const int mask = _mm256_movemask_ps( _mm256_cmp_ps( _mm256_loadu_ps( values + index ), thresholds, _CMP_GE_OQ ) );
+				if( mask ) {
+					return index + lowestBitIndex( mask );
+				}
+			}
+			return Scalar::findFirstNotLess( values, index, end, threshold );
+		}
+
+		SAMPLE_WINDOW_KERNELS_TARGET( "avx2" )
+		int findFirstGreater( const float *values, int begin, int end, float threshold ) {
+			const __m256 thresholds = _mm256_set1_ps( threshold );
+
+			int index = begin;
+			for( ; index + 8 <= end ; index += 8 ) {
+				const int mask = _mm256_movemask_ps( _mm256_cmp_ps( _mm256_loadu_ps( values + index ), thresholds, _CMP_GT_OQ ) );
+				if( mask ) {
+					return index + lowestBitIndex( mask );
+				}
+			}
+			return Scalar::findFirstGreater( values, index, end, threshold );
+		}
+
+		SAMPLE_WINDOW_KERNELS_TARGET( "avx2" )
+		int matchColors( const SampleColumns &columns, int begin, int end, const float *referenceColor, float squaredTolerance, int *matchedIndices ) {
+			const __m256 referenceL = _mm256_set1_ps( referenceColor[ 0 ] );
+			const __m256 referenceA = _mm256_set1_ps( referenceColor[ 1 ] );
+			const __m256 referenceB = _mm256_set1_ps( referenceColor[ 2 ] );
+			const __m256 squaredTolerances = _mm256_set1_ps( squaredTolerance );
+
+			int numMatches = 0;
+
+			int index = begin;
+			for( ; index + 8 <= end ; index += 8 ) {
+				const __m256 deltaL = _mm256_sub_ps( loadColors( columns.colorL + index ), referenceL );
+				const __m256 deltaA = _mm256_sub_ps( loadColors( columns.colorA + index ), referenceA );
+				const __m256 deltaB = _mm256_sub_ps( loadColors( columns.colorB + index ), referenceB );
+				const __m256 squaredDistances = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( deltaL, deltaL ), _mm256_mul_ps( deltaA, deltaA ) ), _mm256_mul_ps( deltaB, deltaB ) );
+
+				for( unsigned mask = _mm256_movemask_ps( _mm256_cmp_ps( squaredDistances, squaredTolerances, _CMP_LE_OQ ) ) ; mask ; mask &= mask - 1 ) {
+					matchedIndices[ numMatches++ ] = index + lowestBitIndex( mask );
+				}
+			}
+
+			return numMatches + Scalar::matchColors( columns, index, end, referenceColor, squaredTolerance, matchedIndices + numMatches );
+		}
+	}
+
+	struct Dispatch {
+		InstructionSet instructionSet;
+
+		int (*findFirstNotLess)( const float *values, int begin, int end, float threshold );
+		int (*findFirstGreater)( const float *values, int begin, int end, float threshold );
+		int (*matchColors)( const SampleColumns &columns, int begin, int end, const float *referenceColor, float squaredTolerance, int *matchedIndices );
+
+		Dispatch() {
+			select( getSupportedInstructionSet() );
+		}
+
+		void select( InstructionSet requestedInstructionSet ) {
+			instructionSet = requestedInstructionSet <= getSupportedInstructionSet() ? requestedInstructionSet : getSupportedInstructionSet();
+
+			switch( instructionSet ) {
+			case IS_AVX2:
+				findFirstNotLess = &AVX2::findFirstNotLess;
+				findFirstGreater = &AVX2::findFirstGreater;
+				matchColors = &AVX2::matchColors;
+				break;
+			case IS_SSE42:
+				findFirstNotLess = &SSE42::findFirstNotLess;
+				findFirstGreater = &SSE42::findFirstGreater;
+				matchColors = &SSE42::matchColors;
+				break;
+			default:
+				findFirstNotLess = &Scalar::findFirstNotLess;
+				findFirstGreater = &Scalar::findFirstGreater;
+				matchColors = &Scalar::matchColors;
+				break;
+			}
+		}
+	};
+
+	static Dispatch &getDispatch() {
+		static Dispatch dispatch;
+		return dispatch;
+	}
+
+	InstructionSet getInstructionSet() {
+		return getDispatch().instructionSet;
+	}
+
+	void setInstructionSet( InstructionSet instructionSet ) {
+		getDispatch().select( instructionSet );
+	}
+
+	int findFirstNotLess( const float *values, int begin, int end, float threshold ) {
+		return getDispatch().findFirstNotLess( values, begin, end, threshold );
+	}
+
+	int findFirstGreater( const float *values, int begin, int end, float threshold ) {
+		return getDispatch().findFirstGreater( values, begin, end, threshold );
+	}
+
+	int matchColors( const SampleColumns &columns, int begin, int end, const float *referenceColor, float squaredTolerance, int *matchedIndices ) {
+		return getDispatch().matchColors( columns, begin, end, referenceColor, squaredTolerance, matchedIndices );
+	}
+}
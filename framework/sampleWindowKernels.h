@@ -0,0 +1,40 @@
+#pragma once
+
+#include "bitPlaneKernels.h"
+
+// vectorized kernels for the sorted-range matcher of IndexedProbeSamples
+// they work on structure-of-arrays columns (one array per sample attribute), so a single step tests a whole register of inner samples
+// the implementation is picked at runtime like for BitPlaneKernels (and uses the same instruction sets)
+namespace SampleWindowKernels {
+	using BitPlaneKernels::InstructionSet;
+	using BitPlaneKernels::IS_SCALAR;
+	using BitPlaneKernels::IS_SSE42;
+	using BitPlaneKernels::IS_AVX2;
+	using BitPlaneKernels::getSupportedInstructionSet;
+	using BitPlaneKernels::getInstructionSetName;
+
+	// the columns of a range of samples that is sorted by distance
+	// colors are stored with 8 bits per channel (like in the probe samples) and converted to floats when they are loaded,
+	// so the squared distances stay exact (they are < 2^24)
+	struct SampleColumns {
+		const float *distances;
+		const signed char *colorL;
+		const signed char *colorA;
+		const signed char *colorB;
+	};
+
+	InstructionSet getInstructionSet();
+	// force a specific implementation (for tests and benchmarks)
+	// falls back to the supported instruction set if the CPU cannot execute the requested one
+	void setInstructionSet( InstructionSet instructionSet );
+
+	// returns the first index in [begin, end) with values[ index ] >= threshold or end if there is none
+	int findFirstNotLess( const float *values, int begin, int end, float threshold );
+	// returns the first index in [begin, end) with values[ index ] > threshold or end if there is none
+	int findFirstGreater( const float *values, int begin, int end, float threshold );
+
+	// writes all indices in [begin, end) whose squared color distance to referenceColor (L, a, b) is <= squaredTolerance into matchedIndices
+	// returns how many indices were written (in ascending order)
+	// matchedIndices has to have room for end - begin entries
+	int matchColors( const SampleColumns &columns, int begin, int end, const float *referenceColor, float squaredTolerance, int *matchedIndices );
+}
@@ -0,0 +1,250 @@
+#include "taskRuntime.h"
+
+#include <stdexcept>
+
+#ifdef _MSC_VER
+#	define TASK_RUNTIME_THREAD_LOCAL __declspec( thread )
+#else
+#	define TASK_RUNTIME_THREAD_LOCAL __thread
+#endif
+
+namespace TaskRuntime {
+	namespace {
+		// the pool and worker index of the current thread (if it is a worker)
+		TASK_RUNTIME_THREAD_LOCAL ThreadPool *currentPool = nullptr;
+		TASK_RUNTIME_THREAD_LOCAL int currentWorkerIndex = -1;
+
+		struct ThreadSlots {
+			std::mutex mutex;
+			std::vector< int > freeSlots;
+			int numUsedSlots;
+
+			ThreadSlots() : numUsedSlots( 0 ) {}
+
+			int acquire() {
+				std::lock_guard< std::mutex > lock( mutex );
+				if( !freeSlots.empty() ) {
+					const int slotIndex = freeSlots.back();
+					freeSlots.pop_back();
+					return slotIndex;
+				}
+				if( numUsedSlots == detail::maxThreadSlots ) {
+					throw std::logic_error( "TaskRuntime: too many threads!" );
+				}
+				return numUsedSlots++;
+			}
+
+			void release( int slotIndex ) {
+				std::lock_guard< std::mutex > lock( mutex );
+				freeSlots.push_back( slotIndex );
+			}
+		};
+
+		// never destroyed: the workers of static pools release their slots during static destruction
+		ThreadSlots &getThreadSlots() {
+			static ThreadSlots *threadSlots = new ThreadSlots();
+			return *threadSlots;
+		}
+
+		// owns the slot of a thread and gives it back when the thread exits
+		// (this works for every thread, not only for the workers of a pool)
+		struct ThreadSlotGuard {
+			const int slotIndex;
+
+			ThreadSlotGuard() : slotIndex( getThreadSlots().acquire() ) {}
+			~ThreadSlotGuard() {
+				getThreadSlots().release( slotIndex );
+			}
+		};
+	}
+
+	namespace detail {
+		int getThreadSlotIndex() {
+			// constructed on first use in every thread
+			static thread_local ThreadSlotGuard threadSlotGuard;
+			return threadSlotGuard.slotIndex;
+		}
+	}
+
+	ThreadPool::ThreadPool( int numWorkers )
+		: numQueuedTasks( 0 )
+		, numSleepingWorkers( 0 )
+		, stopping( false )
+	{
+		if( numWorkers <= 0 ) {
+			numWorkers = std::max( 1, (int) std::thread::hardware_concurrency() - 1 );
+		}
+
+		for( int workerIndex = 0 ; workerIndex < numWorkers ; workerIndex++ ) {
+			workerQueues.push_back( std::unique_ptr< WorkerQueue >( new WorkerQueue() ) );
+		}
+		for( int workerIndex = 0 ; workerIndex < numWorkers ; workerIndex++ ) {
+			workers.push_back( std::thread( &ThreadPool::workerMain, this, workerIndex ) );
+		}
+	}
+
+	ThreadPool::~ThreadPool() {
+		{
+			std::lock_guard< std::mutex > lock( sleepMutex );
+			stopping = true;
+		}
+		wakeUp.notify_all();
+
+		for( auto worker = workers.begin() ; worker != workers.end() ; ++worker ) {
+			worker->join();
+		}
+	}
+
+	ThreadPool &ThreadPool::getDefault() {
+		static ThreadPool defaultPool;
+		return defaultPool;
+	}
+
+	void ThreadPool::submit( std::function< void() > &&task ) {
+		std::unique_ptr< std::function< void() > > queuedTask( new std::function< void() >( std::move( task ) ) );
+
+		WorkerQueue &queue = (currentPool == this) ? *workerQueues[ currentWorkerIndex ] : sharedQueue;
+		{
+			std::lock_guard< std::mutex > lock( queue.mutex );
+			queue.tasks.push_back( queuedTask.release() );
+		}
+		numQueuedTasks++;
+
+		// a worker that is about to sleep either sees the new task or gets woken up here
+		if( numSleepingWorkers > 0 ) {
+			{
+				std::lock_guard< std::mutex > lock( sleepMutex );
+			}
+			wakeUp.notify_one();
+		}
+	}
+
+	std::function< void() > *ThreadPool::popBack( WorkerQueue &queue ) {
+		std::lock_guard< std::mutex > lock( queue.mutex );
+		if( queue.tasks.empty() ) {
+			return nullptr;
+		}
+		std::function< void() > *task = queue.tasks.back();
+		queue.tasks.pop_back();
+		return task;
+	}
+
+	std::function< void() > *ThreadPool::popFront( WorkerQueue &queue ) {
+		std::lock_guard< std::mutex > lock( queue.mutex );
+		if( queue.tasks.empty() ) {
+			return nullptr;
+		}
+		std::function< void() > *task = queue.tasks.front();
+		queue.tasks.pop_front();
+		return task;
+	}
+
+	std::function< void() > *ThreadPool::popTask( int workerIndex ) {
+		if( numQueuedTasks == 0 ) {
+			return nullptr;
+		}
+
+		std::function< void() > *task = nullptr;
+
+		// newest own task first (it's still in the cache)
+		if( workerIndex >= 0 ) {
+			task = popBack( *workerQueues[ workerIndex ] );
+		}
+		// then the oldest tasks of everyone else (the biggest chunks)
+		const int numQueues = (int) workerQueues.size();
+		for( int offset = 1 ; !task && offset <= numQueues ; offset++ ) {
+			const int victimIndex = (std::max( workerIndex, 0 ) + offset) % numQueues;
+			if( victimIndex != workerIndex ) {
+				task = popFront( *workerQueues[ victimIndex ] );
+			}
+		}
+		if( !task ) {
+			task = popFront( sharedQueue );
+		}
+
+		if( task ) {
+			numQueuedTasks--;
+		}
+		return task;
+	}
+
+	bool ThreadPool::runPendingTask() {
+		std::unique_ptr< std::function< void() > > task( popTask( currentPool == this ? currentWorkerIndex : -1 ) );
+		if( !task ) {
+			return false;
+		}
+		(*task)();
+		return true;
+	}
+
+	void ThreadPool::waitForTask( const std::function< bool() > &isDone ) {
+		std::unique_lock< std::mutex > lock( sleepMutex );
+		numSleepingWorkers++;
+		wakeUp.wait( lock, [&] () { return numQueuedTasks > 0 || isDone(); } );
+		numSleepingWorkers--;
+	}
+
+	void ThreadPool::notifyWaitingThreads() {
+		// same handshake as in submit
+		if( numSleepingWorkers > 0 ) {
+			{
+				std::lock_guard< std::mutex > lock( sleepMutex );
+			}
+			wakeUp.notify_all();
+		}
+	}
+
+	void ThreadPool::workerMain( int workerIndex ) {
+		currentPool = this;
+		currentWorkerIndex = workerIndex;
+
+		while( true ) {
+			std::unique_ptr< std::function< void() > > task( popTask( workerIndex ) );
+			if( task ) {
+				(*task)();
+				continue;
+			}
+
+			std::unique_lock< std::mutex > lock( sleepMutex );
+			numSleepingWorkers++;
+			wakeUp.wait( lock, [this] () { return stopping || numQueuedTasks > 0; } );
+			numSleepingWorkers--;
+
+			if( stopping ) {
+				break;
+			}
+		}
+	}
+
+	void TaskGroup::onException( std::exception_ptr exception ) {
+		{
+			std::lock_guard< std::mutex > lock( exceptionMutex );
+			if( !this->exception ) {
+				this->exception = exception;
+			}
+		}
+		cancel();
+	}
+
+	void TaskGroup::waitForPendingTasks() {
+		while( numPendingTasks > 0 ) {
+			// help with the queued tasks, and sleep once the remaining tasks of the group are running on other threads
+			if( !pool.runPendingTask() ) {
+				pool.waitForTask( [this] () { return numPendingTasks == 0; } );
+			}
+		}
+	}
+
+	void TaskGroup::wait() {
+		waitForPendingTasks();
+
+		std::exception_ptr exception;
+		{
+			std::lock_guard< std::mutex > lock( exceptionMutex );
+			std::swap( exception, this->exception );
+		}
+		if( exception ) {
+			std::rethrow_exception( exception );
+		}
+	}
+}
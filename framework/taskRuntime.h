@@ -0,0 +1,357 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <algorithm>
+#include <iterator>
+
+// small task-parallel runtime (replaces Concurrency::parallel_for & co, so we can run on non-Windows machines, too)
+//
+// a thread pool with one work-stealing deque per worker: workers pop their own tasks LIFO and steal FIFO from the others
+// threads that wait for a task group help executing tasks, so nested parallel_fors don't deadlock
+namespace TaskRuntime {
+	class ThreadPool;
+
+	// can be shared between task groups and parallel_fors to stop them early
+	class CancellationToken {
+	public:
+		CancellationToken() : canceled( false ) {}
+
+		void cancel() {
+			canceled = true;
+		}
+
+		bool isCanceled() const {
+			return canceled;
+		}
+
+	private:
+		std::atomic< bool > canceled;
+
+		CancellationToken( const CancellationToken & );
+		CancellationToken & operator = ( const CancellationToken & );
+	};
+
+	class ThreadPool {
+	public:
+		// numWorkers <= 0: one worker less than the hardware supports (the thread that waits helps, too)
+		explicit ThreadPool( int numWorkers = 0 );
+		~ThreadPool();
+
+		int getNumWorkers() const {
+			return (int) workers.size();
+		}
+
+		// the pool all parallel_fors use by default
+		static ThreadPool &getDefault();
+
+		// internal interface for TaskGroup
+		void submit( std::function< void() > &&task );
+		// runs one queued task in the calling thread
+		// returns false if there was nothing to do
+		bool runPendingTask();
+		// blocks the calling thread like an idle worker until a task is queued or isDone() returns true
+		void waitForTask( const std::function< bool() > &isDone );
+		// wakes up the threads in waitForTask, so they check isDone() again
+		void notifyWaitingThreads();
+
+	private:
+		struct WorkerQueue {
+			std::mutex mutex;
+			std::deque< std::function< void() > * > tasks;
+		};
+
+		std::vector< std::thread > workers;
+		std::vector< std::unique_ptr< WorkerQueue > > workerQueues;
+		// tasks submitted by threads that don't belong to the pool
+		WorkerQueue sharedQueue;
+
+		std::atomic< int > numQueuedTasks;
+		std::atomic< int > numSleepingWorkers;
+		std::atomic< bool > stopping;
+
+		std::mutex sleepMutex;
+		std::condition_variable wakeUp;
+
+		void workerMain( int workerIndex );
+
+		std::function< void() > *popTask( int workerIndex );
+		static std::function< void() > *popBack( WorkerQueue &queue );
+		static std::function< void() > *popFront( WorkerQueue &queue );
+
+		ThreadPool( const ThreadPool & );
+		ThreadPool & operator = ( const ThreadPool & );
+	};
+
+	// a set of tasks that can be waited on
+	// the first exception thrown by a task cancels the group and is rethrown by wait()
+	class TaskGroup {
+	public:
+		explicit TaskGroup( ThreadPool &pool = ThreadPool::getDefault(), const CancellationToken *cancellationToken = nullptr )
+			: pool( pool )
+			, cancellationToken( cancellationToken )
+			, numPendingTasks( 0 )
+			, canceled( false )
+		{
+		}
+
+		~TaskGroup() {
+			// never leave tasks behind that reference this group
+			waitForPendingTasks();
+		}
+
+		template< typename Function >
+		void run( Function &&function ) {
+			numPendingTasks++;
+			ThreadPool *pool = &this->pool;
+			pool->submit( [this, pool, function] () {
+				if( !isCanceled() ) {
+					try {
+						function();
+					}
+					catch( ... ) {
+						onException( std::current_exception() );
+					}
+				}
+				// the group can be destroyed as soon as the count drops to zero, so only the pool is used afterwards
+				if( --numPendingTasks == 0 ) {
+					pool->notifyWaitingThreads();
+				}
+			} );
+		}
+
+		// waits for all tasks and rethrows the first exception
+		void wait();
+
+		void cancel() {
+			canceled = true;
+		}
+
+		bool isCanceled() const {
+			return canceled || (cancellationToken && cancellationToken->isCanceled());
+		}
+
+		ThreadPool &getPool() {
+			return pool;
+		}
+
+	private:
+		ThreadPool &pool;
+		const CancellationToken *cancellationToken;
+
+		std::atomic< int > numPendingTasks;
+		std::atomic< bool > canceled;
+
+		std::mutex exceptionMutex;
+		std::exception_ptr exception;
+
+		void onException( std::exception_ptr exception );
+		void waitForPendingTasks();
+
+		TaskGroup( const TaskGroup & );
+		TaskGroup & operator = ( const TaskGroup & );
+	};
+
+	namespace detail {
+		// returns an index in [0, maxThreadSlots) that is unique for every live thread
+		int getThreadSlotIndex();
+		const int maxThreadSlots = 256;
+
+		template< typename Body >
+		void splitRange( TaskGroup &taskGroup, int begin, int end, int grainSize, const Body &body ) {
+			// hand out the upper halves, so other workers can steal big chunks
+			while( end - begin > grainSize ) {
+				const int middle = begin + (end - begin) / 2;
+				const int rangeEnd = end;
+				taskGroup.run( [&taskGroup, middle, rangeEnd, grainSize, &body] () {
+					splitRange( taskGroup, middle, rangeEnd, grainSize, body );
+				} );
+				end = middle;
+			}
+
+			for( int index = begin ; index < end ; index++ ) {
+				if( taskGroup.isCanceled() ) {
+					return;
+				}
+				body( index );
+			}
+		}
+	}
+
+	// a grain size that results in a few chunks per thread, so stealing can balance the load
+	inline int getDefaultGrainSize( int numItems, const ThreadPool &pool = ThreadPool::getDefault() ) {
+		return std::max( 1, numItems / (8 * (pool.getNumWorkers() + 1)) );
+	}
+
+	// calls body( index ) for every index in [begin, end)
+	// ranges with at most grainSize indices are executed sequentially
+	// stops early (without calling body for the remaining indices) if the cancellation token is canceled or body throws
+	template< typename Body >
+	void parallel_for( int begin, int end, int grainSize, const Body &body, const CancellationToken *cancellationToken = nullptr, ThreadPool &pool = ThreadPool::getDefault() ) {
+		if( begin >= end ) {
+			return;
+		}
+		grainSize = std::max( grainSize, 1 );
+
+		TaskGroup taskGroup( pool, cancellationToken );
+		try {
+			detail::splitRange( taskGroup, begin, end, grainSize, body );
+		}
+		catch( ... ) {
+			taskGroup.cancel();
+			throw;
+		}
+		taskGroup.wait();
+	}
+
+	template< typename Body >
+	void parallel_for( int begin, int end, const Body &body ) {
+		parallel_for( begin, end, getDefaultGrainSize( end - begin ), body );
+	}
+
+	// calls body( item ) for every item in [begin, end) (random access iterators only)
+	template< typename Iterator, typename Body >
+	void parallel_for_each( Iterator begin, Iterator end, const Body &body ) {
+		const int numItems = (int) std::distance( begin, end );
+		parallel_for( 0, numItems, getDefaultGrainSize( numItems ),
+			[&] ( int index ) {
+				body( begin[ index ] );
+			}
+		);
+	}
+
+	// per-thread storage for reductions (like Concurrency::combinable)
+	// local() is only ever accessed by its own thread, combine*() may only be called after the parallel work has finished
+	template< typename T >
+	class Reducer {
+	public:
+		Reducer()
+			: initializer( [] () { return T(); } )
+			, slots( new std::unique_ptr< T >[ detail::maxThreadSlots ] )
+		{
+		}
+
+		explicit Reducer( const std::function< T () > &initializer )
+			: initializer( initializer )
+			, slots( new std::unique_ptr< T >[ detail::maxThreadSlots ] )
+		{
+		}
+
+		Reducer( const Reducer &other )
+			: initializer( other.initializer )
+			, slots( new std::unique_ptr< T >[ detail::maxThreadSlots ] )
+		{
+			for( int slotIndex = 0 ; slotIndex < detail::maxThreadSlots ; slotIndex++ ) {
+				if( other.slots[ slotIndex ] ) {
+					slots[ slotIndex ].reset( new T( *other.slots[ slotIndex ] ) );
+				}
+			}
+		}
+
+		Reducer( Reducer &&other )
+			: initializer( std::move( other.initializer ) )
+			, slots( std::move( other.slots ) )
+		{
+		}
+
+		T &local() {
+			std::unique_ptr< T > &slot = slots[ detail::getThreadSlotIndex() ];
+			if( !slot ) {
+				slot.reset( new T( initializer() ) );
+			}
+			return *slot;
+		}
+
+		template< typename Function >
+		void combine_each( Function &&function ) const {
+			for( int slotIndex = 0 ; slotIndex < detail::maxThreadSlots ; slotIndex++ ) {
+				if( slots[ slotIndex ] ) {
+					function( *slots[ slotIndex ] );
+				}
+			}
+		}
+
+		template< typename BinaryOperation >
+		T combine( BinaryOperation &&operation ) const {
+			T result = initializer();
+			combine_each( [&] ( const T &value ) {
+				result = operation( result, value );
+			} );
+			return result;
+		}
+
+		void clear() {
+			for( int slotIndex = 0 ; slotIndex < detail::maxThreadSlots ; slotIndex++ ) {
+				slots[ slotIndex ].reset();
+			}
+		}
+
+	private:
+		std::function< T () > initializer;
+		std::unique_ptr< std::unique_ptr< T >[] > slots;
+
+		Reducer & operator = ( const Reducer & );
+	};
+
+	// blocking queue with a fixed capacity that connects the stages of a pipeline
+	// push() waits while the queue is full, pop() waits while it is empty
+	// close() wakes everybody up: pop() then returns false once the queue is empty and push() drops the item and returns false
+	template< typename T >
+	class BoundedQueue {
+	public:
+		explicit BoundedQueue( int capacity )
+			: capacity( std::max( capacity, 1 ) )
+			, closed( false )
+		{
+		}
+
+		bool push( T item ) {
+			std::unique_lock< std::mutex > lock( mutex );
+			notFull.wait( lock, [this] () { return closed || (int) items.size() < capacity; } );
+			if( closed ) {
+				return false;
+			}
+			items.push_back( std::move( item ) );
+			notEmpty.notify_one();
+			return true;
+		}
+
+		bool pop( T &item ) {
+			std::unique_lock< std::mutex > lock( mutex );
+			notEmpty.wait( lock, [this] () { return closed || !items.empty(); } );
+			if( items.empty() ) {
+				return false;
+			}
+			item = std::move( items.front() );
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+
+		// no more items will be pushed (the queued items can still be popped)
+		void close() {
+			std::lock_guard< std::mutex > lock( mutex );
+			closed = true;
+			notFull.notify_all();
+			notEmpty.notify_all();
+		}
+
+	private:
+		const int capacity;
+		bool closed;
+		std::deque< T > items;
+
+		std::mutex mutex;
+		std::condition_variable notFull, notEmpty;
+
+		BoundedQueue( const BoundedQueue & );
+		BoundedQueue & operator = ( const BoundedQueue & );
+	};
+}
@@ -0,0 +1,72 @@
+#include "bitPlaneKernels.h"
+
+#include <gtest.h>
+
+#include <vector>
+#include <stdlib.h>
+
+using namespace BitPlaneKernels;
+
+static std::vector<unsigned> makeRandomPlane( int numWords, int density ) {
+	std::vector<unsigned> plane( numWords );
+	for( int wordIndex = 0 ; wordIndex < numWords ; wordIndex++ ) {
+		// leave most words empty like real sample bit planes
+		if( rand() % 100 < density ) {
+			plane[ wordIndex ] = unsigned( rand() ) ^ (unsigned( rand() ) << 16);
+		}
+	}
+	return plane;
+}
+
+TEST( BitPlaneKernels, popcount ) {
+	EXPECT_EQ( 0, popcount( 0 ) );
+	EXPECT_EQ( 1, popcount( 1 ) );
+	EXPECT_EQ( 32, popcount( 0xFFFFFFFFu ) );
+	EXPECT_EQ( 16, popcount( 0xF0F0F0F0u ) );
+}
+
+TEST( BitPlaneKernels, lowestBitIndex ) {
+	for( int bitIndex = 0 ; bitIndex < 32 ; bitIndex++ ) {
+		EXPECT_EQ( bitIndex, lowestBitIndex( 1u << bitIndex ) );
+		EXPECT_EQ( bitIndex, lowestBitIndex( 0x80000000u | (1u << bitIndex) ) );
+	}
+}
+
+TEST( BitPlaneKernels, allInstructionSetsAgree ) {
+	// odd size to exercise the scalar tails
+	const int numWords = 2048 + 3;
+
+	srand( 0 );
+	const std::vector<unsigned> planeA = makeRandomPlane( numWords, 30 );
+	const std::vector<unsigned> planeB = makeRandomPlane( numWords, 30 );
+
+	int expectedCount = 0;
+	std::vector<MaskedWord> expectedMaskedWords;
+	for( int wordIndex = 0 ; wordIndex < numWords ; wordIndex++ ) {
+		const unsigned mask = planeA[ wordIndex ] & planeB[ wordIndex ];
+		expectedCount += popcount( mask );
+		if( mask ) {
+			MaskedWord maskedWord = { wordIndex, mask };
+			expectedMaskedWords.push_back( maskedWord );
+		}
+	}
+
+	const InstructionSet instructionSets[] = { IS_SCALAR, IS_SSE42, IS_AVX2 };
+	for( int i = 0 ; i < 3 ; i++ ) {
+		setInstructionSet( instructionSets[ i ] );
+		SCOPED_TRACE( getInstructionSetName( getInstructionSet() ) );
+
+		std::vector<MaskedWord> maskedWords( numWords );
+		const int numMaskedWords = intersect( &planeA.front(), &planeB.front(), numWords, &maskedWords.front() );
+
+		ASSERT_EQ( expectedMaskedWords.size(), numMaskedWords );
+		for( int j = 0 ; j < numMaskedWords ; j++ ) {
+			EXPECT_EQ( expectedMaskedWords[ j ].wordIndex, maskedWords[ j ].wordIndex );
+			EXPECT_EQ( expectedMaskedWords[ j ].mask, maskedWords[ j ].mask );
+		}
+
+		EXPECT_EQ( expectedCount, countIntersection( &planeA.front(), &planeB.front(), numWords ) );
+	}
+
+	setInstructionSet( getSupportedInstructionSet() );
+}
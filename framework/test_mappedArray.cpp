@@ -0,0 +1,62 @@
+#include "mappedArray.h"
+
+#include <gtest.h>
+
+TEST( MappedArray, owning ) {
+	MappedArray< int > array( std::vector< int >( 3, 7 ) );
+	ASSERT_FALSE( array.isView() );
+	ASSERT_EQ( 3, array.size() );
+	ASSERT_EQ( 7, array[ 2 ] );
+
+	array.makeOwning().push_back( 8 );
+	ASSERT_EQ( 4, array.size() );
+	ASSERT_EQ( 8, array.back() );
+}
+
+TEST( MappedArray, view ) {
+	const int elements[] = { 1, 2, 3, 4 };
+
+	MappedArray< int > array( std::vector< int >( 10 ) );
+	array.setView( elements, 4 );
+	ASSERT_TRUE( array.isView() );
+	ASSERT_EQ( 4, array.size() );
+	ASSERT_EQ( elements, array.data() );
+	ASSERT_EQ( 1, array.front() );
+	ASSERT_EQ( 4, array.back() );
+
+	// modifying a view copies it first
+	array.makeOwning()[ 0 ] = 5;
+	ASSERT_FALSE( array.isView() );
+	ASSERT_NE( elements, array.data() );
+	ASSERT_EQ( 5, array[ 0 ] );
+	ASSERT_EQ( 1, elements[ 0 ] );
+	ASSERT_EQ( 4, array.size() );
+}
+
+TEST( MappedArray, copyAndMove ) {
+	const int elements[] = { 1, 2, 3 };
+
+	MappedArray< int > view;
+	view.setView( elements, 3 );
+
+	// copies of views own their elements
+	MappedArray< int > copy( view );
+	ASSERT_FALSE( copy.isView() );
+	ASSERT_EQ( view, copy );
+
+	MappedArray< int > assigned;
+	assigned = view;
+	ASSERT_FALSE( assigned.isView() );
+	ASSERT_EQ( view, assigned );
+
+	// moves keep the view
+	MappedArray< int > moved( std::move( view ) );
+	ASSERT_TRUE( moved.isView() );
+	ASSERT_EQ( elements, moved.data() );
+	ASSERT_TRUE( view.empty() );
+
+	moved.clear();
+	ASSERT_FALSE( moved.isView() );
+	ASSERT_TRUE( moved.empty() );
+	ASSERT_NE( copy, moved );
+}
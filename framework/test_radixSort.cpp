@@ -0,0 +1,51 @@
+#include "radixSort.h"
+
+#include <gtest.h>
+
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+
+TEST( RadixSort, sort ) {
+	const int keyBits[] = { 8, 16, 32 };
+	for( int i = 0 ; i < 3 ; i++ ) {
+		const unsigned mask = keyBits[ i ] == 32 ? ~0u : (1u << keyBits[ i ]) - 1;
+
+		srand( i );
+		std::vector< unsigned > keys( 10000 );
+		for( size_t keyIndex = 0 ; keyIndex < keys.size() ; keyIndex++ ) {
+			keys[ keyIndex ] = (unsigned( rand() ) ^ (unsigned( rand() ) << 15) ^ (unsigned( rand() ) << 30)) & mask;
+		}
+
+		std::vector< unsigned > expectedKeys = keys;
+		std::sort( expectedKeys.begin(), expectedKeys.end() );
+
+		RadixSort::sort( keys, keyBits[ i ] );
+		EXPECT_EQ( expectedKeys, keys ) << keyBits[ i ] << " bits";
+	}
+}
+
+TEST( RadixSort, sortByKey_isStable ) {
+	// sort pairs by their second element only
+	std::vector< std::pair< int, unsigned short > > items;
+	for( int itemIndex = 0 ; itemIndex < 5000 ; itemIndex++ ) {
+		items.push_back( std::make_pair( itemIndex, (unsigned short) (rand() % 300) ) );
+	}
+
+	std::vector< std::pair< int, unsigned short > > expectedItems = items;
+	std::stable_sort( expectedItems.begin(), expectedItems.end(),
+		[] ( const std::pair< int, unsigned short > &a, const std::pair< int, unsigned short > &b ) {
+			return a.second < b.second;
+		}
+	);
+
+	RadixSort::sortByKey( items, 16, [] ( const std::pair< int, unsigned short > &item ) { return item.second; } );
+	EXPECT_EQ( expectedItems, items );
+}
+
+TEST( RadixSort, getOrderedBits ) {
+	const float values[] = { -1e30f, -2.5f, -1.0f, -1e-30f, 0.0f, 1e-30f, 0.25f, 1.0f, 3.5f, 1e30f };
+	for( size_t i = 0 ; i + 1 < sizeof( values ) / sizeof( *values ) ; i++ ) {
+		EXPECT_LT( RadixSort::getOrderedBits( values[ i ] ), RadixSort::getOrderedBits( values[ i + 1 ] ) ) << values[ i ];
+	}
+}
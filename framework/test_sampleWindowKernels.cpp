@@ -0,0 +1,73 @@
+#include "sampleWindowKernels.h"
+
+#include <gtest.h>
+
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+
+using namespace SampleWindowKernels;
+
+// note: BitPlaneKernels::setInstructionSet is found by ADL, too, so the dispatch functions are qualified
+
+TEST( SampleWindowKernels, allInstructionSetsAgree ) {
+	// odd size to exercise the scalar tails
+	const int numSamples = 1024 + 5;
+
+	srand( 0 );
+	std::vector<float> distances( numSamples );
+	std::vector<signed char> colorL( numSamples ), colorA( numSamples ), colorB( numSamples );
+	for( int index = 0 ; index < numSamples ; index++ ) {
+		// coarse values, so there are runs of equal distances
+		distances[ index ] = float( rand() % 64 ) * 0.25f;
+		colorL[ index ] = (signed char) (rand() % 256 - 128);
+		colorA[ index ] = (signed char) (rand() % 256 - 128);
+		colorB[ index ] = (signed char) (rand() % 256 - 128);
+	}
+	std::sort( distances.begin(), distances.end() );
+
+	const SampleColumns columns = { &distances.front(), &colorL.front(), &colorA.front(), &colorB.front() };
+	const float referenceColor[] = { 10.0f, -20.0f, 30.0f };
+	const float squaredTolerance = 80.0f * 80.0f;
+
+	const InstructionSet instructionSets[] = { IS_SCALAR, IS_SSE42, IS_AVX2 };
+	for( int i = 0 ; i < 3 ; i++ ) {
+		SampleWindowKernels::setInstructionSet( instructionSets[ i ] );
+		SCOPED_TRACE( getInstructionSetName( SampleWindowKernels::getInstructionSet() ) );
+
+		for( int begin = 0 ; begin < numSamples ; begin += 37 ) {
+			for( float threshold = -1.0f ; threshold <= 17.0f ; threshold += 0.125f ) {
+				const int expectedNotLess = int( std::lower_bound( distances.begin() + begin, distances.end(), threshold ) - distances.begin() );
+				const int expectedGreater = int( std::upper_bound( distances.begin() + begin, distances.end(), threshold ) - distances.begin() );
+
+				ASSERT_EQ( expectedNotLess, findFirstNotLess( &distances.front(), begin, numSamples, threshold ) );
+				ASSERT_EQ( expectedGreater, findFirstGreater( &distances.front(), begin, numSamples, threshold ) );
+			}
+
+			const int end = std::min( numSamples, begin + 100 );
+
+			std::vector<int> expectedIndices;
+			for( int index = begin ; index < end ; index++ ) {
+				const int deltaL = int( colorL[ index ] - referenceColor[ 0 ] );
+				const int deltaA = int( colorA[ index ] - referenceColor[ 1 ] );
+				const int deltaB = int( colorB[ index ] - referenceColor[ 2 ] );
+				if( deltaL * deltaL + deltaA * deltaA + deltaB * deltaB <= int( squaredTolerance ) ) {
+					expectedIndices.push_back( index );
+				}
+			}
+
+			std::vector<int> matchedIndices( end - begin );
+			const int numMatches = matchColors( columns, begin, end, referenceColor, squaredTolerance, &matchedIndices.front() );
+			matchedIndices.resize( numMatches );
+			ASSERT_EQ( expectedIndices, matchedIndices );
+		}
+	}
+
+	SampleWindowKernels::setInstructionSet( getSupportedInstructionSet() );
+}
+
+TEST( SampleWindowKernels, emptyRange ) {
+	const float values[] = { 1.0f };
+	EXPECT_EQ( 0, findFirstNotLess( values, 0, 0, 0.0f ) );
+	EXPECT_EQ( 1, findFirstGreater( values, 1, 1, 0.0f ) );
+}
@@ -0,0 +1,217 @@
+#include "taskRuntime.h"
+
+#include <gtest.h>
+
+#include <stdexcept>
+#include <vector>
+#include <numeric>
+#include <thread>
+#include <chrono>
+
+using namespace TaskRuntime;
+
+TEST( TaskRuntime, parallel_for_visitsEveryIndexOnce ) {
+	const int numItems = 10007;
+
+	const int grainSizes[] = { 1, 7, 64, 1000, numItems, 2 * numItems };
+	for( size_t i = 0 ; i < sizeof( grainSizes ) / sizeof( *grainSizes ) ; i++ ) {
+		std::vector< std::atomic< int > > visits( numItems );
+		for( int index = 0 ; index < numItems ; index++ ) {
+			visits[ index ] = 0;
+		}
+
+		parallel_for( 0, numItems, grainSizes[ i ], [&] ( int index ) {
+			visits[ index ]++;
+		} );
+
+		for( int index = 0 ; index < numItems ; index++ ) {
+			ASSERT_EQ( 1, visits[ index ] ) << "grain size " << grainSizes[ i ] << ", index " << index;
+		}
+	}
+}
+
+TEST( TaskRuntime, parallel_for_emptyRange ) {
+	int numCalls = 0;
+	parallel_for( 5, 5, 1, [&] ( int ) { numCalls++; } );
+	parallel_for( 5, 3, 1, [&] ( int ) { numCalls++; } );
+	EXPECT_EQ( 0, numCalls );
+}
+
+TEST( TaskRuntime, parallel_for_nested ) {
+	const int numOuter = 64, numInner = 256;
+
+	Reducer< int > sum;
+	parallel_for( 0, numOuter, 1, [&] ( int ) {
+		parallel_for( 0, numInner, 16, [&] ( int ) {
+			sum.local()++;
+		} );
+	} );
+
+	EXPECT_EQ( numOuter * numInner, sum.combine( std::plus< int >() ) );
+}
+
+TEST( TaskRuntime, parallel_for_each ) {
+	std::vector< int > values( 1000 );
+	std::iota( values.begin(), values.end(), 0 );
+
+	Reducer< long long > sum;
+	parallel_for_each( values.begin(), values.end(), [&] ( int value ) {
+		sum.local() += value;
+	} );
+
+	EXPECT_EQ( 999 * 1000 / 2, sum.combine( std::plus< long long >() ) );
+}
+
+TEST( TaskRuntime, Reducer_combineEach ) {
+	Reducer< std::vector< int > > indices;
+	parallel_for( 0, 1000, 10, [&] ( int index ) {
+		indices.local().push_back( index );
+	} );
+
+	std::vector< int > mergedIndices;
+	indices.combine_each( [&] ( const std::vector< int > &localIndices ) {
+		mergedIndices.insert( mergedIndices.end(), localIndices.begin(), localIndices.end() );
+	} );
+	std::sort( mergedIndices.begin(), mergedIndices.end() );
+
+	ASSERT_EQ( 1000, mergedIndices.size() );
+	for( int index = 0 ; index < 1000 ; index++ ) {
+		EXPECT_EQ( index, mergedIndices[ index ] );
+	}
+}
+
+TEST( TaskRuntime, Reducer_initializer ) {
+	Reducer< std::vector< int > > grids( [] () { return std::vector< int >( 16 ); } );
+	EXPECT_EQ( 16, grids.local().size() );
+
+	Reducer< std::vector< int > > copy( grids );
+	EXPECT_EQ( 16, copy.local().size() );
+}
+
+TEST( TaskRuntime, Reducer_shortLivedThreads ) {
+	// every thread gives its slot back when it exits, so over time we can use more threads than there are slots
+	const int numThreads = 4 * detail::maxThreadSlots;
+
+	Reducer< int > sum;
+	for( int threadIndex = 0 ; threadIndex < numThreads ; threadIndex++ ) {
+		std::thread thread( [&] () {
+			sum.local()++;
+		} );
+		thread.join();
+	}
+
+	EXPECT_EQ( numThreads, sum.combine( std::plus< int >() ) );
+}
+
+TEST( TaskRuntime, cancellation ) {
+	const int numItems = 1000000;
+
+	CancellationToken cancellationToken;
+	std::atomic< int > numCalls( 0 );
+
+	parallel_for( 0, numItems, 1, [&] ( int ) {
+		if( numCalls++ == 100 ) {
+			cancellationToken.cancel();
+		}
+	}, &cancellationToken );
+
+	EXPECT_TRUE( cancellationToken.isCanceled() );
+	EXPECT_LT( numCalls, numItems );
+}
+
+TEST( TaskRuntime, exceptionsArePropagated ) {
+	std::atomic< int > numCalls( 0 );
+
+	EXPECT_THROW(
+		parallel_for( 0, 100000, 1, [&] ( int index ) {
+			numCalls++;
+			if( index == 500 ) {
+				throw std::logic_error( "test" );
+			}
+		} ),
+		std::logic_error
+	);
+	EXPECT_LT( numCalls, 100000 );
+
+	// the pool is still usable
+	std::atomic< int > numCallsAfterwards( 0 );
+	parallel_for( 0, 100, 1, [&] ( int ) { numCallsAfterwards++; } );
+	EXPECT_EQ( 100, numCallsAfterwards );
+}
+
+TEST( TaskRuntime, TaskGroup ) {
+	ThreadPool pool( 3 );
+	EXPECT_EQ( 3, pool.getNumWorkers() );
+
+	std::atomic< int > numTasks( 0 );
+	TaskGroup taskGroup( pool );
+	for( int i = 0 ; i < 100 ; i++ ) {
+		taskGroup.run( [&] () { numTasks++; } );
+	}
+	taskGroup.wait();
+
+	EXPECT_EQ( 100, numTasks );
+}
+
+TEST( TaskRuntime, TaskGroup_waitsForRunningTasks ) {
+	// the waiting thread runs out of queued tasks while the workers are still busy, so it has to be woken up
+	ThreadPool pool( 2 );
+	for( int round = 0 ; round < 50 ; round++ ) {
+		std::atomic< int > numTasks( 0 );
+		TaskGroup taskGroup( pool );
+		for( int i = 0 ; i < 3 ; i++ ) {
+			taskGroup.run( [&] () {
+				std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+				numTasks++;
+			} );
+		}
+		taskGroup.wait();
+
+		ASSERT_EQ( 3, numTasks ) << "round " << round;
+	}
+}
+
+TEST( TaskRuntime, BoundedQueue_keepsOrder ) {
+	const int numItems = 10000;
+
+	BoundedQueue< int > queue( 4 );
+	std::thread producer( [&] () {
+		for( int item = 0 ; item < numItems ; item++ ) {
+			queue.push( item );
+		}
+		queue.close();
+	} );
+
+	std::vector< int > items;
+	int item;
+	while( queue.pop( item ) ) {
+		items.push_back( item );
+	}
+	producer.join();
+
+	ASSERT_EQ( numItems, items.size() );
+	for( int index = 0 ; index < numItems ; index++ ) {
+		ASSERT_EQ( index, items[ index ] );
+	}
+}
+
+TEST( TaskRuntime, BoundedQueue_closeWakesUpProducers ) {
+	BoundedQueue< int > queue( 1 );
+	EXPECT_TRUE( queue.push( 1 ) );
+
+	std::atomic< bool > pushed( true );
+	// blocks because the queue is full
+	std::thread producer( [&] () {
+		pushed = queue.push( 2 );
+	} );
+	queue.close();
+	producer.join();
+
+	EXPECT_FALSE( pushed );
+
+	// the queued item can still be popped
+	int item;
+	EXPECT_TRUE( queue.pop( item ) );
+	EXPECT_EQ( 1, item );
+	EXPECT_FALSE( queue.pop( item ) );
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <string.h>
+#include <vector>
+
+// self-contained LZ77 block codec in the spirit of LZ4, plus reversible filters for arrays of numbers
+//
+// compressed block format: a sequence of
+//  token (high nibble: literal length, low nibble: match length - MIN_MATCH, 15 = more length bytes follow, each adds up to 255)
+//  literal length bytes, literals,
+//  offset (2 bytes, little endian), match length bytes
+// the last sequence only consists of literals
+namespace BlockCodec {
+	enum Filter {
+		FILTER_NONE,
+		// groups the i-th bytes of all elements together (sign and exponent bytes of similar numbers are all the same)
+		FILTER_SHUFFLE,
+		// stores differences of consecutive elements (as unsigned integers of elementSize bytes) and shuffles them
+		// turns sorted arrays into small numbers
+		FILTER_DELTA_SHUFFLE
+	};
+
+	namespace detail {
+		static const int MIN_MATCH = 4;
+		static const int MAX_OFFSET = 65535;
+		static const int HASH_BITS = 14;
+
+		inline unsigned read32( const unsigned char *data ) {
+			unsigned value;
+			memcpy( &value, data, sizeof( value ) );
+			return value;
+		}
+
+		inline unsigned hash( unsigned value ) {
+			return (value * 2654435761u) >> (32 - HASH_BITS);
+		}
+
+		inline unsigned char *writeLength( unsigned char *output, size_t length ) {
+			for( ; length >= 255 ; length -= 255 ) {
+				*output++ = 255;
+			}
+			*output++ = (unsigned char) length;
+			return output;
+		}
+
+		// returns false if the input ends before the length does
+		inline bool readLength( const unsigned char *&input, const unsigned char *inputEnd, size_t &length ) {
+			unsigned char byte;
+			do {
+				if( input == inputEnd ) {
+					return false;
+				}
+				byte = *input++;
+				length += byte;
+			} while( byte == 255 );
+			return true;
+		}
+
+		inline unsigned char *writeSequence( unsigned char *output, const unsigned char *literals, size_t numLiterals, size_t offset, size_t matchLength ) {
+			unsigned char *token = output++;
+
+			*token = (unsigned char) ((numLiterals < 15 ? numLiterals : 15) << 4);
+			if( numLiterals >= 15 ) {
+				output = writeLength( output, numLiterals - 15 );
+			}
+			if( numLiterals ) {
+				memcpy( output, literals, numLiterals );
+			}
+			output += numLiterals;
+
+			// the last sequence has no match
+			if( !matchLength ) {
+				return output;
+			}
+
+			*output++ = (unsigned char) offset;
+			*output++ = (unsigned char) (offset >> 8);
+
+			const size_t matchLengthCode = matchLength - MIN_MATCH;
+			*token |= (unsigned char) (matchLengthCode < 15 ? matchLengthCode : 15);
+			if( matchLengthCode >= 15 ) {
+				output = writeLength( output, matchLengthCode - 15 );
+			}
+			return output;
+		}
+	}
+
+	// worst case size of compress's output
+	inline size_t getMaxCompressedSize( size_t size ) {
+		return size + size / 255 + 16;
+	}
+
+	// output has to have room for getMaxCompressedSize( size ) bytes
+	// returns the size of the compressed data
+	inline size_t compress( const unsigned char *input, size_t size, unsigned char *output ) {
+		using namespace detail;
+
+		unsigned char *outputBegin = output;
+
+		// positions + 1 (0 is empty)
+		std::vector< unsigned > positionsByHash( 1 << HASH_BITS );
+
+		size_t anchor = 0;
+		size_t position = 0;
+		if( size >= MIN_MATCH ) {
+			const size_t lastMatchPosition = size - MIN_MATCH;
+			while( position <= lastMatchPosition ) {
+				const unsigned value = read32( input + position );
+				unsigned &entry = positionsByHash[ hash( value ) ];
+				const size_t candidate = size_t( entry ) - 1;
+				entry = unsigned( position + 1 );
+
+				if( candidate < position && position - candidate <= MAX_OFFSET && read32( input + candidate ) == value ) {
+					size_t matchLength = MIN_MATCH;
+					while( position + matchLength < size && input[ candidate + matchLength ] == input[ position + matchLength ] ) {
+						matchLength++;
+					}
+
+					output = writeSequence( output, input + anchor, position - anchor, position - candidate, matchLength );
+					position += matchLength;
+					anchor = position;
+				}
+				else {
+					// skip faster through data that doesn't compress
+					position += 1 + ((position - anchor) >> 6);
+				}
+			}
+		}
+
+		output = writeSequence( output, input + anchor, size - anchor, 0, 0 );
+		return output - outputBegin;
+	}
+
+	// returns false if the compressed data is corrupt or doesn't decompress to exactly size bytes
+	inline bool decompress( const unsigned char *input, size_t inputSize, unsigned char *output, size_t size ) {
+		using namespace detail;
+
+		const unsigned char *inputEnd = input + inputSize;
+		unsigned char *outputBegin = output;
+		unsigned char *outputEnd = output + size;
+
+		while( input < inputEnd ) {
+			const unsigned char token = *input++;
+
+			size_t numLiterals = token >> 4;
+			if( numLiterals == 15 && !readLength( input, inputEnd, numLiterals ) ) {
+				return false;
+			}
+			if( size_t( inputEnd - input ) < numLiterals || size_t( outputEnd - output ) < numLiterals ) {
+				return false;
+			}
+			if( numLiterals ) {
+				memcpy( output, input, numLiterals );
+			}
+			input += numLiterals;
+			output += numLiterals;
+
+			// last sequence
+			if( input == inputEnd ) {
+				break;
+			}
+
+			if( inputEnd - input < 2 ) {
+				return false;
+			}
+			const size_t offset = input[0] | (size_t( input[1] ) << 8);
+			input += 2;
+
+			size_t matchLength = token & 15;
+			if( matchLength == 15 && !readLength( input, inputEnd, matchLength ) ) {
+				return false;
+			}
+			matchLength += MIN_MATCH;
+
+			if( !offset || size_t( output - outputBegin ) < offset || size_t( outputEnd - output ) < matchLength ) {
+				return false;
+			}
+
+			// matches can overlap with their own output
+			const unsigned char *match = output - offset;
+			if( offset >= matchLength ) {
+				memcpy( output, match, matchLength );
+				output += matchLength;
+			}
+			else {
+				for( size_t i = 0 ; i < matchLength ; i++ ) {
+					*output++ = *match++;
+				}
+			}
+		}
+
+		return output == outputEnd;
+	}
+
+	// filters work on whole elements, trailing bytes (size % elementSize) are copied as they are
+	inline void applyFilter( Filter filter, const unsigned char *input, size_t size, size_t elementSize, unsigned char *output ) {
+		if( filter == FILTER_NONE || elementSize < 2 ) {
+			memcpy( output, input, size );
+			return;
+		}
+
+		const size_t numElements = size / elementSize;
+		const unsigned char *source = input;
+
+		std::vector< unsigned char > deltas;
+		if( filter == FILTER_DELTA_SHUFFLE ) {
+			// byte-wise subtraction with borrow, so this works for any element size
+			deltas.resize( numElements * elementSize );
+			for( size_t elementIndex = 0 ; elementIndex < numElements ; elementIndex++ ) {
+				const unsigned char *element = input + elementIndex * elementSize;
+				unsigned char *delta = &deltas[ elementIndex * elementSize ];
+				unsigned borrow = 0;
+				for( size_t byteIndex = 0 ; byteIndex < elementSize ; byteIndex++ ) {
+					const unsigned previous = elementIndex ? element[ byteIndex - elementSize ] : 0;
+					const unsigned difference = element[ byteIndex ] - previous - borrow;
+					delta[ byteIndex ] = (unsigned char) difference;
+					borrow = (difference >> 8) & 1;
+				}
+			}
+			if( numElements ) {
+				source = &deltas.front();
+			}
+		}
+
+		for( size_t byteIndex = 0 ; byteIndex < elementSize ; byteIndex++ ) {
+			unsigned char *lane = output + byteIndex * numElements;
+			for( size_t elementIndex = 0 ; elementIndex < numElements ; elementIndex++ ) {
+				lane[ elementIndex ] = source[ elementIndex * elementSize + byteIndex ];
+			}
+		}
+
+		memcpy( output + numElements * elementSize, input + numElements * elementSize, size - numElements * elementSize );
+	}
+
+	inline void removeFilter( Filter filter, const unsigned char *input, size_t size, size_t elementSize, unsigned char *output ) {
+		if( filter == FILTER_NONE || elementSize < 2 ) {
+			memcpy( output, input, size );
+			return;
+		}
+
+		const size_t numElements = size / elementSize;
+
+		for( size_t byteIndex = 0 ; byteIndex < elementSize ; byteIndex++ ) {
+			const unsigned char *lane = input + byteIndex * numElements;
+			for( size_t elementIndex = 0 ; elementIndex < numElements ; elementIndex++ ) {
+				output[ elementIndex * elementSize + byteIndex ] = lane[ elementIndex ];
+			}
+		}
+
+		if( filter == FILTER_DELTA_SHUFFLE ) {
+			for( size_t elementIndex = 1 ; elementIndex < numElements ; elementIndex++ ) {
+				unsigned char *element = output + elementIndex * elementSize;
+				unsigned carry = 0;
+				for( size_t byteIndex = 0 ; byteIndex < elementSize ; byteIndex++ ) {
+					const unsigned sum = element[ byteIndex ] + element[ byteIndex - elementSize ] + carry;
+					element[ byteIndex ] = (unsigned char) sum;
+					carry = sum >> 8;
+				}
+			}
+		}
+
+		memcpy( output + numElements * elementSize, input + numElements * elementSize, size - numElements * elementSize );
+	}
+}
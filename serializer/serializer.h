@@ -3,8 +3,15 @@
 
 #include <wml.h>
 #include <stdio.h>
+#include <string.h>
 #include <boost/noncopyable.hpp>
 #include <exception>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <thread>
+
+#include "blockCodec.h"
 
 // for helper macros
 #include <boost/preprocessor/seq/for_each.hpp>
@@ -112,19 +119,90 @@ namespace Serializer {
 
 #pragma warning( push )
 #pragma warning( disable: 4996 )
+	// the binary reader and writer buffer everything in user space, so single values don't cost a libc call each
+	static const size_t BINARY_BUFFER_SIZE = 1 << 20;
+
+	// compressed streams consist of blocks of at most this size that are compressed independently
+	static const size_t COMPRESSED_BLOCK_SIZE = 1 << 18;
+	// set in the version int of compressed streams (everything after the version int is compressed)
+	static const int COMPRESSED_STREAM_FLAG = 1 << 30;
+	// smaller bulk sections are not worth a filtered block of their own
+	static const size_t MIN_FILTERED_SECTION_SIZE = 1 << 14;
+
+	namespace detail {
+		struct CompressedBlockHeader {
+			unsigned rawSize;
+			unsigned storedSize;
+			unsigned char filter;
+			unsigned char isCompressed;
+			unsigned short elementSize;
+		};
+
+		struct CompressedBlock {
+			CompressedBlockHeader header;
+			// the raw data before compress() and the stored data afterwards
+			std::vector< unsigned char > data;
+
+			CompressedBlock( const unsigned char *rawData, size_t size, size_t elementSize, BlockCodec::Filter filter ) : data( rawData, rawData + size ) {
+				header.rawSize = (unsigned) size;
+				header.storedSize = (unsigned) size;
+				header.filter = (unsigned char) filter;
+				header.isCompressed = 0;
+				header.elementSize = (unsigned short) elementSize;
+			}
+
+			void compress() {
+				std::vector< unsigned char > filteredData( data.size() );
+				BlockCodec::applyFilter( (BlockCodec::Filter) header.filter, data.data(), data.size(), header.elementSize, filteredData.data() );
+
+				std::vector< unsigned char > compressedData( BlockCodec::getMaxCompressedSize( data.size() ) );
+				const size_t compressedSize = BlockCodec::compress( filteredData.data(), filteredData.size(), compressedData.data() );
+
+				// incompressible blocks are stored as they are
+				if( compressedSize >= data.size() ) {
+					header.filter = BlockCodec::FILTER_NONE;
+					return;
+				}
+
+				compressedData.resize( compressedSize );
+				data.swap( compressedData );
+				header.isCompressed = 1;
+				header.storedSize = (unsigned) compressedSize;
+			}
+		};
+	}
+
 	struct BinaryWriter : boost::noncopyable {
 		FILE *handle;
 
-		BinaryWriter( const std::string &filename ) : handle( fopen( filename.c_str() , "wb" ) ) {
+		enum Mode {
+			UNCOMPRESSED,
+			// only supported for streams with a version (the flag is stored in it)
+			COMPRESSED
+		};
+
+		BinaryWriter( const std::string &filename ) : handle( fopen( filename.c_str() , "wb" ) ), ownsHandle( true ), bufferUsed( 0 ), compressed( false ) {
+			initBuffer();
 		}
 
-		BinaryWriter( const std::string &filename, int version ) : handle( fopen( filename.c_str() , "wb" ) ) {
-			put( version );
+		BinaryWriter( const std::string &filename, int version, Mode mode = UNCOMPRESSED ) : handle( fopen( filename.c_str() , "wb" ) ), ownsHandle( true ), bufferUsed( 0 ), compressed( false ) {
+			initBuffer();
+			initStream( version, mode );
+		}
+
+		// appends a stream to a file that is already open (eg to put several independent streams into one container file)
+		// the handle is flushed but not closed by the destructor
+		BinaryWriter( FILE *handle, int version, Mode mode = UNCOMPRESSED ) : handle( handle ), ownsHandle( false ), bufferUsed( 0 ), compressed( false ) {
+			initBuffer();
+			initStream( version, mode );
 		}
 
 		~BinaryWriter() {
 			if( handle ) {
-				fclose( handle );
+				flush();
+				if( ownsHandle ) {
+					fclose( handle );
+				}
 			}
 		}
 
@@ -132,21 +210,173 @@ namespace Serializer {
 		void put( const T &value ) {
 			Serializer::put( *this, value );
 		}
-	};
 
-	struct BinaryReader : boost::noncopyable {
-		FILE *handle;
+		bool isCompressed() const {
+			return compressed;
+		}
+
+		// bulk data that doesn't fit into the buffer anymore is written directly
+		void writeRaw( const void *data, size_t size ) {
+			if( !handle ) {
+				return;
+			}
+
+			if( compressed ) {
+				// fill the current block and start new ones
+				const unsigned char *source = (const unsigned char *) data;
+				while( size ) {
+					const size_t numBytes = std::min( size, buffer.size() - bufferUsed );
+					memcpy( &buffer[ bufferUsed ], source, numBytes );
+					bufferUsed += numBytes;
+					source += numBytes;
+					size -= numBytes;
+
+					if( bufferUsed == buffer.size() ) {
+						endBlock();
+					}
+				}
+				return;
+			}
+
+			if( bufferUsed + size > buffer.size() ) {
+				flush();
+
+				if( size >= buffer.size() ) {
+					fwrite( data, 1, size, handle );
+					return;
+				}
+			}
+
+			memcpy( &buffer[ bufferUsed ], data, size );
+			bufferUsed += size;
+		}
+
+		// arrays of count elements of elementSize bytes
+		// in compressed streams, big arrays get blocks of their own and filter is applied to them before compression
+		void writeBulk( const void *data, size_t elementSize, size_t count, BlockCodec::Filter filter ) {
+			const size_t size = elementSize * count;
+			if( !compressed || filter == BlockCodec::FILTER_NONE || size < MIN_FILTERED_SECTION_SIZE ) {
+				writeRaw( data, size );
+				return;
+			}
+			if( !handle ) {
+				return;
+			}
+
+			endBlock();
+
+			const size_t maxBlockSize = std::max( elementSize, COMPRESSED_BLOCK_SIZE / elementSize * elementSize );
+			const unsigned char *source = (const unsigned char *) data;
+			for( size_t offset = 0 ; offset < size ; offset += maxBlockSize ) {
+				addBlock( source + offset, std::min( maxBlockSize, size - offset ), elementSize, filter );
+			}
+		}
+
+		void flush() {
+			if( compressed ) {
+				endBlock();
+				writeBlocks();
+			}
+			else if( bufferUsed ) {
+				fwrite( &buffer.front(), 1, bufferUsed, handle );
+				bufferUsed = 0;
+			}
+		}
 
-		BinaryReader( const std::string &filename ) : handle( fopen( filename.c_str() , "rb" ) ) {}
-		BinaryReader( const std::string &filename, int version ) : handle( fopen( filename.c_str() , "rb" ) ) {
+	private:
+		bool ownsHandle;
+
+		std::vector< unsigned char > buffer;
+		size_t bufferUsed;
+
+		bool compressed;
+		int numCompressionThreads;
+		// blocks are compressed in parallel batches
+		std::vector< detail::CompressedBlock > pendingBlocks;
+
+		void initBuffer() {
 			if( handle ) {
-				int actualVersion;
-				get( actualVersion );
-				if( actualVersion != version ) {
-					fclose( handle );
-					handle = nullptr;
+				buffer.resize( BINARY_BUFFER_SIZE );
+			}
+		}
+
+		void initStream( int version, Mode mode ) {
+			if( mode == COMPRESSED ) {
+				put( version | COMPRESSED_STREAM_FLAG );
+				flush();
+
+				compressed = true;
+				buffer.resize( COMPRESSED_BLOCK_SIZE );
+				numCompressionThreads = std::max( 1, (int) std::thread::hardware_concurrency() );
+			}
+			else {
+				put( version );
+			}
+		}
+
+		void endBlock() {
+			if( bufferUsed ) {
+				addBlock( &buffer.front(), bufferUsed, 1, BlockCodec::FILTER_NONE );
+				bufferUsed = 0;
+			}
+		}
+
+		void addBlock( const unsigned char *data, size_t size, size_t elementSize, BlockCodec::Filter filter ) {
+			pendingBlocks.push_back( detail::CompressedBlock( data, size, elementSize, filter ) );
+			if( (int) pendingBlocks.size() >= 2 * numCompressionThreads ) {
+				writeBlocks();
+			}
+		}
+
+		void writeBlocks() {
+			const int numBlocks = (int) pendingBlocks.size();
+			const int numThreads = std::min( numBlocks, numCompressionThreads );
+
+			auto compressBlocks = [this, numBlocks, numThreads] ( int firstBlockIndex ) {
+				for( int blockIndex = firstBlockIndex ; blockIndex < numBlocks ; blockIndex += numThreads ) {
+					pendingBlocks[ blockIndex ].compress();
 				}
+			};
+
+			std::vector< std::thread > threads;
+			for( int threadIndex = 1 ; threadIndex < numThreads ; threadIndex++ ) {
+				threads.push_back( std::thread( compressBlocks, threadIndex ) );
+			}
+			if( numThreads ) {
+				compressBlocks( 0 );
+			}
+			for( auto thread = threads.begin() ; thread != threads.end() ; ++thread ) {
+				thread->join();
 			}
+
+			for( auto block = pendingBlocks.begin() ; block != pendingBlocks.end() ; ++block ) {
+				fwrite( &block->header, sizeof( block->header ), 1, handle );
+				fwrite( block->data.data(), 1, block->data.size(), handle );
+			}
+			pendingBlocks.clear();
+		}
+	};
+
+	// reads either from a file (through a buffer) or directly from memory (eg a mapped file)
+	// compressed streams are detected by the flag in their version
+	struct BinaryReader : boost::noncopyable {
+		FILE *handle;
+
+		BinaryReader( const std::string &filename ) : handle( fopen( filename.c_str() , "rb" ) ), current(), end(), memoryBacked( false ), compressed( false ), storedCurrent(), storedEnd() {
+			initBuffer();
+		}
+
+		BinaryReader( const std::string &filename, int version ) : handle( fopen( filename.c_str() , "rb" ) ), current(), end(), memoryBacked( false ), compressed( false ), storedCurrent(), storedEnd() {
+			initBuffer();
+			checkVersion( version );
+		}
+
+		// data has to stay valid as long as the reader is used
+		// (unsigned char, so calls with a filename and a version can't end up here)
+		BinaryReader( const unsigned char *data, size_t size ) : handle(), current( data ), end( data + size ), memoryBacked( data != nullptr ), compressed( false ), storedCurrent(), storedEnd() {}
+
+		BinaryReader( const unsigned char *data, size_t size, int version ) : handle(), current( data ), end( data + size ), memoryBacked( data != nullptr ), compressed( false ), storedCurrent(), storedEnd() {
+			checkVersion( version );
 		}
 
 		~BinaryReader() {
@@ -156,7 +386,11 @@ namespace Serializer {
 		}
 
 		bool valid() const {
-			return handle != nullptr;
+			return handle != nullptr || memoryBacked;
+		}
+
+		bool isCompressed() const {
+			return compressed;
 		}
 
 		template<typename T>
@@ -164,31 +398,260 @@ namespace Serializer {
 			Serializer::get( *this, value );
 		}
 
-		// TODO: etc
+		// like fread, a truncated file leaves the rest of data untouched (so do corrupt compressed blocks)
+		void readRaw( void *data, size_t size ) {
+			unsigned char *target = (unsigned char *) data;
+
+			while( size ) {
+				if( current == end ) {
+					if( compressed ) {
+						if( !readBlock() ) {
+							return;
+						}
+						continue;
+					}
+
+					if( !handle ) {
+						return;
+					}
+
+					// bulk data that is bigger than the buffer is read directly
+					if( size >= buffer.size() ) {
+						fread( target, 1, size, handle );
+						return;
+					}
+
+					const size_t numBytesRead = fread( &buffer.front(), 1, buffer.size(), handle );
+					if( !numBytesRead ) {
+						return;
+					}
+					current = &buffer.front();
+					end = current + numBytesRead;
+				}
+
+				const size_t numBytes = size < size_t( end - current ) ? size : size_t( end - current );
+				memcpy( target, current, numBytes );
+				current += numBytes;
+				target += numBytes;
+				size -= numBytes;
+			}
+		}
+
+	private:
+		std::vector< unsigned char > buffer;
+		// the unread part of the buffer or of the memory block
+		const unsigned char *current;
+		const unsigned char *end;
+		bool memoryBacked;
+
+		// compressed streams decode their blocks into buffer
+		// the stored (compressed) data is read from the memory block or through storedBuffer
+		bool compressed;
+		std::vector< unsigned char > storedBuffer;
+		const unsigned char *storedCurrent;
+		const unsigned char *storedEnd;
+		// decompressed data before the filter is removed
+		std::vector< unsigned char > filteredData;
+
+		void initBuffer() {
+			if( handle ) {
+				buffer.resize( BINARY_BUFFER_SIZE );
+			}
+		}
+
+		void checkVersion( int version ) {
+			if( !valid() ) {
+				return;
+			}
+
+			int actualVersion = -1;
+			get( actualVersion );
+			if( (actualVersion & ~COMPRESSED_STREAM_FLAG) != version ) {
+				if( handle ) {
+					fclose( handle );
+					handle = nullptr;
+				}
+				current = end = nullptr;
+				memoryBacked = false;
+				return;
+			}
+
+			if( actualVersion & COMPRESSED_STREAM_FLAG ) {
+				// whatever has been read ahead already belongs to the compressed stream
+				if( handle ) {
+					storedBuffer.assign( current, end );
+					storedCurrent = storedBuffer.data();
+					storedEnd = storedCurrent + storedBuffer.size();
+				}
+				else {
+					storedCurrent = current;
+					storedEnd = end;
+				}
+				current = end = nullptr;
+				compressed = true;
+			}
+		}
+
+		// returns size contiguous bytes of stored data or nullptr if the stream ends before
+		const unsigned char *readStored( size_t size ) {
+			if( size_t( storedEnd - storedCurrent ) < size && handle ) {
+				// move the rest to the front and refill the buffer
+				const size_t numLeft = storedEnd - storedCurrent;
+				memmove( storedBuffer.data(), storedCurrent, numLeft );
+				storedBuffer.resize( std::max( size, BINARY_BUFFER_SIZE ) );
+
+				const size_t numBytesRead = fread( storedBuffer.data() + numLeft, 1, storedBuffer.size() - numLeft, handle );
+				storedCurrent = storedBuffer.data();
+				storedEnd = storedCurrent + numLeft + numBytesRead;
+			}
+
+			if( size_t( storedEnd - storedCurrent ) < size ) {
+				return nullptr;
+			}
+
+			const unsigned char *stored = storedCurrent;
+			storedCurrent += size;
+			return stored;
+		}
+
+		bool readBlock() {
+			detail::CompressedBlockHeader header;
+			const unsigned char *storedHeader = readStored( sizeof( header ) );
+			if( !storedHeader ) {
+				return false;
+			}
+			memcpy( &header, storedHeader, sizeof( header ) );
+
+			// the sizes come from the file: writers never produce bigger blocks, so anything else is corrupt
+			// (and must not make us allocate or read that much; readStored fails if the input ends before storedSize)
+			if( header.rawSize > COMPRESSED_BLOCK_SIZE || header.storedSize > BlockCodec::getMaxCompressedSize( header.rawSize ) ) {
+				return false;
+			}
+
+			const unsigned char *stored = readStored( header.storedSize );
+			if( !stored ) {
+				return false;
+			}
+
+			const BlockCodec::Filter filter = (BlockCodec::Filter) header.filter;
+			if( !header.isCompressed ) {
+				if( header.storedSize != header.rawSize ) {
+					return false;
+				}
+
+				// no need to copy blocks that are stored as they are
+				current = stored;
+				end = stored + header.rawSize;
+				return header.rawSize != 0;
+			}
+
+			buffer.resize( header.rawSize );
+			if( filter == BlockCodec::FILTER_NONE ) {
+				if( !BlockCodec::decompress( stored, header.storedSize, buffer.data(), header.rawSize ) ) {
+					return false;
+				}
+			}
+			else {
+				filteredData.resize( header.rawSize );
+				if( !BlockCodec::decompress( stored, header.storedSize, filteredData.data(), header.rawSize ) ) {
+					return false;
+				}
+				BlockCodec::removeFilter( filter, filteredData.data(), header.rawSize, header.elementSize, buffer.data() );
+			}
+
+			current = buffer.data();
+			end = current + header.rawSize;
+			return header.rawSize != 0;
+		}
 	};
 
 	namespace detail {
-		// shared base class by TextWriter and TextReader
-		struct TextBase : boost::noncopyable {
-			wml::Node root;
+		// node of the document a TextReader reads from
+		// for unnamed gets, it can also be the key node of an item, whose only data is the content of the item
+		// (so the key node doesn't have to be created, see get( TextReader &, Value & ))
+		struct TextReaderNode {
+			wml::Document::NodeRef node;
+			// node is the data of a key node
+			bool isKeyNode;
+
+			TextReaderNode() : isKeyNode( false ) {}
+			TextReaderNode( const wml::Document::NodeRef &node, bool isKeyNode = false ) : node( node ), isKeyNode( isKeyNode ) {}
+
+			bool valid() const {
+				return node.valid();
+			}
+
+			size_t size() const {
+				return isKeyNode ? 1 : node.size();
+			}
+
+			wml::Document::NodeRef operator[] ( int i ) const {
+				return isKeyNode ? node : node[ i ];
+			}
+
+			wml::Document::NodeRef data() const {
+				return isKeyNode ? node : node.data();
+			}
+
+			// returns an invalid NodeRef if there is no child with this key
+			wml::Document::NodeRef find( const std::string &key ) const {
+				if( isKeyNode ) {
+					return node.hasContent( key ) ? node : wml::Document::NodeRef();
+				}
+				return node.find( key );
+			}
+
+			void error( const std::string &message ) const {
+				node.error( message );
+			}
+		};
+
+		// Node tree of the document of a TextReader, which is only built when it is used (see TextReader::root)
+		// converts to const wml::Node &, so it can be passed to wml::emit etc like the Node tree itself
+		struct TextReaderRoot : boost::noncopyable {
+			const wml::Document &document;
+
+			TextReaderRoot( const wml::Document &document ) : document( document ) {}
+
+			const wml::Node &get() const {
+				if( !node ) {
+					node.reset( new wml::Node( document.toNode() ) );
+				}
+				return *node;
+			}
 
-			wml::Node *mapNode;
+			operator const wml::Node &() const {
+				return get();
+			}
+
+			const wml::Node *operator ->() const {
+				return &get();
+			}
+
+		private:
+			mutable std::unique_ptr< wml::Node > node;
+		};
+
+		// shared base class by TextWriter (NodeHandle = wml::Node *) and TextReader (NodeHandle = TextReaderNode)
+		template< typename NodeHandle >
+		struct TextBase : boost::noncopyable {
+			NodeHandle mapNode;
 
 			// there are cases when we have to use a dummy key '-', eg when serializing arrays or std::pairs
 			// if keyNode is set, putAsKey and getAsKey will write to it instead of creating a sub key in mapNode
-			wml::Node *keyNode;
+			NodeHandle keyNode;
 
-			TextBase() : mapNode( &root ), keyNode( nullptr ) {}
+			TextBase( const NodeHandle &mapNode ) : mapNode( mapNode ), keyNode() {}
 
 			// this class can be used to create a new environment for processing a certain node
 			template< class Base >
 			struct Environment {
 				Base &base;
 
-				wml::Node *mapNode;
-				wml::Node *keyNode;
+				NodeHandle mapNode;
+				NodeHandle keyNode;
 
-				Environment( Base &base, wml::Node *newMapNode, wml::Node *newKeyNode = nullptr )
+				Environment( Base &base, const NodeHandle &newMapNode, const NodeHandle &newKeyNode = NodeHandle() )
 					: base( base ),
 					mapNode( base.mapNode ),
 					keyNode( base.keyNode )
@@ -210,20 +673,48 @@ namespace Serializer {
 		struct TextConverterTag {};
 	}
 
-	struct TextWriter : detail::TextBase {
+	struct TextWriter : detail::TextBase< wml::Node * > {
+		wml::Node root;
+
 		std::string filename;
 
+		// entries of the root are written as soon as they are complete and removed from the tree afterwards
+		std::ofstream file;
+		wml::StreamEmitter emitter;
+
 		// TODO: fix this hack and implement proper support for a TextWriterBase that just consists of TextBase and nothing else
 		// we should wrap fread and fwrite as well, so we are independent of the actual output method [10/12/2012 kirschan2]
-		TextWriter( detail::TextConverterTag tag ) {}
-		TextWriter( const std::string &filename ) : filename( filename ) {}
+		TextWriter( detail::TextConverterTag tag ) : TextBase( &root ), emitter( file ) {}
+		TextWriter( const std::string &filename ) : TextBase( &root ), filename( filename ), file( filename ), emitter( file ) {}
 		~TextWriter() {
-			if( !filename.empty() ) {
-				wml::emitFile( filename, root );
+			emitCompletedEntries();
+			emitter.flush();
+		}
+
+		void emitCompletedEntries() {
+			if( filename.empty() ) {
+				return;
 			}
+
+			for( auto entry = root.nodes.begin() ; entry != root.nodes.end() ; ++entry ) {
+				emitter.emitEntry( *entry );
+			}
+			root.nodes.clear();
 		}
 
-		typedef detail::TextBase::Environment< TextWriter > Environment;
+		struct Environment : detail::TextBase< wml::Node * >::Environment< TextWriter > {
+			typedef detail::TextBase< wml::Node * >::Environment< TextWriter > super;
+
+			Environment( TextWriter &writer, wml::Node *newMapNode, wml::Node *newKeyNode = nullptr )
+				: super( writer, newMapNode, newKeyNode ) {}
+
+			// back at the root => the entry has been written completely
+			~Environment() {
+				if( mapNode == &base.root ) {
+					base.emitCompletedEntries();
+				}
+			}
+		};
 	};
 
 	// for now just text output [10/12/2012 kirschan2]
@@ -235,19 +726,24 @@ namespace Serializer {
 		}
 	};
 
-	struct TextReader : detail::TextBase {
+	struct TextReader : detail::TextBase< detail::TextReaderNode > {
+		// the values are read from the document in place
+		wml::Document document;
+		// the classic Node tree of the document
+		detail::TextReaderRoot root;
+
 		// node counter for unnamed gets (so we can iterate over all sub nodes of mapNode)
 		int unnamedCounter;
 
-		TextReader( const std::string &filename ) : unnamedCounter( 0 ) {
-			root = wml::parseFile( filename );
+		TextReader( const std::string &filename ) : TextBase( detail::TextReaderNode() ), document( wml::parseDocumentFile( filename ) ), root( document ), unnamedCounter( 0 ) {
+			mapNode = document.getRoot();
 		}
 
-		struct Environment : detail::TextBase::Environment< TextReader > {
-			typedef detail::TextBase::Environment< TextReader > super;
+		struct Environment : detail::TextBase< detail::TextReaderNode >::Environment< TextReader > {
+			typedef detail::TextBase< detail::TextReaderNode >::Environment< TextReader > super;
 			int unnamedCounter;
 
-			Environment( TextReader &reader, wml::Node *newMapNode, wml::Node *newKeyNode = nullptr )
+			Environment( TextReader &reader, const detail::TextReaderNode &newMapNode, const detail::TextReaderNode &newKeyNode = detail::TextReaderNode() )
 				: super( reader, newMapNode, newKeyNode ), unnamedCounter( reader.unnamedCounter )
 			{
 				reader.unnamedCounter = 0;
@@ -360,13 +856,13 @@ namespace Serializer {
 
 		template< typename Value >
 		bool tryGet( TextReader &reader, const char *key, Value &value ) {
-			auto it = reader.mapNode->find( key );
+			const wml::Document::NodeRef node = reader.mapNode.find( key );
 
-			if( it == reader.mapNode->not_found() ) {
+			if( !node.valid() ) {
 				return false;
 			}
 
-			TextReader::Environment environment( reader, &*it );
+			TextReader::Environment environment( reader, node );
 			Serializer::read( reader, value );
 
 			return true;
@@ -400,21 +896,21 @@ namespace Serializer {
 	typename boost::enable_if_c< !detail::is_default_constructible< Value >::value >::type
 	get( TextReader &reader, const char *key, Value &value ) {
 		if( !detail::tryGet( reader, key, value ) ) {
-			reader.mapNode->error( boost::str( boost::format( "'%s' not found!") % key ) );
+			reader.mapNode.error( boost::str( boost::format( "'%s' not found!") % key ) );
 		}
 	}
 #endif
 	template< typename Value >
 	void get( TextReader &reader, const char *key, Value &value ) {
 		if( !detail::tryGet( reader, key, value ) ) {
-			//reader.mapNode->error( boost::str( boost::format( "'%s' not found!") % key ) );
+			//reader.mapNode.error( boost::str( boost::format( "'%s' not found!") % key ) );
 		}
 	}
 
 	// get value from the object name, if possible, or from a key-value pair
 	template< typename Value >
 	void getAsKey( TextReader &reader, const char *key, Value &value ) {
-		if( !reader.keyNode ) {
+		if( !reader.keyNode.valid() ) {
 			get( reader, key, value );
 		}
 		else {
@@ -425,7 +921,7 @@ namespace Serializer {
 			}
 
 			// keyNode has been used - additional getAsKey will be gets
-			reader.keyNode = nullptr;
+			reader.keyNode = detail::TextReaderNode();
 		}
 	}
 
@@ -496,25 +992,22 @@ namespace Serializer {
 
 	template< typename Value >
 	void get( TextReader &reader, Value &value ) {
-		if( reader.mapNode->nodes.size() <= reader.unnamedCounter ) {
+		if( (int) reader.mapNode.size() <= reader.unnamedCounter ) {
 			// TODO: print a warning? [10/21/2012 kirschan2]
 			return;
 		}
 
-		wml::Node &itemNode = reader.mapNode->nodes[ reader.unnamedCounter++ ];
+		const wml::Document::NodeRef itemNode = reader.mapNode[ reader.unnamedCounter++ ];
 
-		// TODO: on demand keyNode creation would be better
-		wml::Node keyNode;
-		// we move the content, because it is either meaningful or useless
-		keyNode.push_back( std::move( itemNode.content ) );
-		keyNode.context = itemNode.context;
+		// the content of the item is the data of its key node
+		const detail::TextReaderNode keyNode( itemNode, true );
 
 		if( detail::is_simple< Value >::value ) {
-			TextReader::Environment environment( reader, &keyNode );
+			TextReader::Environment environment( reader, keyNode );
 			read( reader, value );
 		}
 		else {
-			TextReader::Environment environment( reader, &itemNode, &keyNode );
+			TextReader::Environment environment( reader, itemNode, keyNode );
 			read( reader, value );
 		}
 	}
@@ -537,20 +1030,20 @@ namespace Serializer {
 	template< typename Value >
 	typename boost::enable_if< boost::is_arithmetic< Value > >::type
 	read( BinaryReader &reader, Value &value ) {
-		fread( &value, sizeof( Value ), 1, reader.handle );
+		reader.readRaw( &value, sizeof( Value ) );
 	}
 
 	template< typename Value >
 	typename boost::enable_if< boost::is_arithmetic< Value > >::type
 	write( BinaryWriter &writer, const Value &value ) {
-		fwrite( &value, sizeof( Value ), 1, writer.handle );
+		writer.writeRaw( &value, sizeof( Value ) );
 	}
 
 	template< typename Value >
 	typename boost::enable_if< boost::is_arithmetic< Value > >::type
 	read( TextReader &reader, Value &value ) {
 		// TODO: add checks and error to data() if there is none [9/9/2012 Andreas]
-		value = reader.mapNode->data().as<Value>();
+		value = reader.mapNode.data().as<Value>();
 	}
 
 	template< typename Value >
@@ -565,13 +1058,13 @@ namespace Serializer {
 	template< typename Value >
 	typename boost::enable_if< boost::is_enum< Value > >::type
 		read( BinaryReader &reader, Value &value ) {
-			fread( &value, sizeof( Value ), 1, reader.handle );
+			reader.readRaw( &value, sizeof( Value ) );
 	}
 
 	template< typename Value >
 	typename boost::enable_if< boost::is_enum< Value > >::type
 		write( BinaryWriter &writer, const Value &value ) {
-			fwrite( &value, sizeof( Value ), 1, writer.handle );
+			writer.writeRaw( &value, sizeof( Value ) );
 	}
 
 	template< typename Value >
@@ -639,7 +1132,7 @@ namespace Serializer {
 	template< typename Value >
 	typename boost::enable_if< detail::has_reflection< Value > >::type
 	read( TextReader &reader, Value &value ) {
-		const std::string &label = reader.mapNode->data().content;
+		const wml::Document::NodeRef label = reader.mapNode.data();
 
 		for( int index = 0 ; ; ++index ) {
 			std::pair< const char *, Value > labelValuePair = Reflection<Value>::get( index );
@@ -648,14 +1141,14 @@ namespace Serializer {
 				break;
 			}
 
-			if( label == labelValuePair.first ) {
+			if( label.hasContent( labelValuePair.first ) ) {
 				value = labelValuePair.second;
 				return;
 			}
 		}
 
 		// read it with lexical cast
-		value = (Value) reader.mapNode->data().as<int>();
+		value = (Value) label.as<int>();
 	}
 
 	template< typename Value >
@@ -721,9 +1214,7 @@ namespace Serializer {
 				break;
 			}
 
-			auto it = reader.mapNode->find( labelValuePair.first );
-
-			if( it != reader.mapNode->not_found() ) {
+			if( reader.mapNode.find( labelValuePair.first ).valid() ) {
 				value = labelValuePair.second;
 				return;
 			}
@@ -746,7 +1237,7 @@ namespace Serializer {
 				values.append( labelValuePair.first );
 			}
 
-			reader.mapNode->error( boost::str( boost::format( "expected global enum with possible values: %s") % values ) );
+			reader.mapNode.error( boost::str( boost::format( "expected global enum with possible values: %s") % values ) );
 		}
 	}
 
@@ -756,6 +1247,11 @@ namespace Serializer {
 	// static array
 	template< typename Value, int N >
 	void write( BinaryWriter &writer, const Value (&array)[N] ) {
+		if( detail::can_be_dumped<Value>::value ) {
+			writer.writeRaw( array, sizeof( array ) );
+			return;
+		}
+
 		for( int i = 0 ; i < N ; ++i ) {
 			write( writer, array[i] );
 		}
@@ -763,6 +1259,11 @@ namespace Serializer {
 
 	template< typename Value, int N >
 	void read( BinaryReader &reader, Value (&array)[N] ) {
+		if( detail::can_be_dumped<Value>::value ) {
+			reader.readRaw( array, sizeof( array ) );
+			return;
+		}
+
 		for( int i = 0 ; i < N ; ++i ) {
 			read( reader, array[i] );
 		}
@@ -777,12 +1278,12 @@ namespace Serializer {
 
 	template< typename Value, int N >
 	void read( TextReader &reader, Value (&array)[N] ) {
-		int numChildren = (int) reader.mapNode->size();
+		int numChildren = (int) reader.mapNode.size();
 		for( int i = 0 ; i < numChildren ; ++i ) {
 			get( reader, array[i] );
 		}
 		if( numChildren != N ) {
-			reader.mapNode->error( boost::str( boost::format( "expected %i array elements - only found %i!" ) % N % numChildren ) );
+			reader.mapNode.error( boost::str( boost::format( "expected %i array elements - only found %i!" ) % N % numChildren ) );
 		}
 	}
 
@@ -799,21 +1300,21 @@ namespace Serializer {
 
 	template< typename X >
 	typename boost::enable_if< RawMode< X > >::type read( BinaryReader &reader, X &value ) {
-		fread( &value, sizeof( X ), 1, reader.handle );
+		reader.readRaw( &value, sizeof( X ) );
 	}
 
 	template< typename X >
 	typename boost::enable_if< RawMode< X > >::type write( BinaryWriter &writer, const X &value ) {
-		fwrite( &value, sizeof( X ), 1, writer.handle );
+		writer.writeRaw( &value, sizeof( X ) );
 	}
 
 	template< typename X >
 	typename boost::enable_if< RawMode< X > >::type read( TextReader &reader, X &value ) {
 #ifdef SERIALIZER_TEXT_ALLOW_RAW_DATA
-		const std::string &data = reader.mapNode->data().content;
+		const std::string data = reader.mapNode.data().getContent();
 		value = *reinterpret_cast<const X*>( &data.front() );
 #else
-		reader.mapNode->error( "raw data not allowed! #define SERIALIZER_TEXT_ALLOW_RAW_DATA to allow!")
+		reader.mapNode.error( "raw data not allowed! #define SERIALIZER_TEXT_ALLOW_RAW_DATA to allow!");
 #endif
 	}
 
@@ -977,6 +977,46 @@ void StdList( const char *filename ) {
 
 TextBinaryTest( StdList );
 
+// vectors of vectors of pods (coalesced into bulk sections in binary mode)
+template< typename Reader, typename Writer >
+void StdVector_Nested( const char *filename ) {
+	std::vector< std::vector<int> > ref( 10 );
+	for( int i = 0 ; i < 10 ; i++ ) {
+		// the first vector stays empty
+		for( int j = 0 ; j < i * 3 ; j++ ) {
+			ref[i].push_back( i * 100 + j );
+		}
+	}
+
+	{
+		Writer writer( filename );
+
+		std::vector< std::vector<int> > seq = ref;
+		int after = 42;
+
+		SERIALIZER_PUT_VARIABLE( writer, seq );
+		SERIALIZER_PUT_VARIABLE( writer, after );
+	}
+
+	{
+		Reader reader( filename );
+
+		std::vector< std::vector<int> > seq;
+		int after = 0;
+
+		SERIALIZER_GET_VARIABLE( reader, seq );
+		SERIALIZER_GET_VARIABLE( reader, after );
+
+		ASSERT_EQ( ref.size(), seq.size() );
+		for( int i = 0 ; i < 10 ; i++ ) {
+			EXPECT_EQ( ref[i], seq[i] );
+		}
+		EXPECT_EQ( 42, after );
+	}
+}
+
+TextBinaryTest( StdVector_Nested );
+
 //////////////////////////////////////////////////////////////////////////
 // eigen library support
 #include "serializer_eigen.h"
@@ -1198,3 +1238,482 @@ namespace MoveOnly {
 
 	TextBinaryTest( MoveOnly );
 }
+
+
+//////////////////////////////////////////////////////////////////////////
+// buffered and memory-backed binary I/O
+
+#include <boost/timer/timer.hpp>
+#include <boost/format.hpp>
+#include <iostream>
+
+namespace BinaryIO {
+	// more data than fits into the buffer, written as single values and in bulk
+	TEST( BinaryIO, BiggerThanBuffer ) {
+		const int numValues = int( Serializer::BINARY_BUFFER_SIZE / sizeof( int ) ) * 3 + 17;
+
+		std::vector<int> bulk( numValues );
+		for( int i = 0 ; i < numValues ; i++ ) {
+			bulk[i] = i * 7;
+		}
+
+		{
+			Serializer::BinaryWriter writer( "Binary_BiggerThanBuffer", 3 );
+
+			for( int i = 0 ; i < numValues ; i++ ) {
+				writer.put( i );
+			}
+			writer.put( bulk );
+			writer.put( std::string( "end" ) );
+		}
+
+		{
+			Serializer::BinaryReader reader( "Binary_BiggerThanBuffer", 3 );
+			ASSERT_TRUE( reader.valid() );
+
+			for( int i = 0 ; i < numValues ; i++ ) {
+				int value;
+				reader.get( value );
+				ASSERT_EQ( i, value );
+			}
+
+			std::vector<int> readBulk;
+			reader.get( readBulk );
+			EXPECT_EQ( bulk, readBulk );
+
+			std::string end;
+			reader.get( end );
+			EXPECT_EQ( "end", end );
+		}
+
+		{
+			Serializer::BinaryReader reader( "Binary_BiggerThanBuffer", 4 );
+			EXPECT_FALSE( reader.valid() );
+		}
+	}
+
+	TEST( BinaryIO, MemoryReader ) {
+		std::vector< std::vector<float> > ref( 3, std::vector<float>( 5, 1.5f ) );
+
+		{
+			Serializer::BinaryWriter writer( "Binary_MemoryReader", 1 );
+			writer.put( ref );
+		}
+
+		std::vector<unsigned char> data;
+		{
+			FILE *file = fopen( "Binary_MemoryReader", "rb" );
+			ASSERT_TRUE( file != nullptr );
+			unsigned char buffer[ 256 ];
+			size_t numBytes;
+			while( (numBytes = fread( buffer, 1, sizeof( buffer ), file )) > 0 ) {
+				data.insert( data.end(), buffer, buffer + numBytes );
+			}
+			fclose( file );
+		}
+
+		{
+			Serializer::BinaryReader reader( &data.front(), data.size(), 1 );
+			ASSERT_TRUE( reader.valid() );
+
+			std::vector< std::vector<float> > seq;
+			reader.get( seq );
+			EXPECT_EQ( ref, seq );
+
+			// reading past the end leaves values untouched
+			int past = 13;
+			reader.get( past );
+			EXPECT_EQ( 13, past );
+		}
+
+		{
+			Serializer::BinaryReader reader( &data.front(), data.size(), 2 );
+			EXPECT_FALSE( reader.valid() );
+		}
+	}
+
+	// shaped like ProbeDatabase: many instances with a transformation and a vector of 16 byte samples each,
+	// and a vector of probe positions per orientation
+	struct Sample {
+		unsigned char colorLab[3];
+		unsigned char occlusion;
+		float distance;
+		int weight;
+		int probeIndex;
+
+		SERIALIZER_ENABLE_RAW_MODE();
+	};
+
+	struct Instance {
+		Eigen::Affine3f transformation;
+		std::vector<Sample> samples;
+
+		SERIALIZER_DEFAULT_IMPL( (transformation)(samples) );
+	};
+
+	struct Model {
+		std::vector<Instance> instances;
+		std::vector< std::vector< Eigen::Matrix< signed char, 3, 1 > > > rotatedProbePositions;
+
+		SERIALIZER_DEFAULT_IMPL( (instances)(rotatedProbePositions) );
+	};
+
+	TEST( BinaryIO, BenchmarkProbeDatabaseShapedData ) {
+		const int numModels = 16;
+		const int numInstances = 32;
+		const int numProbes = 4096;
+
+		std::vector<Model> models( numModels );
+		double numBytes = 0;
+		for( int modelIndex = 0 ; modelIndex < numModels ; modelIndex++ ) {
+			Model &model = models[ modelIndex ];
+
+			model.instances.resize( numInstances );
+			for( int instanceIndex = 0 ; instanceIndex < numInstances ; instanceIndex++ ) {
+				Instance &instance = model.instances[ instanceIndex ];
+				instance.transformation.setIdentity();
+				instance.samples.resize( numProbes );
+				for( int probeIndex = 0 ; probeIndex < numProbes ; probeIndex++ ) {
+					Sample &sample = instance.samples[ probeIndex ];
+					memset( &sample, 0, sizeof( sample ) );
+					sample.probeIndex = probeIndex;
+					sample.distance = float( instanceIndex );
+				}
+				numBytes += sizeof( instance.transformation ) + numProbes * sizeof( Sample );
+			}
+
+			model.rotatedProbePositions.resize( 24, std::vector< Eigen::Matrix< signed char, 3, 1 > >( numProbes, Eigen::Matrix< signed char, 3, 1 >( 1, 2, 3 ) ) );
+			numBytes += 24 * numProbes * 3;
+		}
+
+		const double numMBs = numBytes / (1 << 20);
+
+		{
+			boost::timer::cpu_timer timer;
+			{
+				Serializer::BinaryWriter writer( "Binary_Benchmark" );
+				writer.put( models );
+			}
+			const double wallTime = timer.elapsed().wall * 1e-9;
+			std::cout << boost::format( "write %.1f MB: %.3fs (%.1f MB/s)\n" ) % numMBs % wallTime % (numMBs / wallTime);
+		}
+
+		std::vector<Model> readModels;
+		{
+			boost::timer::cpu_timer timer;
+			{
+				Serializer::BinaryReader reader( "Binary_Benchmark" );
+				reader.get( readModels );
+			}
+			const double wallTime = timer.elapsed().wall * 1e-9;
+			std::cout << boost::format( "read %.1f MB: %.3fs (%.1f MB/s)\n" ) % numMBs % wallTime % (numMBs / wallTime);
+		}
+
+		ASSERT_EQ( numModels, readModels.size() );
+		ASSERT_EQ( numInstances, readModels.back().instances.size() );
+		EXPECT_EQ( numProbes - 1, readModels.back().instances.back().samples.back().probeIndex );
+		EXPECT_EQ( float( numInstances - 1 ), readModels.back().instances.back().samples.back().distance );
+		EXPECT_TRUE( readModels.back().rotatedProbePositions.back().back() == models.back().rotatedProbePositions.back().back() );
+
+		// the same data as compressed stream
+		{
+			boost::timer::cpu_timer timer;
+			{
+				Serializer::BinaryWriter writer( "Binary_BenchmarkCompressed", 1, Serializer::BinaryWriter::COMPRESSED );
+				writer.put( models );
+			}
+			const double wallTime = timer.elapsed().wall * 1e-9;
+
+			FILE *file = fopen( "Binary_BenchmarkCompressed", "rb" );
+			ASSERT_TRUE( file != nullptr );
+			fseek( file, 0, SEEK_END );
+			const double numCompressedMBs = double( ftell( file ) ) / (1 << 20);
+			fclose( file );
+
+			std::cout << boost::format( "write compressed %.1f MB -> %.1f MB (ratio %.1f): %.3fs (%.1f MB/s)\n" ) % numMBs % numCompressedMBs % (numMBs / numCompressedMBs) % wallTime % (numMBs / wallTime);
+		}
+
+		std::vector<Model> readCompressedModels;
+		{
+			boost::timer::cpu_timer timer;
+			{
+				Serializer::BinaryReader reader( "Binary_BenchmarkCompressed", 1 );
+				ASSERT_TRUE( reader.isCompressed() );
+				reader.get( readCompressedModels );
+			}
+			const double wallTime = timer.elapsed().wall * 1e-9;
+			std::cout << boost::format( "read compressed %.1f MB: %.3fs (%.1f MB/s)\n" ) % numMBs % wallTime % (numMBs / wallTime);
+		}
+
+		ASSERT_EQ( numModels, readCompressedModels.size() );
+		ASSERT_EQ( numInstances, readCompressedModels.back().instances.size() );
+		EXPECT_EQ( numProbes - 1, readCompressedModels.back().instances.back().samples.back().probeIndex );
+		EXPECT_EQ( float( numInstances - 1 ), readCompressedModels.back().instances.back().samples.back().distance );
+		EXPECT_TRUE( readCompressedModels.back().rotatedProbePositions.back().back() == models.back().rotatedProbePositions.back().back() );
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// block codec and compressed binary streams
+
+#include <random>
+#include <memory>
+
+namespace BlockCodecTests {
+	std::vector<unsigned char> roundTrip( const std::vector<unsigned char> &data ) {
+		std::vector<unsigned char> compressed( BlockCodec::getMaxCompressedSize( data.size() ) );
+		const size_t compressedSize = BlockCodec::compress( data.data(), data.size(), compressed.data() );
+		EXPECT_LE( compressedSize, compressed.size() );
+
+		std::vector<unsigned char> decompressed( data.size() );
+		EXPECT_TRUE( BlockCodec::decompress( compressed.data(), compressedSize, decompressed.data(), decompressed.size() ) );
+		return decompressed;
+	}
+
+	TEST( BlockCodec, RoundTrip ) {
+		std::mt19937 generator( 7 );
+
+		std::vector<unsigned char> empty;
+		EXPECT_EQ( empty, roundTrip( empty ) );
+
+		std::vector<unsigned char> random( 100000 );
+		for( size_t i = 0 ; i < random.size() ; i++ ) {
+			random[i] = (unsigned char) generator();
+		}
+		EXPECT_EQ( random, roundTrip( random ) );
+
+		// long runs and repeated patterns with long literal runs in between
+		std::vector<unsigned char> repetitive;
+		for( int i = 0 ; i < 1000 ; i++ ) {
+			repetitive.insert( repetitive.end(), 300 + i % 17, (unsigned char) i );
+			for( int j = 0 ; j < 20 ; j++ ) {
+				repetitive.push_back( (unsigned char) generator() );
+			}
+		}
+		EXPECT_EQ( repetitive, roundTrip( repetitive ) );
+
+		std::vector<unsigned char> compressed( BlockCodec::getMaxCompressedSize( repetitive.size() ) );
+		EXPECT_LT( BlockCodec::compress( repetitive.data(), repetitive.size(), compressed.data() ), repetitive.size() / 4 );
+	}
+
+	TEST( BlockCodec, CorruptData ) {
+		std::vector<unsigned char> data( 10000, 5 );
+		std::vector<unsigned char> compressed( BlockCodec::getMaxCompressedSize( data.size() ) );
+		const size_t compressedSize = BlockCodec::compress( data.data(), data.size(), compressed.data() );
+
+		std::vector<unsigned char> decompressed( data.size() );
+		// truncated input
+		EXPECT_FALSE( BlockCodec::decompress( compressed.data(), compressedSize / 2, decompressed.data(), decompressed.size() ) );
+		// wrong output size
+		EXPECT_FALSE( BlockCodec::decompress( compressed.data(), compressedSize, decompressed.data(), decompressed.size() - 1 ) );
+	}
+
+	TEST( BlockCodec, Filters ) {
+		// 4 byte elements and some trailing bytes
+		std::vector<unsigned char> data( 4 * 1000 + 3 );
+		for( size_t i = 0 ; i < data.size() ; i++ ) {
+			data[i] = (unsigned char) (i * 31 + i / 7);
+		}
+
+		const BlockCodec::Filter filters[] = { BlockCodec::FILTER_NONE, BlockCodec::FILTER_SHUFFLE, BlockCodec::FILTER_DELTA_SHUFFLE };
+		for( int filterIndex = 0 ; filterIndex < 3 ; filterIndex++ ) {
+			std::vector<unsigned char> filtered( data.size() ), restored( data.size() );
+			BlockCodec::applyFilter( filters[ filterIndex ], data.data(), data.size(), 4, filtered.data() );
+			BlockCodec::removeFilter( filters[ filterIndex ], filtered.data(), filtered.size(), 4, restored.data() );
+			EXPECT_EQ( data, restored );
+		}
+
+		// sorted ints become small deltas
+		std::vector<int> sorted( 1000 );
+		for( int i = 0 ; i < 1000 ; i++ ) {
+			sorted[i] = 100000 + i * 3;
+		}
+		std::vector<unsigned char> filtered( sorted.size() * sizeof( int ) );
+		BlockCodec::applyFilter( BlockCodec::FILTER_DELTA_SHUFFLE, (const unsigned char *) sorted.data(), filtered.size(), sizeof( int ), filtered.data() );
+		EXPECT_EQ( 3, filtered[ 1 ] );
+		EXPECT_EQ( 0, filtered[ 1000 + 1 ] );
+	}
+
+	TEST( BlockCodec, CompressedStream ) {
+		// more than a few blocks, sorted (delta filter), unsorted (shuffle filter) and single values
+		const int numValues = int( Serializer::COMPRESSED_BLOCK_SIZE / sizeof( int ) ) * 3 + 17;
+
+		std::vector<int> sorted( numValues );
+		std::vector<float> unsorted( numValues );
+		for( int i = 0 ; i < numValues ; i++ ) {
+			sorted[i] = i * 7;
+			unsorted[i] = float( (i * 7919) % 1000 );
+		}
+		std::vector< std::vector<int> > nested( 100, std::vector<int>( 1000, 3 ) );
+
+		{
+			Serializer::BinaryWriter writer( "Binary_CompressedStream", 3, Serializer::BinaryWriter::COMPRESSED );
+			ASSERT_TRUE( writer.isCompressed() );
+
+			for( int i = 0 ; i < 1000 ; i++ ) {
+				writer.put( i );
+			}
+			writer.put( sorted );
+			writer.put( unsorted );
+			writer.put( nested );
+			writer.put( std::string( "end" ) );
+		}
+
+		std::vector<unsigned char> data;
+		{
+			FILE *file = fopen( "Binary_CompressedStream", "rb" );
+			ASSERT_TRUE( file != nullptr );
+			unsigned char buffer[ 4096 ];
+			size_t numBytes;
+			while( (numBytes = fread( buffer, 1, sizeof( buffer ), file )) > 0 ) {
+				data.insert( data.end(), buffer, buffer + numBytes );
+			}
+			fclose( file );
+		}
+		EXPECT_LT( data.size(), sorted.size() * sizeof( int ) );
+
+		for( int useMemory = 0 ; useMemory < 2 ; useMemory++ ) {
+			std::unique_ptr< Serializer::BinaryReader > reader( useMemory ? new Serializer::BinaryReader( &data.front(), data.size(), 3 ) : new Serializer::BinaryReader( "Binary_CompressedStream", 3 ) );
+			ASSERT_TRUE( reader->valid() );
+			EXPECT_TRUE( reader->isCompressed() );
+
+			for( int i = 0 ; i < 1000 ; i++ ) {
+				int value;
+				reader->get( value );
+				ASSERT_EQ( i, value );
+			}
+
+			std::vector<int> readSorted;
+			reader->get( readSorted );
+			EXPECT_EQ( sorted, readSorted );
+
+			std::vector<float> readUnsorted;
+			reader->get( readUnsorted );
+			EXPECT_EQ( unsorted, readUnsorted );
+
+			std::vector< std::vector<int> > readNested;
+			reader->get( readNested );
+			EXPECT_EQ( nested, readNested );
+
+			std::string end;
+			reader->get( end );
+			EXPECT_EQ( "end", end );
+
+			// reading past the end leaves values untouched
+			int past = 13;
+			reader->get( past );
+			EXPECT_EQ( 13, past );
+		}
+
+		{
+			Serializer::BinaryReader reader( "Binary_CompressedStream", 4 );
+			EXPECT_FALSE( reader.valid() );
+		}
+	}
+
+	TEST( BlockCodec, CorruptBlockHeaders ) {
+		{
+			Serializer::BinaryWriter writer( "Binary_CorruptBlockHeaders", 3, Serializer::BinaryWriter::COMPRESSED );
+			for( int i = 0 ; i < 1000 ; i++ ) {
+				writer.put( i );
+			}
+		}
+
+		std::vector<unsigned char> data;
+		{
+			FILE *file = fopen( "Binary_CorruptBlockHeaders", "rb" );
+			ASSERT_TRUE( file != nullptr );
+			unsigned char buffer[ 4096 ];
+			size_t numBytes;
+			while( (numBytes = fread( buffer, 1, sizeof( buffer ), file )) > 0 ) {
+				data.insert( data.end(), buffer, buffer + numBytes );
+			}
+			fclose( file );
+		}
+
+		// the first block header follows the version int
+		const size_t headerOffset = sizeof( int );
+		ASSERT_LT( headerOffset + sizeof( Serializer::detail::CompressedBlockHeader ), data.size() );
+
+		// raw size above the block size, stored size above the codec's bound and stored size above the rest of the input
+		const unsigned rawSizes[] = { 0xffffffffu, unsigned( Serializer::COMPRESSED_BLOCK_SIZE + 1 ), 4000, 4000 };
+		const unsigned storedSizes[] = { 100, 100, 0x7fffffffu, unsigned( data.size() ) };
+		for( int corruptionIndex = 0 ; corruptionIndex < 4 ; corruptionIndex++ ) {
+			std::vector<unsigned char> corruptData( data );
+			Serializer::detail::CompressedBlockHeader header;
+			memcpy( &header, &corruptData[ headerOffset ], sizeof( header ) );
+			header.rawSize = rawSizes[ corruptionIndex ];
+			header.storedSize = storedSizes[ corruptionIndex ];
+			header.isCompressed = 1;
+			memcpy( &corruptData[ headerOffset ], &header, sizeof( header ) );
+
+			{
+				FILE *file = fopen( "Binary_CorruptBlockHeaders", "wb" );
+				ASSERT_TRUE( file != nullptr );
+				fwrite( corruptData.data(), 1, corruptData.size(), file );
+				fclose( file );
+			}
+
+			for( int useMemory = 0 ; useMemory < 2 ; useMemory++ ) {
+				std::unique_ptr< Serializer::BinaryReader > reader( useMemory ? new Serializer::BinaryReader( &corruptData.front(), corruptData.size(), 3 ) : new Serializer::BinaryReader( "Binary_CorruptBlockHeaders", 3 ) );
+				ASSERT_TRUE( reader->valid() );
+
+				// the block is rejected, so the value stays untouched
+				int value = 13;
+				reader->get( value );
+				EXPECT_EQ( 13, value ) << "corruption " << corruptionIndex << ", memory " << useMemory;
+			}
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// streaming text output
+
+#include <fstream>
+
+namespace TextIO {
+	// entries of the root are written while the writer is still open and don't stay in the tree
+	TEST( TextIO, StreamsRootEntries ) {
+		std::vector< std::vector<float> > values;
+		for( int i = 0 ; i < 100 ; i++ ) {
+			values.push_back( std::vector<float>( i % 5, i * 0.5f ) );
+		}
+		std::string multiline = "line 1\nline 2\nline 3";
+
+		Serializer::TextConverter converter;
+		{
+			Serializer::TextWriter writer( "Text_StreamsRootEntries" );
+
+			for( auto value = values.begin() ; value != values.end() ; ++value ) {
+				Serializer::put( writer, *value );
+				Serializer::put( converter, *value );
+				ASSERT_TRUE( writer.root.nodes.empty() );
+			}
+
+			SERIALIZER_PUT_VARIABLE( writer, multiline );
+			SERIALIZER_PUT_VARIABLE( converter, multiline );
+			ASSERT_TRUE( writer.root.nodes.empty() );
+		}
+
+		{
+			std::ifstream file( "Text_StreamsRootEntries" );
+			const std::string text = std::string( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+			EXPECT_EQ( converter.getString(), text );
+		}
+
+		{
+			Serializer::TextReader reader( "Text_StreamsRootEntries" );
+
+			for( auto value = values.begin() ; value != values.end() ; ++value ) {
+				std::vector<float> readValue;
+				Serializer::get( reader, readValue );
+				EXPECT_EQ( *value, readValue );
+			}
+
+			std::string readMultiline;
+			Serializer::get( reader, "multiline", readMultiline );
+			EXPECT_EQ( multiline, readMultiline );
+		}
+	}
+}
\ No newline at end of file
@@ -34,6 +34,12 @@ namespace Serializer {
 		struct EigenTransform< Eigen::Transform< _Scalar, _Dim, _Mode, _Options > > {
 			typedef void isEigenType;
 		};
+
+		// fixed-size matrices are written as their coefficients anyway, so vectors of them can be dumped in one go
+		template< typename _Scalar, int _Rows, int _Cols >
+		struct can_be_dumped_wo_cv< Eigen::Matrix< _Scalar, _Rows, _Cols > > {
+			static const bool value = boost::is_arithmetic< _Scalar >::value && _Rows > 0 && _Cols > 0;
+		};
 	}
 
 	template< typename Reader, typename X >
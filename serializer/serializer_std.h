@@ -8,8 +8,109 @@
 #include <list>
 
 #include <boost/type_traits/is_fundamental.hpp>
+#include <boost/type_traits/is_arithmetic.hpp>
+#include <boost/utility/enable_if.hpp>
 
 namespace Serializer {
+	namespace detail {
+		template< typename Value >
+		struct is_vector_of_dumpables {
+			static const bool value = false;
+		};
+
+		template< typename Value >
+		struct is_vector_of_dumpables< std::vector< Value > > {
+			static const bool value = can_be_dumped< Value >::value;
+		};
+
+		// the filter that is applied before compression (compressed streams only)
+		// sorted numbers (eg offsets or ids) compress a lot better as deltas
+		template< typename Value >
+		typename boost::enable_if< boost::is_arithmetic< Value >, BlockCodec::Filter >::type
+		chooseFilter( const BinaryWriter &writer, const Value *values, size_t count ) {
+			if( !writer.isCompressed() || count < 2 ) {
+				return BlockCodec::FILTER_NONE;
+			}
+			for( size_t i = 1 ; i < count ; ++i ) {
+				if( values[ i ] < values[ i - 1 ] ) {
+					return BlockCodec::FILTER_SHUFFLE;
+				}
+			}
+			return BlockCodec::FILTER_DELTA_SHUFFLE;
+		}
+
+		template< typename Value >
+		typename boost::disable_if< boost::is_arithmetic< Value >, BlockCodec::Filter >::type
+		chooseFilter( const BinaryWriter &writer, const Value *values, size_t count ) {
+			return writer.isCompressed() ? BlockCodec::FILTER_SHUFFLE : BlockCodec::FILTER_NONE;
+		}
+
+		// vectors of dumpable vectors are stored as one bulk section with all sizes and one with all values
+		// (instead of a size and a small section per inner vector)
+		template< typename Value >
+		typename boost::enable_if< is_vector_of_dumpables< Value > >::type
+		writeElements( BinaryWriter &writer, const std::vector<Value> &collection ) {
+			std::vector< unsigned int > sizes( collection.size() );
+			for( size_t i = 0 ; i < collection.size() ; ++i ) {
+				sizes[ i ] = (unsigned int) collection[ i ].size();
+			}
+			writer.writeBulk( &sizes.front(), sizeof( unsigned int ), sizes.size(), chooseFilter( writer, &sizes.front(), sizes.size() ) );
+
+			for( auto it = collection.begin() ; it != collection.end() ; ++it ) {
+				if( !it->empty() ) {
+					writer.writeBulk( &it->front(), sizeof( typename Value::value_type ), it->size(), chooseFilter( writer, &it->front(), it->size() ) );
+				}
+			}
+		}
+
+		template< typename Value >
+		typename boost::enable_if< is_vector_of_dumpables< Value > >::type
+		readElements( BinaryReader &reader, unsigned int size, std::vector<Value> &collection ) {
+			std::vector< unsigned int > sizes( size );
+			reader.readRaw( &sizes.front(), size * sizeof( unsigned int ) );
+
+			collection.resize( size );
+			for( unsigned int i = 0 ; i < size ; ++i ) {
+				Value &value = collection[ i ];
+				value.resize( sizes[ i ] );
+				if( !value.empty() ) {
+					reader.readRaw( &value.front(), value.size() * sizeof( typename Value::value_type ) );
+				}
+			}
+		}
+
+		template< typename Value >
+		typename boost::disable_if< is_vector_of_dumpables< Value > >::type
+		writeElements( BinaryWriter &writer, const std::vector<Value> &collection ) {
+			if( !can_be_dumped<Value>::value ) {
+				for( auto it = collection.begin() ; it != collection.end() ; ++it ) {
+					write( writer, *it );
+				}
+			}
+			else {
+				// speed up fundamental types or raw types :)
+				writer.writeBulk( &collection.front(), sizeof( Value ), collection.size(), chooseFilter( writer, &collection.front(), collection.size() ) );
+			}
+		}
+
+		template< typename Value >
+		typename boost::disable_if< is_vector_of_dumpables< Value > >::type
+		readElements( BinaryReader &reader, unsigned int size, std::vector<Value> &collection ) {
+			if( !can_be_dumped<Value>::value ) {
+				for( unsigned int i = 0 ; i < size ; ++i ) {
+					Value value;
+					read( reader, value );
+					collection.emplace_back( std::move( value ) );
+				}
+			}
+			else {
+				// speed up pods :)
+				collection.resize( size );
+				reader.readRaw( &collection.front(), size * sizeof( Value ) );
+			}
+		}
+	}
+
 	// std::vector
 	template< typename Value >
 	void write( BinaryWriter &writer, const std::vector<Value> &collection ) {
@@ -20,15 +121,7 @@ namespace Serializer {
 			return;
 		}
 
-		if( !detail::can_be_dumped<Value>::value ) {
-			for( auto it = collection.begin() ; it != collection.end() ; ++it ) {
-				write( writer, *it );
-			}
-		}
-		else {
-			// speed up fundamental types or raw types :)
-			fwrite( &collection.front(), sizeof( Value ), size, writer.handle );
-		}
+		detail::writeElements( writer, collection );
 	}
 
 	template< typename Value >
@@ -43,18 +136,7 @@ namespace Serializer {
 		collection.clear();
 		collection.reserve( size );
 
-		if( !detail::can_be_dumped<Value>::value ) {
-			for( unsigned int i = 0 ; i < size ; ++i ) {
-				Value value;
-				read( reader, value );
-				collection.emplace_back( std::move( value ) );
-			}
-		}
-		else {
-			// speed up pods :)
-			collection.resize( size );
-			fread( &collection.front(), sizeof( Value ), size, reader.handle );
-		}
+		detail::readElements( reader, size, collection );
 	}
 
 	template< typename Value >
@@ -66,7 +148,7 @@ namespace Serializer {
 
 	template< typename Value >
 	void read( TextReader &reader, std::vector<Value> &collection ) {
-		int size = (int) reader.mapNode->size();
+		int size = (int) reader.mapNode.size();
 
 		collection.clear();
 		collection.reserve( size );
@@ -112,7 +194,7 @@ namespace Serializer {
 
 	template< typename Value >
 	void read( TextReader &reader, std::list<Value> &collection ) {
-		int size = (int) reader.mapNode->size();
+		int size = (int) reader.mapNode.size();
 		
 		collection.clear();
 
@@ -128,17 +210,19 @@ namespace Serializer {
 		unsigned int size;
 		read( reader, size );
 		value.resize( size );
-		fread( &value[0], size, 1, reader.handle );
+		if( size ) {
+			reader.readRaw( &value[0], size );
+		}
 	}
 
 	inline void write( BinaryWriter &writer, const std::string &value ) {
 		unsigned int size = (unsigned int) value.size();
-		fwrite( &size, sizeof( unsigned int ), 1, writer.handle );
-		fwrite( &value[0], size, 1, writer.handle );
+		write( writer, size );
+		writer.writeRaw( value.data(), size );
 	}
 
 	inline void read( TextReader &reader, std::string &value ) {
-		value = reader.mapNode->data().content;
+		value = reader.mapNode.data().getContent();
 	}
 
 	inline void write( TextWriter &writer, const std::string &value ) {
@@ -173,7 +257,7 @@ namespace Serializer {
 
 	template< typename First, typename Second >
 	void read( TextReader &reader, std::pair< First, Second > &pair ) {
-		if( !detail::is_simple< First >::value || !reader.keyNode ) {
+		if( !detail::is_simple< First >::value || !reader.keyNode.valid() ) {
 			get( reader, pair.first );
 			get( reader, pair.second );
 		}
@@ -217,7 +301,7 @@ namespace Serializer {
 
 	template< typename Key, typename Value >
 	void read( TextReader &reader, std::map< Key, Value > &collection ) {
-		int size = (int) reader.mapNode->size();
+		int size = (int) reader.mapNode.size();
 
 		collection.clear();
 
@@ -0,0 +1,794 @@
+#include "cpuRayTracer.h"
+#include "probeSampling.h"
+
+#include "taskRuntime.h"
+
+#include <xmmintrin.h>
+#include <stdexcept>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <math.h>
+
+using namespace Eigen;
+
+namespace {
+	// same as in optixProgramInterface.h
+	const float sceneEpsilon = 0.005f;
+	// the sun direction is never set, so the programs use the (unnormalized) default
+	const Vector3f sunDirection( -1.0f, -1.0f, -1.0f );
+
+	const int numBins = 16;
+	// deeper nodes become leaves, so the traversal stacks can't overflow
+	const int maxBuildDepth = 60;
+	const int traversalStackSize = maxBuildDepth + 2;
+
+	float getSurfaceArea( const AlignedBox3f &box ) {
+		const Vector3f size = box.sizes();
+		return 2.0f * (size.x() * size.y() + size.y() * size.z() + size.z() * size.x());
+	}
+
+	Vector3f getPosition( const SGSScene::Vertex &vertex ) {
+		return Vector3f::Map( vertex.position );
+	}
+
+	Vector3f getNormal( const SGSScene::Vertex &vertex ) {
+		return Vector3f::Map( vertex.normal );
+	}
+
+	Vector2f getTexCoord( const SGSScene::Vertex &vertex ) {
+		return Vector2f::Map( vertex.uv[0] );
+	}
+
+	int wrap( int value, int size ) {
+		const int wrappedValue = value % size;
+		return wrappedValue < 0 ? wrappedValue + size : wrappedValue;
+	}
+
+	// optix::Ray has no problems with zero direction components, but our slab tests would produce NaNs
+	float safeInverse( float value ) {
+		if( fabsf( value ) < 1e-20f ) {
+			return value < 0.0f ? -1e20f : 1e20f;
+		}
+		return 1.0f / value;
+	}
+
+	signed char toLabChannel( float value ) {
+		return static_cast< signed char >( value );
+	}
+}
+
+Vector4f CpuRayTracer::Texture::sample( float x, float y ) const {
+	// texel centers are at +0.5
+	x -= 0.5f;
+	y -= 0.5f;
+
+	const float floorX = floorf( x );
+	const float floorY = floorf( y );
+	const float fractionX = x - floorX;
+	const float fractionY = y - floorY;
+
+	const int x0 = wrap( int( floorX ), width );
+	const int y0 = wrap( int( floorY ), height );
+	const int x1 = wrap( x0 + 1, width );
+	const int y1 = wrap( y0 + 1, height );
+
+	auto getTexel = [&] ( int texelX, int texelY ) -> Vector4f {
+		const unsigned char *texel = &image[ (texelY * width + texelX) * 4 ];
+		return Vector4f( texel[0], texel[1], texel[2], texel[3] ) / 255.0f;
+	};
+
+	return
+			(getTexel( x0, y0 ) * (1.0f - fractionX) + getTexel( x1, y0 ) * fractionX) * (1.0f - fractionY)
+		+
+			(getTexel( x0, y1 ) * (1.0f - fractionX) + getTexel( x1, y1 ) * fractionX) * fractionY
+	;
+}
+
+CpuRayTracer::CpuRayTracer()
+	: initialized( false )
+	, dirty( false )
+	, hemisphereSamples( ProbeSampling::numHemisphereSamples )
+{
+	ProbeSampling::createHemisphereSamples( &hemisphereSamples.front() );
+}
+
+void CpuRayTracer::clearGeometry() {
+	vertices.clear();
+	indices.clear();
+	materialIndices.clear();
+	materialInfos.clear();
+	nodes.clear();
+}
+
+void CpuRayTracer::addTerrain( const SGSScene::Terrain &terrain ) {
+	const int startVertex = vertices.size();
+
+	for( auto terrainVertex = terrain.vertices.begin() ; terrainVertex != terrain.vertices.end() ; ++terrainVertex ) {
+		SGSScene::Vertex vertex;
+		Vector3f::Map( vertex.position ) = Vector3f::Map( terrainVertex->position );
+		Vector3f::Map( vertex.normal ) = Vector3f::Map( terrainVertex->normal );
+		Vector2f::Map( vertex.uv[0] ) = Vector2f::Map( terrainVertex->blendUV );
+		vertices.push_back( vertex );
+	}
+
+	for( auto index = terrain.indices.begin() ; index != terrain.indices.end() ; ++index ) {
+		indices.push_back( startVertex + *index );
+	}
+	materialIndices.resize( indices.size() / 3, TERRAIN_MATERIAL_INDEX );
+}
+
+void CpuRayTracer::addInstance( const SGSScene &scene, int instanceIndex, int modelIndex, const Affine3f &transformation ) {
+	const SGSScene::Model &model = scene.models[ modelIndex ];
+	const Matrix3f normalTransformation = transformation.linear().inverse().transpose();
+
+	const int endSubObject = model.startSubObject + model.numSubObjects;
+	for( int subObjectIndex = model.startSubObject ; subObjectIndex < endSubObject ; ++subObjectIndex ) {
+		const SGSScene::SubObject &subObject = scene.subObjects[ subObjectIndex ];
+
+		// same as in SGSSceneRenderer::refillOptixBuffer
+		MaterialInfo materialInfo;
+		materialInfo.modelIndex = modelIndex;
+		materialInfo.objectIndex = instanceIndex;
+
+		materialInfo.textureIndex = subObject.material.textureIndex[0];
+		materialInfo.alphaType = (MaterialInfo::AlphaType) subObject.material.alphaType;
+		materialInfo.alpha = subObject.material.alpha / 255.0f;
+
+		materialInfo.diffuse.x = subObject.material.diffuse.r / 255.0f;
+		materialInfo.diffuse.y = subObject.material.diffuse.g / 255.0f;
+		materialInfo.diffuse.z = subObject.material.diffuse.b / 255.0f;
+
+		const int materialIndex = materialInfos.size();
+		materialInfos.push_back( materialInfo );
+
+		const int startVertex = vertices.size();
+		for( int vertexIndex = subObject.startVertex ; vertexIndex < subObject.startVertex + subObject.numVertices ; ++vertexIndex ) {
+			SGSScene::Vertex vertex = scene.vertices[ vertexIndex ];
+			Vector3f::Map( vertex.position ) = transformation * Vector3f::Map( vertex.position );
+			Vector3f::Map( vertex.normal ) = normalTransformation * Vector3f::Map( vertex.normal );
+			vertices.push_back( vertex );
+		}
+
+		const int indexShift = startVertex - subObject.startVertex;
+		for( int indexIndex = subObject.startIndex ; indexIndex < subObject.startIndex + subObject.numIndices ; ++indexIndex ) {
+			indices.push_back( scene.indices[ indexIndex ] + indexShift );
+		}
+		materialIndices.resize( indices.size() / 3, materialIndex );
+	}
+}
+
+void CpuRayTracer::build() {
+	nodes.clear();
+
+	const int numTriangles = materialIndices.size();
+	if( numTriangles == 0 ) {
+		return;
+	}
+
+	std::vector< AlignedBox3f > triangleBounds( numTriangles );
+	std::vector< Vector3f > centroids( numTriangles );
+	for( int triangleIndex = 0 ; triangleIndex < numTriangles ; ++triangleIndex ) {
+		AlignedBox3f &bounds = triangleBounds[ triangleIndex ];
+		bounds.setEmpty();
+		for( int corner = 0 ; corner < 3 ; ++corner ) {
+			bounds.extend( getPosition( vertices[ indices[ triangleIndex * 3 + corner ] ] ) );
+		}
+		centroids[ triangleIndex ] = bounds.center();
+	}
+
+	std::vector< int > triangleOrder( numTriangles );
+	std::iota( triangleOrder.begin(), triangleOrder.end(), 0 );
+
+	struct BuildTask {
+		int nodeIndex;
+		int begin, end;
+		int depth;
+
+		BuildTask( int nodeIndex, int begin, int end, int depth ) : nodeIndex( nodeIndex ), begin( begin ), end( end ), depth( depth ) {}
+	};
+
+	struct Bin {
+		AlignedBox3f bounds;
+		int numTriangles;
+	};
+
+	nodes.reserve( 2 * numTriangles );
+	nodes.push_back( Node() );
+
+	std::vector< BuildTask > buildTasks;
+	buildTasks.push_back( BuildTask( 0, 0, numTriangles, 0 ) );
+
+	while( !buildTasks.empty() ) {
+		const BuildTask buildTask = buildTasks.back();
+		buildTasks.pop_back();
+
+		AlignedBox3f bounds, centroidBounds;
+		bounds.setEmpty();
+		centroidBounds.setEmpty();
+		for( int orderIndex = buildTask.begin ; orderIndex < buildTask.end ; ++orderIndex ) {
+			bounds.extend( triangleBounds[ triangleOrder[ orderIndex ] ] );
+			centroidBounds.extend( centroids[ triangleOrder[ orderIndex ] ] );
+		}
+
+		{
+			Node &node = nodes[ buildTask.nodeIndex ];
+			node.boundsMin = bounds.min();
+			node.boundsMax = bounds.max();
+			node.first = buildTask.begin;
+			node.numTriangles = buildTask.end - buildTask.begin;
+			node.splitAxis = 0;
+		}
+
+		const int numNodeTriangles = buildTask.end - buildTask.begin;
+		if( numNodeTriangles <= maxLeafSize || buildTask.depth >= maxBuildDepth ) {
+			continue;
+		}
+
+		// find the split plane with the lowest SAH cost (bin boundaries only)
+		int bestAxis = -1;
+		int bestSplitBin = 0;
+		float bestCost = std::numeric_limits< float >::max();
+
+		for( int axis = 0 ; axis < 3 ; ++axis ) {
+			const float centroidMin = centroidBounds.min()[ axis ];
+			const float extent = centroidBounds.max()[ axis ] - centroidMin;
+			if( extent <= 0.0f ) {
+				continue;
+			}
+			const float binScale = numBins / extent;
+
+			Bin bins[ numBins ];
+			for( int binIndex = 0 ; binIndex < numBins ; ++binIndex ) {
+				bins[ binIndex ].bounds.setEmpty();
+				bins[ binIndex ].numTriangles = 0;
+			}
+
+			for( int orderIndex = buildTask.begin ; orderIndex < buildTask.end ; ++orderIndex ) {
+				const int triangleIndex = triangleOrder[ orderIndex ];
+				const int binIndex = std::min( numBins - 1, int( (centroids[ triangleIndex ][ axis ] - centroidMin) * binScale ) );
+				bins[ binIndex ].bounds.extend( triangleBounds[ triangleIndex ] );
+				++bins[ binIndex ].numTriangles;
+			}
+
+			// rightCosts[ i ] is the cost of bins i..numBins-1
+			float rightCosts[ numBins ];
+			{
+				AlignedBox3f rightBounds;
+				rightBounds.setEmpty();
+				int numRightTriangles = 0;
+				for( int binIndex = numBins - 1 ; binIndex > 0 ; --binIndex ) {
+					rightBounds.extend( bins[ binIndex ].bounds );
+					numRightTriangles += bins[ binIndex ].numTriangles;
+					rightCosts[ binIndex ] = numRightTriangles ? numRightTriangles * getSurfaceArea( rightBounds ) : 0.0f;
+				}
+			}
+
+			AlignedBox3f leftBounds;
+			leftBounds.setEmpty();
+			int numLeftTriangles = 0;
+			for( int splitBin = 1 ; splitBin < numBins ; ++splitBin ) {
+				leftBounds.extend( bins[ splitBin - 1 ].bounds );
+				numLeftTriangles += bins[ splitBin - 1 ].numTriangles;
+				if( numLeftTriangles == 0 || numLeftTriangles == numNodeTriangles ) {
+					continue;
+				}
+
+				const float cost = numLeftTriangles * getSurfaceArea( leftBounds ) + rightCosts[ splitBin ];
+				if( cost < bestCost ) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplitBin = splitBin;
+				}
+			}
+		}
+
+		int middle;
+		if( bestAxis != -1 ) {
+			const float centroidMin = centroidBounds.min()[ bestAxis ];
+			const float binScale = numBins / (centroidBounds.max()[ bestAxis ] - centroidMin);
+			middle = int( std::partition(
+				triangleOrder.begin() + buildTask.begin,
+				triangleOrder.begin() + buildTask.end,
+				[&] ( int triangleIndex ) {
+					return std::min( numBins - 1, int( (centroids[ triangleIndex ][ bestAxis ] - centroidMin) * binScale ) ) < bestSplitBin;
+				}
+			) - triangleOrder.begin() );
+		}
+		else {
+			// all centroids coincide: split in the middle
+			middle = (buildTask.begin + buildTask.end) / 2;
+		}
+
+		const int leftChildIndex = nodes.size();
+		nodes.push_back( Node() );
+		nodes.push_back( Node() );
+
+		Node &node = nodes[ buildTask.nodeIndex ];
+		node.first = leftChildIndex;
+		node.numTriangles = 0;
+		node.splitAxis = std::max( bestAxis, 0 );
+
+		buildTasks.push_back( BuildTask( leftChildIndex + 1, middle, buildTask.end, buildTask.depth + 1 ) );
+		buildTasks.push_back( BuildTask( leftChildIndex, buildTask.begin, middle, buildTask.depth + 1 ) );
+	}
+
+	// store the triangles in leaf order
+	std::vector< int > orderedIndices( indices.size() );
+	std::vector< int > orderedMaterialIndices( numTriangles );
+	for( int orderIndex = 0 ; orderIndex < numTriangles ; ++orderIndex ) {
+		const int triangleIndex = triangleOrder[ orderIndex ];
+		std::copy( &indices[ triangleIndex * 3 ], &indices[ triangleIndex * 3 ] + 3, &orderedIndices[ orderIndex * 3 ] );
+		orderedMaterialIndices[ orderIndex ] = materialIndices[ triangleIndex ];
+	}
+	indices.swap( orderedIndices );
+	materialIndices.swap( orderedMaterialIndices );
+}
+
+bool CpuRayTracer::isDisabled( int triangleIndex, const RenderContext &renderContext ) const {
+	const int materialIndex = materialIndices[ triangleIndex ];
+	if( materialIndex == TERRAIN_MATERIAL_INDEX ) {
+		return false;
+	}
+
+	// see checkObjectDisabled in objectMesh.cu
+	const MaterialInfo &materialInfo = materialInfos[ materialIndex ];
+	return materialInfo.objectIndex == renderContext.disabledInstanceIndex || materialInfo.modelIndex == renderContext.disabledModelIndex;
+}
+
+bool CpuRayTracer::intersectTriangle( const Ray &ray, int triangleIndex, Hit &hit ) const {
+	// same as optix::intersect_triangle
+	const Vector3f p0 = getPosition( vertices[ indices[ triangleIndex * 3 ] ] );
+	const Vector3f p1 = getPosition( vertices[ indices[ triangleIndex * 3 + 1 ] ] );
+	const Vector3f p2 = getPosition( vertices[ indices[ triangleIndex * 3 + 2 ] ] );
+
+	const Vector3f e0 = p1 - p0;
+	const Vector3f e1 = p0 - p2;
+	const Vector3f n = e1.cross( e0 );
+
+	const Vector3f e2 = (p0 - ray.origin) / n.dot( ray.direction );
+	const Vector3f i = ray.direction.cross( e2 );
+
+	const float beta = i.dot( e1 );
+	const float gamma = i.dot( e0 );
+	const float t = n.dot( e2 );
+
+	if( t < ray.tMax && t > ray.tMin && beta >= 0.0f && gamma >= 0.0f && beta + gamma <= 1.0f ) {
+		hit.triangleIndex = triangleIndex;
+		hit.distance = t;
+		hit.beta = beta;
+		hit.gamma = gamma;
+		return true;
+	}
+	return false;
+}
+
+CpuRayTracer::Hit CpuRayTracer::traceClosest( const Ray &ray, const RenderContext &renderContext ) const {
+	Hit hit;
+	if( nodes.empty() ) {
+		return hit;
+	}
+
+	Ray currentRay( ray );
+	const Vector3f inverseDirection( safeInverse( ray.direction.x() ), safeInverse( ray.direction.y() ), safeInverse( ray.direction.z() ) );
+
+	int stack[ traversalStackSize ];
+	int stackSize = 0;
+	stack[ stackSize++ ] = 0;
+
+	while( stackSize ) {
+		const Node &node = nodes[ stack[ --stackSize ] ];
+
+		const Vector3f t0 = (node.boundsMin - currentRay.origin).cwiseProduct( inverseDirection );
+		const Vector3f t1 = (node.boundsMax - currentRay.origin).cwiseProduct( inverseDirection );
+		const float tNear = std::max( t0.cwiseMin( t1 ).maxCoeff(), currentRay.tMin );
+		const float tFar = std::min( t0.cwiseMax( t1 ).minCoeff(), currentRay.tMax );
+		if( tNear > tFar ) {
+			continue;
+		}
+
+		if( node.isLeaf() ) {
+			const int endTriangle = node.first + node.numTriangles;
+			for( int triangleIndex = node.first ; triangleIndex < endTriangle ; ++triangleIndex ) {
+				if( !isDisabled( triangleIndex, renderContext ) && intersectTriangle( currentRay, triangleIndex, hit ) ) {
+					currentRay.tMax = hit.distance;
+				}
+			}
+		}
+		else {
+			// visit the near child first
+			const bool rightIsNear = ray.direction[ node.splitAxis ] < 0.0f;
+			stack[ stackSize++ ] = node.first + (rightIsNear ? 0 : 1);
+			stack[ stackSize++ ] = node.first + (rightIsNear ? 1 : 0);
+		}
+	}
+
+	return hit;
+}
+
+void CpuRayTracer::traceClosestPacket( const Vector3f &origin, const Vector3f directions[4], float tMin, const float tMaxs[4], const RenderContext &renderContext, Hit hits[4] ) const {
+	for( int lane = 0 ; lane < 4 ; ++lane ) {
+		hits[ lane ] = Hit();
+	}
+	if( nodes.empty() ) {
+		return;
+	}
+
+	const __m128 originX = _mm_set1_ps( origin.x() );
+	const __m128 originY = _mm_set1_ps( origin.y() );
+	const __m128 originZ = _mm_set1_ps( origin.z() );
+
+	const __m128 directionX = _mm_setr_ps( directions[0].x(), directions[1].x(), directions[2].x(), directions[3].x() );
+	const __m128 directionY = _mm_setr_ps( directions[0].y(), directions[1].y(), directions[2].y(), directions[3].y() );
+	const __m128 directionZ = _mm_setr_ps( directions[0].z(), directions[1].z(), directions[2].z(), directions[3].z() );
+
+	const __m128 inverseDirectionX = _mm_setr_ps( safeInverse( directions[0].x() ), safeInverse( directions[1].x() ), safeInverse( directions[2].x() ), safeInverse( directions[3].x() ) );
+	const __m128 inverseDirectionY = _mm_setr_ps( safeInverse( directions[0].y() ), safeInverse( directions[1].y() ), safeInverse( directions[2].y() ), safeInverse( directions[3].y() ) );
+	const __m128 inverseDirectionZ = _mm_setr_ps( safeInverse( directions[0].z() ), safeInverse( directions[1].z() ), safeInverse( directions[2].z() ), safeInverse( directions[3].z() ) );
+
+	const __m128 tMinimum = _mm_set1_ps( tMin );
+	__m128 tMaximum = _mm_loadu_ps( tMaxs );
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps( 1.0f );
+
+	// the rays of a probe are coherent, so the near child of the first ray is good enough for all of them
+	const Vector3f &leadingDirection = directions[0];
+
+	int stack[ traversalStackSize ];
+	int stackSize = 0;
+	stack[ stackSize++ ] = 0;
+
+	while( stackSize ) {
+		const Node &node = nodes[ stack[ --stackSize ] ];
+
+		// slab test for all rays
+		{
+			const __m128 tX0 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.boundsMin.x() ), originX ), inverseDirectionX );
+			const __m128 tX1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.boundsMax.x() ), originX ), inverseDirectionX );
+			const __m128 tY0 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.boundsMin.y() ), originY ), inverseDirectionY );
+			const __m128 tY1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.boundsMax.y() ), originY ), inverseDirectionY );
+			const __m128 tZ0 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.boundsMin.z() ), originZ ), inverseDirectionZ );
+			const __m128 tZ1 = _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( node.boundsMax.z() ), originZ ), inverseDirectionZ );
+
+			const __m128 tNear = _mm_max_ps(
+				_mm_max_ps( _mm_min_ps( tX0, tX1 ), _mm_min_ps( tY0, tY1 ) ),
+				_mm_max_ps( _mm_min_ps( tZ0, tZ1 ), tMinimum )
+			);
+			const __m128 tFar = _mm_min_ps(
+				_mm_min_ps( _mm_max_ps( tX0, tX1 ), _mm_max_ps( tY0, tY1 ) ),
+				_mm_min_ps( _mm_max_ps( tZ0, tZ1 ), tMaximum )
+			);
+
+			if( !_mm_movemask_ps( _mm_cmple_ps( tNear, tFar ) ) ) {
+				continue;
+			}
+		}
+
+		if( !node.isLeaf() ) {
+			const bool rightIsNear = leadingDirection[ node.splitAxis ] < 0.0f;
+			stack[ stackSize++ ] = node.first + (rightIsNear ? 0 : 1);
+			stack[ stackSize++ ] = node.first + (rightIsNear ? 1 : 0);
+			continue;
+		}
+
+		const int endTriangle = node.first + node.numTriangles;
+		for( int triangleIndex = node.first ; triangleIndex < endTriangle ; ++triangleIndex ) {
+			if( isDisabled( triangleIndex, renderContext ) ) {
+				continue;
+			}
+
+			// optix::intersect_triangle for 4 rays
+			const Vector3f p0 = getPosition( vertices[ indices[ triangleIndex * 3 ] ] );
+			const Vector3f p1 = getPosition( vertices[ indices[ triangleIndex * 3 + 1 ] ] );
+			const Vector3f p2 = getPosition( vertices[ indices[ triangleIndex * 3 + 2 ] ] );
+
+			const Vector3f e0 = p1 - p0;
+			const Vector3f e1 = p0 - p2;
+			const Vector3f n = e1.cross( e0 );
+			const Vector3f originToP0 = p0 - origin;
+
+			const __m128 e0X = _mm_set1_ps( e0.x() ), e0Y = _mm_set1_ps( e0.y() ), e0Z = _mm_set1_ps( e0.z() );
+			const __m128 e1X = _mm_set1_ps( e1.x() ), e1Y = _mm_set1_ps( e1.y() ), e1Z = _mm_set1_ps( e1.z() );
+			const __m128 nX = _mm_set1_ps( n.x() ), nY = _mm_set1_ps( n.y() ), nZ = _mm_set1_ps( n.z() );
+
+			const __m128 inverseDenominator = _mm_div_ps(
+				one,
+				_mm_add_ps( _mm_add_ps( _mm_mul_ps( nX, directionX ), _mm_mul_ps( nY, directionY ) ), _mm_mul_ps( nZ, directionZ ) )
+			);
+
+			const __m128 e2X = _mm_mul_ps( _mm_set1_ps( originToP0.x() ), inverseDenominator );
+			const __m128 e2Y = _mm_mul_ps( _mm_set1_ps( originToP0.y() ), inverseDenominator );
+			const __m128 e2Z = _mm_mul_ps( _mm_set1_ps( originToP0.z() ), inverseDenominator );
+
+			// i = cross( direction, e2 )
+			const __m128 iX = _mm_sub_ps( _mm_mul_ps( directionY, e2Z ), _mm_mul_ps( directionZ, e2Y ) );
+			const __m128 iY = _mm_sub_ps( _mm_mul_ps( directionZ, e2X ), _mm_mul_ps( directionX, e2Z ) );
+			const __m128 iZ = _mm_sub_ps( _mm_mul_ps( directionX, e2Y ), _mm_mul_ps( directionY, e2X ) );
+
+			const __m128 beta = _mm_add_ps( _mm_add_ps( _mm_mul_ps( iX, e1X ), _mm_mul_ps( iY, e1Y ) ), _mm_mul_ps( iZ, e1Z ) );
+			const __m128 gamma = _mm_add_ps( _mm_add_ps( _mm_mul_ps( iX, e0X ), _mm_mul_ps( iY, e0Y ) ), _mm_mul_ps( iZ, e0Z ) );
+			const __m128 t = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nX, e2X ), _mm_mul_ps( nY, e2Y ) ), _mm_mul_ps( nZ, e2Z ) );
+
+			const __m128 hitMask = _mm_and_ps(
+				_mm_and_ps( _mm_cmplt_ps( t, tMaximum ), _mm_cmpgt_ps( t, tMinimum ) ),
+				_mm_and_ps(
+					_mm_and_ps( _mm_cmpge_ps( beta, zero ), _mm_cmpge_ps( gamma, zero ) ),
+					_mm_cmple_ps( _mm_add_ps( beta, gamma ), one )
+				)
+			);
+
+			const int laneMask = _mm_movemask_ps( hitMask );
+			if( !laneMask ) {
+				continue;
+			}
+
+			tMaximum = _mm_or_ps( _mm_and_ps( hitMask, t ), _mm_andnot_ps( hitMask, tMaximum ) );
+
+			float ts[4], betas[4], gammas[4];
+			_mm_storeu_ps( ts, t );
+			_mm_storeu_ps( betas, beta );
+			_mm_storeu_ps( gammas, gamma );
+			for( int lane = 0 ; lane < 4 ; ++lane ) {
+				if( laneMask & (1 << lane) ) {
+					hits[ lane ].triangleIndex = triangleIndex;
+					hits[ lane ].distance = ts[ lane ];
+					hits[ lane ].beta = betas[ lane ];
+					hits[ lane ].gamma = gammas[ lane ];
+				}
+			}
+		}
+	}
+}
+
+Vector4f CpuRayTracer::getObjectTexel( const MaterialInfo &materialInfo, const Vector2f &texCoord ) const {
+	// return all white if no texture has been selected (or we don't have the textures)
+	if( materialInfo.textureIndex == -1 || mergedObjectTexture.empty() ) {
+		return Vector4f::Ones();
+	}
+
+	// see getTexel in objectMesh.cu
+	const MergedTextureInfo &textureInfo = mergedTextureInfos[ materialInfo.textureIndex ];
+
+	const float wrappedU = texCoord.x() - floorf( texCoord.x() );
+	const float wrappedV = texCoord.y() - floorf( texCoord.y() );
+
+	return mergedObjectTexture.sample(
+		textureInfo.offset[0] + wrappedU * textureInfo.size[0],
+		textureInfo.offset[1] + wrappedV * textureInfo.size[1]
+	);
+}
+
+float CpuRayTracer::traceShadow( const Vector3f &position, const Vector3f &lightDirection, const RenderContext &renderContext ) const {
+	if( nodes.empty() ) {
+		return 1.0f;
+	}
+
+	// visits all hits like shadow_anyHit in objectMesh.cu and terrainMesh.cu
+	const Ray ray( position, -lightDirection, sceneEpsilon, RT_DEFAULT_MAX );
+	const Vector3f inverseDirection( safeInverse( ray.direction.x() ), safeInverse( ray.direction.y() ), safeInverse( ray.direction.z() ) );
+
+	float transmittance = 1.0f;
+
+	int stack[ traversalStackSize ];
+	int stackSize = 0;
+	stack[ stackSize++ ] = 0;
+
+	while( stackSize ) {
+		const Node &node = nodes[ stack[ --stackSize ] ];
+
+		const Vector3f t0 = (node.boundsMin - ray.origin).cwiseProduct( inverseDirection );
+		const Vector3f t1 = (node.boundsMax - ray.origin).cwiseProduct( inverseDirection );
+		const float tNear = std::max( t0.cwiseMin( t1 ).maxCoeff(), ray.tMin );
+		const float tFar = std::min( t0.cwiseMax( t1 ).minCoeff(), ray.tMax );
+		if( tNear > tFar ) {
+			continue;
+		}
+
+		if( !node.isLeaf() ) {
+			stack[ stackSize++ ] = node.first;
+			stack[ stackSize++ ] = node.first + 1;
+			continue;
+		}
+
+		const int endTriangle = node.first + node.numTriangles;
+		for( int triangleIndex = node.first ; triangleIndex < endTriangle ; ++triangleIndex ) {
+			Hit hit;
+			if( !intersectTriangle( ray, triangleIndex, hit ) ) {
+				continue;
+			}
+
+			const int materialIndex = materialIndices[ triangleIndex ];
+			if( materialIndex == TERRAIN_MATERIAL_INDEX ) {
+				return 0.0f;
+			}
+			if( isDisabled( triangleIndex, renderContext ) ) {
+				continue;
+			}
+
+			const MaterialInfo &materialInfo = materialInfos[ materialIndex ];
+			switch( materialInfo.alphaType ) {
+			default:
+			case MaterialInfo::AT_NONE:
+				return 0.0f;
+			case MaterialInfo::AT_ADDITIVE:
+			case MaterialInfo::AT_MULTIPLY:
+			case MaterialInfo::AT_MULTIPLY_2:
+				continue;
+			case MaterialInfo::AT_MATERIAL:
+				transmittance *= 1.0f - materialInfo.alpha;
+				break;
+			case MaterialInfo::AT_ALPHATEST:
+			case MaterialInfo::AT_TEXTURE:
+				{
+					const SGSScene::Vertex &v0 = vertices[ indices[ triangleIndex * 3 ] ];
+					const SGSScene::Vertex &v1 = vertices[ indices[ triangleIndex * 3 + 1 ] ];
+					const SGSScene::Vertex &v2 = vertices[ indices[ triangleIndex * 3 + 2 ] ];
+					const Vector2f texCoord = getTexCoord( v1 ) * hit.beta + getTexCoord( v2 ) * hit.gamma + getTexCoord( v0 ) * (1.0f - hit.beta - hit.gamma);
+					transmittance *= 1.0f - getObjectTexel( materialInfo, texCoord ).w() * materialInfo.alpha;
+				}
+				break;
+			}
+
+			if( transmittance < 0.01f ) {
+				return transmittance;
+			}
+		}
+	}
+
+	return transmittance;
+}
+
+Vector3f CpuRayTracer::traceEye( const Ray &ray, const RenderContext &renderContext, int depth ) const {
+	if( depth >= maxTraceDepth ) {
+		return Vector3f::Zero();
+	}
+
+	const Hit hit = traceClosest( ray, renderContext );
+	if( !hit.hasHit() ) {
+		// see eye_miss in raytracer.cu
+		return Vector3f::Zero();
+	}
+	return shade( ray, hit, renderContext, depth );
+}
+
+Vector3f CpuRayTracer::shade( const Ray &ray, const Hit &hit, const RenderContext &renderContext, int depth ) const {
+	const Vector3f hitPosition = ray.origin + hit.distance * ray.direction;
+
+	const SGSScene::Vertex &v0 = vertices[ indices[ hit.triangleIndex * 3 ] ];
+	const SGSScene::Vertex &v1 = vertices[ indices[ hit.triangleIndex * 3 + 1 ] ];
+	const SGSScene::Vertex &v2 = vertices[ indices[ hit.triangleIndex * 3 + 2 ] ];
+
+	const float alpha0 = 1.0f - hit.beta - hit.gamma;
+	const Vector3f shadingNormal = (getNormal( v1 ) * hit.beta + getNormal( v2 ) * hit.gamma + getNormal( v0 ) * alpha0).normalized();
+	const Vector2f texCoord = getTexCoord( v1 ) * hit.beta + getTexCoord( v2 ) * hit.gamma + getTexCoord( v0 ) * alpha0;
+
+	// faceforward only flips the normal, so it doesn't matter for the abs
+	const float diffuseAttenuation = fabsf( shadingNormal.dot( sunDirection ) );
+
+	const int materialIndex = materialIndices[ hit.triangleIndex ];
+	if( materialIndex == TERRAIN_MATERIAL_INDEX ) {
+		// see eye_closestHit in terrainMesh.cu
+		const Vector3f terrainColor = terrainTexture.empty() ?
+				Vector3f::Ones()
+			:
+				Vector3f( terrainTexture.sample( texCoord.x() * terrainTexture.width, texCoord.y() * terrainTexture.height ).head<3>() )
+		;
+		return terrainColor * (0.2f + 0.8f * diffuseAttenuation * traceShadow( hitPosition, sunDirection, renderContext ));
+	}
+
+	// see eye_closestHit in objectMesh.cu
+	const MaterialInfo &materialInfo = materialInfos[ materialIndex ];
+	const Vector4f diffuseColor = Vector4f( materialInfo.diffuse.x, materialInfo.diffuse.y, materialInfo.diffuse.z, 1.0f ).cwiseProduct( getObjectTexel( materialInfo, texCoord ) );
+	const Vector3f diffuseColor3 = diffuseColor.head<3>();
+
+	auto subTrace = [&] ( bool earlyOut ) -> Vector3f {
+		if( earlyOut ) {
+			return Vector3f::Zero();
+		}
+		return traceEye( Ray( hitPosition, ray.direction, sceneEpsilon, RT_DEFAULT_MAX ), renderContext, depth + 1 );
+	};
+
+	switch( materialInfo.alphaType ) {
+	case MaterialInfo::AT_ADDITIVE:
+		return diffuseColor3 + subTrace( false );
+	case MaterialInfo::AT_MULTIPLY:
+		return diffuseColor3.cwiseProduct( subTrace( false ) );
+	case MaterialInfo::AT_MULTIPLY_2:
+		return diffuseColor3.cwiseProduct( subTrace( false ) ) * 2;
+	default:
+		break;
+	}
+
+	const Vector3f litSurfaceColor = diffuseColor3 * (0.2f + 0.8f * diffuseAttenuation * traceShadow( hitPosition, sunDirection, renderContext ));
+
+	switch( materialInfo.alphaType ) {
+	case MaterialInfo::AT_NONE:
+		return litSurfaceColor;
+	case MaterialInfo::AT_MATERIAL:
+		{
+			const float alpha = materialInfo.alpha;
+			return litSurfaceColor * alpha + subTrace( alpha > 0.99f ) * (1.0f - alpha);
+		}
+	case MaterialInfo::AT_TEXTURE:
+	case MaterialInfo::AT_ALPHATEST:
+		{
+			const float alpha = materialInfo.alpha * diffuseColor.w();
+			return litSurfaceColor * alpha + subTrace( alpha > 0.99f ) * (1.0f - alpha);
+		}
+	default:
+		return Vector3f::Zero();
+	}
+}
+
+void CpuRayTracer::sampleProbe( const TransformedProbe &probe, unsigned sampleStartIndex, const RenderContext &renderContext, float maxDistance, ProbeSample &probeSample ) const {
+	// see sampleProbes in probeTracer.cu
+	const optix::Onb onb( probe.direction );
+	const Vector3f origin( probe.position.x, probe.position.y, probe.position.z );
+
+	float avgDistance = 0.0f;
+	Vector3f avgColor = Vector3f::Zero();
+	int numHits = 0;
+
+	for( int packetStart = 0 ; packetStart < OptixProgramInterface::numProbeSamples ; packetStart += 4 ) {
+		Vector3f directions[4];
+		float tMaxs[4];
+		for( int lane = 0 ; lane < 4 ; ++lane ) {
+			const int rayIndex = packetStart + lane;
+			if( rayIndex < OptixProgramInterface::numProbeSamples ) {
+				const optix::float3 &sample = hemisphereSamples[ (sampleStartIndex + rayIndex) % ProbeSampling::numWrappedHemisphereSamples ];
+				const optix::float3 rayDirection = onb.m_normal * sample.z + onb.m_tangent * sample.x + onb.m_binormal * sample.y;
+				directions[ lane ] = Vector3f( rayDirection.x, rayDirection.y, rayDirection.z );
+				tMaxs[ lane ] = maxDistance;
+			}
+			else {
+				// inactive lane
+				directions[ lane ] = directions[ 0 ];
+				tMaxs[ lane ] = -1.0f;
+			}
+		}
+
+		Hit hits[4];
+		traceClosestPacket( origin, directions, sceneEpsilon, tMaxs, renderContext, hits );
+
+		for( int lane = 0 ; lane < 4 ; ++lane ) {
+			if( !hits[ lane ].hasHit() ) {
+				continue;
+			}
+
+			++numHits;
+			avgDistance += hits[ lane ].distance;
+			avgColor += shade( Ray( origin, directions[ lane ], sceneEpsilon, maxDistance ), hits[ lane ], renderContext, 0 );
+		}
+	}
+
+	if( numHits ) {
+		avgDistance = avgDistance / numHits;
+		avgColor = avgColor / numHits;
+	}
+
+	// convert to cielab
+	const optix::float3 colorLab = OptixProgramInterface::CIELAB::fromRGB( optix::make_float3( avgColor.x(), avgColor.y(), avgColor.z() ) );
+	probeSample.colorLab = optix::make_char3( toLabChannel( colorLab.x ), toLabChannel( colorLab.y ), toLabChannel( colorLab.z ) );
+	probeSample.distance = avgDistance;
+	probeSample.occlusion = numHits;
+}
+
+void CpuRayTracer::sampleProbes( const TransformedProbes &transformedProbes, ProbeSamples &probeSamples, const RenderContext &renderContext, float maxDistance, int sampleOffset ) {
+	if( transformedProbes.size() == 0 ) {
+		throw std::invalid_argument( "no probes!" );
+	}
+
+	const int numProbes = transformedProbes.size();
+	probeSamples.resize( numProbes );
+
+	TaskRuntime::parallel_for( 0, numProbes, [&] ( int probeIndex ) {
+		sampleProbe(
+			transformedProbes[ probeIndex ],
+			ProbeSampling::getSampleStartIndex( sampleOffset, numProbes, probeIndex ),
+			renderContext,
+			maxDistance,
+			probeSamples[ probeIndex ]
+		);
+	} );
+}
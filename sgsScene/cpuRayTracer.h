@@ -0,0 +1,154 @@
+#pragma once
+
+#include "optixProgramInterface.h"
+#include "sgsScene.h"
+#include "rendering.h"
+
+#include <Eigen/Eigen>
+#include <vector>
+
+// CPU replacement for the probe sampling of OptixRenderer (for machines without a GPU)
+// traces the same hemisphere rays as probeTracer.cu and shades the hits like objectMesh.cu and terrainMesh.cu
+//
+// the scene is flattened into world space triangles and stored in a binned SAH BVH
+// the primary probe rays are traced in packets of 4 with SSE, secondary (shadow and transparency) rays one by one
+//
+// SGSSceneRenderer::initCpuRayTracer fills in the textures and the geometry
+struct CpuRayTracer {
+	typedef OptixProgramInterface::TransformedProbe TransformedProbe;
+	typedef OptixProgramInterface::ProbeSample ProbeSample;
+
+	typedef OptixProgramInterface::TransformedProbes TransformedProbes;
+	typedef OptixProgramInterface::ProbeSamples ProbeSamples;
+
+	typedef OptixProgramInterface::MaterialInfo MaterialInfo;
+	typedef OptixProgramInterface::MergedTextureInfo MergedTextureInfo;
+
+	// rays are cut off after this many transparency bounces (optix runs out of stack instead)
+	static const int maxTraceDepth = 8;
+	static const int maxLeafSize = 4;
+
+	// material index of terrain triangles
+	enum { TERRAIN_MATERIAL_INDEX = -1 };
+
+	// RGBA8 texture (like SGSSceneRenderer::Cache::TextureDump)
+	// sampled with repeat wrapping and bilinear filtering like the optix texture samplers
+	struct Texture {
+		int width, height;
+		std::vector< unsigned char > image;
+
+		Texture() : width(), height() {}
+
+		bool empty() const {
+			return image.empty();
+		}
+
+		// texel coordinates (not normalized)
+		Eigen::Vector4f sample( float x, float y ) const;
+	};
+
+	struct Node {
+		Eigen::Vector3f boundsMin;
+		// index of the first triangle for leaves, index of the left child (the right child follows it) otherwise
+		int first;
+		Eigen::Vector3f boundsMax;
+		// 0 for inner nodes
+		int numTriangles;
+		int splitAxis;
+
+		bool isLeaf() const {
+			return numTriangles > 0;
+		}
+	};
+
+	// textures
+	Texture mergedObjectTexture;
+	// in textureIndex order
+	std::vector< MergedTextureInfo > mergedTextureInfos;
+	Texture terrainTexture;
+
+	// geometry (in world space)
+	std::vector< SGSScene::Vertex > vertices;
+	// 3 vertex indices per triangle, in BVH leaf order after build()
+	std::vector< int > indices;
+	// per triangle
+	std::vector< int > materialIndices;
+	std::vector< MaterialInfo > materialInfos;
+
+	std::vector< Node > nodes;
+
+	// set by SGSSceneRenderer
+	bool initialized;
+	// the instances have changed since the geometry has been filled in
+	bool dirty;
+
+	CpuRayTracer();
+
+	void markDirty() {
+		dirty = true;
+	}
+
+	void clearGeometry();
+	void addTerrain( const SGSScene::Terrain &terrain );
+	// instanceIndex and modelIndex end up in the material infos (for RenderContext)
+	void addInstance( const SGSScene &scene, int instanceIndex, int modelIndex, const Eigen::Affine3f &transformation );
+	// builds the BVH over all triangles
+	void build();
+
+	// same interface as OptixRenderer::sampleProbes
+	void sampleProbes(
+		const TransformedProbes &probes,
+		ProbeSamples &probeSamples,
+		const RenderContext &renderContext,
+		float maxDistance = RT_DEFAULT_MAX,
+		int sampleOffset = 0
+	);
+
+	struct Ray {
+		Eigen::Vector3f origin;
+		Eigen::Vector3f direction;
+		float tMin, tMax;
+
+		Ray( const Eigen::Vector3f &origin, const Eigen::Vector3f &direction, float tMin, float tMax )
+			: origin( origin )
+			, direction( direction )
+			, tMin( tMin )
+			, tMax( tMax )
+		{
+		}
+	};
+
+	struct Hit {
+		int triangleIndex;
+		float distance;
+		// barycentric coordinates of the second and third vertex
+		float beta, gamma;
+
+		Hit() : triangleIndex( -1 ) {}
+
+		bool hasHit() const {
+			return triangleIndex != -1;
+		}
+	};
+
+	// closest hit that is not disabled by renderContext
+	Hit traceClosest( const Ray &ray, const RenderContext &renderContext ) const;
+	// traces 4 rays with a common origin (rays with tMax < tMin are inactive)
+	void traceClosestPacket( const Eigen::Vector3f &origin, const Eigen::Vector3f directions[4], float tMin, const float tMaxs[4], const RenderContext &renderContext, Hit hits[4] ) const;
+
+	// returns the color of a traced ray (like Ray_Eye)
+	Eigen::Vector3f shade( const Ray &ray, const Hit &hit, const RenderContext &renderContext, int depth ) const;
+
+private:
+	bool isDisabled( int triangleIndex, const RenderContext &renderContext ) const;
+	bool intersectTriangle( const Ray &ray, int triangleIndex, Hit &hit ) const;
+
+	Eigen::Vector3f traceEye( const Ray &ray, const RenderContext &renderContext, int depth ) const;
+	float traceShadow( const Eigen::Vector3f &position, const Eigen::Vector3f &lightDirection, const RenderContext &renderContext ) const;
+
+	Eigen::Vector4f getObjectTexel( const MaterialInfo &materialInfo, const Eigen::Vector2f &texCoord ) const;
+	void sampleProbe( const TransformedProbe &probe, unsigned sampleStartIndex, const RenderContext &renderContext, float maxDistance, ProbeSample &probeSample ) const;
+
+	// shared by all sampleProbes calls (created in the constructor, so concurrent calls only read it)
+	std::vector< optix::float3 > hemisphereSamples;
+};
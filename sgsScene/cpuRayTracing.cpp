@@ -0,0 +1,45 @@
+#include "sgsSceneRenderer.h"
+#include "cpuRayTracer.h"
+
+#include "autoTimer.h"
+
+static void dumpTexture( const Texture2D &texture, CpuRayTracer::Texture &cpuTexture ) {
+	SGSSceneRenderer::Cache::TextureDump textureDump;
+	textureDump.dump( texture );
+
+	cpuTexture.width = textureDump.width;
+	cpuTexture.height = textureDump.height;
+	cpuTexture.image.swap( textureDump.image );
+}
+
+void SGSSceneRenderer::initCpuRayTracer( CpuRayTracer *cpuRayTracer ) {
+	AUTO_TIMER_FOR_FUNCTION();
+
+	dumpTexture( mergedTexture, cpuRayTracer->mergedObjectTexture );
+	cpuRayTracer->mergedTextureInfos = mergedTextureInfos;
+
+	dumpTexture( bakedTerrainTexture, cpuRayTracer->terrainTexture );
+
+	cpuRayTracer->initialized = true;
+
+	refillCpuRayTracer( cpuRayTracer );
+}
+
+void SGSSceneRenderer::refillCpuRayTracer( CpuRayTracer *cpuRayTracer ) {
+	AUTO_TIMER_FOR_FUNCTION();
+
+	cpuRayTracer->clearGeometry();
+
+	if( !scene->terrain.indices.empty() ) {
+		cpuRayTracer->addTerrain( scene->terrain );
+	}
+
+	const int numInstances = getNumInstances();
+	for( int instanceIndex = 0 ; instanceIndex < numInstances ; instanceIndex++ ) {
+		cpuRayTracer->addInstance( *scene, instanceIndex, getModelIndex( instanceIndex ), getInstanceTransformation( instanceIndex ) );
+	}
+
+	cpuRayTracer->build();
+
+	cpuRayTracer->dirty = false;
+}
@@ -2,6 +2,7 @@
 #include <optix_world.h>
 
 #include "rendering.h"
+#include "probeSampling.h"
 #include <vector>
 
 struct SGSSceneRenderer;
@@ -18,7 +19,7 @@ struct OptixRenderer {
 	typedef OptixProgramInterface::SelectionResult SelectionResult;
 	typedef std::vector< SelectionResult > SelectionResults;
 
-	static const int numHemisphereSamples = 39989;
+	static const int numHemisphereSamples = ProbeSampling::numHemisphereSamples;
 	static const int maxNumProbes = 1<<18;
 	static const int maxNumSelectionRays = 32;
 
@@ -1,8 +1,8 @@
 #include "sgsSceneRenderer.h"
 #include "optixRenderer.h"
 #include "optixProgramHelpers.h"
+#include "probeSampling.h"
 #include "boost/timer/timer.hpp"
-#include <boost/random.hpp>
 
 template< typename T >
 T *getVectorData( std::vector< T > &container ) {
@@ -241,7 +241,7 @@ void SGSSceneRenderer::writeOptixCache() {
 
 	boost::timer::auto_cpu_timer timer( "initOptix; write cache: %ws wall, %us user + %ss system = %ts CPU (%p%)\n" );
 
-	Serializer::BinaryWriter writer( optixCacheFilename, Optix::Cache::VERSION );
+	Serializer::BinaryWriter writer( optixCacheFilename, Optix::Cache::VERSION, Serializer::BinaryWriter::COMPRESSED );
 	writer.put( cache );
 }
 
@@ -590,22 +590,5 @@ void OptixRenderer::prepareLaunch() {
 }
 
 void OptixRenderer::createHemisphereSamples( optix::float3 *hemisphereSamples ) {
-	// produces randomness out of thin air
-	boost::random::mt19937 rng;
-	// see pseudo-random number generators
-	boost::random::uniform_01<> distribution;
-
-	// info about how cosine_sample_hemisphere's parameters work
-	// we sample a disk and project it up onto the hemisphere
-	//
-	// u1 is the squared radius and u2 the angle
-
-	// we have 8 sample directions in every unit circle slice
-	// => fov: 45 => half is 22.5
-	// // sin(22.5) = 0.38268343236
-	for( int i = 0 ; i < numHemisphereSamples ; ++i ) {
-		const float u1 = (float) distribution(rng) * 0.38268343236f * 0.38268343236f;
-		const float u2 = (float) distribution(rng);
-		optix::cosine_sample_hemisphere( u1, u2, hemisphereSamples[i] );
-	}
+	ProbeSampling::createHemisphereSamples( hemisphereSamples );
 }
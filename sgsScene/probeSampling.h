@@ -0,0 +1,47 @@
+#pragma once
+
+#include "optixProgramInterface.h"
+#include <boost/random.hpp>
+
+// the hemisphere sample sequence of the probe tracer
+// shared between OptixRenderer and CpuRayTracer, so probes sampled by either backend use the same ray directions
+namespace ProbeSampling {
+	// size of the hemisphere sample buffer
+	const int numHemisphereSamples = 39989;
+	// probeTracer.cu wraps the sample index around after this many samples (its numHemisphereSamples)
+	const unsigned numWrappedHemisphereSamples = 39939;
+
+	inline void createHemisphereSamples( optix::float3 *hemisphereSamples ) {
+		// produces randomness out of thin air
+		boost::random::mt19937 rng;
+		// see pseudo-random number generators
+		boost::random::uniform_01<> distribution;
+
+		// info about how cosine_sample_hemisphere's parameters work
+		// we sample a disk and project it up onto the hemisphere
+		//
+		// u1 is the squared radius and u2 the angle
+
+		// we have 8 sample directions in every unit circle slice
+		// => fov: 45 deg => half is 22.5
+		// // sin(22.5 deg) = 0.38268343236
+		for( int i = 0 ; i < numHemisphereSamples ; ++i ) {
+			const float u1 = (float) distribution(rng) * 0.38268343236f * 0.38268343236f;
+			const float u2 = (float) distribution(rng);
+			optix::cosine_sample_hemisphere( u1, u2, hemisphereSamples[i] );
+		}
+	}
+
+	// index of the first hemisphere sample of a probe (see sampleProbes in probeTracer.cu)
+	// ray i of the probe uses the sample (startIndex + i) % numWrappedHemisphereSamples
+	// all arithmetic is unsigned (and wraps around) like on the device
+	inline unsigned getSampleStartIndex( unsigned sampleOffset, unsigned numProbes, unsigned probeIndex ) {
+		return
+				sampleOffset * numProbes * OptixProgramInterface::numProbeSamples
+			+
+				OptixProgramInterface::numProbeSamples * probeIndex
+			+
+				numProbes * 1979
+		;
+	}
+}
@@ -44,6 +44,7 @@ RT_PROGRAM void sampleProbes() {
 
 	//rtPrintf( "%f", dot( onb.m_normal, cross( onb.m_tangent, onb.m_binormal ) ) );
 
+	// keep in sync with ProbeSampling::getSampleStartIndex (the CPU ray tracer uses the same sequence)
 	uint sampleStartIndex =
 			sampleOffset * numProbes * numProbeSamples
 		+
@@ -259,7 +259,7 @@ void SGSSceneRenderer::processScene( const std::shared_ptr<SGSScene> &scene, con
 	if( cacheChanged ) {
 		AUTO_TIMER( "store cache" );
 
-		Serializer::BinaryWriter writer( cacheFilename, Cache::VERSION );
+		Serializer::BinaryWriter writer( cacheFilename, Cache::VERSION, Serializer::BinaryWriter::COMPRESSED );
 		writer.put( cache );
 	}
 }
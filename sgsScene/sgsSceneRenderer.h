@@ -45,6 +45,7 @@ using namespace GL;
 
 //////////////////////////////////////////////////////////////////////////
 struct OptixRenderer;
+struct CpuRayTracer;
 
 struct Instance {
 	// object to world
@@ -90,7 +91,7 @@ struct SGSSceneRenderer {
 		optix::TextureSampler objectTextureSampler;
 
 		struct Cache {
-			static const int VERSION = 1;
+			static const int VERSION = 2;
 
 			int magicStamp;
 			std::vector<unsigned char> staticSceneAccelerationCache;
@@ -312,6 +313,11 @@ struct SGSSceneRenderer {
 	void refillOptixBuffer( const int beginInstanceIndex, const int endInstanceIndex, Optix::ObjectMeshData &meshData );
 	//////////////////////////////////////////////////////////////////////////
 
+	// copies the merged textures and the scene geometry (see cpuRayTracing.cpp)
+	void initCpuRayTracer( CpuRayTracer *cpuRayTracer );
+	// only updates the geometry
+	void refillCpuRayTracer( CpuRayTracer *cpuRayTracer );
+
 	// TODO: most of this should be moved into ModelDatabase [10/13/2012 kirschan2]
 	std::vector< Instance > instances;
 
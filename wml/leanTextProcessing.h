@@ -3,6 +3,8 @@
 #include <boost/format.hpp>
 #include <string>
 #include <exception>
+#include <memory>
+#include <algorithm>
 
 namespace LeanTextProcessing {
 	struct TextPosition {
@@ -28,8 +30,29 @@ namespace LeanTextProcessing {
 		std::string text;
 
 		TextContainer( const std::string &text, const std::string &textIdentifier ) : text( text ), textIdentifier( textIdentifier ) {}
+		TextContainer( std::string &&text, const std::string &textIdentifier ) : text( std::move( text ) ), textIdentifier( textIdentifier ) {}
 	};
 
+	// contextWidth characters before and after index
+	inline std::string getSurroundingText( const char *text, size_t size, size_t index, size_t contextWidth = 30 ) {
+		index = std::min( index, size );
+		const size_t begin = index - std::min( index, contextWidth );
+		const size_t end = std::min( size, index + contextWidth );
+		return std::string( text + begin, text + index ) + "*HERE*" + std::string( text + index, text + end );
+	}
+
+	// counts '\n', '\r\n' and '\r'
+	inline int getLineNumber( const char *text, size_t size, size_t index ) {
+		index = std::min( index, size );
+		int line = 1;
+		for( size_t i = 0 ; i < index ; ++i ) {
+			if( text[ i ] == '\n' || (text[ i ] == '\r' && (i + 1 >= size || text[ i + 1 ] != '\n')) ) {
+				++line;
+			}
+		}
+		return line;
+	}
+
 	struct TextException;
 
 	struct TextIterator {
@@ -190,20 +213,40 @@ namespace LeanTextProcessing {
 		TextPosition position;
 		std::string surroundingText;
 
+		// parsed nodes only store the text and position.index (contexts are rarely needed)
+		// the rest is filled in by resolve() when an exception is thrown
+		std::shared_ptr< const TextContainer > source;
+
 		TextContext() {}
 
 		TextContext( TextContext &&context ) 
 			: 
 				textIdentifier( std::move( context.textIdentifier ) ), 
 				position( std::move( context.position ) ),
-				surroundingText( std::move( context.surroundingText ) ) 
+				surroundingText( std::move( context.surroundingText ) ),
+				source( std::move( context.source ) )
 		{}
 
 		TextContext( const TextIterator &iterator, int contextWidth = 30 ) 
 			: textIdentifier( iterator.textContainer.textIdentifier ), 
 				position( iterator.current ),
-				surroundingText( iterator.textContainer.text.substr( std::max( 0, position.index - contextWidth ), contextWidth ) + "*HERE*" + iterator.textContainer.text.substr( std::max( 0, position.index ), contextWidth ))
+				surroundingText( getSurroundingText( iterator.textContainer.text.data(), iterator.textContainer.text.size(), position.index, contextWidth ) )
 			{}
+
+		TextContext( const std::shared_ptr< const TextContainer > &source, int index ) : source( source ) {
+			position.index = index;
+		}
+
+		void resolve( int contextWidth = 30 ) {
+			if( !source ) {
+				return;
+			}
+
+			textIdentifier = source->textIdentifier;
+			position.line = getLineNumber( source->text.data(), source->text.size(), position.index );
+			surroundingText = getSurroundingText( source->text.data(), source->text.size(), position.index, contextWidth );
+			source.reset();
+		}
 	};
 
 	struct TextException : std::exception {
@@ -213,14 +256,16 @@ namespace LeanTextProcessing {
 		std::string message;
 
 		TextException( const TextContext &context, const std::string &error ) : context( context ), error( error ) {
+			this->context.resolve();
+
 			message = boost::str( 
 				boost::format( "%s(%i:%i (%i)): %s\n\t%s\n" ) 
-					% context.textIdentifier 
-					% context.position.line 
-					% context.position.column 
-					% context.position.index 
+					% this->context.textIdentifier 
+					% this->context.position.line 
+					% this->context.position.column 
+					% this->context.position.index 
 					% error 
-					% context.surroundingText
+					% this->context.surroundingText
 				);
 		}
 
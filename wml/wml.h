@@ -1,6 +1,7 @@
 #pragma once
 
 #include "wml_node.h"
+#include "wml_document.h"
 #include "wml_detail_parser.h"
 #include "wml_detail_emitter.h"
 
@@ -11,13 +12,45 @@ namespace wml {
 
 	inline Node parse( std::istream &stream, const std::string &sourceIdentifier = "" ) {
 		std::string content = std::string( std::istreambuf_iterator<char>( stream ), std::istreambuf_iterator<char>() );
-		return detail::parse( content, sourceIdentifier );
+		return detail::parseDocument( std::move( content ), sourceIdentifier ).toNode();
 	}
 
-	inline Node parseFile( const std::string &filename ) {
+	// borrows text, which has to outlive the document and all nodes that refer to it
+	inline Document parseInPlace( const char *text, size_t size, const std::string &sourceIdentifier = "" ) {
+		return detail::parseInPlace( text, size, sourceIdentifier );
+	}
+
+	// the document takes over the content
+	inline Document parseDocument( std::string &&content, const std::string &sourceIdentifier = "" ) {
+		return detail::parseDocument( std::move( content ), sourceIdentifier );
+	}
+
+	// reads the whole file at once
+	inline bool readFile( const std::string &filename, std::string &content ) {
 		std::ifstream file( filename, std::ios_base::binary );
-		if( file.is_open() ) {
-			return parse( file );
+		if( !file.is_open() ) {
+			return false;
+		}
+
+		file.seekg( 0, std::ios_base::end );
+		content.resize( (size_t) file.tellg() );
+		file.seekg( 0, std::ios_base::beg );
+		if( !content.empty() ) {
+			file.read( &content[0], content.size() );
+		}
+		return true;
+	}
+
+	inline Document parseDocumentFile( const std::string &filename ) {
+		std::string content;
+		readFile( filename, content );
+		return parseDocument( std::move( content ), filename );
+	}
+
+	inline Node parseFile( const std::string &filename ) {
+		std::string content;
+		if( readFile( filename, content ) ) {
+			return detail::parseDocument( std::move( content ), "" ).toNode();
 		}
 		return Node();
 	}
@@ -26,7 +59,33 @@ namespace wml {
 		return detail::emit( node );
 	}
 
+	// writes into stream without building the whole text first
+	inline void emit( std::ostream &stream, const Node &node ) {
+		detail::emit( stream, node );
+	}
+
 	inline void emitFile( const std::string &filename, const Node &node ) {
-		std::ofstream( filename ) << emit( node );
+		std::ofstream file( filename );
+		emit( file, node );
 	}
+
+	// emits the entries of a map one after the other, so they can be discarded once they have been written
+	class StreamEmitter {
+	public:
+		explicit StreamEmitter( std::ostream &stream ) : emitter( stream ) {}
+
+		void emitEntry( const Node &entry ) {
+			emitter.emitEntry( entry );
+		}
+
+		void flush() {
+			emitter.flush();
+		}
+
+	private:
+		detail::Emitter emitter;
+
+		StreamEmitter( const StreamEmitter & );
+		StreamEmitter & operator = ( const StreamEmitter & );
+	};
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 
 #include "wml.h"
 
+#include <iostream>
+#include <boost/timer/timer.hpp>
+
 using namespace wml;
 
 TEST( Parser, empty )  {
@@ -316,4 +319,143 @@ TEST( Emitter, weirdValues ) {
 TEST( Emitter, emptyContent ) {
 	emitTest( "key ''");
 	emitTest( "'' ''");
+}
+
+TEST( Document, slicesOfTheText ) {
+	const std::string text =
+		"keyA valueA 'value B'\n"
+		"keyB:\n"
+		"\tx 1 2\n";
+	const Document document = parseInPlace( text.data(), text.size() );
+	const Document::NodeRef root = document.getRoot();
+
+	ASSERT_EQ( 2, root.size() );
+	ASSERT_TRUE( root[0].isRaw() );
+	ASSERT_TRUE( root[0].hasContent( "keyA" ) );
+	ASSERT_EQ( text.data(), root[0].getRawData() );
+	ASSERT_EQ( "value B", root[0][1].getContent() );
+	ASSERT_EQ( text.data() + text.find( "value B" ), root[0][1].getRawData() );
+	ASSERT_EQ( 2, root["keyB"]["x"][1].as<int>() );
+	ASSERT_FALSE( root.find( "keyC" ).valid() );
+}
+
+TEST( Document, lazyDecoding ) {
+	const std::string text =
+		"key \"a\\tb\\\"c\"\r\n"
+		"text::\r\n"
+		"\tline 1\r\n"
+		"\r\n"
+		"\tline 2\r\n";
+	const Document document = parseInPlace( text.data(), text.size() );
+	const Document::NodeRef root = document.getRoot();
+
+	ASSERT_FALSE( root["key"][0].isRaw() );
+	ASSERT_EQ( "a\\tb\\\"c", std::string( root["key"][0].getRawData(), root["key"][0].getRawSize() ) );
+	ASSERT_EQ( "a\tb\"c", root["key"][0].getContent() );
+	ASSERT_TRUE( root["key"][0].hasContent( "a\tb\"c" ) );
+	ASSERT_EQ( "line 1\n\nline 2", root["text"].data().getContent() );
+}
+
+TEST( Document, toNodeEqualsParse ) {
+	const std::string text =
+		"'key asd' \"\t\ta\t\" b\\ c d e\n"
+		"key:\n"
+		"\ta\n"
+		"\tb 1 2 3\n"
+		"\tc:\n"
+		"\t\tx 1 2\n"
+		"\t\tx 3 4\n"
+		"text::\n"
+		"\tsome data\n"
+		"\tmore data\n";
+	const Node root = parseDocument( std::string( text ), "document" ).toNode();
+
+	ASSERT_EQ( "document", root.content );
+	ASSERT_EQ( emit( parse( text ) ), emit( root ) );
+	ASSERT_EQ( "3", root["key"]["b"][2].content );
+}
+
+TEST( Document, toNodeKeepsTheContexts ) {
+	const std::string text = "a 1\nb:\n\tc 2\n";
+
+	// the nodes of documents that borrow their text can still report the lines of errors
+	Node root = parseInPlace( text.data(), text.size(), "borrowed" ).toNode();
+	try {
+		root["b"]["c"].data().error( "test" );
+		FAIL();
+	}
+	catch( const LeanTextProcessing::TextException &exception ) {
+		ASSERT_EQ( "borrowed", exception.context.textIdentifier );
+		ASSERT_EQ( 3, exception.context.position.line );
+		ASSERT_NE( std::string::npos, exception.context.surroundingText.find( "*HERE*" ) );
+	}
+}
+
+TEST( Document, errors ) {
+	const std::string text = "key:\n\tx 1\n\t\ty 2\n";
+	ASSERT_THROW( parseInPlace( text.data(), text.size() ), LeanTextProcessing::TextException );
+	ASSERT_THROW( parseDocument( "key \"\\x\"" ), LeanTextProcessing::TextException );
+
+	const Document document = parseDocument( "key value" );
+	ASSERT_THROW( document.getRoot()[ "missing" ], LeanTextProcessing::TextException );
+}
+
+static std::string createBenchmarkScene( int numInstances ) {
+	std::string text = "instances:\n";
+	for( int i = 0 ; i < numInstances ; ++i ) {
+		text += boost::str( boost::format(
+			"\tData\\Models\\Terrain_objects\\Containers\\Barrels\\barrel%i.s3d:\n"
+			"\t\tposition %f %f %f\n"
+			"\t\taxis 0 1 0\n"
+			"\t\tdegrees %f\n"
+			) % (i % 7) % (i * 0.25f) % 18.1643391f % (i * -0.5f) % (i * 0.1f) );
+	}
+	return text;
+}
+
+TEST( Document, DISABLED_Benchmark ) {
+	const std::string text = createBenchmarkScene( 100000 );
+	const double numMBs = text.size() / 1024.0 / 1024.0;
+
+	size_t numNodes = 0;
+	{
+		boost::timer::cpu_timer timer;
+		const Node root = parse( text );
+		const double wallTime = timer.elapsed().wall * 1e-9;
+		std::cout << boost::format( "parse %.1f MB: %.3fs (%.1f MB/s)\n" ) % numMBs % wallTime % (numMBs / wallTime);
+
+		numNodes = root["instances"].nodes.size();
+	}
+	{
+		boost::timer::cpu_timer timer;
+		const Document document = parseInPlace( text.data(), text.size() );
+		const double wallTime = timer.elapsed().wall * 1e-9;
+		std::cout << boost::format( "parseInPlace %.1f MB: %.3fs (%.1f MB/s)\n" ) % numMBs % wallTime % (numMBs / wallTime);
+
+		ASSERT_EQ( numNodes, document.getRoot()["instances"].size() );
+	}
+}
+
+TEST( Emitter, DISABLED_Benchmark ) {
+	const Node root = parse( createBenchmarkScene( 100000 ) );
+
+	std::string text;
+	{
+		boost::timer::cpu_timer timer;
+		text = emit( root );
+		const double wallTime = timer.elapsed().wall * 1e-9;
+		const double numMBs = text.size() / 1024.0 / 1024.0;
+		std::cout << boost::format( "emit %.1f MB: %.3fs (%.1f MB/s)\n" ) % numMBs % wallTime % (numMBs / wallTime);
+	}
+	{
+		boost::timer::cpu_timer timer;
+		emitFile( "Emitter_Benchmark.wml", root );
+		const double wallTime = timer.elapsed().wall * 1e-9;
+		const double numMBs = text.size() / 1024.0 / 1024.0;
+		std::cout << boost::format( "emitFile %.1f MB: %.3fs (%.1f MB/s)\n" ) % numMBs % wallTime % (numMBs / wallTime);
+	}
+
+	std::string content;
+	ASSERT_TRUE( readFile( "Emitter_Benchmark.wml", content ) );
+	ASSERT_EQ( text, content );
 }
\ No newline at end of file
@@ -3,18 +3,42 @@
 
 namespace wml {
 	namespace detail {
+		// text is either the result or, if stream is set, a buffer that is flushed whenever it is full
 		struct Emitter {
+			enum {
+				BUFFER_SIZE = 1 << 16
+			};
+
 			int indentLevel;
 			std::string text;
+			std::ostream *stream;
 
-			Emitter() : indentLevel( 0 ) {}
+			Emitter() : indentLevel( 0 ), stream( nullptr ) {}
+			explicit Emitter( std::ostream &stream ) : indentLevel( 0 ), stream( &stream ) {
+				text.reserve( BUFFER_SIZE );
+			}
 
-			void emitTabs() {
-				for( int i = 0 ; i < indentLevel ; ++i ) {
-					text.push_back( '\t' );
+			~Emitter() {
+				flush();
+			}
+
+			void flush() {
+				if( stream && !text.empty() ) {
+					stream->write( text.data(), text.size() );
+					text.clear();
 				}
 			}
 
+			void flushIfFull() {
+				if( stream && text.size() >= BUFFER_SIZE ) {
+					flush();
+				}
+			}
+
+			void emitTabs() {
+				text.append( indentLevel, '\t' );
+			}
+
 			enum ValueType {
 				VT_IDENTIFIER,
 				VT_UNESCAPED_STRING,
@@ -22,42 +46,48 @@ namespace wml {
 				VT_TEXT
 			};
 
+			// in order of precedence:
+			//	null characters or '\r' => VT_ESCAPED_STRING
+			//	more than two lines => VT_TEXT
+			//	'\n', '\t' or '\'' => VT_ESCAPED_STRING
+			//	' ' or ':' => VT_UNESCAPED_STRING
 			static ValueType determineType( const std::string &value ) {
-				int numLines = 1;
-
 				if( value.empty() ) {
 					return VT_UNESCAPED_STRING;
 				}
 
-				// null characters => VT_ESCAPED_STRING
+				int numLines = 1;
+				bool needsEscaping = false;
+				bool needsQuotes = false;
 				for( auto c = value.cbegin() ; c != value.cend() ; ++c ) {
-					if( *c == 0 || *c == '\r' ) {
+					switch( *c ) {
+					case 0:
+					case '\r':
 						return VT_ESCAPED_STRING;
-					}
-				}
-
-				for( auto c = value.cbegin() ; c != value.cend() ; ++c ) {
-					if( *c == '\n' ) {
+					case '\n':
 						numLines++;
+						needsEscaping = true;
+						break;
+					case '\t':
+					case '\'':
+						needsEscaping = true;
+						break;
+					case ' ':
+					case ':':
+						needsQuotes = true;
+						break;
 					}
 				}
 
 				if( numLines > 2 ) {
 					return VT_TEXT;
 				}
-
-				for( auto c = value.cbegin() ; c != value.cend() ; ++c ) {
-					if( *c == '\n' || *c == '\t' || *c == '\'' ) {
-						return VT_ESCAPED_STRING;
-					}
+				else if( needsEscaping ) {
+					return VT_ESCAPED_STRING;
 				}
-
-				for( auto c = value.cbegin() ; c != value.cend() ; ++c ) {
-					if( *c == ' ' || *c == ':' ) {
-						return VT_UNESCAPED_STRING;
-					} 
+				else if( needsQuotes ) {
+					return VT_UNESCAPED_STRING;
 				}
-
 				return VT_IDENTIFIER;
 			}
 
@@ -68,6 +98,10 @@ namespace wml {
 					vt = VT_ESCAPED_STRING;
 				}
 
+				emitValue( value, vt );
+			}
+
+			void emitValue( const std::string &value, ValueType vt ) {
 				if( vt == VT_IDENTIFIER ) {
 					text.append( value );
 				}
@@ -81,41 +115,57 @@ namespace wml {
 
 					++indentLevel;
 
-					emitTabs();
-					for( auto c = value.cbegin() ; c != value.cend() ; ++c ) {
-						text.push_back( *c );
-						if( *c == '\n' ) {
-							emitTabs();
+					// one line at a time
+					for( auto line = value.cbegin() ; ; ) {
+						auto lineEnd = std::find( line, value.cend(), '\n' );
+
+						emitTabs();
+						text.append( line, lineEnd );
+						text.push_back( '\n' );
+
+						if( lineEnd == value.cend() ) {
+							break;
 						}
-					}				
+						line = lineEnd + 1;
+					}
 
-					text.push_back( '\n' );
 					--indentLevel;
 				}
 				else if( vt == VT_ESCAPED_STRING ) {
 					text.push_back( '\"' );
 
+					// append the characters between escape sequences in one go
+					auto unescaped = value.cbegin();
 					for( auto c = value.cbegin() ; c != value.cend() ; ++c ) {
-						if( *c == '\\' || *c == '\"' ) {
-							text.push_back( '\\' );
-							text.push_back( *c );
-						}
-						else if( *c == '\t' ) {
-							text.append( "\\t" );
-						}
-						else if( *c == '\n' ) {
-							text.append( "\\n" );
-						}
-						else if( *c == '\r' ) {
-							text.append( "\\r" );
-						}
-						else if( *c == '\0' ) {
-							text.append( "\\0" );
-						}
-						else {
-							text.push_back( *c );
+						const char *escapeSequence;
+						switch( *c ) {
+						case '\\':
+							escapeSequence = "\\\\";
+							break;
+						case '\"':
+							escapeSequence = "\\\"";
+							break;
+						case '\t':
+							escapeSequence = "\\t";
+							break;
+						case '\n':
+							escapeSequence = "\\n";
+							break;
+						case '\r':
+							escapeSequence = "\\r";
+							break;
+						case '\0':
+							escapeSequence = "\\0";
+							break;
+						default:
+							continue;
 						}
+
+						text.append( unescaped, c );
+						text.append( escapeSequence );
+						unescaped = c + 1;
 					}
+					text.append( unescaped, value.cend() );
 
 					text.push_back( '\"' );
 				}
@@ -130,10 +180,6 @@ namespace wml {
 				return false;
 			}
 
-			static bool isTextBlock( const Node &node ) {
-				return node.size() == 1 && determineType( node.nodes[0].content ) == VT_TEXT;
-			}
-
 			void emitInlineValues( const Node &node ) {
 				for( auto item = node.nodes.begin() ; item != node.nodes.end() ; ++item ) {
 					text.push_back( ' ' );
@@ -143,24 +189,31 @@ namespace wml {
 				text.push_back( '\n' );
 			}
 
+			// emits one entry of a map (with its children)
+			void emitEntry( const Node &item ) {
+				emitTabs();
+				// emit the key
+				emitValue( item.content, true );
+
+				if( isMap( item ) ) {
+					text.append( ":\n" );
+					++indentLevel;
+					emitMap( item );
+					--indentLevel;
+				}
+				else if( item.size() == 1 && determineType( item.nodes[0].content ) == VT_TEXT ) {
+					emitValue( item.nodes[0].content, VT_TEXT );
+				}
+				else {
+					emitInlineValues( item );
+				}
+
+				flushIfFull();
+			}
+
 			void emitMap( const Node &node ) {
 				for( auto item = node.nodes.begin() ; item != node.nodes.end() ; ++item ) {
-					emitTabs();
-					// emit the key
-					emitValue( item->content, true );
-
-					if( isMap( *item ) ) {
-						text.append( ":\n" );
-						++indentLevel;
-						emitMap( *item );
-						--indentLevel;
-					}
-					else if( isTextBlock( *item ) ) {
-						emitValue( item->data().content, false );
-					}
-					else {
-						emitInlineValues( *item );
-					}
+					emitEntry( *item );
 				}
 			}
 		};
@@ -170,5 +223,10 @@ namespace wml {
 			emitter.emitMap( node );
 			return emitter.text;
 		}
+
+		inline void emit( std::ostream &stream, const Node &node ) {
+			Emitter emitter( stream );
+			emitter.emitMap( node );
+		}
 	}
 }
\ No newline at end of file
@@ -5,197 +5,242 @@ namespace wml {
 	namespace detail {
 		using namespace LeanTextProcessing;
 
+		// works on the text in place and only stores slices of it in the document
+		// '\n', '\r\n' and '\r' are all newlines
 		struct Parser {
+			typedef Document::Entry Entry;
+
+			Document &document;
+
+			const char *begin;
+			const char *current;
+			const char *end;
+
 			int indentLevel;
-			TextIterator textIterator;
-
-			std::string parseIdentifier() {
-				std::string text;
-				while( textIterator.checkNotAny( " \t\n" ) ) {
-					if( textIterator.check( ':' ) ) {
-						TextIterator::Scope scope( textIterator );
-						textIterator.tryMatch( "::" ) || textIterator.tryMatch( ':' );
-
-						if( textIterator.checkNotAny( " \t\n" ) ) {
-							text.append( scope.getScopedText() );
-							scope.accept();
+			// the children of the nodes that are being parsed, by depth
+			// they are moved into the document once the node is complete, so siblings end up next to each other
+			std::vector< std::vector< Entry > > pendingChildren;
+
+			bool atEof() const {
+				return current >= end;
+			}
+
+			// newlines are returned as '\n'
+			char peek() const {
+				// assert !atEof()
+				return *current == '\r' ? '\n' : *current;
+			}
+
+			void next() {
+				if( *current == '\r' && current + 1 < end && current[1] == '\n' ) {
+					++current;
+				}
+				++current;
+			}
+
+			bool tryMatch( const char c ) {
+				if( !atEof() && peek() == c ) {
+					next();
+					return true;
+				}
+				return false;
+			}
+
+			bool check( const char c ) const {
+				return !atEof() && peek() == c;
+			}
+
+			bool checkNotWhitespace() const {
+				return !atEof() && *current != ' ' && *current != '\t' && !isNewline( *current );
+			}
+
+			void error( const std::string &message ) const {
+				throw TextException( document.getContext( current - begin ), message );
+			}
+
+			Entry createEntry( Document::Kind kind, const char *text, const char *textEnd ) const {
+				Entry entry;
+				entry.offset = text - begin;
+				entry.size = textEnd - text;
+				entry.position = current - begin;
+				entry.firstChild = 0;
+				entry.numChildren = 0;
+				entry.kind = (unsigned char) kind;
+				entry.indentLevel = (unsigned char) indentLevel;
+				return entry;
+			}
+
+			Entry parseIdentifier() {
+				const char *text = current;
+				while( checkNotWhitespace() ) {
+					// one or two colons only belong to the identifier if they aren't followed by whitespace
+					if( *current == ':' ) {
+						const char *colon = current;
+						++current;
+						if( current < end && *current == ':' ) {
+							++current;
 						}
-						else {
-							scope.reject();
+
+						if( !checkNotWhitespace() ) {
+							current = colon;
 							break;
 						}
 					}
-					text.push_back( textIterator.read() );
+					++current;
 				}
 
-				if( text.empty() ) {
-					textIterator.error( "expected identifier!" );
+				if( current == text ) {
+					error( "expected identifier!" );
 				}
 
-				return text;
+				return createEntry( Document::K_RAW, text, current );
 			}
 
 			void skipWhitespace() {
-				while( textIterator.tryMatchAny( " \t" ) )
-					;
+				while( !atEof() && (*current == ' ' || *current == '\t') ) {
+					++current;
+				}
 			}
 
 			void skipEmptyLines() {
-				TextIterator::Scope scope( textIterator );
+				const char *accepted = current;
 
 				while( true ) {
 					skipWhitespace();
 
-					if( !textIterator.tryMatch( '\n' ) ) {
+					if( !tryMatch( '\n' ) ) {
 						break;
 					}
 
-					scope.accept();
+					accepted = current;
 				}
-			}
 
-			std::string parseEscapedString() {
-				std::string text;
+				current = accepted;
+			}
 
-				if( !textIterator.tryMatch( '"' ) ) {
-					textIterator.error( "'\"' expected!" );
+			// the escape sequences are only validated here and decoded on demand
+			Entry parseEscapedString() {
+				if( !tryMatch( '"' ) ) {
+					error( "'\"' expected!" );
 				}
-				while( textIterator.checkNotAny( "\"\n" ) ) {
-					if( textIterator.tryMatch( '\\' ) ) {
-						if( textIterator.atEof() ) {
-							textIterator.error( "unexpected EOF!" );
+
+				const char *text = current;
+				bool hasEscapeSequences = false;
+				while( !atEof() && !check( '"' ) && !check( '\n' ) ) {
+					if( *current == '\\' ) {
+						hasEscapeSequences = true;
+
+						++current;
+						if( atEof() ) {
+							error( "unexpected EOF!" );
 						}
-						const char control = textIterator.read();
+						const char control = peek();
 						switch( control ) {
 						case '\\':
 						case '\'':
 						case '\"':
-							text.push_back( control );
-							break;
 						case 't':
-							text.push_back( '\t' );
-							break;
 						case 'n':
-							text.push_back( '\n' );
-							break;
 						case 'r':
-							text.push_back( '\r' );
-							break;
 						case '0':
-							text.push_back( '\0' );
 							break;
 						default:
-							textIterator.error( boost::str( boost::format( "unknown escape control character '%c'!" ) % control  ) );
+							error( boost::str( boost::format( "unknown escape control character '%c'!" ) % control  ) );
 						}
 					}
-					else {
-						text.push_back( textIterator.read() );
-					}
+					++current;
 				}
-				if( !textIterator.tryMatch( '"' ) ) {
-					textIterator.error( "'\"' expected!" );
+				const char *textEnd = current;
+
+				if( !tryMatch( '"' ) ) {
+					error( "'\"' expected!" );
 				}
 
-				return text;
+				return createEntry( hasEscapeSequences ? Document::K_ESCAPED_STRING : Document::K_RAW, text, textEnd );
 			}
 
-			std::string parseUnescapedString() {
-				std::string text;
-
-				if( !textIterator.tryMatch( '\'' ) ) {
-					textIterator.error( "' expected!" );
+			Entry parseUnescapedString() {
+				if( !tryMatch( '\'' ) ) {
+					error( "' expected!" );
 				}
-				while( textIterator.checkNotAny( "'\n" ) ) {
-					text.push_back( textIterator.read() );
+
+				const char *text = current;
+				while( !atEof() && !check( '\'' ) && !check( '\n' ) ) {
+					++current;
 				}
-				if( !textIterator.tryMatch( '\'' ) ) {
-					textIterator.error( "' expected!" );
+				const char *textEnd = current;
+
+				if( !tryMatch( '\'' ) ) {
+					error( "' expected!" );
 				}
 
-				return text;
+				return createEntry( Document::K_RAW, text, textEnd );
 			}
 
 			void skipIndentLevel() {
 				for( int i = 0 ; i < indentLevel ; ++i ) {
-					if( !textIterator.tryMatch( '\t' ) ) {
-						textIterator.error( boost::str( boost::format( "expected %i tabs - found only %i!") % indentLevel % i  ) );
+					if( !tryMatch( '\t' ) ) {
+						error( boost::str( boost::format( "expected %i tabs - found only %i!") % indentLevel % i  ) );
 					}
 				}
 			}
 
-			bool checkMinimumIndentLevel() {
-				TextIterator::Scope scope( textIterator);
-
-				for( int i = 0 ; i < indentLevel ; ++i ) {
-					if( !textIterator.tryMatch( '\t') ) {
-						return false;
-					}
+			bool checkMinimumIndentLevel() const {
+				if( end - current < indentLevel ) {
+					return false;
 				}
-				return true;
-			}
-
-			bool checkIndentLevel() {
-				TextIterator::Scope scope( textIterator );
 
 				for( int i = 0 ; i < indentLevel ; ++i ) {
-					if( !textIterator.tryMatch( '\t') ) {
+					if( current[ i ] != '\t' ) {
 						return false;
 					}
 				}
-
-				if( textIterator.check( '\t' ) ) {
-					return false;
-				}
-
 				return true;
 			}
 
 			void ensureIndentLevel() {
 				skipIndentLevel();
 
-				if( textIterator.check( '\t' ) ) {
-					textIterator.error( boost::str( boost::format( "expected %i tabs - found more!") % indentLevel ) );
+				if( check( '\t' ) ) {
+					error( boost::str( boost::format( "expected %i tabs - found more!") % indentLevel ) );
 				}
 			}
 
-			bool checkRestOfLineEmpty() {
-				TextIterator::Scope scope( textIterator );				
-
-				while( textIterator.tryMatchAny( " \t" ) )
-					;
+			bool checkRestOfLineEmpty() const {
+				const char *p = current;
+				while( p < end && (*p == ' ' || *p == '\t') ) {
+					++p;
+				}
+				return p < end && isNewline( *p );
+			}
 
-				return textIterator.peek() == '\n';
+			void skipLine() {
+				while( !atEof() && !isNewline( *current ) ) {
+					++current;
+				}
+				tryMatch( '\n' );
 			}
 
-			std::string parseIndentedText() {
-				std::string text;
+			// the lines are only unindented on demand (see decodeTextBlock)
+			Entry parseIndentedText() {
+				const char *text = current;
 
 				bool isEmptyLine;
-				while( !textIterator.atEof() && ( (isEmptyLine = checkRestOfLineEmpty()) || checkMinimumIndentLevel() )  ) {
-					if( isEmptyLine ) {
-						textIterator.readLine();
-						text.push_back( '\n' );
-					}
-					else {
+				while( !atEof() && ( (isEmptyLine = checkRestOfLineEmpty()) || checkMinimumIndentLevel() )  ) {
+					if( !isEmptyLine ) {
 						skipIndentLevel();
-
-						text.append( textIterator.readLine() );	
 					}
+					skipLine();
 				}
 
-				// remove the last newline
-				if( !text.empty() ) {
-					text.pop_back();
-				}
-
-				return text;
+				return createEntry( Document::K_TEXT_BLOCK, text, current );
 			}
 
-			std::string parseValue() {
-				if( textIterator.check( '"' ) ) {
+			Entry parseValue() {
+				if( check( '"' ) ) {
 					return parseEscapedString();
 				}
-				else if( textIterator.check( '\'' ) ) {
+				else if( check( '\'' ) ) {
 					return parseUnescapedString();
 				}
 				else {
@@ -204,82 +249,125 @@ namespace wml {
 			}
 
 			void expectNewline() {
-				if( !textIterator.tryMatch( '\n' ) ) {
-					textIterator.error( "expected newline!" );
+				if( !tryMatch( '\n' ) ) {
+					error( "expected newline!" );
 				}
 			}
 
-			void parseMap( Node &node, bool allowEmpty = true ) {
+			std::vector< Entry > &getPendingChildren( int depth ) {
+				if( (int) pendingChildren.size() <= depth ) {
+					pendingChildren.resize( depth + 1 );
+				}
+				return pendingChildren[ depth ];
+			}
+
+			void addPendingChildren( Entry &entry, int depth ) {
+				std::vector< Entry > &children = getPendingChildren( depth );
+
+				entry.firstChild = (int) document.entries.size();
+				entry.numChildren = (int) children.size();
+
+				document.entries.insert( document.entries.end(), children.begin(), children.end() );
+				children.clear();
+			}
+
+			// the entries of the map are added to the pending children of depth
+			void parseMap( int depth, bool allowEmpty = true ) {
 				while( true ) {
 					skipEmptyLines();
 
-					if( !checkMinimumIndentLevel() || textIterator.atEof() ) {
+					if( !checkMinimumIndentLevel() || atEof() ) {
 						break;
 					}
 
 					ensureIndentLevel();
 					skipWhitespace();
 
-					std::string key = parseValue();
-
-					Node childNode( key, TextContext( textIterator ) );
+					Entry childEntry = parseValue();
 
 					skipWhitespace();
 
-					if( textIterator.tryMatch( ':' ) ) {
+					if( tryMatch( ':' ) ) {
 						skipWhitespace();
 
-						if( textIterator.tryMatch( ':' ) ) {
+						if( tryMatch( ':' ) ) {
 							// text literal
 							skipWhitespace();
 							expectNewline();
 
 							indentLevel++;
-							std::string indentedText = parseIndentedText();
+							const Entry textEntry = parseIndentedText();
 							indentLevel--;
 
-							childNode.nodes.push_back( Node( indentedText, TextContext( textIterator ) ) );
+							getPendingChildren( depth + 1 ).push_back( textEntry );
 						}
 						else {
 							expectNewline();
 
 							indentLevel++;
-							parseMap( childNode, false );
+							parseMap( depth + 1, false );
 							indentLevel--;
 						}
 					}
 					else {
-						parseInlineValues( childNode );
+						parseInlineValues( depth + 1 );
 					}
 
-					node.nodes.push_back( std::move( childNode ) );
+					addPendingChildren( childEntry, depth + 1 );
+					getPendingChildren( depth ).push_back( childEntry );
 				}
-				if( node.nodes.empty() && !allowEmpty ) {
-					textIterator.error( "expected non-empty map" );
+				if( getPendingChildren( depth ).empty() && !allowEmpty ) {
+					error( "expected non-empty map" );
 				}
 			}
 
-			void parseInlineValues( Node &node ) {
-				while( !textIterator.atEof() && !textIterator.tryMatch( '\n' ) ) {
-					std::string value = parseValue();
+			void parseInlineValues( int depth ) {
+				while( !atEof() && !tryMatch( '\n' ) ) {
+					const Entry valueEntry = parseValue();
 
-					node.nodes.push_back( Node( value, TextContext( textIterator ) ) );
+					getPendingChildren( depth ).push_back( valueEntry );
 
 					skipWhitespace();
 				}
 			}
 
-			Parser( const TextContainer &textContainer ) : indentLevel( 0 ), textIterator( textContainer, TextPosition() ) {}
+			void parseRoot() {
+				document.entries.clear();
+
+				Entry rootEntry = createEntry( Document::K_ROOT, begin, begin );
+				document.entries.push_back( rootEntry );
+
+				parseMap( 0 );
+
+				addPendingChildren( rootEntry, 0 );
+				document.entries.front() = rootEntry;
+			}
+
+			Parser( Document &document ) : document( document ), begin( document.text ), current( document.text ), end( document.text + document.size ), indentLevel( 0 ) {}
+
+			static Document parse( const char *text, size_t size, const std::string &sourceIdentifier, const std::shared_ptr< const TextContainer > &source ) {
+				Document document;
+				document.text = text;
+				document.size = size;
+				document.sourceIdentifier = sourceIdentifier;
+				document.source = source;
+
+				Parser( document ).parseRoot();
+				return document;
+			}
 		};
 
-		inline Node parse( const std::string &content, const std::string &sourceIdentifier ) {
-			TextContainer textContainer( content, sourceIdentifier );
+		inline Document parseInPlace( const char *text, size_t size, const std::string &sourceIdentifier ) {
+			return Parser::parse( text, size, sourceIdentifier, nullptr );
+		}
 
-			Parser parser( textContainer );
+		inline Document parseDocument( std::string &&content, const std::string &sourceIdentifier ) {
+			const std::shared_ptr< const TextContainer > source = std::make_shared< const TextContainer >( std::move( content ), sourceIdentifier );
+			return Parser::parse( source->text.data(), source->text.size(), sourceIdentifier, source );
+		}
 
-			Node node( sourceIdentifier );
-			parser.parseMap( node );
-			return node;
+		inline Node parse( const std::string &content, const std::string &sourceIdentifier ) {
+			return parseDocument( std::string( content ), sourceIdentifier ).toNode();
 		}
 	}
-}
\ No newline at end of file
+}
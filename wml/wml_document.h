@@ -0,0 +1,311 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <boost/lexical_cast.hpp>
+
+#include "leanTextProcessing.h"
+
+namespace wml {
+	namespace detail {
+		struct Parser;
+
+		inline bool isNewline( char c ) {
+			return c == '\n' || c == '\r';
+		}
+
+		// the escape sequences have been validated by the parser already
+		inline std::string decodeEscapedString( const char *text, size_t size ) {
+			std::string decoded;
+			decoded.reserve( size );
+
+			const char *end = text + size;
+			for( const char *p = text ; p < end ; ++p ) {
+				if( *p != '\\' ) {
+					decoded.push_back( *p );
+					continue;
+				}
+
+				switch( *++p ) {
+				case 't':
+					decoded.push_back( '\t' );
+					break;
+				case 'n':
+					decoded.push_back( '\n' );
+					break;
+				case 'r':
+					decoded.push_back( '\r' );
+					break;
+				case '0':
+					decoded.push_back( '\0' );
+					break;
+				default:
+					decoded.push_back( *p );
+					break;
+				}
+			}
+			return decoded;
+		}
+
+		// removes the indentation of the lines of a text block and normalizes the newlines
+		// lines with whitespace only are empty lines
+		inline std::string decodeTextBlock( const char *text, size_t size, int indentLevel ) {
+			std::string decoded;
+			decoded.reserve( size );
+
+			const char *end = text + size;
+			for( const char *line = text ; line < end ; ) {
+				const char *lineEnd = line;
+				while( lineEnd < end && !isNewline( *lineEnd ) ) {
+					++lineEnd;
+				}
+
+				const char *firstNonWhitespace = line;
+				while( firstNonWhitespace < lineEnd && (*firstNonWhitespace == ' ' || *firstNonWhitespace == '\t') ) {
+					++firstNonWhitespace;
+				}
+
+				// the parser only accepts lines that are empty or start with indentLevel tabs
+				if( firstNonWhitespace != lineEnd || lineEnd == end ) {
+					decoded.append( line + indentLevel, lineEnd );
+				}
+				decoded.push_back( '\n' );
+
+				line = lineEnd;
+				if( line < end && *line++ == '\r' && line < end && *line == '\n' ) {
+					++line;
+				}
+			}
+
+			// remove the last newline
+			if( !decoded.empty() ) {
+				decoded.pop_back();
+			}
+			return decoded;
+		}
+	}
+
+	// result of parseInPlace: all nodes are stored in one array and only refer to slices of the text
+	// strings with escape sequences and text blocks are only decoded when their content is requested
+	//
+	// unless the document owns the text (see parseDocument), the text has to outlive the document
+	class Document {
+	public:
+		enum Kind {
+			// identifiers and unescaped strings are slices of the text as they are
+			K_RAW,
+			K_ESCAPED_STRING,
+			K_TEXT_BLOCK,
+			// its content is the source identifier
+			K_ROOT
+		};
+
+		struct Entry {
+			size_t offset;
+			size_t size;
+			// index into the text after the node (for error contexts)
+			size_t position;
+
+			// the children of a node are stored next to each other
+			int firstChild;
+			int numChildren;
+
+			unsigned char kind;
+			// text blocks only
+			unsigned char indentLevel;
+		};
+
+		// lightweight reference to a node of a document (the document has to outlive it)
+		class NodeRef {
+		public:
+			NodeRef() : document( nullptr ), index( -1 ) {}
+			NodeRef( const Document *document, int index ) : document( document ), index( index ) {}
+
+			bool valid() const {
+				return document != nullptr && index >= 0;
+			}
+
+			// decodes the content if necessary
+			std::string getContent() const {
+				const Entry &entry = getEntry();
+				const char *text = document->text + entry.offset;
+
+				switch( entry.kind ) {
+				case K_ESCAPED_STRING:
+					return detail::decodeEscapedString( text, entry.size );
+				case K_TEXT_BLOCK:
+					return detail::decodeTextBlock( text, entry.size, entry.indentLevel );
+				case K_ROOT:
+					return document->sourceIdentifier;
+				default:
+					return std::string( text, entry.size );
+				}
+			}
+
+			std::string key() const {
+				return getContent();
+			}
+
+			// the content as it is stored in the text (without quotes)
+			// only equals the content for raw nodes
+			const char *getRawData() const {
+				return getEntry().kind == K_ROOT ? document->sourceIdentifier.data() : document->text + getEntry().offset;
+			}
+
+			size_t getRawSize() const {
+				return getEntry().kind == K_ROOT ? document->sourceIdentifier.size() : getEntry().size;
+			}
+
+			bool isRaw() const {
+				return getEntry().kind == K_RAW || getEntry().kind == K_ROOT;
+			}
+
+			// compares without decoding raw nodes
+			bool hasContent( const std::string &content ) const {
+				if( isRaw() ) {
+					return getRawSize() == content.size() && std::equal( content.begin(), content.end(), getRawData() );
+				}
+				return getContent() == content;
+			}
+
+			template< typename T >
+			T as() const {
+				if( isRaw() ) {
+					return boost::lexical_cast<T>( getRawData(), getRawSize() );
+				}
+				return boost::lexical_cast<T>( getContent() );
+			}
+
+			size_t size() const {
+				return getEntry().numChildren;
+			}
+
+			bool empty() const {
+				return getEntry().numChildren == 0;
+			}
+
+			NodeRef operator[] ( int i ) const {
+				return NodeRef( document, getEntry().firstChild + i );
+			}
+
+			// returns an invalid NodeRef if there is no child with this key
+			NodeRef find( const std::string &key ) const {
+				const Entry &entry = getEntry();
+				for( int childIndex = entry.firstChild ; childIndex < entry.firstChild + entry.numChildren ; ++childIndex ) {
+					const NodeRef child( document, childIndex );
+					if( child.hasContent( key ) ) {
+						return child;
+					}
+				}
+				return NodeRef();
+			}
+
+			NodeRef operator[] ( const std::string &key ) const {
+				const NodeRef child = find( key );
+				if( !child.valid() ) {
+					error( boost::str( boost::format( "key '%s' not found!" ) % key ) );
+				}
+				return child;
+			}
+
+			NodeRef data() const {
+				if( empty() ) {
+					error( "expected data at node!" );
+				}
+				else if( size() > 1 ) {
+					error( "expected data at node, found array/map!" );
+				}
+
+				return (*this)[ 0 ];
+			}
+
+			LeanTextProcessing::TextContext getContext() const {
+				return document->getContext( getEntry().position );
+			}
+
+			void error( const std::string &message ) const {
+				throw LeanTextProcessing::TextException( getContext(), message );
+			}
+
+		private:
+			const Document *document;
+			int index;
+
+			const Entry &getEntry() const {
+				return document->entries[ index ];
+			}
+		};
+
+		Document() : text( nullptr ), size( 0 ) {}
+
+		NodeRef getRoot() const {
+			return NodeRef( this, 0 );
+		}
+
+		const std::string &getSourceIdentifier() const {
+			return sourceIdentifier;
+		}
+
+		size_t getNumNodes() const {
+			return entries.size();
+		}
+
+		// converts the document into a Node tree
+		// the contexts of the nodes are resolved lazily (if at all), so a document that borrows its text copies it once for them
+		Node toNode() const {
+			const std::shared_ptr< const LeanTextProcessing::TextContainer > nodeSource = source ? source : std::make_shared< const LeanTextProcessing::TextContainer >( std::string( text, size ), sourceIdentifier );
+
+			Node root( sourceIdentifier );
+			if( !entries.empty() ) {
+				fillNode( entries.front(), nodeSource, root );
+			}
+			return root;
+		}
+
+	private:
+		friend struct detail::Parser;
+
+		const char *text;
+		size_t size;
+		std::string sourceIdentifier;
+		// only set if the document owns the text
+		std::shared_ptr< const LeanTextProcessing::TextContainer > source;
+
+		std::vector< Entry > entries;
+
+		LeanTextProcessing::TextContext getContext( size_t position ) const {
+			if( source ) {
+				return LeanTextProcessing::TextContext( source, int( position ) );
+			}
+
+			LeanTextProcessing::TextContext context;
+			context.textIdentifier = sourceIdentifier;
+			context.position.index = int( position );
+			context.position.line = LeanTextProcessing::getLineNumber( text, size, position );
+			context.surroundingText = LeanTextProcessing::getSurroundingText( text, size, position );
+			return context;
+		}
+
+		void fillNode( const Entry &entry, const std::shared_ptr< const LeanTextProcessing::TextContainer > &nodeSource, Node &node ) const {
+			node.nodes.resize( entry.numChildren );
+			for( int childIndex = 0 ; childIndex < entry.numChildren ; ++childIndex ) {
+				const int entryIndex = entry.firstChild + childIndex;
+				const Entry &childEntry = entries[ entryIndex ];
+				Node &child = node.nodes[ childIndex ];
+
+				if( childEntry.kind == K_RAW ) {
+					child.content.assign( text + childEntry.offset, childEntry.size );
+				}
+				else {
+					child.content = NodeRef( this, entryIndex ).getContent();
+				}
+
+				child.context.source = nodeSource;
+				child.context.position.index = int( childEntry.position );
+
+				fillNode( childEntry, nodeSource, child );
+			}
+		}
+	};
+}